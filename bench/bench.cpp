@@ -0,0 +1,678 @@
+// Self-contained benchmarks of the core entity operations, reporting machine-readable results.
+//
+// Usage: ecs_bench [--entities 1000,10000,...] [--archetypes N] [--component-size 4|16|64|256]
+//                  [--fragmentation F] [--repeat R] [--format json|csv]
+//
+// Each result reports the best of the repeats, in nanoseconds per entity, and the heap bytes per entity
+// that are still held after the measured operation.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ECS/ECS.h"
+
+
+/**
+* Heap accounting: every allocation of the process goes through these, so that the memory held by a world
+* can be measured without any help from the library.
+*/
+static std::atomic<long long> live_heap_bytes{ 0 };
+
+// Kept right in front of the returned address, so that delete knows how much is released and which malloc
+// block to free
+struct BlockHeader
+{
+	void* block;
+	size_t size;
+};
+
+static_assert(sizeof(BlockHeader) <= alignof(std::max_align_t), "the header fits in the alignment padding");
+
+static BlockHeader* GetBlockHeader(void* ptr)
+{
+	return reinterpret_cast<BlockHeader*>(reinterpret_cast<uintptr_t>(ptr) - sizeof(BlockHeader));
+}
+
+void* operator new(size_t size)
+{
+	void* block = std::malloc(size + alignof(std::max_align_t));
+	if (block == nullptr) {
+		throw std::bad_alloc();
+	}
+	void* ptr = static_cast<char*>(block) + alignof(std::max_align_t);
+	*GetBlockHeader(ptr) = BlockHeader{ block, size };
+	live_heap_bytes += static_cast<long long>(size);
+	return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+	if (ptr == nullptr) {
+		return;
+	}
+	BlockHeader* header = GetBlockHeader(ptr);
+	live_heap_bytes -= static_cast<long long>(header->size);
+	std::free(header->block);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* ptr) noexcept { operator delete(ptr); }
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { operator delete(ptr); }
+
+// Over-aligned blocks, e.g. chunks, have the header in front of the aligned address as well
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	size_t align = static_cast<size_t>(alignment);
+	void* block = std::malloc(size + align + sizeof(BlockHeader));
+	if (block == nullptr) {
+		throw std::bad_alloc();
+	}
+	uintptr_t address = (reinterpret_cast<uintptr_t>(block) + sizeof(BlockHeader) + align - 1) / align * align;
+	void* ptr = reinterpret_cast<void*>(address);
+	*GetBlockHeader(ptr) = BlockHeader{ block, size };
+	live_heap_bytes += static_cast<long long>(size);
+	return ptr;
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+	operator delete(ptr);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) { return operator new(size, alignment); }
+void operator delete[](void* ptr, std::align_val_t alignment) noexcept { operator delete(ptr, alignment); }
+void operator delete(void* ptr, size_t, std::align_val_t alignment) noexcept { operator delete(ptr, alignment); }
+void operator delete[](void* ptr, size_t, std::align_val_t alignment) noexcept { operator delete(ptr, alignment); }
+
+
+/**
+* Components
+*/
+struct Position
+{
+	float x = 0.0f;
+	float y = 0.0f;
+	float z = 0.0f;
+};
+
+struct Velocity
+{
+	float x = 1.0f;
+	float y = 1.0f;
+	float z = 1.0f;
+};
+
+// A component of configurable size, standing for the rest of an entity's data
+template <size_t Size>
+struct Payload
+{
+	char data[Size] = {};
+};
+
+// Empty components whose combinations make up different archetypes
+template <size_t Bit>
+struct Tag {};
+
+// Position and Velocity interleaved in blocks of 8 entries of each (AoSoA)
+struct GroupedPosition
+{
+	float x = 0.0f;
+	float y = 0.0f;
+	float z = 0.0f;
+};
+
+struct GroupedVelocity
+{
+	float x = 1.0f;
+	float y = 1.0f;
+	float z = 1.0f;
+};
+
+template <>
+struct ECS::ComponentTraits<GroupedPosition> : ECS::DefaultComponentTraits
+{
+	static constexpr size_t interleave_group = 1;
+};
+
+template <>
+struct ECS::ComponentTraits<GroupedVelocity> : ECS::DefaultComponentTraits
+{
+	static constexpr size_t interleave_group = 1;
+};
+
+// A payload stored apart from the chunks
+template <size_t Size>
+struct ColdPayload
+{
+	char data[Size] = {};
+};
+
+template <size_t Size>
+struct ECS::ComponentTraits<ColdPayload<Size>> : ECS::DefaultComponentTraits
+{
+	static constexpr bool cold = true;
+};
+
+// Added to existing entities to measure archetype migration
+struct Migrated
+{
+	int value = 0;
+};
+
+const size_t max_archetype_bits = 6;
+
+// Keeps the results of measured loops from being optimized away
+volatile float sink;
+
+
+/**
+* Create an entity of the archetype given by a bitmask of tags at runtime, through a table of instantiations.
+*/
+template <size_t Size, size_t Mask, size_t Bit, typename... Tags>
+struct TaggedEntityCreator
+{
+	static ECS::Entity Create(ECS::EntityManager& entity_mgr)
+	{
+		if constexpr (Bit == max_archetype_bits) {
+			return entity_mgr.CreateEntity<Position, Velocity, Payload<Size>, Tags...>();
+		}
+		else if constexpr ((Mask & (size_t(1) << Bit)) != 0) {
+			return TaggedEntityCreator<Size, Mask, Bit + 1, Tags..., Tag<Bit>>::Create(entity_mgr);
+		}
+		else {
+			return TaggedEntityCreator<Size, Mask, Bit + 1, Tags...>::Create(entity_mgr);
+		}
+	}
+};
+
+typedef ECS::Entity(*CreateFunc)(ECS::EntityManager&);
+
+template <size_t Size, size_t... Masks>
+std::vector<CreateFunc> MakeCreators(std::index_sequence<Masks...>)
+{
+	return { &TaggedEntityCreator<Size, Masks, 0>::Create... };
+}
+
+
+/**
+* Harness
+*/
+struct Options
+{
+	std::vector<size_t> entity_counts{ 1000, 10000, 100000, 1000000 };
+	size_t archetypes = 1;
+	size_t component_size = 16;
+	double fragmentation = 0.0;  // The fraction of entities removed before the measurements
+	size_t repeat = 3;
+	bool csv = false;
+};
+
+struct Result
+{
+	std::string name;
+	size_t entities;
+	double ns_per_entity;
+	double bytes_per_entity;
+};
+
+class Timer
+{
+public:
+	Timer() : start(std::chrono::steady_clock::now()) {}
+
+	double ElapsedNanoseconds() const
+	{
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	}
+
+private:
+	std::chrono::steady_clock::time_point start;
+};
+
+void Report(const Options& options, const Result& result)
+{
+	if (options.csv) {
+		std::cout << result.name << "," << result.entities << "," << options.archetypes << "," << options.component_size
+			<< "," << options.fragmentation << "," << result.ns_per_entity << "," << result.bytes_per_entity << std::endl;
+	}
+	else {
+		std::cout << "{\"case\":\"" << result.name << "\",\"entities\":" << result.entities
+			<< ",\"archetypes\":" << options.archetypes << ",\"component_size\":" << options.component_size
+			<< ",\"fragmentation\":" << options.fragmentation << ",\"ns_per_entity\":" << result.ns_per_entity
+			<< ",\"bytes_per_entity\":" << result.bytes_per_entity << "}" << std::endl;
+	}
+}
+
+// Keep the best of the repeats for every case
+void Merge(std::vector<Result>& best, const std::vector<Result>& results)
+{
+	if (best.empty()) {
+		best = results;
+		return;
+	}
+	for (size_t i = 0; i < results.size(); i++) {
+		best[i].ns_per_entity = std::min(best[i].ns_per_entity, results[i].ns_per_entity);
+	}
+}
+
+// Integrate the positions of every chunk a block at a time, i.e. a whole row unless P is interleaved
+template <typename P, typename V>
+void IntegrateBlocks(ECS::World& world)
+{
+	world.ForEachChunk<P, V>([&](const ECS::ChunkView& chunk) -> void {
+		ECS::BlockedColumnView<P> positions = chunk.GetBlocks<P>();
+		ECS::BlockedColumnView<const V> velocities = chunk.GetBlocks<const V>();
+		for (size_t i = 0; i < positions.GetBlockCount(); i++) {
+			ECS::BulkOps::Integrate(positions.GetBlock(i), velocities.GetBlock(i), 0.016f);
+		}
+	});
+}
+
+// Time the integration of entities of P, V and a payload in a world of their own, to compare chunk layouts
+template <typename P, typename V, typename Rest>
+Result RunLayout(const std::string& name, size_t entity_count)
+{
+	long long heap_before = live_heap_bytes;
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+	std::unique_ptr<ECS::Prefab> prefab_ptr = entity_mgr.CreatePrefab(entity_mgr.CreateEntity<P, V, Rest>());
+	std::vector<ECS::Entity> entities = entity_mgr.Instantiate(*prefab_ptr, entity_count - 1);
+	prefab_ptr.reset();
+	double held_bytes = double(live_heap_bytes - heap_before) - double(entities.capacity() * sizeof(ECS::Entity));
+
+	Timer timer;
+	IntegrateBlocks<P, V>(world);
+	double ns = timer.ElapsedNanoseconds();
+	return { name, entity_count, ns / entity_count, held_bytes / entity_count };
+}
+
+// Time a parallel integration of entities of Position, Velocity and a payload in a world of their own, with the chunks
+// on the given NUMA node or interleaved over the nodes, to compare the bandwidth of the nodes and the interleaving
+template <typename Rest>
+Result RunNuma(const std::string& name, size_t entity_count, size_t node)
+{
+	long long heap_before = live_heap_bytes;
+	ECS::NumaChunkResource resource(node);
+	ECS::World world(&resource);
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+	std::unique_ptr<ECS::Prefab> prefab_ptr = entity_mgr.CreatePrefab(entity_mgr.CreateEntity<Position, Velocity, Rest>());
+	std::vector<ECS::Entity> entities = entity_mgr.Instantiate(*prefab_ptr, entity_count - 1);
+	prefab_ptr.reset();
+	double held_bytes = double(live_heap_bytes - heap_before) - double(entities.capacity() * sizeof(ECS::Entity));
+
+	Timer timer;
+	world.ForEachChunkParallel<Position, Velocity>([&](const ECS::ChunkView& chunk) -> void {
+		ECS::BulkOps::Integrate(chunk.GetColumn<Position>(), chunk.GetColumn<const Velocity>(), 0.016f);
+	});
+	double ns = timer.ElapsedNanoseconds();
+	return { name, entity_count, ns / entity_count, held_bytes / entity_count };
+}
+
+template <size_t Size>
+std::vector<Result> RunOnce(const Options& options, size_t entity_count)
+{
+	std::vector<Result> results;
+	std::vector<CreateFunc> creators = MakeCreators<Size>(std::make_index_sequence<size_t(1) << max_archetype_bits>());
+	std::mt19937_64 rng(entity_count);
+
+	long long heap_before = live_heap_bytes;
+	{
+		ECS::World world;
+		ECS::EntityManager& entity_mgr = world.GetEntityManager();
+
+		// Create; entities are spread over the archetypes round robin
+		std::vector<ECS::Entity> entities;
+		entities.reserve(entity_count);
+
+		// The heap held by the world, excluding the entity list of the harness itself
+		auto held_bytes = [&]() -> double {
+			return double(live_heap_bytes - heap_before) - double(entities.capacity() * sizeof(ECS::Entity));
+		};
+		{
+			Timer timer;
+			for (size_t i = 0; i < entity_count; i++) {
+				entities.push_back(creators[i % options.archetypes](entity_mgr));
+			}
+			double ns = timer.ElapsedNanoseconds();
+			results.push_back({ "create", entity_count, ns / entity_count, held_bytes() / entity_count });
+		}
+
+		// Fragment the storage by removing a random subset of entities
+		std::shuffle(entities.begin(), entities.end(), rng);
+		size_t removed_count = static_cast<size_t>(options.fragmentation * entity_count);
+		for (size_t i = 0; i < removed_count; i++) {
+			entity_mgr.RemoveEntityAllComponents(entities[i]);
+		}
+		entities.erase(entities.begin(), entities.begin() + removed_count);
+		size_t alive_count = std::max<size_t>(entities.size(), 1);
+
+		// Iterate
+		{
+			Timer timer;
+			world.ForEach<Position, Velocity>([&](const ECS::Entity*, Position* pos_ptr, Velocity* vel_ptr) -> void {
+				pos_ptr->x += vel_ptr->x * 0.016f;
+				pos_ptr->y += vel_ptr->y * 0.016f;
+				pos_ptr->z += vel_ptr->z * 0.016f;
+			});
+			double ns = timer.ElapsedNanoseconds();
+			results.push_back({ "iterate", entity_count, ns / alive_count, held_bytes() / alive_count });
+		}
+
+		// The same update over whole columns, with the widest SIMD level supported
+		{
+			Timer timer;
+			world.ForEachChunk<Position, Velocity>([&](const ECS::ChunkView& chunk) -> void {
+				ECS::BulkOps::Integrate(chunk.GetColumn<Position>(), chunk.GetColumn<const Velocity>(), 0.016f);
+			});
+			double ns = timer.ElapsedNanoseconds();
+			results.push_back({ "bulk_integrate", entity_count, ns / alive_count, held_bytes() / alive_count });
+		}
+
+		// Random access, in the shuffled order
+		{
+			float sum = 0.0f;
+			Timer timer;
+			for (const auto& entity : entities) {
+				sum += entity_mgr.GetEntityComponent<Position>(entity)->x;
+			}
+			double ns = timer.ElapsedNanoseconds();
+			results.push_back({ "random_access", entity_count, ns / alive_count, held_bytes() / alive_count });
+			sink = sum;
+		}
+
+		// Sort by a random key, then sort again after a frame moving one entity in a hundred a few places
+		{
+			std::uniform_real_distribution<float> key_dist(0.0f, 1000.0f);
+			world.ForEach<Position>([&](const ECS::Entity*, Position* pos_ptr) -> void {
+				pos_ptr->x = key_dist(rng);
+			});
+			auto by_x = [](const Position& lhs, const Position& rhs) -> bool { return lhs.x < rhs.x; };
+			{
+				Timer timer;
+				world.SortBy<Position>(by_x);
+				double ns = timer.ElapsedNanoseconds();
+				results.push_back({ "sort", entity_count, ns / alive_count, held_bytes() / alive_count });
+			}
+			size_t visit_count = 0;
+			world.ForEach<Position>([&](const ECS::Entity*, Position* pos_ptr) -> void {
+				if (visit_count++ % 100 == 0) {
+					pos_ptr->x += 4000.0f / alive_count;
+				}
+			});
+			{
+				Timer timer;
+				world.SortBy<Position>(by_x);
+				double ns = timer.ElapsedNanoseconds();
+				results.push_back({ "resort", entity_count, ns / alive_count, held_bytes() / alive_count });
+			}
+		}
+
+		// Index the positions spread in a cube in a grid, then find the entities around random points with the grid
+		// and by testing every entity chunk by chunk; a query's time is reported per entity of the world
+		{
+			const size_t query_count = 100;
+			const float radius = 10.0f;
+			std::uniform_real_distribution<float> coord_dist(0.0f, 1000.0f);
+			world.ForEach<Position>([&](const ECS::Entity*, Position* pos_ptr) -> void {
+				pos_ptr->x = coord_dist(rng);
+				pos_ptr->y = coord_dist(rng);
+				pos_ptr->z = coord_dist(rng);
+			});
+			std::vector<ECS::SpatialIndex<Position>::Point> centers(query_count);
+			for (auto& center : centers) {
+				center = { coord_dist(rng), coord_dist(rng), coord_dist(rng) };
+			}
+
+			ECS::SpatialIndex<Position> index(&entity_mgr, radius);
+			{
+				Timer timer;
+				index.Update();
+				double ns = timer.ElapsedNanoseconds();
+				results.push_back({ "spatial_build", entity_count, ns / alive_count, held_bytes() / alive_count });
+			}
+			size_t found_count = 0;
+			{
+				std::vector<ECS::Entity> found;
+				Timer timer;
+				for (const auto& center : centers) {
+					found_count += index.QueryRadius(center, radius, found);
+				}
+				double ns = timer.ElapsedNanoseconds();
+				results.push_back({ "query_radius_grid", entity_count, ns / query_count / alive_count, held_bytes() / alive_count });
+			}
+			{
+				std::vector<ECS::Entity> found;
+				Timer timer;
+				for (const auto& center : centers) {
+					found.clear();
+					world.ForEachChunk<Position>([&](const ECS::ChunkView& chunk) -> void {
+						const Position* positions = chunk.GetComponents<const Position>();
+						for (size_t i = 0; i < chunk.GetEntityCount(); i++) {
+							float dx = positions[i].x - center[0], dy = positions[i].y - center[1], dz = positions[i].z - center[2];
+							if (dx * dx + dy * dy + dz * dz <= radius * radius) {
+								found.push_back(chunk.GetEntities()[i]);
+							}
+						}
+					});
+					found_count -= found.size();
+				}
+				double ns = timer.ElapsedNanoseconds();
+				results.push_back({ "query_radius_scan", entity_count, ns / query_count / alive_count, held_bytes() / alive_count });
+			}
+			sink = static_cast<float>(found_count);
+		}
+
+		// Send an event per entity from the jobs of a ParallelFor, in batches of a job's events, and read them all;
+		// over two frames, so that the second one reuses the arena of the first
+		{
+			const size_t batch_size = 256;
+			ECS::EventChannel<Position>& events = world.GetEvents<Position>(1);
+			ECS::EventReader<Position> reader = events.CreateReader();
+			float sum = 0.0f;
+			Timer timer;
+			for (int frame = 0; frame < 2; frame++) {
+				world.GetJobSystem().ParallelFor((alive_count + batch_size - 1) / batch_size, [&](size_t batch_index) -> void {
+					Position batch[batch_size];
+					size_t begin = batch_index * batch_size;
+					size_t count = std::min(batch_size, alive_count - begin);
+					for (size_t i = 0; i < count; i++) {
+						batch[i] = Position{ static_cast<float>(begin + i), 0.0f, 0.0f };
+					}
+					events.Send(batch, count);
+				});
+				reader.Read([&](const Position& event) -> void {
+					sum += event.x;
+				});
+				events.EndFrame();
+			}
+			double ns = timer.ElapsedNanoseconds();
+			results.push_back({ "events", entity_count, ns / 2 / alive_count, held_bytes() / alive_count });
+			sink = sum;
+		}
+
+		// Create an entity per entity from the jobs of a ParallelFor through command buffers, reserving the IDs
+		// in the jobs and creating the entities at the sync point; in a world of its own
+		{
+			const size_t batch_size = 256;
+			ECS::World spawn_world;
+			Timer timer;
+			spawn_world.GetJobSystem().ParallelFor((alive_count + batch_size - 1) / batch_size, [&](size_t batch_index) -> void {
+				ECS::EntityCommandBuffer commands = spawn_world.CreateCommandBuffer();
+				size_t begin = batch_index * batch_size;
+				size_t count = std::min(batch_size, alive_count - begin);
+				for (size_t i = 0; i < count; i++) {
+					ECS::Entity entity = commands.CreateEntity<Position, Velocity>();
+					commands.SetComponent<Position>(entity, Position{ static_cast<float>(begin + i), 0.0f, 0.0f });
+				}
+				spawn_world.SubmitCommands(std::move(commands));
+			});
+			spawn_world.PlaybackCommands();
+			double ns = timer.ElapsedNanoseconds();
+			results.push_back({ "spawn_deferred", entity_count, ns / alive_count, held_bytes() / alive_count });
+		}
+
+		// Checkpoint a frame writing every entity, and roll back to the frame before; the chunks unchanged
+		// between the two are neither copied nor copied back
+		{
+			ECS::CheckpointRing checkpoints(&entity_mgr, 8);
+			checkpoints.Save(0);
+			world.ForEach<Position, Velocity>([&](const ECS::Entity*, Position* pos_ptr, Velocity* vel_ptr) -> void {
+				pos_ptr->x += vel_ptr->x * 0.016f;
+			});
+			Timer timer;
+			checkpoints.Save(1);
+			checkpoints.Restore(0);
+			double ns = timer.ElapsedNanoseconds();
+			results.push_back({ "checkpoint", entity_count, ns / alive_count, held_bytes() / alive_count });
+		}
+
+		// The typical frame of a speculative simulation, writing every entity as double-buffered rows do: save a
+		// checkpoint upon the last one, simulate, and roll back taking the checkpoint, so that its copies are
+		// swapped back in. The memory of the checkpoints is reused from the third frame on, which is measured. The
+		// target is under 1 ms at 100k entities, i.e. 10 ns per entity.
+		{
+			const int frame_count = 4;
+			ECS::WorldCheckpoint checkpoints[2];
+			double ns = 0.0;
+			for (int frame = 0; frame < frame_count + 2; frame++) {
+				ECS::WorldCheckpoint& checkpoint = checkpoints[frame % 2];
+				Timer save_timer;
+				entity_mgr.SaveCheckpoint(checkpoint, &checkpoints[(frame + 1) % 2]);
+				double save_ns = save_timer.ElapsedNanoseconds();
+				world.ForEach<Position, Velocity>([&](const ECS::Entity*, Position* pos_ptr, Velocity* vel_ptr) -> void {
+					pos_ptr->x += vel_ptr->x * 0.016f;
+				});
+				Timer restore_timer;
+				entity_mgr.RestoreCheckpoint(std::move(checkpoint));
+				if (frame >= 2) {
+					ns += save_ns + restore_timer.ElapsedNanoseconds();
+				}
+			}
+			results.push_back({ "checkpoint_frame", entity_count, ns / frame_count / alive_count, held_bytes() / alive_count });
+		}
+
+		// Migrate every entity to another archetype
+		{
+			Timer timer;
+			for (const auto& entity : entities) {
+				entity_mgr.AddEntityComponent<Migrated>(entity);
+			}
+			double ns = timer.ElapsedNanoseconds();
+			results.push_back({ "migrate", entity_count, ns / alive_count, held_bytes() / alive_count });
+		}
+
+		// Destroy, i.e. remove all components of every entity
+		{
+			Timer timer;
+			for (const auto& entity : entities) {
+				entity_mgr.RemoveEntityAllComponents(entity);
+			}
+			double ns = timer.ElapsedNanoseconds();
+			results.push_back({ "destroy", entity_count, ns / alive_count, held_bytes() / alive_count });
+		}
+	}
+
+	// The same integration with the payload in the rows (pure SoA), with Position and Velocity interleaved,
+	// and with the payload cold
+	results.push_back(RunLayout<Position, Velocity, Payload<Size>>("layout_soa", entity_count));
+	results.push_back(RunLayout<GroupedPosition, GroupedVelocity, Payload<Size>>("layout_aosoa", entity_count));
+	results.push_back(RunLayout<Position, Velocity, ColdPayload<Size>>("layout_hot_cold", entity_count));
+
+	// The parallel integration with the chunks on each NUMA node (a single one without ECS_ENABLE_NUMA), and
+	// interleaved over them
+	for (size_t node = 0; node < ECS::Internal::GetNumaNodeCount(); node++) {
+		results.push_back(RunNuma<Payload<Size>>("numa_node" + std::to_string(node), entity_count, node));
+	}
+	results.push_back(RunNuma<Payload<Size>>("numa_interleaved", entity_count, ECS::NumaChunkResource::interleaved));
+
+	return results;
+}
+
+template <size_t Size>
+void Run(const Options& options)
+{
+	for (size_t entity_count : options.entity_counts) {
+		std::vector<Result> best;
+		for (size_t i = 0; i < options.repeat; i++) {
+			Merge(best, RunOnce<Size>(options, entity_count));
+		}
+		for (const auto& result : best) {
+			Report(options, result);
+		}
+	}
+}
+
+bool ParseOptions(int argc, char** argv, Options& options)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--format" && i + 1 < argc) {
+			options.csv = std::string(argv[++i]) == "csv";
+		}
+		else if (arg == "--entities" && i + 1 < argc) {
+			options.entity_counts.clear();
+			std::stringstream list(argv[++i]);
+			std::string count;
+			while (std::getline(list, count, ',')) {
+				options.entity_counts.push_back(std::stoull(count));
+			}
+		}
+		else if (arg == "--archetypes" && i + 1 < argc) {
+			options.archetypes = std::stoull(argv[++i]);
+		}
+		else if (arg == "--component-size" && i + 1 < argc) {
+			options.component_size = std::stoull(argv[++i]);
+		}
+		else if (arg == "--fragmentation" && i + 1 < argc) {
+			options.fragmentation = std::stod(argv[++i]);
+		}
+		else if (arg == "--repeat" && i + 1 < argc) {
+			options.repeat = std::stoull(argv[++i]);
+		}
+		else {
+			return false;
+		}
+	}
+
+	return options.archetypes >= 1 && options.archetypes <= (size_t(1) << max_archetype_bits)
+		&& options.fragmentation >= 0.0 && options.fragmentation < 1.0 && options.repeat >= 1;
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options)) {
+		std::cerr << "Usage: " << argv[0] << " [--entities 1000,10000,...] [--archetypes 1-64]"
+			<< " [--component-size 4|16|64|256] [--fragmentation 0-1] [--repeat N] [--format json|csv]" << std::endl;
+		return 1;
+	}
+
+	if (options.csv) {
+		std::cout << "case,entities,archetypes,component_size,fragmentation,ns_per_entity,bytes_per_entity" << std::endl;
+	}
+
+	switch (options.component_size) {
+	case 4: Run<4>(options); break;
+	case 16: Run<16>(options); break;
+	case 64: Run<64>(options); break;
+	case 256: Run<256>(options); break;
+	default:
+		std::cerr << "Unsupported component size " << options.component_size << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -33,6 +33,15 @@ namespace ECS
 			archetype_id_by_component_set.insert({ c_id_set,  new_a_id });
 			archetypes.push_back(Archetype(new_a_id, c_id_set));
 
+			for (const auto& c_id : c_id_set) {
+				archetype_ids_by_component[c_id].push_back(new_a_id);
+
+				const ComponentType& c_type = c_mgr_ptr->GetComponentType(c_id);
+				if (c_type.is_pair) {
+					archetype_ids_by_relation[c_type.relation_id].push_back(new_a_id);
+				}
+			}
+
 			assert(archetypes.size() == archetype_id_counter);
 
 			return new_a_id;
@@ -54,22 +63,53 @@ namespace ECS
 		ArchetypeIDSet GetArchetypeContains(const ComponentTypeIDSet& c_id_set)
 		{
 			ArchetypeIDSet a_id_set{};
-			for (const auto& pair : archetype_id_by_component_set) {
-				// check if a subset (we can do better if change the underlying data structure)
+			if (c_id_set.empty()) {
+				for (const auto& archetype : archetypes) {
+					a_id_set.insert(archetype.GetID());
+				}
+				return a_id_set;
+			}
+
+			// Only check the archetypes of the rarest component type
+			const std::vector<ArchetypeID>* candidates_ptr = nullptr;
+			for (const auto& c_id : c_id_set) {
+				const std::vector<ArchetypeID>& a_ids = this->GetArchetypesWith(c_id);
+				if (candidates_ptr == nullptr || a_ids.size() < candidates_ptr->size()) {
+					candidates_ptr = &a_ids;
+				}
+			}
+
+			for (const auto& a_id : *candidates_ptr) {
 				bool is_subset = true;
 				for (const auto& c_id : c_id_set) {
-					if (pair.first.count(c_id) == 0) {
+					if (!archetypes[a_id].hasComponentType(c_id)) {
 						is_subset = false;
 						break;
 					}
 				}
 				if (is_subset) {
-					a_id_set.insert(pair.second);
+					a_id_set.insert(a_id);
 				}
 			}
 			return a_id_set;
 		}
 
+		// The archetypes having the component type
+		const std::vector<ArchetypeID>& GetArchetypesWith(const ComponentTypeID& c_id) const
+		{
+			static const std::vector<ArchetypeID> no_archetypes;
+			auto iter = archetype_ids_by_component.find(c_id);
+			return iter == archetype_ids_by_component.end() ? no_archetypes : iter->second;
+		}
+
+		// The archetypes having a pair of the relation type, with any target
+		const std::vector<ArchetypeID>& GetArchetypesWithRelation(const ComponentTypeID& relation_id) const
+		{
+			static const std::vector<ArchetypeID> no_archetypes;
+			auto iter = archetype_ids_by_relation.find(relation_id);
+			return iter == archetype_ids_by_relation.end() ? no_archetypes : iter->second;
+		}
+
 		void PrintArchetypesInfo() const
 		{
 			cout << "\n====== Archetype Info ======" << endl;
@@ -94,5 +134,9 @@ namespace ECS
 
 		// A fast retrival of archetype ID by combination of component types.
 		std::unordered_map<ComponentTypeIDSet, ArchetypeID> archetype_id_by_component_set;
+
+		// The inverted index from component type (and relation type of pairs) to the archetypes having it
+		std::unordered_map<ComponentTypeID, std::vector<ArchetypeID>> archetype_ids_by_component;
+		std::unordered_map<ComponentTypeID, std::vector<ArchetypeID>> archetype_ids_by_relation;
 	};
 }
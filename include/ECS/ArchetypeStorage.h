@@ -1,14 +1,22 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <numeric>
 using std::cout;
 using std::endl;
 
 #include "EntityManager.h"
 #include "Chunk.h"
+#include "Numa.h"
 #include "ComponentTypeManager.h"
 #include "ArchetypeManager.h"
+#include "StorageStats.h"
+#include "SharedComponent.h"
 
 
 namespace ECS
@@ -32,6 +40,25 @@ namespace ECS
 		return !(lhs == rhs);
 	}
 
+	// The chunks of an archetype storage at a checkpoint, see EntityManager::SaveCheckpoint. Chunk copies and the
+	// entity bookkeeping are shared between checkpoints while unchanged.
+	struct ArchetypeCheckpoint
+	{
+		struct Structure
+		{
+			std::pmr::vector<std::pmr::vector<Entity>> archetype_entities;
+			std::pmr::unordered_map<Entity, EntityIndex> entity_indices;
+			std::vector<size_t> cur_entity_count;
+		};
+
+		uint64_t version = 0;
+		std::vector<std::shared_ptr<Chunk>> chunks;
+		std::vector<std::shared_ptr<Chunk>> cold_chunks;
+		std::shared_ptr<const Structure> structure_ptr;  // Null for a storage created after the checkpoint
+		std::vector<size_t> row_offsets;
+		std::vector<size_t> row_previous_offsets;
+	};
+
 	// Manage the archetype's storage-related information and chunk storage.
 	struct ArchetypeStorage
 	{
@@ -41,49 +68,191 @@ namespace ECS
 		ArchetypeStorage(const ArchetypeStorage&) = delete;
 		ArchetypeStorage operator=(const ArchetypeStorage&) = delete;
 
-		ArchetypeStorage(const ComponentTypeManager* c_mgr_ptr, const ArchetypeManager* a_mgr_ptr, const ArchetypeID& a_id)
+		// The chunks and the entity bookkeeping are allocated from the given memory resource; the NUMA resource, if
+		// any, is the same one, telling the node of each chunk.
+		ArchetypeStorage(const ComponentTypeManager* c_mgr_ptr, const ArchetypeManager* a_mgr_ptr, const ArchetypeID& a_id,
+			SharedValueStores* shared_stores_ptr = nullptr, std::pmr::memory_resource* resource_ptr = std::pmr::get_default_resource(),
+			const NumaChunkResource* numa_resource_ptr = nullptr)
+			: archetype_entities(resource_ptr), entity_indices(resource_ptr), shared_stores_ptr(shared_stores_ptr), resource_ptr(resource_ptr),
+			numa_resource_ptr(numa_resource_ptr)
 		{
-			const Archetype& archetype = a_mgr_ptr->GetArchtype(a_id);
-			const ComponentTypeIDSet& c_id_set = archetype.GetComponentTypeIDs();
+			size_t total_components_size = this->InitComponentTypes(c_mgr_ptr, a_mgr_ptr, a_id);
+			size_t cold_components_size = 0;
+			for (size_t i = 0; i < row_sizeofs.size(); i++) {
+				if (row_cold[i]) {
+					cold_components_size += row_double_buffered[i] ? 2 * row_sizeofs[i] : row_sizeofs[i];
+				}
+			}
 
-			// Init component-related info
-			size_t row_index = 0;
-			size_t total_components_size = 0;
+			// An archetype of only shared components still needs room for its entities; the capacity is lowered
+			// until the rows fit with their padding, and the cold rows fit in a cold chunk.
+			chunk_entity_capacity = std::min(chunk_size / std::max(total_components_size - cold_components_size, size_t(1)),
+				max_cold_chunk_size / std::max(cold_components_size, size_t(1)));
+			while (this->LayOutRows(c_mgr_ptr) > chunk_size || cold_chunk_size > max_cold_chunk_size) {
+				chunk_entity_capacity--;
+			}
 
-			for (const auto& c_id : c_id_set) {
-				component_types.push_back(c_id);
-				component_type_index_by_id.insert({ c_id, row_index });
+			if (shared_types.empty()) {
+				this->CreateNewChunk(SharedKey());
+			}
+		}
 
-				size_t c_size = c_mgr_ptr->GetComponentType(c_id).size;
-				row_sizeofs.push_back(c_size);
+		// Construct with a given chunk layout (e.g. read from persisted storage) and no chunk, which are then
+		// attached by AttachChunk.
+		ArchetypeStorage(const ComponentTypeManager* c_mgr_ptr, const ArchetypeManager* a_mgr_ptr, const ArchetypeID& a_id,
+			const std::unordered_map<ComponentTypeID, size_t>& row_offset_by_id, size_t chunk_entity_capacity,
+			std::pmr::memory_resource* resource_ptr = std::pmr::get_default_resource())
+			: archetype_entities(resource_ptr), entity_indices(resource_ptr), resource_ptr(resource_ptr), chunk_entity_capacity(chunk_entity_capacity)
+		{
+			this->InitComponentTypes(c_mgr_ptr, a_mgr_ptr, a_id);
+			assert(shared_types.empty());
+			row_cold.assign(component_types.size(), false);  // all rows are in the given layout
 
-				total_components_size += c_size;
-				row_index++;
+			for (const auto& c_id : component_types) {
+				assert(row_offset_by_id.count(c_id) != 0);
+				row_offsets.push_back(row_offset_by_id.at(c_id));
 			}
+			assert(std::count(row_double_buffered.begin(), row_double_buffered.end(), true) == 0);
+			row_previous_offsets = row_offsets;
+		}
 
-			chunk_entity_capacity = chunk_size / total_components_size;
-			this->CreateNewChunk();
+		~ArchetypeStorage()
+		{
+			for (Chunk* chunk_ptr : chunks) {
+				delete chunk_ptr;
+			}
+			for (Chunk* chunk_ptr : cold_chunks) {
+				delete chunk_ptr;
+			}
 		}
 
-		void AddEntity(const Entity& new_entity)
+		// Add an entity into a chunk having the given shared values.
+		void AddEntity(const Entity& new_entity, const SharedKey& shared_key = SharedKey())
 		{
-			EntityIndex new_e_index = this->GetEmptyEntityIndex();
+			EntityIndex new_e_index = this->GetEmptyEntityIndex(shared_key);
 			AddEntityToIndex(new_entity, new_e_index);
 		}
 
+		// Add entities with copies of the given row values (one per row, e.g. a prefab's or another entity's),
+		// filling the free slots of chunks having the given shared values a chunk-sized batch at a time.
+		void AddEntities(const Entity* new_entities, size_t count, const SharedKey& shared_key, const std::vector<const void*>& row_values)
+		{
+			assert(row_values.size() == component_types.size());
+
+			entity_indices.reserve(entity_indices.size() + count);
+			size_t added_count = 0;
+			while (added_count < count) {
+				EntityIndex e_index = this->GetEmptyEntityIndex(shared_key);
+				size_t batch_count = std::min(count - added_count, chunk_entity_capacity - e_index.col_index);
+
+				for (size_t row_index = 0; row_index < component_types.size(); row_index++) {
+					if (row_lanes[row_index] != 0) {
+						// The entries of an interleaved row are consecutive only within a block
+						for (size_t i = 0; i < batch_count; i++) {
+							EntityIndex entry_e_index(e_index.chunk_index, e_index.col_index + i);
+							char* dest = static_cast<char*>(this->GetComponentDataAddress(entry_e_index, row_index));
+							this->FillRow(row_index, dest, row_values[row_index], 1);
+						}
+						continue;
+					}
+					char* dest = static_cast<char*>(this->GetComponentDataAddress(e_index, row_index));
+					this->FillRow(row_index, dest, row_values[row_index], batch_count);
+					if (row_double_buffered[row_index]) {
+						dest = static_cast<char*>(this->GetPreviousComponentDataAddress(e_index, row_index));
+						this->FillRow(row_index, dest, row_values[row_index], batch_count);
+					}
+				}
+
+				std::pmr::vector<Entity>& chunk_entities = archetype_entities[e_index.chunk_index];
+				for (size_t i = 0; i < batch_count; i++) {
+					chunk_entities[e_index.col_index + i] = new_entities[added_count + i];
+					entity_indices.insert({ new_entities[added_count + i], EntityIndex(e_index.chunk_index, e_index.col_index + i) });
+				}
+				cur_entity_count[e_index.chunk_index] += batch_count;
+				added_count += batch_count;
+				this->MarkChunkChanged(e_index.chunk_index);
+			}
+		}
+
+		// The address of each row value of an entity, in row order
+		std::vector<const void*> GetEntityRowAddresses(const Entity& entity)
+		{
+			EntityIndex e_index = entity_indices.at(entity);
+			std::vector<const void*> row_addresses;
+			for (size_t row_index = 0; row_index < component_types.size(); row_index++) {
+				row_addresses.push_back(this->GetComponentDataAddress(e_index, row_index));
+			}
+			return row_addresses;
+		}
+
+		// The address of an entity's component, which is marked as changed since the caller may write it.
 		void* GetComponentDataAddress(const Entity& entity, const ComponentTypeID& c_id)
 		{
 			assert(component_type_index_by_id.count(c_id) != 0);
 			size_t row_index = component_type_index_by_id[c_id];
 			EntityIndex e_index = entity_indices[entity];
 
+			this->MarkRowChanged(e_index.chunk_index, row_index);
 			return GetComponentDataAddress(e_index, row_index);
 		}
 
-		void MigrateEntity(const Entity& entity, ArchetypeStorage* const dest_a_storage_ptr)
+		// The address of an entity's component for reading only, not marked as changed.
+		const void* ReadComponentDataAddress(const Entity& entity, const ComponentTypeID& c_id) const
 		{
+			return this->ReadEntryComponent(entity_indices.at(entity), component_type_index_by_id.at(c_id));
+		}
+
+		// Mark the row of an entity's component as changed, e.g. after writing its previous buffer.
+		void MarkRowChanged(const Entity& entity, const ComponentTypeID& c_id)
+		{
+			this->MarkRowChanged(entity_indices.at(entity).chunk_index, component_type_index_by_id.at(c_id));
+		}
+
+		// The previous frame's value of a double-buffered component; the same as GetComponentDataAddress for other types.
+		void* GetPreviousComponentDataAddress(const Entity& entity, const ComponentTypeID& c_id)
+		{
+			return this->GetPreviousComponentDataAddress(entity_indices.at(entity), component_type_index_by_id.at(c_id));
+		}
+
+		// Make the rows written in the last frame the previous buffers, and reuse the previous buffers for the next
+		// frame, by swapping the row offsets. The rows of the skipped types are flipped by the steps of their group.
+		void FlipBuffers(const ComponentTypeIDSet& skipped_c_ids = ComponentTypeIDSet())
+		{
+			for (size_t i = 0; i < row_offsets.size(); i++) {
+				if (row_double_buffered[i] && skipped_c_ids.count(component_types[i]) == 0) {
+					this->FlipRow(i, 0, 1);
+				}
+			}
+		}
+
+		// Flip the rows of the given types in the chunks whose index modulo slice_count is slice_index, i.e. those
+		// processed by a step of a time-sliced group.
+		void FlipBuffers(const ComponentTypeIDSet& c_id_set, size_t slice_index, size_t slice_count)
+		{
+			for (const auto& c_id : c_id_set) {
+				auto iter = component_type_index_by_id.find(c_id);
+				if (iter != component_type_index_by_id.end() && row_double_buffered[iter->second]) {
+					this->FlipRow(iter->second, slice_index, slice_count);
+				}
+			}
+		}
+
+		bool HasDoubleBufferedRows() const
+		{
+			return std::count(row_double_buffered.begin(), row_double_buffered.end(), true) != 0;
+		}
+
+		// Move an entity into a chunk of the destination having the given shared values. The destination may be
+		// this storage, to change the entity's shared values.
+		void MigrateEntity(const Entity& entity, ArchetypeStorage* const dest_a_storage_ptr, const SharedKey& dest_shared_key = SharedKey())
+		{
+			assert(!chunks[entity_indices.at(entity).chunk_index]->read_only);
+
 			EntityIndex src_e_index = entity_indices.at(entity);
-			EntityIndex dest_e_index = dest_a_storage_ptr->GetEmptyEntityIndex();
+			if (dest_a_storage_ptr == this && chunk_shared_keys[src_e_index.chunk_index] == dest_shared_key) {
+				return;
+			}
+			EntityIndex dest_e_index = dest_a_storage_ptr->GetEmptyEntityIndex(dest_shared_key);
 
 			this->CopyEntityData(src_e_index, dest_e_index, dest_a_storage_ptr);
 			this->RemoveEntityData(entity);
@@ -95,6 +264,7 @@ namespace ECS
 		void RemoveEntityData(const Entity& entity)
 		{
 			EntityIndex e_index = entity_indices.at(entity);
+			assert(!chunks[e_index.chunk_index]->read_only);
 
 			EntityIndex last_e_index(e_index.chunk_index, cur_entity_count[e_index.chunk_index] - 1);
 			Entity last_e_entity = archetype_entities[last_e_index.chunk_index][last_e_index.col_index];
@@ -107,15 +277,50 @@ namespace ECS
 			archetype_entities[e_index.chunk_index][e_index.col_index] = last_e_entity;
 			entity_indices.at(last_e_entity) = e_index;
 			entity_indices.erase(entity);
+			this->MarkChunkChanged(e_index.chunk_index);
+		}
+
+		// Reorder the entities so that the values of a row are in the order given by less(lhs_value, rhs_value)
+		// across the chunks having the same shared values, moving the entities' data and keeping their indices.
+		// The sort is stable. Returns the number of entities moved.
+		template <typename F>
+		size_t SortBy(const ComponentTypeID& c_id, F less)
+		{
+			size_t row_index = component_type_index_by_id.at(c_id);
+			size_t moved_count = 0;
+			std::vector<bool> sorted_chunks(chunks.size(), false);
+			for (size_t first = 0; first < chunks.size(); first++) {
+				if (sorted_chunks[first]) {
+					continue;
+				}
+				// The entries of the chunks having the shared values of the first one, in iteration order; they are
+				// left unsorted if any of them is read-only.
+				std::vector<EntityIndex> e_indices;
+				bool read_only = false;
+				for (size_t i = first; i < chunks.size(); i++) {
+					if (!sorted_chunks[i] && chunk_shared_keys[i] == chunk_shared_keys[first]) {
+						read_only = read_only || (chunks[i]->read_only && cur_entity_count[i] != 0);
+						sorted_chunks[i] = true;
+						for (size_t j = 0; j < cur_entity_count[i]; j++) {
+							e_indices.push_back(EntityIndex(i, j));
+						}
+					}
+				}
+				if (!read_only) {
+					moved_count += this->SortEntries(e_indices, row_index, less);
+				}
+			}
+			return moved_count;
 		}
 
 		// Copy all entities (potential performance issue to be addressed!)
 		// Must copy the entities instead of using an indirect link, because the entity storage 
 		// may be altered during ForEach update.
-		std::vector<Entity> GetEntities()
+		// With a slice count, only the entities of the chunks whose index modulo the count is slice_index.
+		std::vector<Entity> GetEntities(size_t slice_index = 0, size_t slice_count = 1)
 		{
 			std::vector<Entity> entities;
-			for (size_t i = 0; i < chunks.size(); i++) {
+			for (size_t i = slice_index; i < chunks.size(); i += slice_count) {
 				for (size_t j = 0; j < cur_entity_count[i]; j++) {
 					entities.push_back(archetype_entities[i][j]);
 				}
@@ -123,6 +328,311 @@ namespace ECS
 			return entities;
 		}
 
+		// Append a chunk that already holds the data of the given entities, e.g. a page range of a mapped file.
+		// The chunk must use this storage's chunk layout, which must have no cold rows. An owned chunk of another
+		// memory resource is copied into one of this storage's and freed, so that the storage's memory is all
+		// from its resource, e.g. an arena released at once.
+		void AttachChunk(Chunk* chunk_ptr, const Entity* entities, size_t entity_count, const SharedKey& shared_key = SharedKey())
+		{
+			assert(chunk_ptr->chunk_size == chunk_size && entity_count <= chunk_entity_capacity && cold_chunk_size == 0);
+			if (chunk_ptr->owns_memory && !chunk_ptr->resource_ptr->is_equal(*resource_ptr)) {
+				Chunk* own_chunk_ptr = this->AllocateChunk(chunk_size);
+				std::memcpy(own_chunk_ptr->chunk_ptr, chunk_ptr->chunk_ptr, chunk_size);
+				delete chunk_ptr;
+				chunk_ptr = own_chunk_ptr;
+			}
+
+			chunks.push_back(chunk_ptr);
+			cur_entity_count.push_back(entity_count);
+			archetype_entities.emplace_back(chunk_entity_capacity);
+			chunk_shared_keys.emplace_back();
+			row_versions.resize(row_versions.size() + component_types.size());
+			chunk_versions.push_back(0);
+
+			size_t chunk_index = chunks.size() - 1;
+			if (!shared_types.empty()) {
+				this->SetChunkSharedKey(chunk_index, shared_key);
+			}
+			this->MarkChunkChanged(chunk_index);
+			entity_indices.reserve(entity_indices.size() + entity_count);
+			for (size_t i = 0; i < entity_count; i++) {
+				archetype_entities[chunk_index][i] = entities[i];
+				entity_indices.insert({ entities[i], EntityIndex(chunk_index, i) });
+			}
+		}
+
+		// Take a chunk and its entities out of the storage, handing the chunk over to the caller. The last chunk
+		// takes its place, so only the indices of its entities change. The storage must have no cold rows.
+		Chunk* DetachChunk(size_t chunk_index, std::vector<Entity>& chunk_entities)
+		{
+			assert(cold_chunk_size == 0);
+			chunk_entities.assign(archetype_entities[chunk_index].begin(), archetype_entities[chunk_index].begin() + cur_entity_count[chunk_index]);
+			for (const auto& entity : chunk_entities) {
+				entity_indices.erase(entity);
+			}
+			if (!chunk_shared_keys[chunk_index].empty()) {
+				for (size_t i = 0; i < shared_types.size(); i++) {
+					(*shared_stores_ptr)[shared_types[i]]->Release(chunk_shared_keys[chunk_index][i]);
+				}
+			}
+
+			Chunk* chunk_ptr = chunks[chunk_index];
+			size_t last_chunk_index = chunks.size() - 1;
+			if (chunk_index != last_chunk_index) {
+				chunks[chunk_index] = chunks[last_chunk_index];
+				cur_entity_count[chunk_index] = cur_entity_count[last_chunk_index];
+				archetype_entities[chunk_index].swap(archetype_entities[last_chunk_index]);
+				chunk_shared_keys[chunk_index].swap(chunk_shared_keys[last_chunk_index]);
+				for (size_t i = 0; i < cur_entity_count[chunk_index]; i++) {
+					entity_indices.at(archetype_entities[chunk_index][i]).chunk_index = chunk_index;
+				}
+				this->MarkChunkChanged(chunk_index);
+			}
+			chunks.pop_back();
+			cur_entity_count.pop_back();
+			archetype_entities.pop_back();
+			chunk_shared_keys.pop_back();
+			row_versions.resize(chunks.size() * component_types.size());
+			chunk_versions.pop_back();
+
+			return chunk_ptr;
+		}
+
+		/**
+		* Shared components, whose values are per chunk
+		*/
+		const std::vector<ComponentTypeID>& GetSharedTypes() const { return shared_types; }
+		const SharedKey& GetChunkSharedKey(size_t chunk_index) const { return chunk_shared_keys[chunk_index]; }
+
+		bool HasSharedType(const ComponentTypeID& c_id) const
+		{
+			return shared_type_index_by_id.count(c_id) != 0;
+		}
+
+		// The position of a shared type in the shared keys
+		size_t GetSharedTypeIndex(const ComponentTypeID& c_id) const
+		{
+			return shared_type_index_by_id.at(c_id);
+		}
+
+		// Whether an entity is stored in a read-only chunk, i.e. a page of a file mapped read-only
+		bool IsEntityReadOnly(const Entity& entity) const
+		{
+			return chunks[entity_indices.at(entity).chunk_index]->read_only;
+		}
+
+		bool HasReadOnlyChunks() const
+		{
+			for (const auto& chunk_ptr : chunks) {
+				if (chunk_ptr->read_only) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		const SharedKey& GetEntitySharedKey(const Entity& entity) const
+		{
+			return chunk_shared_keys[entity_indices.at(entity).chunk_index];
+		}
+
+		size_t GetEntitySharedValueIndex(const Entity& entity, const ComponentTypeID& c_id) const
+		{
+			return this->GetEntitySharedKey(entity)[shared_type_index_by_id.at(c_id)];
+		}
+
+		/**
+		* Read access to the chunk layout and contents
+		*/
+		size_t GetChunkCount() const { return chunks.size(); }
+		size_t GetChunkNumaNode(size_t chunk_index) const { return chunks[chunk_index]->numa_node; }
+		const Chunk* GetChunk(size_t chunk_index) const { return chunks[chunk_index]; }
+		size_t GetChunkEntityCount(size_t chunk_index) const { return cur_entity_count[chunk_index]; }
+		const Entity* GetChunkEntities(size_t chunk_index) const { return archetype_entities[chunk_index].data(); }
+
+		// The first entry of a component type's row in a chunk, i.e. an array of the chunk's entity count, or the
+		// first block of an interleaved row; the row is marked as changed.
+		void* GetChunkRowAddress(size_t chunk_index, const ComponentTypeID& c_id)
+		{
+			size_t row_index = component_type_index_by_id.at(c_id);
+			this->MarkRowChanged(chunk_index, row_index);
+			return this->GetComponentDataAddress(EntityIndex(chunk_index, 0), row_index);
+		}
+
+		// The same as GetChunkRowAddress for reading only, not marking the row as changed.
+		const void* ReadChunkRowAddress(size_t chunk_index, const ComponentTypeID& c_id) const
+		{
+			return this->ReadEntryComponent(EntityIndex(chunk_index, 0), component_type_index_by_id.at(c_id));
+		}
+
+		size_t GetRowIndex(const ComponentTypeID& c_id) const
+		{
+			return component_type_index_by_id.at(c_id);
+		}
+
+		// The component of a row at an entry, for reading only: unlike the other accessors, the row isn't marked as changed.
+		const void* ReadEntryComponent(const EntityIndex& e_index, size_t row_index) const
+		{
+			return const_cast<ArchetypeStorage*>(this)->GetComponentDataAddress(e_index, row_index);
+		}
+
+		// The number of entries in a block of an interleaved row, or 0 for a contiguous row
+		size_t GetRowLanes(const ComponentTypeID& c_id) const
+		{
+			return row_lanes[component_type_index_by_id.at(c_id)];
+		}
+
+		// The distance from a block of an interleaved row to the next
+		size_t GetRowBlockStride(const ComponentTypeID& c_id) const
+		{
+			return row_block_strides[component_type_index_by_id.at(c_id)];
+		}
+
+		// Whether every row is contiguous in the chunks, as persisted storage and deltas expect, i.e. there are no
+		// interleaved or cold rows.
+		bool HasDefaultLayout() const
+		{
+			return cold_chunk_size == 0 && std::count(row_lanes.begin(), row_lanes.end(), size_t(0)) == static_cast<ptrdiff_t>(row_lanes.size());
+		}
+
+		/**
+		* Change versions: the storage manager's change version at the last possible change of a chunk or of
+		* one of its rows, so that readers can skip what didn't change since they last looked.
+		*/
+		void SetChangeVersionSource(const uint64_t* change_version_ptr)
+		{
+			this->change_version_ptr = change_version_ptr;
+		}
+
+		// The version of the last change of a chunk: to any row, or to its entities
+		uint64_t GetChunkVersion(size_t chunk_index) const
+		{
+			return chunk_versions[chunk_index];
+		}
+
+		uint64_t GetRowVersion(size_t chunk_index, size_t row_index) const
+		{
+			return row_versions[chunk_index * component_types.size() + row_index];
+		}
+
+		// The version of the last change of the entities of any chunk
+		uint64_t GetStructureVersion() const
+		{
+			return structure_version;
+		}
+
+		// Capture the chunks into a checkpoint at the given version, sharing the copies of the chunks unchanged since
+		// a previous checkpoint of this storage, and reusing the memory of the checkpoint's copies no longer shared.
+		void CaptureCheckpoint(ArchetypeCheckpoint& checkpoint, const ArchetypeCheckpoint* previous_ptr, uint64_t version) const
+		{
+			auto copy_chunk = [](std::shared_ptr<Chunk>& copy_ptr, const Chunk* chunk_ptr) -> void {
+				if (!copy_ptr || copy_ptr.use_count() != 1) {
+					copy_ptr.reset(new Chunk(chunk_ptr->chunk_size));
+				}
+				std::memcpy(copy_ptr->chunk_ptr, chunk_ptr->chunk_ptr, chunk_ptr->chunk_size);
+			};
+
+			checkpoint.chunks.resize(chunks.size());
+			checkpoint.cold_chunks.resize(cold_chunks.size());
+			for (size_t i = 0; i < chunks.size(); i++) {
+				if (previous_ptr != nullptr && i < previous_ptr->chunks.size() && chunk_versions[i] <= previous_ptr->version) {
+					checkpoint.chunks[i] = previous_ptr->chunks[i];
+					if (!cold_chunks.empty()) {
+						checkpoint.cold_chunks[i] = previous_ptr->cold_chunks[i];
+					}
+					continue;
+				}
+				copy_chunk(checkpoint.chunks[i], chunks[i]);
+				if (!cold_chunks.empty()) {
+					copy_chunk(checkpoint.cold_chunks[i], cold_chunks[i]);
+				}
+			}
+
+			if (previous_ptr != nullptr && previous_ptr->structure_ptr && structure_version <= previous_ptr->version) {
+				checkpoint.structure_ptr = previous_ptr->structure_ptr;
+			}
+			else {
+				checkpoint.structure_ptr.reset(new ArchetypeCheckpoint::Structure{ archetype_entities, entity_indices, cur_entity_count });
+			}
+			checkpoint.row_offsets = row_offsets;
+			checkpoint.row_previous_offsets = row_previous_offsets;
+			checkpoint.version = version;
+		}
+
+		// Put the chunks back to their state at a checkpoint, copying back only the chunks changed since, and the
+		// entity bookkeeping only if entities were added or removed since. The archetype must have no shared type.
+		void RestoreCheckpoint(const ArchetypeCheckpoint& checkpoint)
+		{
+			this->RestoreCheckpoint(checkpoint, nullptr);
+		}
+
+		// Same as above, for a checkpoint no longer needed: its copies held by it alone are swapped with the chunks
+		// rather than copied back, leaving it with the chunks' old data to be captured into again.
+		void RestoreCheckpoint(ArchetypeCheckpoint&& checkpoint)
+		{
+			this->RestoreCheckpoint(checkpoint, &checkpoint);
+		}
+
+		void* GetChunkPreviousRowAddress(size_t chunk_index, const ComponentTypeID& c_id)
+		{
+			return this->GetPreviousComponentDataAddress(EntityIndex(chunk_index, 0), component_type_index_by_id.at(c_id));
+		}
+
+		static size_t GetChunkSize() { return chunk_size; }
+		size_t GetChunkEntityCapacity() const { return chunk_entity_capacity; }
+		size_t GetEntityCount() const { return entity_indices.size(); }
+
+		// The number of chunks holding at least one entity
+		size_t GetUsedChunkCount() const
+		{
+			return cur_entity_count.size() - std::count(cur_entity_count.begin(), cur_entity_count.end(), size_t(0));
+		}
+
+		const std::vector<ComponentTypeID>& GetComponentTypes() const { return component_types; }
+		const std::vector<size_t>& GetRowSizeofs() const { return row_sizeofs; }
+		const std::vector<size_t>& GetRowOffsets() const { return row_offsets; }
+		const std::vector<size_t>& GetRowPreviousOffsets() const { return row_previous_offsets; }
+
+		void GetStats(ArchetypeStorageStats& stats) const
+		{
+			stats.entity_count = entity_indices.size();
+			stats.chunk_count = chunks.size();
+			stats.chunk_entity_capacity = chunk_entity_capacity;
+
+			stats.occupancy_histogram.fill(0);
+			for (size_t count : cur_entity_count) {
+				size_t bucket = count == 0 ? 0 : 1 + (count * 4 - 1) / chunk_entity_capacity;
+				stats.occupancy_histogram[bucket]++;
+			}
+
+			size_t row_size = 0;
+			size_t rows_end = 0;
+			for (size_t i = 0; i < row_sizeofs.size(); i++) {
+				row_size += row_double_buffered[i] ? 2 * row_sizeofs[i] : row_sizeofs[i];
+				if (row_cold[i]) {
+					continue;
+				}
+				size_t row_end = std::max(row_offsets[i], row_previous_offsets[i]) + row_sizeofs[i] * chunk_entity_capacity;
+				if (row_lanes[i] != 0) {
+					size_t block_count = (chunk_entity_capacity + row_lanes[i] - 1) / row_lanes[i];
+					row_end = row_offsets[i] + (block_count - 1) * row_block_strides[i] + row_lanes[i] * row_sizeofs[i];
+				}
+				rows_end = std::max(rows_end, row_end);
+			}
+			stats.bytes_used = stats.entity_count * row_size;
+			stats.bytes_reserved = chunks.size() * (chunk_size + cold_chunk_size);
+			stats.wasted_tail_bytes_per_chunk = chunk_size - rows_end;
+
+			stats.index_bytes = archetype_entities.capacity() * sizeof(std::pmr::vector<Entity>)
+				+ chunks.capacity() * sizeof(Chunk*) + chunks.size() * sizeof(Chunk)
+				+ cold_chunks.capacity() * sizeof(Chunk*) + cold_chunks.size() * sizeof(Chunk)
+				+ cur_entity_count.capacity() * sizeof(size_t)
+				+ Internal::HashContainerBytes(entity_indices);
+			for (const auto& entities : archetype_entities) {
+				stats.index_bytes += entities.capacity() * sizeof(Entity);
+			}
+		}
+
 		void PrintInfo() const
 		{
 			cout << "Has " << component_types.size() << " components (rows):" << endl;;
@@ -142,11 +652,274 @@ namespace ECS
 
 	private:
 
-		void CreateNewChunk()
+		// Init the rows of the storage, ordered by the component types' stable names so that an archetype
+		// has the same chunk layout regardless of the order its types were registered. Shared component types
+		// have no row. Return the row size in total, cold rows included.
+		size_t InitComponentTypes(const ComponentTypeManager* c_mgr_ptr, const ArchetypeManager* a_mgr_ptr, const ArchetypeID& a_id)
 		{
-			chunks.push_back(new Chunk(chunk_size));
+			const Archetype& archetype = a_mgr_ptr->GetArchtype(a_id);
+			const ComponentTypeIDSet& c_id_set = archetype.GetComponentTypeIDs();
+
+			component_types.assign(c_id_set.begin(), c_id_set.end());
+			std::sort(component_types.begin(), component_types.end(),
+				[&](const ComponentTypeID& lhs, const ComponentTypeID& rhs) -> bool {
+				return c_mgr_ptr->GetComponentType(lhs).name < c_mgr_ptr->GetComponentType(rhs).name;
+			});
+
+			// Shared types are moved out of the rows, keeping the order by name
+			auto shared_begin = std::stable_partition(component_types.begin(), component_types.end(),
+				[&](const ComponentTypeID& c_id) -> bool {
+				return c_mgr_ptr->GetComponentType(c_id).storage != StoragePolicy::Shared;
+			});
+			shared_types.assign(shared_begin, component_types.end());
+			component_types.erase(shared_begin, component_types.end());
+			for (size_t i = 0; i < shared_types.size(); i++) {
+				shared_type_index_by_id.insert({ shared_types[i], i });
+			}
+
+			// Init component-related info
+			size_t total_components_size = 0;
+
+			for (size_t row_index = 0; row_index < component_types.size(); row_index++) {
+				const ComponentTypeID& c_id = component_types[row_index];
+				component_type_index_by_id.insert({ c_id, row_index });
+
+				size_t c_size = c_mgr_ptr->GetComponentType(c_id).size;
+				row_sizeofs.push_back(c_size);
+				row_copy_constructs.push_back(c_mgr_ptr->GetComponentType(c_id).copy_construct);
+				row_double_buffered.push_back(c_mgr_ptr->GetComponentType(c_id).storage == StoragePolicy::DoubleBuffered);
+				row_cold.push_back(c_mgr_ptr->GetComponentType(c_id).cold);
+				row_lanes.push_back(0);
+				row_block_strides.push_back(0);
+
+				total_components_size += row_double_buffered.back() ? 2 * c_size : c_size;
+			}
+
+			// Cold rows only move out of the chunks when other rows are left to iterate without them
+			if (std::count(row_cold.begin(), row_cold.end(), false) == 0) {
+				row_cold.assign(row_cold.size(), false);
+			}
+
+			return total_components_size;
+		}
+
+		// Rows are laid out one after another, each holding chunk_entity_capacity entries and starting on a
+		// Chunk::alignment boundary; a double-buffered row is followed by its previous buffer. The rows of an
+		// interleave group (neither cold nor double-buffered) take the place of the first of them, as blocks of
+		// lanes entries of each row in turn, lanes being the most any of them asks for. Cold rows are laid out the
+		// same way in the cold chunks, whose size is set. Returns the end of the last row in the chunks.
+		size_t LayOutRows(const ComponentTypeManager* c_mgr_ptr)
+		{
+			auto align = [](size_t offset, size_t alignment) -> size_t {
+				return (offset + alignment - 1) / alignment * alignment;
+			};
+			auto is_interleavable = [&](size_t row_index) -> bool {
+				return c_mgr_ptr->GetComponentType(component_types[row_index]).interleave_group != 0
+					&& !row_cold[row_index] && !row_double_buffered[row_index];
+			};
+
+			row_offsets.assign(row_sizeofs.size(), 0);
+			row_previous_offsets.assign(row_sizeofs.size(), 0);
+			row_lanes.assign(row_sizeofs.size(), 0);
+			row_block_strides.assign(row_sizeofs.size(), 0);
+			std::vector<bool> laid_out(row_sizeofs.size(), false);
+			size_t rows_end = 0;
+			cold_chunk_size = 0;
+			for (size_t i = 0; i < row_sizeofs.size(); i++) {
+				if (laid_out[i]) {
+					continue;
+				}
+				size_t& row_offset = row_cold[i] ? cold_chunk_size : rows_end;
+
+				std::vector<size_t> group_rows{ i };
+				size_t lanes = c_mgr_ptr->GetComponentType(component_types[i]).interleave_lanes;
+				for (size_t j = i + 1; is_interleavable(i) && j < row_sizeofs.size(); j++) {
+					const ComponentType& c_type = c_mgr_ptr->GetComponentType(component_types[j]);
+					if (is_interleavable(j) && c_type.interleave_group == c_mgr_ptr->GetComponentType(component_types[i]).interleave_group) {
+						group_rows.push_back(j);
+						lanes = std::max(lanes, c_type.interleave_lanes);
+					}
+				}
+
+				if (group_rows.size() > 1) {
+					// Each row's part of a block starts on a max_align_t boundary
+					size_t group_offset = align(row_offset, Chunk::alignment);
+					size_t block_stride = 0;
+					for (const auto& j : group_rows) {
+						row_offsets[j] = group_offset + block_stride;
+						row_previous_offsets[j] = row_offsets[j];
+						block_stride += align(lanes * row_sizeofs[j], alignof(std::max_align_t));
+					}
+					for (const auto& j : group_rows) {
+						row_lanes[j] = lanes;
+						row_block_strides[j] = block_stride;
+						laid_out[j] = true;
+					}
+					row_offset = group_offset + (chunk_entity_capacity + lanes - 1) / lanes * block_stride;
+					continue;
+				}
+
+				row_offsets[i] = align(row_offset, Chunk::alignment);
+				row_offset = row_offsets[i] + chunk_entity_capacity * row_sizeofs[i];
+
+				row_previous_offsets[i] = row_offsets[i];
+				if (row_double_buffered[i]) {
+					row_previous_offsets[i] = align(row_offset, Chunk::alignment);
+					row_offset = row_previous_offsets[i] + chunk_entity_capacity * row_sizeofs[i];
+				}
+			}
+			return rows_end;
+		}
+
+		// Allocate a chunk from the storage's memory resource, recording its NUMA node
+		Chunk* AllocateChunk(size_t size) const
+		{
+			Chunk* chunk_ptr = new Chunk(size, resource_ptr);
+			if (numa_resource_ptr != nullptr) {
+				chunk_ptr->numa_node = numa_resource_ptr->GetNode(chunk_ptr->chunk_ptr);
+			}
+			return chunk_ptr;
+		}
+
+		void CreateNewChunk(const SharedKey& shared_key)
+		{
+			chunks.push_back(this->AllocateChunk(chunk_size));
+			if (cold_chunk_size != 0) {
+				cold_chunks.push_back(this->AllocateChunk(cold_chunk_size));
+			}
 			cur_entity_count.push_back(0);
-			archetype_entities.push_back(std::vector<Entity>(chunk_entity_capacity));
+			archetype_entities.emplace_back(chunk_entity_capacity);
+			chunk_shared_keys.emplace_back();
+			row_versions.resize(row_versions.size() + component_types.size());
+			chunk_versions.push_back(0);
+			this->SetChunkSharedKey(chunks.size() - 1, shared_key);
+		}
+
+		// Flip a double-buffered row in a slice of the chunks. The row offsets are shared by all chunks, so they are
+		// swapped only when all chunks flip; the buffers of a slice are swapped in place.
+		void FlipRow(size_t row_index, size_t slice_index, size_t slice_count)
+		{
+			if (slice_count == 1) {
+				std::swap(row_offsets[row_index], row_previous_offsets[row_index]);
+			}
+			size_t row_bytes = row_sizeofs[row_index] * chunk_entity_capacity;
+			for (size_t i = slice_index; i < chunks.size(); i += slice_count) {
+				if (slice_count > 1 && !chunks[i]->read_only) {
+					char* chunk_data = static_cast<char*>(row_cold[row_index] ? cold_chunks[i]->chunk_ptr : chunks[i]->chunk_ptr);
+					std::swap_ranges(chunk_data + row_offsets[row_index], chunk_data + row_offsets[row_index] + row_bytes,
+						chunk_data + row_previous_offsets[row_index]);
+				}
+				this->MarkRowChanged(i, row_index);
+			}
+		}
+
+		// Restore a checkpoint, swapping in the copies of the one taken, if any, see RestoreCheckpoint
+		void RestoreCheckpoint(const ArchetypeCheckpoint& checkpoint, ArchetypeCheckpoint* taken_ptr)
+		{
+			assert(shared_types.empty());
+
+			// Chunks created since the checkpoint are freed, and those freed since are allocated again
+			size_t old_chunk_count = chunks.size();
+			for (size_t i = checkpoint.chunks.size(); i < old_chunk_count; i++) {
+				delete chunks[i];
+				if (cold_chunk_size != 0) {
+					delete cold_chunks[i];
+				}
+			}
+			chunks.resize(checkpoint.chunks.size());
+			if (cold_chunk_size != 0) {
+				cold_chunks.resize(chunks.size());
+			}
+			row_versions.resize(chunks.size() * component_types.size());
+			chunk_versions.resize(chunks.size());
+			chunk_shared_keys.resize(chunks.size());
+
+			bool structure_changed = structure_version > checkpoint.version || old_chunk_count != chunks.size();
+			uint64_t old_structure_version = structure_version;
+			for (size_t i = 0; i < chunks.size(); i++) {
+				if (i < old_chunk_count && chunk_versions[i] <= checkpoint.version) {
+					continue;
+				}
+				if (i >= old_chunk_count) {
+					chunks[i] = this->AllocateChunk(chunk_size);
+					if (cold_chunk_size != 0) {
+						cold_chunks[i] = this->AllocateChunk(cold_chunk_size);
+					}
+				}
+				if (taken_ptr == nullptr || !SwapCopy(chunks[i], taken_ptr->chunks[i])) {
+					std::memcpy(chunks[i]->chunk_ptr, checkpoint.chunks[i]->chunk_ptr, chunk_size);
+				}
+				if (cold_chunk_size != 0 && (taken_ptr == nullptr || !SwapCopy(cold_chunks[i], taken_ptr->cold_chunks[i]))) {
+					std::memcpy(cold_chunks[i]->chunk_ptr, checkpoint.cold_chunks[i]->chunk_ptr, cold_chunk_size);
+				}
+				this->MarkChunkChanged(i);
+			}
+
+			if (structure_changed) {
+				if (checkpoint.structure_ptr) {
+					archetype_entities = checkpoint.structure_ptr->archetype_entities;
+					entity_indices = checkpoint.structure_ptr->entity_indices;
+					cur_entity_count = checkpoint.structure_ptr->cur_entity_count;
+				}
+				else {
+					archetype_entities.clear();
+					entity_indices.clear();
+					cur_entity_count.clear();
+				}
+				structure_version = change_version_ptr == nullptr ? 0 : *change_version_ptr;
+			}
+			else {
+				structure_version = old_structure_version;  // only the data of chunks changed
+			}
+			if (checkpoint.structure_ptr) {
+				row_offsets = checkpoint.row_offsets;
+				row_previous_offsets = checkpoint.row_previous_offsets;
+			}
+		}
+
+		// Swap the memory of a chunk with a copy held by nothing else from the same resource and NUMA node
+		static bool SwapCopy(Chunk* chunk_ptr, std::shared_ptr<Chunk>& copy_ptr)
+		{
+			if (copy_ptr.use_count() != 1 || !chunk_ptr->owns_memory || chunk_ptr->numa_node != copy_ptr->numa_node
+				|| !chunk_ptr->resource_ptr->is_equal(*copy_ptr->resource_ptr)) {
+				return false;
+			}
+			std::swap(chunk_ptr->chunk_ptr, copy_ptr->chunk_ptr);
+			return true;
+		}
+
+		void MarkRowChanged(size_t chunk_index, size_t row_index)
+		{
+			uint64_t change_version = change_version_ptr == nullptr ? 0 : *change_version_ptr;
+			row_versions[chunk_index * component_types.size() + row_index] = change_version;
+			chunk_versions[chunk_index] = change_version;
+		}
+
+		// Mark all rows and the entities of a chunk as changed
+		void MarkChunkChanged(size_t chunk_index)
+		{
+			uint64_t change_version = change_version_ptr == nullptr ? 0 : *change_version_ptr;
+			std::fill(row_versions.begin() + chunk_index * component_types.size(),
+				row_versions.begin() + (chunk_index + 1) * component_types.size(), change_version);
+			chunk_versions[chunk_index] = change_version;
+			structure_version = change_version;
+		}
+
+		// Let a chunk refer to other shared values, updating the reference counts of the values.
+		void SetChunkSharedKey(size_t chunk_index, const SharedKey& shared_key)
+		{
+			assert(shared_key.size() == shared_types.size());
+
+			SharedKey& old_key = chunk_shared_keys[chunk_index];
+			for (size_t i = 0; i < shared_types.size(); i++) {
+				SharedValueStoreBase* store_ptr = (*shared_stores_ptr)[shared_types[i]].get();
+				store_ptr->AddRef(shared_key[i]);
+				if (!old_key.empty()) {
+					store_ptr->Release(old_key[i]);
+				}
+			}
+			old_key = shared_key;
+			this->MarkChunkChanged(chunk_index);
 		}
 
 		void AddEntityToIndex(const Entity& new_entity, const EntityIndex& e_index)
@@ -156,12 +929,28 @@ namespace ECS
 			archetype_entities[e_index.chunk_index][e_index.col_index] = new_entity;
 			entity_indices.insert({ new_entity, e_index });
 			cur_entity_count[e_index.chunk_index]++;
+			this->MarkChunkChanged(e_index.chunk_index);
 		}
 
 		// Computer the data component address by given chunk_index, column_index (entity) and row_index (component).
 		void* GetComponentDataAddress(const EntityIndex& e_index, size_t row_index)
 		{
-			return chunks[e_index.chunk_index]->GetAddress(row_index, e_index.col_index, row_sizeofs, chunk_entity_capacity);
+			return this->GetEntryAddress(e_index, row_index, row_offsets[row_index]);
+		}
+
+		void* GetPreviousComponentDataAddress(const EntityIndex& e_index, size_t row_index)
+		{
+			return this->GetEntryAddress(e_index, row_index, row_previous_offsets[row_index]);
+		}
+
+		// The entry of a row, or of its previous buffer, in the chunk or the cold chunk holding the row
+		void* GetEntryAddress(const EntityIndex& e_index, size_t row_index, size_t row_offset)
+		{
+			Chunk* chunk_ptr = row_cold[row_index] ? cold_chunks[e_index.chunk_index] : chunks[e_index.chunk_index];
+			if (row_lanes[row_index] != 0) {
+				return chunk_ptr->GetAddress(row_offset, e_index.col_index, row_sizeofs[row_index], row_lanes[row_index], row_block_strides[row_index]);
+			}
+			return chunk_ptr->GetAddress(row_offset, e_index.col_index, row_sizeofs[row_index]);
 		}
 
 		void CopyEntityData(const EntityIndex& src_e_index, const EntityIndex& dest_e_index, ArchetypeStorage* const dest_a_storage_ptr)
@@ -176,34 +965,164 @@ namespace ECS
 				size_t dest_row_index = dest_a_storage_ptr->component_type_index_by_id.at(c_id);
 				void* src_c_data_address = this->GetComponentDataAddress(src_e_index, src_row_index);
 				void* dest_c_data_address = dest_a_storage_ptr->GetComponentDataAddress(dest_e_index, dest_row_index);
-				std::memcpy(dest_c_data_address, src_c_data_address, row_sizeofs[component_type_index_by_id.at(c_id)]);
+				std::memcpy(dest_c_data_address, src_c_data_address, row_sizeofs[src_row_index]);
+
+				if (row_double_buffered[src_row_index]) {
+					src_c_data_address = this->GetPreviousComponentDataAddress(src_e_index, src_row_index);
+					dest_c_data_address = dest_a_storage_ptr->GetPreviousComponentDataAddress(dest_e_index, dest_row_index);
+					std::memcpy(dest_c_data_address, src_c_data_address, row_sizeofs[src_row_index]);
+				}
+			}
+		}
+
+		// Sort the entities of the given entries by the values of a row, and move them to their place. Insertion sort
+		// takes a comparison per entry for nearly sorted entries, e.g. sorted last frame; the entries too far from
+		// sorted for it are sorted by std::stable_sort instead. Only the misplaced entities are moved.
+		template <typename F>
+		size_t SortEntries(const std::vector<EntityIndex>& e_indices, size_t key_row_index, F less)
+		{
+			// Insertion sort shifts at most this many entries per entry before giving up
+			const size_t max_shifts_per_entry = 8;
+
+			std::vector<const void*> values;
+			values.reserve(e_indices.size());
+			for (const auto& e_index : e_indices) {
+				values.push_back(this->GetComponentDataAddress(e_index, key_row_index));
+			}
+			auto is_less = [&](size_t lhs, size_t rhs) -> bool {
+				return less(values[lhs], values[rhs]);
+			};
+
+			// order[k]: the entry whose entity goes to entry k
+			std::vector<size_t> order(e_indices.size());
+			std::iota(order.begin(), order.end(), size_t(0));
+			size_t shift_count = 0;
+			for (size_t k = 1; k < order.size() && shift_count <= max_shifts_per_entry * order.size(); k++) {
+				size_t item = order[k];
+				size_t m = k;
+				for (; m > 0 && is_less(item, order[m - 1]); m--, shift_count++) {
+					order[m] = order[m - 1];
+				}
+				order[m] = item;
+			}
+			if (shift_count > max_shifts_per_entry * order.size()) {
+				std::iota(order.begin(), order.end(), size_t(0));
+				std::stable_sort(order.begin(), order.end(), is_less);
+			}
+
+			// Gather the values of the entries getting another entity a row at a time in their new order, and write
+			// them back; a row's values are read from scattered entries but written in order.
+			std::vector<size_t> moved_entries;
+			for (size_t k = 0; k < order.size(); k++) {
+				if (order[k] != k) {
+					moved_entries.push_back(k);
+				}
+			}
+			std::vector<char> buffer;
+			for (size_t row_index = 0; row_index < component_types.size(); row_index++) {
+				size_t c_size = row_sizeofs[row_index];
+				buffer.resize(moved_entries.size() * c_size);
+				for (bool previous : { false, true }) {
+					if (previous && !row_double_buffered[row_index]) {
+						continue;
+					}
+					auto address_of = [&](size_t k) -> void* {
+						return previous ? this->GetPreviousComponentDataAddress(e_indices[k], row_index)
+							: this->GetComponentDataAddress(e_indices[k], row_index);
+					};
+					for (size_t i = 0; i < moved_entries.size(); i++) {
+						std::memcpy(buffer.data() + i * c_size, address_of(order[moved_entries[i]]), c_size);
+					}
+					for (size_t i = 0; i < moved_entries.size(); i++) {
+						std::memcpy(address_of(moved_entries[i]), buffer.data() + i * c_size, c_size);
+					}
+				}
+			}
+
+			std::vector<Entity> moved_entities;
+			moved_entities.reserve(moved_entries.size());
+			for (size_t k : moved_entries) {
+				moved_entities.push_back(archetype_entities[e_indices[order[k]].chunk_index][e_indices[order[k]].col_index]);
+			}
+			std::vector<bool> changed_chunks(chunks.size(), false);
+			for (size_t i = 0; i < moved_entries.size(); i++) {
+				const EntityIndex& e_index = e_indices[moved_entries[i]];
+				archetype_entities[e_index.chunk_index][e_index.col_index] = moved_entities[i];
+				entity_indices.at(moved_entities[i]) = e_index;
+				changed_chunks[e_index.chunk_index] = true;
+			}
+			for (size_t i = 0; i < chunks.size(); i++) {
+				if (changed_chunks[i]) {
+					this->MarkChunkChanged(i);
+				}
+			}
+			return moved_entries.size();
+		}
+
+		// Copy a value into count consecutive entries of a row: by copy constructors if the type has one, otherwise
+		// by memcpy, doubling the filled range each time.
+		void FillRow(size_t row_index, char* dest, const void* value, size_t count)
+		{
+			size_t row_sizeof = row_sizeofs[row_index];
+			if (row_copy_constructs[row_index] != nullptr) {
+				for (size_t i = 0; i < count; i++) {
+					row_copy_constructs[row_index](dest + i * row_sizeof, value);
+				}
+				return;
+			}
+
+			if (count == 0) {
+				return;
+			}
+			std::memcpy(dest, value, row_sizeof);
+			size_t filled_count = 1;
+			while (filled_count < count) {
+				size_t copy_count = std::min(filled_count, count - filled_count);
+				std::memcpy(dest + filled_count * row_sizeof, dest, copy_count * row_sizeof);
+				filled_count += copy_count;
 			}
 		}
 
-		EntityIndex GetEmptyEntityIndex()
+		// Find room in a chunk having the given shared values, so that entities sharing values are grouped together.
+		EntityIndex GetEmptyEntityIndex(const SharedKey& shared_key)
 		{
+			assert(shared_key.size() == shared_types.size());
+
+			size_t empty_chunk_index = chunks.size();
 			for (size_t i = 0; i < cur_entity_count.size(); i++) {
-				if (cur_entity_count[i] < chunk_entity_capacity) {
-					return EntityIndex(i, cur_entity_count[i]);
+				if (cur_entity_count[i] < chunk_entity_capacity && !chunks[i]->read_only) {
+					if (chunk_shared_keys[i] == shared_key) {
+						return EntityIndex(i, cur_entity_count[i]);
+					}
+					if (cur_entity_count[i] == 0 && empty_chunk_index == chunks.size()) {
+						empty_chunk_index = i;
+					}
 				}
 			}
 
-			// If all chunks are full, allocate a new chunk.
-			this->CreateNewChunk();
+			// Reuse an empty chunk for the shared values, or allocate a new chunk if there is none.
+			if (empty_chunk_index != chunks.size()) {
+				this->SetChunkSharedKey(empty_chunk_index, shared_key);
+				return EntityIndex(empty_chunk_index, 0);
+			}
+			this->CreateNewChunk(shared_key);
 			return EntityIndex(chunks.size() - 1, 0);
 		}
 
 		// All chunks storing data for this archetype; use vector because we'll only add or delete chunks at the end
 		std::vector<Chunk*> chunks;
 
+		// The chunk of the cold rows of each chunk, if there are cold rows
+		std::vector<Chunk*> cold_chunks;
+
 		/**
 		* Entity-related info (column index of chunk)
 		*/
 		// Column index: All entities having this archetype
-		std::vector<std::vector<Entity>> archetype_entities;
+		std::pmr::vector<std::pmr::vector<Entity>> archetype_entities;
 
 		// The inverted column index [chunk_id][column_id] of each entity having this archetype
-		std::unordered_map<Entity, EntityIndex> entity_indices;
+		std::pmr::unordered_map<Entity, EntityIndex> entity_indices;
 
 		// 	The number of entities currently stored in the chunk
 		std::vector<size_t> cur_entity_count;
@@ -214,20 +1133,70 @@ namespace ECS
 		// The size of each component type
 		std::vector<size_t> row_sizeofs;
 
+		// The offset of each row from the beginning of a chunk
+		std::vector<size_t> row_offsets;
+
+		// The copy constructor of each row's type, or nullptr to copy the bytes
+		std::vector<CopyConstructFunc> row_copy_constructs;
+
+		// The offset of each row's previous buffer, which differs from row_offsets only for double-buffered rows
+		std::vector<size_t> row_previous_offsets;
+		std::vector<bool> row_double_buffered;
+
+		// The number of entries in a block of each interleaved row (0 for contiguous rows), and the distance from
+		// a block to the next
+		std::vector<size_t> row_lanes;
+		std::vector<size_t> row_block_strides;
+
+		// Whether each row is in the cold chunks
+		std::vector<bool> row_cold;
+
 		// Row index: All components in this archetype
 		std::vector<ComponentTypeID> component_types;
 
 		// The inverted row index for fast lookup
 		std::unordered_map<ComponentTypeID, size_t> component_type_index_by_id;
 
+		/**
+		* Shared component info (chunk metadata)
+		*/
+		// The shared component types in this archetype, ordered by name
+		std::vector<ComponentTypeID> shared_types;
+		std::unordered_map<ComponentTypeID, size_t> shared_type_index_by_id;
+
+		// The shared values of each chunk; empty until the chunk is used when the archetype has shared types
+		std::vector<SharedKey> chunk_shared_keys;
+
+		// The stores of shared values, owned by the storage manager
+		SharedValueStores* shared_stores_ptr = nullptr;
+
+		// The memory resource of the chunks and the entity bookkeeping, owned by the world
+		std::pmr::memory_resource* resource_ptr;
+		const NumaChunkResource* numa_resource_ptr = nullptr;
+
+		/**
+		* Change versions
+		*/
+		// The version of each row of each chunk, at [chunk_index * row count + row_index]
+		std::vector<uint64_t> row_versions;
+		std::vector<uint64_t> chunk_versions;
+		uint64_t structure_version = 0;
+
+		// The current change version, owned by the storage manager
+		const uint64_t* change_version_ptr = nullptr;
+
 		/**
 		* Chunk properties, determined at construction
 		*/
 		// Default 16K chunk size
-		const size_t chunk_size = 16384;
+		static constexpr size_t chunk_size = 16384;
 
 		// The number of entities having this archetype that can fit into a single chunk
 		size_t chunk_entity_capacity;
+
+		// The size of the cold chunks, holding the cold rows for chunk_entity_capacity entities; 0 if none
+		size_t cold_chunk_size = 0;
+		static constexpr size_t max_cold_chunk_size = 16 * chunk_size;
 	};
 
 }
@@ -0,0 +1,315 @@
+#pragma once
+// Coroutine systems need C++20 and are compiled in only with ECS_ENABLE_COROUTINES defined.
+#ifdef ECS_ENABLE_COROUTINES
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "System.h"
+#include "JobSystem.h"
+
+
+namespace ECS
+{
+	// The return type of AsyncSystem::Run. The coroutine starts suspended and is owned by the task.
+	class Task
+	{
+	public:
+		struct promise_type
+		{
+			Task get_return_object()
+			{
+				return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+			}
+
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			std::suspend_always final_suspend() noexcept { return {}; }
+			void return_void() {}
+
+			void unhandled_exception()
+			{
+				exception = std::current_exception();
+			}
+
+			std::exception_ptr exception;
+		};
+
+		typedef std::coroutine_handle<promise_type> Handle;
+
+		Task() {}
+		Task(Handle handle) : handle(handle) {}
+
+		// Avoid unintentional copy
+		Task(const Task&) = delete;
+		Task operator=(const Task&) = delete;
+
+		Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+		Task& operator=(Task&& other) noexcept
+		{
+			if (this != &other) {
+				this->Reset();
+				handle = std::exchange(other.handle, nullptr);
+			}
+			return *this;
+		}
+
+		~Task()
+		{
+			this->Reset();
+		}
+
+		// Whether the coroutine is started and not finished yet
+		bool IsRunning() const
+		{
+			return handle && !handle.done();
+		}
+
+		Handle GetHandle() const
+		{
+			return handle;
+		}
+
+	private:
+		void Reset()
+		{
+			if (handle) {
+				handle.destroy();
+				handle = nullptr;
+			}
+		}
+
+		Handle handle;
+	};
+
+	// Resumes the suspended coroutines of the async systems of a world: those waiting for the next frame or
+	// for a finished job at the start of World::Update, and those waiting for the sync point at its end, after
+	// all systems. Resumptions stop for the frame once the coroutines have run for the frame budget; the rest
+	// wait for the next frame, but at least one coroutine is resumed each frame.
+	class CoroutineScheduler
+	{
+	public:
+
+		CoroutineScheduler(JobSystem* job_system_ptr) : job_system_ptr(job_system_ptr) {}
+
+		// Avoid unintentional copy
+		CoroutineScheduler(const CoroutineScheduler&) = delete;
+		CoroutineScheduler operator=(const CoroutineScheduler&) = delete;
+
+		// The time the coroutines may run per frame, in seconds.
+		void SetFrameBudget(double budget)
+		{
+			this->budget = budget;
+		}
+
+		double GetFrameBudget() const
+		{
+			return budget;
+		}
+
+		// The delta time of the frame being updated
+		double GetFrameDeltaTime() const
+		{
+			return frame_delta_time;
+		}
+
+		// The number of suspended coroutines waiting to be resumed
+		size_t GetPendingCount()
+		{
+			std::lock_guard<std::mutex> lock(finished_jobs_mutex);
+			return next_frame_waiters.size() + sync_point_waiters.size() + finished_jobs.size() + running_job_count;
+		}
+
+		// Called by World::Update before the systems
+		void BeginFrame(double delta_time)
+		{
+			frame_delta_time = delta_time;
+			spent_time = 0;
+			resumed_count = 0;
+
+			{
+				std::lock_guard<std::mutex> lock(finished_jobs_mutex);
+				next_frame_waiters.insert(next_frame_waiters.end(), finished_jobs.begin(), finished_jobs.end());
+				finished_jobs.clear();
+			}
+			this->ResumeWaiters(next_frame_waiters);
+		}
+
+		// Called by World::Update after the systems
+		void EndFrame()
+		{
+			this->ResumeWaiters(sync_point_waiters);
+		}
+
+		// Run a coroutine to its first suspension, regardless of the budget, though counted in it.
+		void Start(Task::Handle handle)
+		{
+			this->Resume(handle);
+		}
+
+		void WaitNextFrame(Task::Handle handle)
+		{
+			next_frame_waiters.push_back(handle);
+		}
+
+		void WaitSyncPoint(Task::Handle handle)
+		{
+			sync_point_waiters.push_back(handle);
+		}
+
+		// Run func on the job system, and resume the coroutine at the start of the frame after it finished;
+		// an exception thrown by func is stored in exception.
+		void WaitJob(Task::Handle handle, std::function<void()> func, std::exception_ptr* exception_ptr)
+		{
+			{
+				std::lock_guard<std::mutex> lock(finished_jobs_mutex);
+				running_job_count++;
+			}
+			job_system_ptr->Submit([this, handle, func = std::move(func), exception_ptr]() -> void {
+				try {
+					func();
+				}
+				catch (...) {
+					*exception_ptr = std::current_exception();
+				}
+				std::lock_guard<std::mutex> lock(finished_jobs_mutex);
+				running_job_count--;
+				finished_jobs.push_back(handle);
+			});
+		}
+
+	private:
+		// Resume the coroutines waiting at the time of the call, while the budget allows.
+		void ResumeWaiters(std::deque<Task::Handle>& waiters)
+		{
+			size_t waiter_count = waiters.size();
+			for (size_t i = 0; i < waiter_count; i++) {
+				if (resumed_count != 0 && spent_time >= budget) {
+					break;
+				}
+				Task::Handle handle = waiters.front();
+				waiters.pop_front();
+				resumed_count++;
+				this->Resume(handle);
+			}
+		}
+
+		void Resume(Task::Handle handle)
+		{
+			auto start = std::chrono::steady_clock::now();
+			handle.resume();
+			spent_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			if (handle.done() && handle.promise().exception) {
+				std::rethrow_exception(std::exchange(handle.promise().exception, nullptr));
+			}
+		}
+
+		JobSystem* job_system_ptr;
+
+		double budget = 0.002;
+		double frame_delta_time = 0;
+		double spent_time = 0;
+		size_t resumed_count = 0;
+
+		std::deque<Task::Handle> next_frame_waiters;
+		std::deque<Task::Handle> sync_point_waiters;
+
+		// Filled by the job system's workers
+		std::mutex finished_jobs_mutex;
+		std::vector<Task::Handle> finished_jobs;
+		size_t running_job_count = 0;
+	};
+
+	// A system whose work is a coroutine, which can suspend across frames with co_await NextFrame(),
+	// SyncPoint() or RunJob(func), e.g. for a batch of pathfinding that doesn't fit in a frame.
+	// Update starts Run in the system's turn when no run is in progress, and skips the frame otherwise.
+	// An async system must not be destroyed while its run is in progress.
+	class AsyncSystem : public System
+	{
+	public:
+		friend class World;
+
+		virtual Task Run(double delta_time) = 0;
+
+		virtual void Update(double delta_time) override
+		{
+			if (task.IsRunning()) {
+				return;
+			}
+			task = this->Run(delta_time);
+			scheduler_ptr->Start(task.GetHandle());
+		}
+
+		// Whether a run is in progress
+		bool IsRunning() const
+		{
+			return task.IsRunning();
+		}
+
+	protected:
+		// Resume at the start of the next frame, before the systems; returns the delta time of that frame.
+		struct NextFrameAwaiter
+		{
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(Task::Handle handle) { scheduler_ptr->WaitNextFrame(handle); }
+			double await_resume() const { return scheduler_ptr->GetFrameDeltaTime(); }
+
+			CoroutineScheduler* scheduler_ptr;
+		};
+
+		// Resume at the end of World::Update, after all systems of the frame.
+		struct SyncPointAwaiter
+		{
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(Task::Handle handle) { scheduler_ptr->WaitSyncPoint(handle); }
+			void await_resume() const {}
+
+			CoroutineScheduler* scheduler_ptr;
+		};
+
+		// Resume at the start of the frame after the job finished, rethrowing its exception if any.
+		struct JobAwaiter
+		{
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(Task::Handle handle) { scheduler_ptr->WaitJob(handle, std::move(func), &exception); }
+
+			void await_resume()
+			{
+				if (exception) {
+					std::rethrow_exception(exception);
+				}
+			}
+
+			CoroutineScheduler* scheduler_ptr;
+			std::function<void()> func;
+			std::exception_ptr exception;
+		};
+
+		NextFrameAwaiter NextFrame()
+		{
+			return NextFrameAwaiter{ scheduler_ptr };
+		}
+
+		SyncPointAwaiter SyncPoint()
+		{
+			return SyncPointAwaiter{ scheduler_ptr };
+		}
+
+		// Run func on the world's job system; func must not touch the world, whose systems keep running.
+		JobAwaiter RunJob(std::function<void()> func)
+		{
+			return JobAwaiter{ scheduler_ptr, std::move(func), nullptr };
+		}
+
+	private:
+		Task task;
+		CoroutineScheduler* scheduler_ptr = nullptr;
+	};
+}
+#endif
@@ -0,0 +1,290 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define ECS_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#include "ColumnView.h"
+
+// AVX2 code is compiled per function and only called when the CPU supports it, so that the library needs no
+// architecture flags; MSVC compiles intrinsics of any level without them.
+#if defined(ECS_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define ECS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define ECS_TARGET_AVX2
+#endif
+
+
+namespace ECS
+{
+	// The instruction sets BulkOps can use; SSE2 is part of every x86-64 CPU.
+	enum class SimdLevel
+	{
+		Scalar,
+		SSE2,
+		AVX2
+	};
+
+	namespace Internal
+	{
+		inline SimdLevel DetectSimdLevel()
+		{
+#if defined(ECS_SIMD_X86) && defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] >= 7) {
+				__cpuidex(info, 7, 0);
+				bool avx2 = (info[1] & (1 << 5)) != 0;
+				__cpuid(info, 1);
+				bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+				if (avx2 && os_saves_ymm) {
+					return SimdLevel::AVX2;
+				}
+			}
+			return SimdLevel::SSE2;
+#elif defined(ECS_SIMD_X86)
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") ? SimdLevel::AVX2 : SimdLevel::SSE2;
+#else
+			return SimdLevel::Scalar;
+#endif
+		}
+
+		inline SimdLevel& ActiveSimdLevel()
+		{
+			static SimdLevel level = DetectSimdLevel();
+			return level;
+		}
+
+		/**
+		* Kernels, each processing the tail left by its vectors with the scalar one
+		*/
+		inline void FillScalar(float* data, size_t count, float value, size_t begin)
+		{
+			for (size_t i = begin; i < count; i++) {
+				data[i] = value;
+			}
+		}
+
+		inline void AxpyScalar(float* y, const float* x, size_t count, float a, size_t begin)
+		{
+			for (size_t i = begin; i < count; i++) {
+				y[i] = y[i] + a * x[i];
+			}
+		}
+
+		inline void ClampScalar(float* data, size_t count, float low, float high, size_t begin)
+		{
+			for (size_t i = begin; i < count; i++) {
+				data[i] = std::min(std::max(data[i], low), high);
+			}
+		}
+
+		template <bool IsMin>
+		float ReduceScalar(const float* data, size_t count, float result, size_t begin)
+		{
+			for (size_t i = begin; i < count; i++) {
+				result = IsMin ? std::min(result, data[i]) : std::max(result, data[i]);
+			}
+			return result;
+		}
+
+#ifdef ECS_SIMD_X86
+		inline void FillSSE2(float* data, size_t count, float value)
+		{
+			__m128 v = _mm_set1_ps(value);
+			size_t body = count - count % 4;
+			for (size_t i = 0; i < body; i += 4) {
+				_mm_storeu_ps(data + i, v);
+			}
+			FillScalar(data, count, value, body);
+		}
+
+		ECS_TARGET_AVX2 inline void FillAVX2(float* data, size_t count, float value)
+		{
+			__m256 v = _mm256_set1_ps(value);
+			size_t body = count - count % 8;
+			for (size_t i = 0; i < body; i += 8) {
+				_mm256_storeu_ps(data + i, v);
+			}
+			FillScalar(data, count, value, body);
+		}
+
+		inline void AxpySSE2(float* y, const float* x, size_t count, float a)
+		{
+			__m128 va = _mm_set1_ps(a);
+			size_t body = count - count % 4;
+			for (size_t i = 0; i < body; i += 4) {
+				_mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+			}
+			AxpyScalar(y, x, count, a, body);
+		}
+
+		ECS_TARGET_AVX2 inline void AxpyAVX2(float* y, const float* x, size_t count, float a)
+		{
+			__m256 va = _mm256_set1_ps(a);
+			size_t body = count - count % 8;
+			for (size_t i = 0; i < body; i += 8) {
+				_mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(va, _mm256_loadu_ps(x + i))));
+			}
+			AxpyScalar(y, x, count, a, body);
+		}
+
+		inline void ClampSSE2(float* data, size_t count, float low, float high)
+		{
+			__m128 vlow = _mm_set1_ps(low);
+			__m128 vhigh = _mm_set1_ps(high);
+			size_t body = count - count % 4;
+			for (size_t i = 0; i < body; i += 4) {
+				_mm_storeu_ps(data + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(data + i), vlow), vhigh));
+			}
+			ClampScalar(data, count, low, high, body);
+		}
+
+		ECS_TARGET_AVX2 inline void ClampAVX2(float* data, size_t count, float low, float high)
+		{
+			__m256 vlow = _mm256_set1_ps(low);
+			__m256 vhigh = _mm256_set1_ps(high);
+			size_t body = count - count % 8;
+			for (size_t i = 0; i < body; i += 8) {
+				_mm256_storeu_ps(data + i, _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(data + i), vlow), vhigh));
+			}
+			ClampScalar(data, count, low, high, body);
+		}
+
+		template <bool IsMin>
+		float ReduceSSE2(const float* data, size_t count, float result)
+		{
+			__m128 v = _mm_set1_ps(result);
+			size_t body = count - count % 4;
+			for (size_t i = 0; i < body; i += 4) {
+				v = IsMin ? _mm_min_ps(v, _mm_loadu_ps(data + i)) : _mm_max_ps(v, _mm_loadu_ps(data + i));
+			}
+			alignas(16) float lanes[4];
+			_mm_store_ps(lanes, v);
+			return ReduceScalar<IsMin>(data, count, ReduceScalar<IsMin>(lanes, 4, result, 0), body);
+		}
+
+		template <bool IsMin>
+		ECS_TARGET_AVX2 float ReduceAVX2(const float* data, size_t count, float result)
+		{
+			__m256 v = _mm256_set1_ps(result);
+			size_t body = count - count % 8;
+			for (size_t i = 0; i < body; i += 8) {
+				v = IsMin ? _mm256_min_ps(v, _mm256_loadu_ps(data + i)) : _mm256_max_ps(v, _mm256_loadu_ps(data + i));
+			}
+			alignas(32) float lanes[8];
+			_mm256_store_ps(lanes, v);
+			return ReduceScalar<IsMin>(data, count, ReduceScalar<IsMin>(lanes, 8, result, 0), body);
+		}
+#endif
+
+		template <bool IsMin>
+		float Reduce(ColumnView<const float> column)
+		{
+			float result = IsMin ? std::numeric_limits<float>::infinity() : -std::numeric_limits<float>::infinity();
+#ifdef ECS_SIMD_X86
+			switch (ActiveSimdLevel()) {
+			case SimdLevel::AVX2: return ReduceAVX2<IsMin>(column.data(), column.size(), result);
+			case SimdLevel::SSE2: return ReduceSSE2<IsMin>(column.data(), column.size(), result);
+			default: break;
+			}
+#endif
+			return ReduceScalar<IsMin>(column.data(), column.size(), result, 0);
+		}
+	}
+
+	// Vectorized operations over columns of floats, e.g. from ChunkView::GetColumn, using the widest instruction
+	// set the CPU supports. The results are the same at every level; NaNs are not handled.
+	namespace BulkOps
+	{
+		inline SimdLevel GetSupportedSimdLevel()
+		{
+			static SimdLevel level = Internal::DetectSimdLevel();
+			return level;
+		}
+
+		inline SimdLevel GetSimdLevel()
+		{
+			return Internal::ActiveSimdLevel();
+		}
+
+		// Use a lower level than supported, e.g. to compare them; must not be called while operations run.
+		inline void SetSimdLevel(SimdLevel level)
+		{
+			Internal::ActiveSimdLevel() = std::min(level, GetSupportedSimdLevel());
+		}
+
+		inline void Fill(ColumnView<float> column, float value)
+		{
+#ifdef ECS_SIMD_X86
+			switch (Internal::ActiveSimdLevel()) {
+			case SimdLevel::AVX2: Internal::FillAVX2(column.data(), column.size(), value); return;
+			case SimdLevel::SSE2: Internal::FillSSE2(column.data(), column.size(), value); return;
+			default: break;
+			}
+#endif
+			Internal::FillScalar(column.data(), column.size(), value, 0);
+		}
+
+		template <typename T>
+		void Fill(ColumnView<T> column, const T& value)
+		{
+			std::fill(column.begin(), column.end(), value);
+		}
+
+		// y += a * x, for columns of the same size
+		inline void Axpy(ColumnView<float> y, ColumnView<const float> x, float a)
+		{
+			assert(y.size() == x.size());
+#ifdef ECS_SIMD_X86
+			switch (Internal::ActiveSimdLevel()) {
+			case SimdLevel::AVX2: Internal::AxpyAVX2(y.data(), x.data(), y.size(), a); return;
+			case SimdLevel::SSE2: Internal::AxpySSE2(y.data(), x.data(), y.size(), a); return;
+			default: break;
+			}
+#endif
+			Internal::AxpyScalar(y.data(), x.data(), y.size(), a, 0);
+		}
+
+		// positions += velocities * delta_time, for components made of the same number of floats
+		template <typename P, typename V>
+		void Integrate(ColumnView<P> positions, ColumnView<V> velocities, float delta_time)
+		{
+			static_assert(sizeof(P) == sizeof(V), "positions and velocities must have the same number of floats");
+			Axpy(positions.template AsScalars<float>(), ColumnView<const V>(velocities).template AsScalars<float>(), delta_time);
+		}
+
+		inline void Clamp(ColumnView<float> column, float low, float high)
+		{
+#ifdef ECS_SIMD_X86
+			switch (Internal::ActiveSimdLevel()) {
+			case SimdLevel::AVX2: Internal::ClampAVX2(column.data(), column.size(), low, high); return;
+			case SimdLevel::SSE2: Internal::ClampSSE2(column.data(), column.size(), low, high); return;
+			default: break;
+			}
+#endif
+			Internal::ClampScalar(column.data(), column.size(), low, high, 0);
+		}
+
+		// The least value of a column, or infinity if empty
+		inline float Min(ColumnView<const float> column)
+		{
+			return Internal::Reduce<true>(column);
+		}
+
+		// The greatest value of a column, or -infinity if empty
+		inline float Max(ColumnView<const float> column)
+		{
+			return Internal::Reduce<false>(column);
+		}
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <memory>
+#include <unordered_set>
+
+#include "Entity.h"
+#include "ComponentStorageManager.h"
+
+
+namespace ECS
+{
+	// The state of a world at a checkpoint for rollback, see EntityManager::SaveCheckpoint. Checkpoints of a world
+	// share their copies of the chunks and of the entity bookkeeping while unchanged between them.
+	struct WorldCheckpoint
+	{
+		StorageCheckpoint storage;
+		std::shared_ptr<const std::unordered_set<Entity>> entities_ptr;
+		std::unordered_set<Entity> null_entities;
+		size_t entity_id_counter = 0;
+		bool taken = false;  // Restored by taking its copies, see EntityManager::RestoreCheckpoint
+	};
+}
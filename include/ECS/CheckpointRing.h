@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "EntityManager.h"
+#include "Checkpoint.h"
+
+
+namespace ECS
+{
+	// The checkpoints of the last frames of a world in a ring buffer, for rollback: save one after each simulated
+	// frame, and restore an earlier frame to simulate again from it. A checkpoint only copies the chunks changed
+	// since the one before, and the memory of the overwritten checkpoints is reused.
+	class CheckpointRing
+	{
+	public:
+
+		CheckpointRing(EntityManager* entity_mgr_ptr, size_t capacity)
+			: entity_mgr_ptr(entity_mgr_ptr), checkpoints(capacity > 0 ? capacity : 1), frames(checkpoints.size()) {}
+
+		// Avoid unintentional copy
+		CheckpointRing(const CheckpointRing&) = delete;
+		CheckpointRing operator=(const CheckpointRing&) = delete;
+
+		// Save the world as the given frame, overwriting the oldest frame when full. Returns false if the frame is
+		// not after the last one, or the world can't be checkpointed, see EntityManager::SaveCheckpoint.
+		bool Save(uint64_t frame)
+		{
+			if (count != 0 && frame <= frames[this->GetSlot(count - 1)]) {
+				return false;
+			}
+			const WorldCheckpoint* previous_ptr = count == 0 ? nullptr : &checkpoints[this->GetSlot(count - 1)];
+			size_t slot = this->GetSlot(count < checkpoints.size() ? count : 0);
+			if (!entity_mgr_ptr->SaveCheckpoint(checkpoints[slot], previous_ptr)) {
+				return false;
+			}
+			frames[slot] = frame;
+			if (count < checkpoints.size()) {
+				count++;
+			}
+			else {
+				first = (first + 1) % checkpoints.size();
+			}
+			return true;
+		}
+
+		// Put the world back to a saved frame, dropping the frames after it. Returns false if the frame isn't held.
+		// The frame is kept to be restored again, so its copies are copied back rather than taken.
+		bool Restore(uint64_t frame)
+		{
+			for (size_t i = 0; i < count; i++) {
+				size_t slot = this->GetSlot(i);
+				if (frames[slot] != frame) {
+					continue;
+				}
+				if (!entity_mgr_ptr->RestoreCheckpoint(checkpoints[slot])) {
+					return false;
+				}
+				count = i + 1;
+				return true;
+			}
+			return false;
+		}
+
+		bool Contains(uint64_t frame) const
+		{
+			for (size_t i = 0; i < count; i++) {
+				if (frames[this->GetSlot(i)] == frame) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		size_t GetCount() const { return count; }
+		size_t GetCapacity() const { return checkpoints.size(); }
+
+	private:
+		// The slot of the i-th oldest frame
+		size_t GetSlot(size_t i) const
+		{
+			return (first + i) % checkpoints.size();
+		}
+
+		EntityManager* entity_mgr_ptr;
+
+		std::vector<WorldCheckpoint> checkpoints;
+		std::vector<uint64_t> frames;
+		size_t first = 0;
+		size_t count = 0;
+	};
+}
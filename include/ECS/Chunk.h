@@ -1,4 +1,6 @@
 #pragma once
+#include <memory_resource>
+#include <new>
 #include <vector>
 
 
@@ -11,13 +13,27 @@ namespace ECS
 		Chunk(const Chunk&) = delete;
 		Chunk operator=(const Chunk&) = delete;
 
-		Chunk(size_t chunk_size) : chunk_size(chunk_size)
+		// Allocate the chunk's memory from a memory resource, e.g. the arena of the world the chunk belongs to.
+		Chunk(size_t chunk_size, std::pmr::memory_resource* resource_ptr = std::pmr::get_default_resource())
+			: chunk_size(chunk_size), owns_memory(true), read_only(false), resource_ptr(resource_ptr)
 		{
-			chunk_ptr = new char[chunk_size];
+			chunk_ptr = resource_ptr->allocate(chunk_size, alignment);
 		}
 
-		// Compute the entry address with index and necessary size information, which are stored and passed in 
-		// by the caller, instead of saving a copy in each chunk. Write or read of the returned address is 
+		// Wrap a memory block owned by someone else, e.g. a page range of a memory-mapped file.
+		Chunk(size_t chunk_size, void* external_ptr, bool read_only)
+			: chunk_size(chunk_size), chunk_ptr(external_ptr), owns_memory(false), read_only(read_only)
+		{}
+
+		~Chunk()
+		{
+			if (owns_memory) {
+				resource_ptr->deallocate(chunk_ptr, chunk_size, alignment);
+			}
+		}
+
+		// Compute the entry address with index and necessary size information, which are stored and passed in
+		// by the caller, instead of saving a copy in each chunk. Write or read of the returned address is
 		// then executed by the caller.
 		void* GetAddress(const size_t row_index, const size_t col_index,
 			const std::vector<size_t>& row_sizeofs, const size_t col_num)
@@ -34,7 +50,32 @@ namespace ECS
 			return static_cast<void*>(address);
 		}
 
+		// Same as above, but with the row's offset in the chunk precomputed by the caller.
+		void* GetAddress(const size_t row_offset, const size_t col_index, const size_t row_sizeof)
+		{
+			return static_cast<char*>(chunk_ptr) + row_offset + col_index * row_sizeof;
+		}
+
+		// Same as above, for a row interleaved with others: its entries are in blocks of lanes entries, the
+		// blocks being block_stride bytes apart.
+		void* GetAddress(const size_t row_offset, const size_t col_index, const size_t row_sizeof, const size_t lanes,
+			const size_t block_stride)
+		{
+			return static_cast<char*>(chunk_ptr) + row_offset + col_index / lanes * block_stride + col_index % lanes * row_sizeof;
+		}
+
+		// Chunks and the rows in them start on a cache line, which is also the width of the widest SIMD vectors
+		static constexpr size_t alignment = 64;
+
 		size_t chunk_size;
 		void* chunk_ptr;
+
+		bool owns_memory;
+		bool read_only;  // A read-only chunk must not be written, nor have entities added or removed
+
+		// The resource an owned chunk's memory is returned to, which must outlive the chunk
+		std::pmr::memory_resource* resource_ptr = nullptr;
+
+		size_t numa_node = 0;  // The NUMA node of the chunk's memory, set by the storage allocating it from a NumaChunkResource
 	};
 }
@@ -0,0 +1,86 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+
+#include "Chunk.h"
+
+
+namespace ECS
+{
+	// A typed view of a row of a chunk, i.e. the contiguous array of one component of the chunk's entities, for
+	// loops over whole columns such as the ones of BulkOps. Rows start on a Chunk::alignment boundary, so the view
+	// of a whole row is aligned; the body is the entries in full SIMD vectors of a given width, the tail the rest.
+	template <typename T>
+	class ColumnView
+	{
+	public:
+		ColumnView() : ptr(nullptr), count(0) {}
+		ColumnView(T* ptr, size_t count) : ptr(ptr), count(count) {}
+
+		// A view of mutable components is a view of const ones as well
+		template <typename U, typename = std::enable_if_t<std::is_same_v<const U, T> && !std::is_same_v<U, T>>>
+		ColumnView(const ColumnView<U>& other) : ptr(other.data()), count(other.size()) {}
+
+		T* data() const { return ptr; }
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+
+		T* begin() const { return ptr; }
+		T* end() const { return ptr + count; }
+		T& operator[](size_t index) const { return ptr[index]; }
+
+		bool IsAligned(size_t alignment = Chunk::alignment) const
+		{
+			return reinterpret_cast<uintptr_t>(ptr) % alignment == 0;
+		}
+
+		// The number of entries in full vectors of the given number of lanes, and of the ones after them
+		size_t GetBodySize(size_t lanes) const { return count - count % lanes; }
+		size_t GetTailSize(size_t lanes) const { return count % lanes; }
+
+		// View a column of components made only of scalars of type S (e.g. a position of three floats) as the
+		// column of all their scalars.
+		template <typename S>
+		ColumnView<std::conditional_t<std::is_const_v<T>, const S, S>> AsScalars() const
+		{
+			static_assert(std::is_trivially_copyable_v<std::remove_const_t<T>> && sizeof(T) % sizeof(S) == 0
+				&& alignof(T) % alignof(S) == 0, "T must be made of S only");
+			typedef std::conditional_t<std::is_const_v<T>, const S, S> ScalarType;
+			return ColumnView<ScalarType>(reinterpret_cast<ScalarType*>(ptr), count * (sizeof(T) / sizeof(S)));
+		}
+
+	private:
+		T* ptr;
+		size_t count;
+	};
+
+	// A typed view of a row of a chunk interleaved with other rows, whose entries are consecutive only within
+	// blocks of a number of lanes, e.g. to process the components of an interleave group a block at a time. The
+	// view of a contiguous row has a single block.
+	template <typename T>
+	class BlockedColumnView
+	{
+	public:
+		BlockedColumnView(T* ptr, size_t count, size_t lanes, size_t block_stride)
+			: ptr(ptr), count(count), lanes(std::max(lanes, size_t(1))), block_stride(block_stride) {}
+
+		size_t size() const { return count; }
+		size_t GetLanes() const { return lanes; }
+		size_t GetBlockCount() const { return (count + lanes - 1) / lanes; }
+
+		// The entries of a block; the last block holds the rest of the entries
+		ColumnView<T> GetBlock(size_t block_index) const
+		{
+			typedef std::conditional_t<std::is_const_v<T>, const char, char> ByteType;
+			T* block_ptr = reinterpret_cast<T*>(reinterpret_cast<ByteType*>(ptr) + block_index * block_stride);
+			return ColumnView<T>(block_ptr, std::min(lanes, count - block_index * lanes));
+		}
+
+	private:
+		T* ptr;
+		size_t count;
+		size_t lanes;
+		size_t block_stride;
+	};
+}
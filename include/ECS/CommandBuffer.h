@@ -0,0 +1,84 @@
+#pragma once
+#include <functional>
+#include <vector>
+
+#include "EntityManager.h"
+
+
+namespace ECS
+{
+	// Structural changes recorded by a job or a system, e.g. from the jobs of a ParallelFor, and applied to the
+	// entity manager later at a sync point by Playback, in the order recorded. The entities created are reserved at
+	// once, so that their handles can be used by the following commands and stored in components right away.
+	// A buffer is filled by one thread at a time; use one per job.
+	class EntityCommandBuffer
+	{
+	public:
+		EntityCommandBuffer(EntityManager* entity_mgr_ptr) : entity_mgr_ptr(entity_mgr_ptr) {}
+
+		EntityCommandBuffer(EntityCommandBuffer&&) = default;
+		EntityCommandBuffer& operator=(EntityCommandBuffer&&) = default;
+
+		// Avoid unintentional copy
+		EntityCommandBuffer(const EntityCommandBuffer&) = delete;
+		EntityCommandBuffer operator=(const EntityCommandBuffer&) = delete;
+
+		// Reserve an entity and record its creation with the specified combination of component types.
+		template <typename... Args>
+		Entity CreateEntity()
+		{
+			Entity new_entity = entity_mgr_ptr->ReserveEntity();
+			commands.push_back([new_entity](EntityManager& entity_mgr) -> void {
+				entity_mgr.CreateReservedEntity<Args...>(new_entity);
+			});
+			return new_entity;
+		}
+
+		// The arguments are copied into the buffer.
+		template <typename T, typename... Args>
+		void AddComponent(const Entity& entity, const Args&... args)
+		{
+			commands.push_back([entity, args...](EntityManager& entity_mgr) -> void {
+				entity_mgr.AddEntityComponent<T>(entity, args...);
+			});
+		}
+
+		template <typename T, typename... Args>
+		void SetComponent(const Entity& entity, const Args&... args)
+		{
+			commands.push_back([entity, args...](EntityManager& entity_mgr) -> void {
+				entity_mgr.SetEntityComponent<T>(entity, args...);
+			});
+		}
+
+		template <typename T>
+		void RemoveComponent(const Entity& entity)
+		{
+			commands.push_back([entity](EntityManager& entity_mgr) -> void {
+				entity_mgr.RemoveEntityComponent<T>(entity);
+			});
+		}
+
+		void DestroyEntity(const Entity& entity)
+		{
+			commands.push_back([entity](EntityManager& entity_mgr) -> void {
+				entity_mgr.DestroyEntity(entity);
+			});
+		}
+
+		// Apply the recorded commands and clear the buffer. Must not run with other uses of the entity manager.
+		void Playback()
+		{
+			for (const auto& command : commands) {
+				command(*entity_mgr_ptr);
+			}
+			commands.clear();
+		}
+
+		size_t GetCommandCount() const { return commands.size(); }
+
+	private:
+		EntityManager* entity_mgr_ptr;
+		std::vector<std::function<void(EntityManager&)>> commands;
+	};
+}
@@ -1,20 +1,43 @@
 #pragma once
 #include <cassert>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
 using std::cout;
 using std::endl;
 
 #include "ArchetypeStorage.h"
+#include "SparseSet.h"
+#include "SharedComponent.h"
+#include "Prefab.h"
+#include "ColumnView.h"
 
 
 namespace ECS
 {
+	// The chunk storage at a checkpoint, see EntityManager::SaveCheckpoint
+	struct StorageCheckpoint
+	{
+		uint64_t version = 0;
+		std::unordered_map<ArchetypeID, ArchetypeCheckpoint> archetypes;
+		std::shared_ptr<const std::pmr::unordered_map<Entity, ArchetypeID>> archetype_id_by_entity_ptr;
+	};
+
 	// Manage the entity's archetype and data storage
 	class ComponentStorageManager
 	{
 	public:
 
-		ComponentStorageManager() {}
+		// The chunks and the entity bookkeeping are allocated from the given memory resource, see ArchetypeStorage.
+		ComponentStorageManager(std::pmr::memory_resource* resource_ptr = std::pmr::get_default_resource(), const NumaChunkResource* numa_resource_ptr = nullptr)
+			: archetype_id_by_entity(resource_ptr), resource_ptr(resource_ptr), numa_resource_ptr(numa_resource_ptr) {}
+
+		~ComponentStorageManager()
+		{
+			for (const auto& pair : archetype_storage_ptr_by_id) {
+				delete pair.second;
+			}
+		}
 
 		// Avoid unintentional copy
 		ComponentStorageManager(const ComponentStorageManager&) = delete;
@@ -29,10 +52,12 @@ namespace ECS
 		void AddArchetype(const ArchetypeID& a_id)
 		{
 			assert(archetype_storage_ptr_by_id.count(a_id) == 0);
-			archetype_storage_ptr_by_id.insert({ a_id, new ArchetypeStorage(c_mgr_ptr, a_mgr_ptr, a_id) });
+			archetype_storage_ptr_by_id.insert({ a_id, new ArchetypeStorage(c_mgr_ptr, a_mgr_ptr, a_id, &shared_stores, resource_ptr, numa_resource_ptr) });
+			archetype_storage_ptr_by_id.at(a_id)->SetChangeVersionSource(&change_version);
 		}
 
-		// Add entity with given archetype, and default construct all components
+		// Add entity with given archetype, and default construct all components stored in chunks.
+		// Shared components get default constructed values.
 		template <typename... Args>
 		void AddEntity(const Entity& new_entity, const ArchetypeID& a_id)
 		{
@@ -42,15 +67,65 @@ namespace ECS
 			archetype_id_by_entity.insert({ new_entity, a_id });
 
 			ArchetypeStorage* a_store_ptr = archetype_storage_ptr_by_id.at(a_id);
-			a_store_ptr->AddEntity(new_entity);
+			SharedKey shared_key(a_store_ptr->GetSharedTypes().size());
+			(this->SetDefaultSharedValue<Args>(a_store_ptr, shared_key), ...);
+
+			a_store_ptr->AddEntity(new_entity, shared_key);
 			(this->DefaultConstructEntityComponent<Args>(new_entity), ...);
 		}
 
 		template <typename T>
 		void DefaultConstructEntityComponent(const Entity& entity)
 		{
-			T* address = this->GetEntityComponent<T>(entity);
-			new (address) T();
+			if constexpr (!IsSparseComponent<T> && !IsSharedComponent<T>) {
+				T* address = this->GetEntityComponent<T>(entity);
+				new (address) T();
+			}
+			if constexpr (IsDoubleBufferedComponent<T>) {
+				this->SetPreviousEntityComponent<T>(entity);
+			}
+		}
+
+		// The previous frame's value of a double-buffered component T, which is safe to read while other
+		// systems write the next frame's values.
+		template <typename T>
+		const T* GetPreviousEntityComponent(const Entity& entity) const
+		{
+			static_assert(IsDoubleBufferedComponent<T>, "T is not a double-buffered component");
+			ComponentTypeID c_id = c_mgr_ptr->GetComponentTypeID<T>();
+			return static_cast<const T*>(this->GetEntityArchetypeStorage(entity)->GetPreviousComponentDataAddress(entity, c_id));
+		}
+
+		// Construct the previous frame's value of a double-buffered component T, e.g. when the component is added.
+		template <typename T, typename... Args>
+		T* SetPreviousEntityComponent(const Entity& entity, const Args&... args)
+		{
+			static_assert(IsDoubleBufferedComponent<T>, "T is not a double-buffered component");
+			ComponentTypeID c_id = c_mgr_ptr->GetComponentTypeID<T>();
+			ArchetypeStorage* a_store_ptr = this->GetEntityArchetypeStorage(entity);
+			a_store_ptr->MarkRowChanged(entity, c_id);
+			return new (a_store_ptr->GetPreviousComponentDataAddress(entity, c_id)) T(args...);
+		}
+
+		// Swap the previous and next buffers of the double-buffered components, at a frame boundary, except those
+		// of the skipped types.
+		void FlipBuffers(const ComponentTypeIDSet& skipped_c_ids = ComponentTypeIDSet())
+		{
+			for (const auto& pair : archetype_storage_ptr_by_id) {
+				if (pair.second->HasDoubleBufferedRows()) {
+					pair.second->FlipBuffers(skipped_c_ids);
+				}
+			}
+		}
+
+		// Swap the buffers of the given double-buffered types in a slice of the chunks, see ArchetypeStorage.
+		void FlipBuffers(const ComponentTypeIDSet& c_id_set, size_t slice_index, size_t slice_count)
+		{
+			for (const auto& pair : archetype_storage_ptr_by_id) {
+				if (pair.second->HasDoubleBufferedRows()) {
+					pair.second->FlipBuffers(c_id_set, slice_index, slice_count);
+				}
+			}
 		}
 
 		template <typename T, typename... Args>
@@ -60,11 +135,29 @@ namespace ECS
 			return new (address) T(args...);
 		}
 
+		// The component T of an entity stored in a chunk, for reading only: unlike GetEntityComponent, the row
+		// isn't marked as changed.
+		template <typename T>
+		const T* ReadEntityComponent(const Entity& entity) const
+		{
+			static_assert(!IsSparseComponent<T> && !IsSharedComponent<T>, "only chunk components are stored in rows");
+			return static_cast<const T*>(this->GetEntityArchetypeStorage(entity)->ReadComponentDataAddress(entity, c_mgr_ptr->GetComponentTypeID<T>()));
+		}
+
+		// For a shared component, the value shared by the entity's chunk is returned; writing it changes
+		// the value of all entities sharing it, use SetEntityComponent to change the entity's value only.
 		template <typename T>
 		T* GetEntityComponent(const Entity& entity) const
 		{
+			if constexpr (IsSparseComponent<T>) {
+				SparseSet<T>* sparse_set_ptr = this->GetSparseSet<T>(c_mgr_ptr->GetComponentTypeID<T>());
+				return sparse_set_ptr == nullptr ? nullptr : sparse_set_ptr->Get(entity);
+			}
 			ArchetypeStorage* a_store_ptr = GetEntityArchetypeStorage(entity);
 			ComponentTypeID c_id = c_mgr_ptr->GetComponentTypeID<T>();
+			if constexpr (IsSharedComponent<T>) {
+				return this->GetSharedValueStore<T>(c_id)->Get(a_store_ptr->GetEntitySharedValueIndex(entity, c_id));
+			}
 			void* address = a_store_ptr->GetComponentDataAddress(entity, c_id);
 			return static_cast<T*>(address);
 		}
@@ -72,26 +165,46 @@ namespace ECS
 		template <typename T, typename... Args>
 		T* SetEntityComponent(const Entity& entity, const Args&... args)
 		{
+			if constexpr (IsSparseComponent<T>) {
+				return this->GetOrCreateSparseSet<T>(c_mgr_ptr->GetComponentTypeID<T>()).Emplace(entity, args...);
+			}
+			if constexpr (IsSharedComponent<T>) {
+				// Move the entity to a chunk sharing the new value
+				ComponentTypeID c_id = c_mgr_ptr->GetComponentTypeID<T>();
+				ArchetypeStorage* a_store_ptr = GetEntityArchetypeStorage(entity);
+				SharedKey shared_key = a_store_ptr->GetEntitySharedKey(entity);
+				shared_key[a_store_ptr->GetSharedTypeIndex(c_id)] = this->GetOrCreateSharedValueStore<T>(c_id).FindOrAdd(T(args...));
+
+				a_store_ptr->MigrateEntity(entity, a_store_ptr, shared_key);
+				return this->GetEntityComponent<T>(entity);
+			}
 			T* address = this->GetEntityComponent<T>(entity);
 			return new (address) T(args...);
 		}
 
+		// Move an entity to another archetype, keeping the values of the shared components in both archetypes.
 		void MigrateEntity(const Entity& entity, const ArchetypeID& new_a_id)
 		{
-			ArchetypeStorage* src_a_store_ptr = GetEntityArchetypeStorage(entity);
-
-			if (archetype_storage_ptr_by_id.count(new_a_id) == 0) {
-				this->AddArchetype(new_a_id);
-			}
-			ArchetypeStorage* dest_a_store_ptr = archetype_storage_ptr_by_id.at(new_a_id);
+			ArchetypeStorage* dest_a_store_ptr = this->GetOrAddArchetypeStorage(new_a_id);
+			SharedKey shared_key = this->GetMigratedSharedKey(entity, dest_a_store_ptr);
+			assert(std::count(shared_key.begin(), shared_key.end(), INVALID_SHARED_VALUE_INDEX) == 0);
 
-			src_a_store_ptr->MigrateEntity(entity, dest_a_store_ptr);
-			archetype_id_by_entity.at(entity) = new_a_id;
+			this->PlaceEntity(entity, new_a_id, shared_key);
 		}
 
+		// Add the component T to an entity that may have no chunk component yet, moving it to the given archetype.
 		template <typename T, typename... Args>
 		T* AddEntityComponent(const Entity& entity, const ArchetypeID& new_a_id, const Args&... args)
 		{
+			if constexpr (IsSharedComponent<T>) {
+				ComponentTypeID c_id = c_mgr_ptr->GetComponentTypeID<T>();
+				ArchetypeStorage* dest_a_store_ptr = this->GetOrAddArchetypeStorage(new_a_id);
+				SharedKey shared_key = this->GetMigratedSharedKey(entity, dest_a_store_ptr);
+				shared_key[dest_a_store_ptr->GetSharedTypeIndex(c_id)] = this->GetOrCreateSharedValueStore<T>(c_id).FindOrAdd(T(args...));
+
+				this->PlaceEntity(entity, new_a_id, shared_key);
+				return this->GetEntityComponent<T>(entity);
+			}
 			this->MigrateEntity(entity, new_a_id);
 
 			ArchetypeStorage* new_a_store_ptr = archetype_storage_ptr_by_id.at(new_a_id);
@@ -99,9 +212,46 @@ namespace ECS
 
 			void* address = new_a_store_ptr->GetComponentDataAddress(entity, c_id);
 			new (address) T(args...);
+			if constexpr (IsDoubleBufferedComponent<T>) {
+				this->SetPreviousEntityComponent<T>(entity, args...);
+			}
 			return static_cast<T*>(address);
 		}
 
+		// Add entities to the archetype, with copies of the given values of its rows and shared components.
+		void AddEntities(const Entity* new_entities, size_t count, const ArchetypeID& a_id, const SharedKey& shared_key,
+			const std::vector<const void*>& row_values)
+		{
+			archetype_id_by_entity.reserve(archetype_id_by_entity.size() + count);
+			for (size_t i = 0; i < count; i++) {
+				archetype_id_by_entity.insert({ new_entities[i], a_id });
+			}
+			this->GetOrAddArchetypeStorage(a_id)->AddEntities(new_entities, count, shared_key, row_values);
+		}
+
+		// Add an entity with a copy of the source entity's chunk and shared components.
+		void CloneEntity(const Entity& src_entity, const Entity& new_entity)
+		{
+			ArchetypeID a_id = archetype_id_by_entity.at(src_entity);
+			ArchetypeStorage* a_store_ptr = archetype_storage_ptr_by_id.at(a_id);
+
+			archetype_id_by_entity.insert({ new_entity, a_id });
+			SharedKey shared_key = a_store_ptr->GetEntitySharedKey(src_entity);
+			a_store_ptr->AddEntities(&new_entity, 1, shared_key, a_store_ptr->GetEntityRowAddresses(src_entity));
+		}
+
+		std::unique_ptr<Prefab> CreatePrefab(const Entity& entity)
+		{
+			ArchetypeID a_id = archetype_id_by_entity.at(entity);
+			return std::unique_ptr<Prefab>(new Prefab(c_mgr_ptr, &shared_stores, a_id, archetype_storage_ptr_by_id.at(a_id), entity));
+		}
+
+		// The address of an entity's component data by type ID, for types only known at runtime such as relation pairs.
+		void* GetEntityComponentData(const Entity& entity, const ComponentTypeID& c_id) const
+		{
+			return this->GetEntityArchetypeStorage(entity)->GetComponentDataAddress(entity, c_id);
+		}
+
 		ArchetypeID GetEntityArchetypeID(const Entity& entity) const
 		{
 			return archetype_id_by_entity.at(entity);
@@ -116,6 +266,23 @@ namespace ECS
 			a_store_ptr->RemoveEntityData(entity);
 		}
 
+		// Whether an entity's chunk components are stored in a read-only chunk; false for an entity without any.
+		bool IsEntityReadOnly(const Entity& entity) const
+		{
+			auto iter = archetype_id_by_entity.find(entity);
+			return iter != archetype_id_by_entity.end() && archetype_storage_ptr_by_id.at(iter->second)->IsEntityReadOnly(entity);
+		}
+
+		bool HasReadOnlyChunks() const
+		{
+			for (const auto& pair : archetype_storage_ptr_by_id) {
+				if (pair.second->HasReadOnlyChunks()) {
+					return true;
+				}
+			}
+			return false;
+		}
+
 		bool HasComponentType(const Entity& entity, const ComponentTypeID& c_id) const
 		{
 			if (archetype_id_by_entity.count(entity) == 0) {
@@ -126,9 +293,243 @@ namespace ECS
 			return a_mgr_ptr->GetArchtype(a_id).hasComponentType(c_id);
 		}
 
-		std::vector<Entity> GetEntities(ArchetypeID a_id)
+		std::vector<Entity> GetEntities(ArchetypeID a_id, size_t slice_index = 0, size_t slice_count = 1)
+		{
+			return archetype_storage_ptr_by_id.at(a_id)->GetEntities(slice_index, slice_count);
+		}
+
+		// The sparse set of component type T, or nullptr if no entity ever had T.
+		template <typename T>
+		SparseSet<T>* GetSparseSet(const ComponentTypeID& c_id) const
+		{
+			if (c_id >= sparse_sets.size()) {
+				return nullptr;
+			}
+			return static_cast<SparseSet<T>*>(sparse_sets[c_id].get());
+		}
+
+		template <typename T>
+		SparseSet<T>& GetOrCreateSparseSet(const ComponentTypeID& c_id)
+		{
+			if (c_id >= sparse_sets.size()) {
+				sparse_sets.resize(c_id + 1);
+			}
+			if (!sparse_sets[c_id]) {
+				sparse_sets[c_id].reset(new SparseSet<T>());
+			}
+			return *static_cast<SparseSet<T>*>(sparse_sets[c_id].get());
+		}
+
+		void RemoveSparseComponents(const Entity& entity)
+		{
+			for (const auto& sparse_set_ptr : sparse_sets) {
+				if (sparse_set_ptr) {
+					sparse_set_ptr->Remove(entity);
+				}
+			}
+		}
+
+		void CopySparseComponents(const Entity& src_entity, const Entity& dest_entity)
+		{
+			for (const auto& sparse_set_ptr : sparse_sets) {
+				if (sparse_set_ptr) {
+					sparse_set_ptr->Copy(src_entity, dest_entity);
+				}
+			}
+		}
+
+		bool HasSparseComponents(const Entity& entity) const
+		{
+			for (const auto& sparse_set_ptr : sparse_sets) {
+				if (sparse_set_ptr && sparse_set_ptr->Has(entity)) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool HasSparseComponents() const
+		{
+			for (const auto& sparse_set_ptr : sparse_sets) {
+				if (sparse_set_ptr && sparse_set_ptr->Size() != 0) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// The distinct values of shared component type T, or nullptr if no entity ever had T.
+		template <typename T>
+		SharedValueStore<T>* GetSharedValueStore(const ComponentTypeID& c_id) const
+		{
+			if (c_id >= shared_stores.size()) {
+				return nullptr;
+			}
+			return static_cast<SharedValueStore<T>*>(shared_stores[c_id].get());
+		}
+
+		template <typename T>
+		SharedValueStore<T>& GetOrCreateSharedValueStore(const ComponentTypeID& c_id)
+		{
+			if (c_id >= shared_stores.size()) {
+				shared_stores.resize(c_id + 1);
+			}
+			if (!shared_stores[c_id]) {
+				shared_stores[c_id].reset(new SharedValueStore<T>());
+			}
+			return *static_cast<SharedValueStore<T>*>(shared_stores[c_id].get());
+		}
+
+		bool HasSharedComponents() const
+		{
+			for (const auto& pair : archetype_storage_ptr_by_id) {
+				if (!pair.second->GetSharedTypes().empty() && pair.second->GetEntityCount() != 0) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		const std::unordered_map<ArchetypeID, ArchetypeStorage*>& GetArchetypeStorages() const
+		{
+			return archetype_storage_ptr_by_id;
+		}
+
+		std::pmr::memory_resource* GetMemoryResource() const
 		{
-			return archetype_storage_ptr_by_id.at(a_id)->GetEntities();
+			return resource_ptr;
+		}
+
+		// Take over a storage whose chunks were filled elsewhere (e.g. by loading persisted storage), and
+		// register the archetype of every entity in it.
+		void AttachArchetypeStorage(const ArchetypeID& a_id, ArchetypeStorage* a_store_ptr)
+		{
+			assert(archetype_storage_ptr_by_id.count(a_id) == 0);
+			archetype_storage_ptr_by_id.insert({ a_id, a_store_ptr });
+			a_store_ptr->SetChangeVersionSource(&change_version);
+
+			archetype_id_by_entity.reserve(archetype_id_by_entity.size() + a_store_ptr->GetEntityCount());
+			for (size_t i = 0; i < a_store_ptr->GetChunkCount(); i++) {
+				const Entity* entities = a_store_ptr->GetChunkEntities(i);
+				for (size_t j = 0; j < a_store_ptr->GetChunkEntityCount(i); j++) {
+					archetype_id_by_entity.insert({ entities[j], a_id });
+				}
+			}
+		}
+
+		// Take a chunk of the archetype out of the storage with its entities, see ArchetypeStorage::DetachChunk.
+		Chunk* DetachChunk(const ArchetypeID& a_id, size_t chunk_index, std::vector<Entity>& chunk_entities)
+		{
+			Chunk* chunk_ptr = archetype_storage_ptr_by_id.at(a_id)->DetachChunk(chunk_index, chunk_entities);
+			for (const auto& entity : chunk_entities) {
+				archetype_id_by_entity.erase(entity);
+			}
+			return chunk_ptr;
+		}
+
+		// Append a chunk holding the data of the given entities to the archetype's storage, which takes it over.
+		void AttachChunk(const ArchetypeID& a_id, Chunk* chunk_ptr, const Entity* entities, size_t entity_count,
+			const SharedKey& shared_key)
+		{
+			this->GetOrAddArchetypeStorage(a_id)->AttachChunk(chunk_ptr, entities, entity_count, shared_key);
+			archetype_id_by_entity.reserve(archetype_id_by_entity.size() + entity_count);
+			for (size_t i = 0; i < entity_count; i++) {
+				archetype_id_by_entity.insert({ entities[i], a_id });
+			}
+		}
+
+		ArchetypeStorage* GetOrAddArchetypeStorage(const ArchetypeID& a_id)
+		{
+			if (archetype_storage_ptr_by_id.count(a_id) == 0) {
+				this->AddArchetype(a_id);
+			}
+			return archetype_storage_ptr_by_id.at(a_id);
+		}
+
+		// The version chunk changes are marked with. A reader takes it with NextChangeVersion before looking at
+		// the chunks, and later finds the chunks changed since by their versions being greater.
+		uint64_t GetChangeVersion() const
+		{
+			return change_version;
+		}
+
+		uint64_t NextChangeVersion()
+		{
+			return change_version++;
+		}
+
+		// Whether entities were added to or removed from any archetype storage since a version
+		bool HasStructureChangedSince(uint64_t version) const
+		{
+			for (const auto& pair : archetype_storage_ptr_by_id) {
+				if (pair.second->GetStructureVersion() > version) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Capture all archetype storages into a checkpoint, sharing what is unchanged since a previous checkpoint.
+		void CaptureCheckpoint(StorageCheckpoint& checkpoint, const StorageCheckpoint* previous_ptr)
+		{
+			uint64_t version = this->NextChangeVersion();
+			for (const auto& [a_id, a_store_ptr] : archetype_storage_ptr_by_id) {
+				if (!a_store_ptr->GetSharedTypes().empty()) {
+					continue;  // empty, since checkpoints are refused otherwise
+				}
+				const ArchetypeCheckpoint* previous_a_ptr = nullptr;
+				if (previous_ptr != nullptr) {
+					auto iter = previous_ptr->archetypes.find(a_id);
+					previous_a_ptr = iter == previous_ptr->archetypes.end() ? nullptr : &iter->second;
+				}
+				a_store_ptr->CaptureCheckpoint(checkpoint.archetypes[a_id], previous_a_ptr, version);
+			}
+
+			if (previous_ptr != nullptr && previous_ptr->archetype_id_by_entity_ptr && !this->HasStructureChangedSince(previous_ptr->version)) {
+				checkpoint.archetype_id_by_entity_ptr = previous_ptr->archetype_id_by_entity_ptr;
+			}
+			else {
+				checkpoint.archetype_id_by_entity_ptr.reset(new std::pmr::unordered_map<Entity, ArchetypeID>(archetype_id_by_entity));
+			}
+			checkpoint.version = version;
+		}
+
+		// Put all archetype storages back to their state at a checkpoint; the storages created since are emptied.
+		// Returns whether entities were added or removed since.
+		bool RestoreCheckpoint(const StorageCheckpoint& checkpoint)
+		{
+			return this->RestoreCheckpoint(checkpoint, nullptr);
+		}
+
+		// Same as above, swapping the copies held by the checkpoint alone into the chunks, see ArchetypeStorage.
+		bool RestoreCheckpoint(StorageCheckpoint&& checkpoint)
+		{
+			return this->RestoreCheckpoint(checkpoint, &checkpoint);
+		}
+
+		// Fill the stats of all archetype storages; the vector in stats is reused to avoid allocations when sampled often.
+		void GetStorageStats(StorageStats& stats) const
+		{
+			stats.archetypes.resize(archetype_storage_ptr_by_id.size());
+			stats.entity_count = stats.chunk_count = stats.bytes_used = stats.bytes_reserved = 0;
+			stats.wasted_tail_bytes = stats.index_bytes = 0;
+
+			size_t i = 0;
+			for (const auto& pair : archetype_storage_ptr_by_id) {
+				ArchetypeStorageStats& a_stats = stats.archetypes[i++];
+				a_stats.archetype_id = pair.first;
+				pair.second->GetStats(a_stats);
+
+				stats.entity_count += a_stats.entity_count;
+				stats.chunk_count += a_stats.chunk_count;
+				stats.bytes_used += a_stats.bytes_used;
+				stats.bytes_reserved += a_stats.bytes_reserved;
+				stats.wasted_tail_bytes += a_stats.wasted_tail_bytes_per_chunk * a_stats.chunk_count;
+				stats.index_bytes += a_stats.index_bytes;
+			}
+
+			stats.entity_bookkeeping_bytes = Internal::HashContainerBytes(archetype_storage_ptr_by_id)
+				+ Internal::HashContainerBytes(archetype_id_by_entity);
 		}
 
 		void PrintComponentStorageInfo() const
@@ -139,10 +540,8 @@ namespace ECS
 			for (const auto& pair : archetype_storage_ptr_by_id) {
 				cout << "\n=== Archetype ID: " << pair.first << "===" << endl;
 				cout << "Entities: ";
-				for (const auto& p : archetype_id_by_entity) {
-					if (p.second == pair.first) {
-						cout << p.first.id << ", ";
-					}
+				for (const auto& entity : pair.second->GetEntities()) {
+					cout << entity.id << ", ";
 				}
 				cout << endl;
 
@@ -158,12 +557,183 @@ namespace ECS
 			return archetype_storage_ptr_by_id.at(a_id);
 		}
 
+		// Restore a checkpoint, swapping in the copies of the one taken, if any, see RestoreCheckpoint
+		bool RestoreCheckpoint(const StorageCheckpoint& checkpoint, StorageCheckpoint* taken_ptr)
+		{
+			bool structure_changed = this->HasStructureChangedSince(checkpoint.version);
+			ArchetypeCheckpoint empty_checkpoint;
+			for (const auto& [a_id, a_store_ptr] : archetype_storage_ptr_by_id) {
+				if (!a_store_ptr->GetSharedTypes().empty()) {
+					continue;  // empty both at the checkpoint and now
+				}
+				auto iter = checkpoint.archetypes.find(a_id);
+				if (iter == checkpoint.archetypes.end()) {
+					a_store_ptr->RestoreCheckpoint(empty_checkpoint);
+				}
+				else if (taken_ptr != nullptr) {
+					a_store_ptr->RestoreCheckpoint(std::move(taken_ptr->archetypes.at(a_id)));
+				}
+				else {
+					a_store_ptr->RestoreCheckpoint(iter->second);
+				}
+			}
+
+			if (structure_changed) {
+				archetype_id_by_entity = *checkpoint.archetype_id_by_entity_ptr;
+			}
+			return structure_changed;
+		}
+
+		template <typename T>
+		void SetDefaultSharedValue(const ArchetypeStorage* a_store_ptr, SharedKey& shared_key)
+		{
+			if constexpr (IsSharedComponent<T>) {
+				ComponentTypeID c_id = c_mgr_ptr->GetComponentTypeID<T>();
+				shared_key[a_store_ptr->GetSharedTypeIndex(c_id)] = this->GetOrCreateSharedValueStore<T>(c_id).FindOrAdd(T());
+			}
+		}
+
+		// The shared values an entity keeps when moved to the destination, and INVALID_SHARED_VALUE_INDEX for
+		// the shared types it doesn't have yet.
+		SharedKey GetMigratedSharedKey(const Entity& entity, const ArchetypeStorage* dest_a_store_ptr) const
+		{
+			const std::vector<ComponentTypeID>& dest_shared_types = dest_a_store_ptr->GetSharedTypes();
+			SharedKey shared_key(dest_shared_types.size(), INVALID_SHARED_VALUE_INDEX);
+
+			auto iter = archetype_id_by_entity.find(entity);
+			if (iter != archetype_id_by_entity.end()) {
+				const ArchetypeStorage* src_a_store_ptr = archetype_storage_ptr_by_id.at(iter->second);
+				for (size_t i = 0; i < dest_shared_types.size(); i++) {
+					if (src_a_store_ptr->HasSharedType(dest_shared_types[i])) {
+						shared_key[i] = src_a_store_ptr->GetEntitySharedValueIndex(entity, dest_shared_types[i]);
+					}
+				}
+			}
+			return shared_key;
+		}
+
+		// Put an entity into a chunk of the archetype having the given shared values, moving its data if it is stored.
+		void PlaceEntity(const Entity& entity, const ArchetypeID& new_a_id, const SharedKey& shared_key)
+		{
+			ArchetypeStorage* dest_a_store_ptr = this->GetOrAddArchetypeStorage(new_a_id);
+
+			auto iter = archetype_id_by_entity.find(entity);
+			if (iter == archetype_id_by_entity.end()) {
+				archetype_id_by_entity.insert({ entity, new_a_id });
+				dest_a_store_ptr->AddEntity(entity, shared_key);
+			}
+			else {
+				archetype_storage_ptr_by_id.at(iter->second)->MigrateEntity(entity, dest_a_store_ptr, shared_key);
+				iter->second = new_a_id;
+			}
+		}
+
 		const ArchetypeManager* a_mgr_ptr = nullptr;
 		const ComponentTypeManager* c_mgr_ptr = nullptr;
 
 		std::unordered_map<ArchetypeID, ArchetypeStorage*> archetype_storage_ptr_by_id;
 
 		// Store each entity's archetype
-		std::unordered_map<Entity, ArchetypeID> archetype_id_by_entity;
+		std::pmr::unordered_map<Entity, ArchetypeID> archetype_id_by_entity;
+
+		// Sparse sets of the component types with StoragePolicy::SparseSet, indexed by component type ID
+		std::vector<std::unique_ptr<SparseSetBase>> sparse_sets;
+
+		// Values of the component types with StoragePolicy::Shared, indexed by component type ID
+		SharedValueStores shared_stores;
+
+		uint64_t change_version = 1;
+
+		// The memory resource of the chunks and the entity bookkeeping, and the same one if it places the chunks on NUMA nodes
+		std::pmr::memory_resource* resource_ptr;
+		const NumaChunkResource* numa_resource_ptr;
+	};
+
+	// A chunk of entities handed to ForEachChunk: the rows of chunk components as arrays, and the values
+	// of shared components, which are the same for the whole chunk.
+	class ChunkView
+	{
+	public:
+
+		ChunkView(const ComponentTypeManager* c_mgr_ptr, const ComponentStorageManager* storage_mgr_ptr,
+			ArchetypeStorage* a_store_ptr, size_t chunk_index)
+			: c_mgr_ptr(c_mgr_ptr), storage_mgr_ptr(storage_mgr_ptr), a_store_ptr(a_store_ptr), chunk_index(chunk_index)
+		{}
+
+		size_t GetEntityCount() const
+		{
+			return a_store_ptr->GetChunkEntityCount(chunk_index);
+		}
+
+		const Entity* GetEntities() const
+		{
+			return a_store_ptr->GetChunkEntities(chunk_index);
+		}
+
+		// The array of component T of all entities in the chunk; for a double-buffered T, GetComponents<const T>
+		// gives the previous frame's values, and GetComponents<T> the next frame's. T must not be interleaved with
+		// other components, see GetBlocks.
+		template <typename T>
+		T* GetComponents() const
+		{
+			assert(a_store_ptr->GetRowLanes(c_mgr_ptr->GetComponentTypeID<std::remove_const_t<T>>()) == 0);
+			return this->GetRowEntries<T>();
+		}
+
+		// The components of GetComponents as a column, e.g. for BulkOps
+		template <typename T>
+		ColumnView<T> GetColumn() const
+		{
+			return ColumnView<T>(this->GetComponents<T>(), this->GetEntityCount());
+		}
+
+		// The components as blocks of consecutive entries, for a T interleaved with other components or not; the
+		// rows of an interleave group have the same blocks, e.g. for (size_t i = 0; i < positions.GetBlockCount(); i++)
+		// BulkOps::Integrate(positions.GetBlock(i), velocities.GetBlock(i), delta_time).
+		template <typename T>
+		BlockedColumnView<T> GetBlocks() const
+		{
+			ComponentTypeID c_id = c_mgr_ptr->GetComponentTypeID<std::remove_const_t<T>>();
+			size_t lanes = a_store_ptr->GetRowLanes(c_id);
+			if (lanes == 0) {
+				return BlockedColumnView<T>(this->GetRowEntries<T>(), this->GetEntityCount(), this->GetEntityCount(), 0);
+			}
+			return BlockedColumnView<T>(this->GetRowEntries<T>(), this->GetEntityCount(), lanes, a_store_ptr->GetRowBlockStride(c_id));
+		}
+
+		ArchetypeStorage* GetArchetypeStorage() const { return a_store_ptr; }
+		size_t GetChunkIndex() const { return chunk_index; }
+
+		// The value of shared component T of the chunk
+		template <typename T>
+		const T* GetShared() const
+		{
+			static_assert(IsSharedComponent<T>, "T is not a shared component");
+			ComponentTypeID c_id = c_mgr_ptr->GetComponentTypeID<T>();
+			size_t value_index = a_store_ptr->GetChunkSharedKey(chunk_index)[a_store_ptr->GetSharedTypeIndex(c_id)];
+			return storage_mgr_ptr->GetSharedValueStore<T>(c_id)->Get(value_index);
+		}
+
+	private:
+		// The first entry of T's row, or of the previous buffer for a const double-buffered T; only the rows of
+		// non-const T are marked as changed.
+		template <typename T>
+		T* GetRowEntries() const
+		{
+			static_assert(!IsSparseComponent<T> && !IsSharedComponent<T>, "only chunk components are stored in rows");
+			ComponentTypeID c_id = c_mgr_ptr->GetComponentTypeID<std::remove_const_t<T>>();
+			if constexpr (std::is_const_v<T> && IsDoubleBufferedComponent<T>) {
+				return static_cast<T*>(a_store_ptr->GetChunkPreviousRowAddress(chunk_index, c_id));
+			}
+			else if constexpr (std::is_const_v<T>) {
+				return static_cast<T*>(a_store_ptr->ReadChunkRowAddress(chunk_index, c_id));
+			}
+			return static_cast<T*>(a_store_ptr->GetChunkRowAddress(chunk_index, c_id));
+		}
+
+		const ComponentTypeManager* c_mgr_ptr;
+		const ComponentStorageManager* storage_mgr_ptr;
+		ArchetypeStorage* a_store_ptr;
+		size_t chunk_index;
 	};
 }
@@ -9,17 +9,58 @@ namespace ECS
     typedef size_t ComponentTypeID;
     typedef std::unordered_set<ComponentTypeID> ComponentTypeIDSet;
 
+    // Where the data of a component type lives
+    enum class StoragePolicy
+    {
+        Chunk,     // In the chunks of the entity's archetype, as part of the archetype signature
+        SparseSet, // In a sparse set outside of archetypes, for components that are added and removed often
+        Shared,    // Once per chunk, shared by all entities in the chunk; part of the archetype signature
+        DoubleBuffered  // In chunks, with a row for the previous frame's values and one for the next frame's
+    };
+
+    // What happens to the entities having a relation pair (R, target) when the target is destroyed
+    enum class RelationCleanup
+    {
+        RemovePair,    // The pair is removed from them, e.g. for "targets" links
+        DestroySource  // They are destroyed as well, e.g. for "owned-by" links
+    };
+
+    // Type-erased operations on component data, for types that can't be copied as bytes
+    typedef void (*CopyConstructFunc)(void* dest, const void* src);
+    typedef void (*DestroyFunc)(void* ptr);
+
     struct ComponentType
     {
 
         ComponentTypeID id;
         size_t size;
-        std::string name;
+        std::string name;  // The stable name, which identifies the type across processes
+
+        // Whether the component data can be persisted or relocated by raw byte copies
+        bool trivially_copyable;
+
+        StoragePolicy storage;
+
+        // Chunk layout hints, see DefaultComponentTraits
+        size_t interleave_group = 0;
+        size_t interleave_lanes = 8;
+        bool cold = false;
+
+        // Set for types that are not trivially copyable but copy constructible
+        CopyConstructFunc copy_construct = nullptr;
+        DestroyFunc destroy = nullptr;
+
+        // Set for a relation pair type, i.e. the relation component type with a target entity
+        bool is_pair = false;
+        ComponentTypeID relation_id = 0;
+        size_t target_id = 0;
+        RelationCleanup cleanup = RelationCleanup::RemovePair;
 
-        ComponentType() : id(0), size(0), name("NULL_COMPONENT_TYPE") {}
+        ComponentType() : id(0), size(0), name("NULL_COMPONENT_TYPE"), trivially_copyable(true), storage(StoragePolicy::Chunk) {}
 
-        ComponentType(ComponentTypeID id, size_t size, std::string name) :
-            id(id), size(size), name(name)
+        ComponentType(ComponentTypeID id, size_t size, std::string name, bool trivially_copyable = true,
+            StoragePolicy storage = StoragePolicy::Chunk) :
+            id(id), size(size), name(name), trivially_copyable(trivially_copyable), storage(storage)
         {}
     };
 }
@@ -1,28 +1,107 @@
 #pragma once
 #include <cassert>
+#include <cstdlib>
 #include <typeindex>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include <vector>
 #include <iostream>
 using std::cout;
 using std::endl;
 
 #include "ComponentType.h"
+#include "Entity.h"
 
 
 namespace ECS
 {
+	// The stable name of a component type, which identifies it in persisted storage. Defaults to the RTTI name;
+	// specialize it to keep persisted data readable across compilers, or after renaming a type.
+	template <typename T>
+	struct ComponentName
+	{
+		static std::string Get()
+		{
+			return std::type_index(typeid(T)).name();
+		}
+	};
+
+	// The storage options of a component type. Specialize it, deriving from DefaultComponentTraits, to change them:
+	//   template <> struct ECS::ComponentTraits<Selected> : ECS::DefaultComponentTraits
+	//   { static constexpr ECS::StoragePolicy storage = ECS::StoragePolicy::SparseSet; };
+	struct DefaultComponentTraits
+	{
+		static constexpr StoragePolicy storage = StoragePolicy::Chunk;
+
+		// Chunk layout: the components of an archetype in the same nonzero interleave group are stored in blocks of
+		// interleave_lanes entries of each in turn (AoSoA), for systems reading them together; cold components are
+		// stored apart from the chunks, so that iterating the others touches fewer cache lines.
+		static constexpr size_t interleave_group = 0;
+		static constexpr size_t interleave_lanes = 8;
+		static constexpr bool cold = false;
+	};
+
+	template <typename T>
+	struct ComponentTraits : DefaultComponentTraits {};
+
+	// The policy of a component type; a const T, as in read-only query terms, has the policy of T.
+	template <typename T>
+	constexpr StoragePolicy StoragePolicyOf = ComponentTraits<std::remove_const_t<T>>::storage;
+
+	template <typename T>
+	constexpr bool IsSparseComponent = StoragePolicyOf<T> == StoragePolicy::SparseSet;
+
+	template <typename T>
+	constexpr bool IsSharedComponent = StoragePolicyOf<T> == StoragePolicy::Shared;
+
+	template <typename T>
+	constexpr bool IsDoubleBufferedComponent = StoragePolicyOf<T> == StoragePolicy::DoubleBuffered;
+
+	// The options of a relation component type R, used in pairs (R, target). Specialize it like ComponentTraits:
+	//   template <> struct ECS::RelationTraits<OwnedBy> : ECS::DefaultRelationTraits
+	//   { static constexpr ECS::RelationCleanup on_target_destroyed = ECS::RelationCleanup::DestroySource; };
+	struct DefaultRelationTraits
+	{
+		static constexpr RelationCleanup on_target_destroyed = RelationCleanup::RemovePair;
+	};
+
+	template <typename R>
+	struct RelationTraits : DefaultRelationTraits {};
+
 	namespace Internal
 	{
 		// Extract the type information (an identifier and a name), through RTTI or compile-time processing;
-		// Current version: generate an ID and name for type T by RTTI.
+		// Current version: generate an ID by RTTI, and a stable name by ComponentName.
 		template <typename T>
 		std::pair<size_t, std::string> GetTypeInfo()
 		{
 			std::type_index c_rtti_type_index = std::type_index(typeid(T));
 			size_t internal_id = c_rtti_type_index.hash_code();
-			std::string name = c_rtti_type_index.name();
+			std::string name = ComponentName<T>::Get();
 
 			return std::make_pair(internal_id, name);
 		}
+
+		template <typename T>
+		void CopyConstructComponent(void* dest, const void* src)
+		{
+			new (dest) T(*static_cast<const T*>(src));
+		}
+
+		template <typename T>
+		void DestroyComponent(void* ptr)
+		{
+			static_cast<T*>(ptr)->~T();
+		}
+
+		// Stop at a misuse that has no error to return, in release builds as well
+		[[noreturn]] inline void Fail(const std::string& message)
+		{
+			std::cerr << "ECS: " << message << std::endl;
+			std::abort();
+		}
 	}
 
 	class ComponentTypeManager
@@ -48,7 +127,12 @@ namespace ECS
 			auto type_info = Internal::GetTypeInfo<T>();
 			size_t internal_id = type_info.first;
 
-			return component_ids_by_internal_id.at(internal_id);
+			auto iter = component_ids_by_internal_id.find(internal_id);
+			if (iter != component_ids_by_internal_id.end()) {
+				return iter->second;
+			}
+			// Not bound to T yet, i.e. registered by name when loading persisted storage
+			return component_ids_by_name.at(type_info.second);
 		}
 
 		template <typename T>
@@ -59,11 +143,31 @@ namespace ECS
 			std::string name = type_info.second;
 
 			if (component_ids_by_internal_id.count(internal_id) == 0) {
+				if (component_ids_by_name.count(name) != 0) {
+					// The type was registered by name when loading persisted storage, or copied from another manager;
+					// bind it to T now. It must not be bound to another type of the same name, and must be stored as T
+					// is, with its bytes copied only if T allows it.
+					ComponentTypeID c_id = component_ids_by_name.at(name);
+					const ComponentType& c_type = component_types[c_id];
+					if (bound_c_ids.count(c_id) != 0 || c_type.is_pair || c_type.size != sizeof(T) || c_type.storage != StoragePolicyOf<T>
+						|| c_type.trivially_copyable != std::is_trivially_copyable<T>::value) {
+						Internal::Fail("component type " + name + " doesn't match the type registered under its name");
+					}
+
+					component_ids_by_internal_id.insert({ internal_id, c_id });
+					bound_c_ids.insert(c_id);
+					this->SetTypeOperations<T>(component_types[c_id]);
+					return c_id;
+				}
+
 				// Create new component type
 				size_t new_c_id = component_type_id_counter++;
 
 				component_ids_by_internal_id.insert({ internal_id, new_c_id });
-				component_types.emplace_back(new_c_id, sizeof(T), name);
+				component_ids_by_name.insert({ name, new_c_id });
+				bound_c_ids.insert(new_c_id);
+				component_types.emplace_back(new_c_id, sizeof(T), name, std::is_trivially_copyable<T>::value, StoragePolicyOf<T>);
+				this->SetTypeOperations<T>(component_types.back());
 
 				assert(component_type_id_counter == component_types.size());
 			}
@@ -71,6 +175,139 @@ namespace ECS
 			return component_ids_by_internal_id.at(internal_id);
 		}
 
+		// Find a component type by its stable name without registering it. Returns false if the name is unknown.
+		bool FindComponentTypeID(const std::string& name, ComponentTypeID& c_id) const
+		{
+			auto iter = component_ids_by_name.find(name);
+			if (iter == component_ids_by_name.end()) {
+				return false;
+			}
+			c_id = iter->second;
+			return true;
+		}
+
+		// Find a component type by its stable name, or register a placeholder of given size that will be bound to
+		// the C++ type of the same name once it is used. Returns false if the name is known with a different size.
+		bool GetOrCreateComponentTypeID(const std::string& name, size_t size, ComponentTypeID& c_id)
+		{
+			if (component_ids_by_name.count(name) == 0) {
+				c_id = component_type_id_counter++;
+
+				component_ids_by_name.insert({ name, c_id });
+				component_types.emplace_back(c_id, size, name);
+
+				assert(component_type_id_counter == component_types.size());
+			}
+			c_id = component_ids_by_name.at(name);
+
+			return component_types[c_id].size == size;
+		}
+
+		// Find a component type by its stable name, or register a copy of a type of another manager in this process,
+		// e.g. of another world, with its storage options and operations. Returns false if the name is known with a
+		// different size or storage policy.
+		bool GetOrCreateComponentTypeID(const ComponentType& c_type, ComponentTypeID& c_id)
+		{
+			if (component_ids_by_name.count(c_type.name) == 0) {
+				c_id = component_type_id_counter++;
+
+				component_ids_by_name.insert({ c_type.name, c_id });
+				component_types.push_back(c_type);
+				component_types.back().id = c_id;
+
+				assert(component_type_id_counter == component_types.size());
+			}
+			c_id = component_ids_by_name.at(c_type.name);
+
+			return component_types[c_id].size == c_type.size && component_types[c_id].storage == c_type.storage;
+		}
+
+		// The component type of the relation pair (R, target), registered on first use. Each pair is a
+		// component type of its own, so that archetypes tell the targets of their entities. The types of destroyed
+		// targets are reused for new ones, with their archetypes and storages, so that short-lived targets don't
+		// make them grow without bound.
+		template <typename R>
+		ComponentTypeID GetOrCreatePairTypeID(const Entity& target)
+		{
+			static_assert(!IsSparseComponent<R> && !IsSharedComponent<R>, "a relation is stored in chunks");
+
+			ComponentTypeID relation_id = this->GetOrCreateComponentTypeID<R>();
+			std::unordered_map<size_t, ComponentTypeID>& pair_ids = pair_ids_by_relation[relation_id];
+
+			auto iter = pair_ids.find(target.id);
+			if (iter != pair_ids.end()) {
+				return iter->second;
+			}
+
+			std::vector<ComponentTypeID>& free_pair_ids = free_pair_ids_by_relation[relation_id];
+			if (!free_pair_ids.empty()) {
+				ComponentTypeID reused_c_id = free_pair_ids.back();
+				free_pair_ids.pop_back();
+				component_types[reused_c_id].name = component_types[relation_id].name + "(" + std::to_string(target.id) + ")";
+				component_types[reused_c_id].target_id = target.id;
+
+				pair_ids.insert({ target.id, reused_c_id });
+				pair_ids_by_target[target.id].push_back(reused_c_id);
+				return reused_c_id;
+			}
+
+			size_t new_c_id = component_type_id_counter++;
+			ComponentType pair_type = component_types[relation_id];
+			pair_type.id = new_c_id;
+			pair_type.name = pair_type.name + "(" + std::to_string(target.id) + ")";
+			pair_type.storage = StoragePolicy::Chunk;
+			pair_type.is_pair = true;
+			pair_type.relation_id = relation_id;
+			pair_type.target_id = target.id;
+			pair_type.cleanup = RelationTraits<R>::on_target_destroyed;
+			component_types.push_back(pair_type);
+
+			pair_ids.insert({ target.id, new_c_id });
+			pair_ids_by_target[target.id].push_back(new_c_id);
+
+			assert(component_type_id_counter == component_types.size());
+			return new_c_id;
+		}
+
+		// Find the component type of the relation pair (R, target); returns false if it was never used.
+		template <typename R>
+		bool GetPairTypeID(const Entity& target, ComponentTypeID& c_id)
+		{
+			auto relation_iter = pair_ids_by_relation.find(this->GetOrCreateComponentTypeID<R>());
+			if (relation_iter == pair_ids_by_relation.end()) {
+				return false;
+			}
+			auto iter = relation_iter->second.find(target.id);
+			if (iter == relation_iter->second.end()) {
+				return false;
+			}
+			c_id = iter->second;
+			return true;
+		}
+
+		// The pair types having the entity as their target
+		std::vector<ComponentTypeID> GetPairTypeIDsOfTarget(const Entity& target) const
+		{
+			auto iter = pair_ids_by_target.find(target.id);
+			return iter == pair_ids_by_target.end() ? std::vector<ComponentTypeID>() : iter->second;
+		}
+
+		// Stop finding the pair types of a destroyed target, which no entity has anymore; the types stay
+		// registered, to be reused by the next targets of their relations.
+		void ForgetTarget(const Entity& target)
+		{
+			for (const auto& c_id : this->GetPairTypeIDsOfTarget(target)) {
+				pair_ids_by_relation.at(component_types[c_id].relation_id).erase(target.id);
+				free_pair_ids_by_relation[component_types[c_id].relation_id].push_back(c_id);
+			}
+			pair_ids_by_target.erase(target.id);
+		}
+
+		size_t GetComponentTypeCount() const
+		{
+			return component_types.size();
+		}
+
 		void PrintComponentTypesInfo() const
 		{
 			cout << "\n====== Component Type Info ======" << endl;
@@ -83,11 +320,40 @@ namespace ECS
 		}
 
 	private:
+		template <typename T>
+		void SetTypeOperations(ComponentType& c_type)
+		{
+			c_type.trivially_copyable = std::is_trivially_copyable<T>::value;
+			static_assert(ComponentTraits<T>::interleave_lanes > 0, "a block has one entry at least");
+			c_type.interleave_group = ComponentTraits<T>::interleave_group;
+			c_type.interleave_lanes = ComponentTraits<T>::interleave_lanes;
+			c_type.cold = ComponentTraits<T>::cold;
+			if constexpr (!std::is_trivially_copyable<T>::value && std::is_copy_constructible<T>::value) {
+				c_type.copy_construct = &Internal::CopyConstructComponent<T>;
+				c_type.destroy = &Internal::DestroyComponent<T>;
+			}
+		}
+
 		// Index by component type ID, which grows from 0;
 		std::vector<ComponentType> component_types;
 		ComponentTypeID component_type_id_counter = 0;
 
 		// A mapping from internal type id (arbitrary size_t) to component type id (grows from 0)
 		std::unordered_map<size_t, ComponentTypeID> component_ids_by_internal_id;
+
+		// A mapping from stable name to component type id
+		std::unordered_map<std::string, ComponentTypeID> component_ids_by_name;
+
+		// The component types bound to a C++ type; the others are placeholders registered by name, or pair types
+		std::unordered_set<ComponentTypeID> bound_c_ids;
+
+		// The relation pair types: relation type id -> target entity id -> pair type id
+		std::unordered_map<ComponentTypeID, std::unordered_map<size_t, ComponentTypeID>> pair_ids_by_relation;
+
+		// The relation pair types of each target entity id
+		std::unordered_map<size_t, std::vector<ComponentTypeID>> pair_ids_by_target;
+
+		// The pair types of forgotten targets by relation type id, to reuse
+		std::unordered_map<ComponentTypeID, std::vector<ComponentTypeID>> free_pair_ids_by_relation;
 	};
 }
\ No newline at end of file
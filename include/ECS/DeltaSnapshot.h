@@ -0,0 +1,228 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Entity.h"
+#include "ArchetypeManager.h"
+#include "ArchetypeStorage.h"
+
+
+namespace ECS
+{
+	// The state of a world at a change version, as the base of the deltas encoded by EntityManager::EncodeDelta.
+	// Capturing into the same snapshot again only copies the chunks changed since. A snapshot belongs to the
+	// world it was captured from; a default constructed one is empty, so that the delta against it is the full state.
+	struct WorldSnapshot
+	{
+		struct ArchetypeChunks
+		{
+			std::vector<size_t> row_offsets;
+			std::vector<std::vector<char>> chunks;
+			std::vector<std::vector<Entity>> chunk_entities;
+			std::unordered_map<Entity, EntityIndex> entity_indices;
+		};
+
+		uint64_t version = 0;
+		std::unordered_set<Entity> entities;
+		std::unordered_set<Entity> null_entities;
+		std::unordered_map<ArchetypeID, ArchetypeChunks> archetypes;
+	};
+
+	namespace Internal
+	{
+		// Layout of a delta, all integers as LEB128 varints:
+		//   destroyed entities:     { count, { id } x count }
+		//   entities without component, new since the base: { count, { id } x count }
+		//   archetypes: { count, { row_count, { size, name_length, char name[name_length] } x row_count,
+		//                 chunk_count, { entity_count, { id } x entity_count,
+		//                                changed_row_count, { row_index, xor_runs } x changed_row_count } x chunk_count } x count }
+		// xor_runs is a row's values (entity_count * size bytes) XORed with their values in the base, as
+		// { zero_count, literal_count, char literals[literal_count] } runs; the base value of an entity not in the
+		// same archetype in the base is zeros.
+		inline void AppendVarint(std::vector<char>& buffer, uint64_t value)
+		{
+			while (value >= 0x80) {
+				buffer.push_back(static_cast<char>((value & 0x7F) | 0x80));
+				value >>= 7;
+			}
+			buffer.push_back(static_cast<char>(value));
+		}
+
+		// Returns false past the end of the data or on an overlong varint.
+		inline bool ReadVarint(const char*& cur, const char* end, uint64_t& value)
+		{
+			value = 0;
+			for (unsigned shift = 0; shift < 64; shift += 7) {
+				if (cur == end) {
+					return false;
+				}
+				uint8_t byte = static_cast<uint8_t>(*cur++);
+				value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+				if ((byte & 0x80) == 0) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Append the runs of data XOR base, both of size bytes.
+		inline void AppendXorRuns(std::vector<char>& buffer, const char* data, const char* base, size_t size)
+		{
+			// A literal run ends at this many zero bytes, which are cheaper as the next zero run
+			const size_t min_zero_run = 4;
+
+			size_t i = 0;
+			while (i < size) {
+				size_t zero_start = i;
+				while (i < size && data[i] == base[i]) {
+					i++;
+				}
+				size_t literal_start = i;
+				size_t zero_count = 0;
+				while (i < size && zero_count < min_zero_run) {
+					zero_count = data[i] == base[i] ? zero_count + 1 : 0;
+					i++;
+				}
+				if (zero_count == min_zero_run) {
+					i -= zero_count;
+				}
+				AppendVarint(buffer, literal_start - zero_start);
+				AppendVarint(buffer, i - literal_start);
+				for (size_t j = literal_start; j < i; j++) {
+					buffer.push_back(static_cast<char>(data[j] ^ base[j]));
+				}
+			}
+		}
+
+		// Check the runs covering size bytes, setting cur past them. The literals are applied by ApplyXorRuns.
+		inline bool SkipXorRuns(const char*& cur, const char* end, size_t size)
+		{
+			size_t covered = 0;
+			while (covered < size) {
+				uint64_t zero_count, literal_count;
+				if (!ReadVarint(cur, end, zero_count) || !ReadVarint(cur, end, literal_count)
+					|| zero_count > size - covered || literal_count > size - covered - zero_count
+					|| literal_count > static_cast<size_t>(end - cur)) {
+					return false;
+				}
+				covered += zero_count + literal_count;
+				cur += literal_count;
+			}
+			return true;
+		}
+
+		// XOR the runs checked by SkipXorRuns into the bytes of a row, calling data_of(i) for the address of the
+		// i-th value of the row.
+		template <typename F>
+		void ApplyXorRuns(const char* cur, size_t value_size, size_t value_count, F data_of)
+		{
+			size_t size = value_size * value_count;
+			size_t pos = 0;
+			while (pos < size) {
+				uint64_t zero_count, literal_count;
+				ReadVarint(cur, cur + 10, zero_count);
+				ReadVarint(cur, cur + 10, literal_count);
+				pos += zero_count;
+				for (size_t j = 0; j < literal_count; j++, pos++) {
+					static_cast<char*>(data_of(pos / value_size))[pos % value_size] ^= *cur++;
+				}
+			}
+		}
+
+		// A delta parsed and checked by EntityManager::ApplyDelta before changing anything
+		struct ParsedDelta
+		{
+			struct ChunkRecord
+			{
+				std::vector<Entity> entities;
+				std::vector<std::pair<size_t, const char*>> changed_rows;  // Row indices with the start of their runs
+			};
+
+			struct ArchetypeRecord
+			{
+				std::vector<std::pair<std::string, size_t>> rows;  // Names and sizes
+				std::vector<ChunkRecord> chunks;
+			};
+
+			std::vector<Entity> destroyed_entities;
+			std::vector<Entity> null_entities;
+			std::vector<ArchetypeRecord> archetypes;
+		};
+
+		inline bool ReadEntities(const char*& cur, const char* end, std::vector<Entity>& entities)
+		{
+			uint64_t count;
+			if (!ReadVarint(cur, end, count) || count > static_cast<size_t>(end - cur)) {
+				return false;  // an ID takes a byte at least
+			}
+			for (uint64_t i = 0; i < count; i++) {
+				uint64_t id;
+				if (!ReadVarint(cur, end, id) || id == 0) {
+					return false;
+				}
+				entities.push_back(Entity(id));
+			}
+			return true;
+		}
+
+		inline bool ParseDelta(const std::vector<char>& delta, ParsedDelta& parsed)
+		{
+			// Names longer than this are corrupted data
+			const uint64_t max_name_length = 4096;
+
+			const char* cur = delta.data();
+			const char* end = delta.data() + delta.size();
+			uint64_t archetype_count;
+			if (!ReadEntities(cur, end, parsed.destroyed_entities) || !ReadEntities(cur, end, parsed.null_entities)
+				|| !ReadVarint(cur, end, archetype_count) || archetype_count > static_cast<size_t>(end - cur)) {
+				return false;
+			}
+
+			for (uint64_t a = 0; a < archetype_count; a++) {
+				ParsedDelta::ArchetypeRecord archetype;
+				uint64_t row_count, chunk_count;
+				if (!ReadVarint(cur, end, row_count) || row_count == 0 || row_count > static_cast<size_t>(end - cur)) {
+					return false;
+				}
+				for (uint64_t r = 0; r < row_count; r++) {
+					uint64_t size, name_length;
+					if (!ReadVarint(cur, end, size) || size == 0 || size > ArchetypeStorage::GetChunkSize()
+						|| !ReadVarint(cur, end, name_length) || name_length > max_name_length
+						|| name_length > static_cast<size_t>(end - cur)) {
+						return false;
+					}
+					archetype.rows.emplace_back(std::string(cur, name_length), size);
+					cur += name_length;
+				}
+
+				if (!ReadVarint(cur, end, chunk_count) || chunk_count > static_cast<size_t>(end - cur)) {
+					return false;
+				}
+				for (uint64_t i = 0; i < chunk_count; i++) {
+					ParsedDelta::ChunkRecord chunk;
+					uint64_t changed_row_count;
+					if (!ReadEntities(cur, end, chunk.entities) || !ReadVarint(cur, end, changed_row_count) || changed_row_count > row_count) {
+						return false;
+					}
+					for (uint64_t r = 0; r < changed_row_count; r++) {
+						uint64_t row_index;
+						if (!ReadVarint(cur, end, row_index) || row_index >= row_count) {
+							return false;
+						}
+						const char* runs = cur;
+						if (!SkipXorRuns(cur, end, archetype.rows[row_index].second * chunk.entities.size())) {
+							return false;
+						}
+						chunk.changed_rows.emplace_back(row_index, runs);
+					}
+					archetype.chunks.push_back(std::move(chunk));
+				}
+				parsed.archetypes.push_back(std::move(archetype));
+			}
+			return cur == end;
+		}
+	}
+}
@@ -1,11 +1,25 @@
 #pragma once
+#include <cassert>
 #include <map>
 #include <list>
+#include <memory>
+#include <memory_resource>
 #include <functional>
+#include <mutex>
 #include <type_traits>
+#include <unordered_map>
 
 #include "EntityManager.h"
 #include "System.h"
+#include "SystemGroup.h"
+#include "JobSystem.h"
+#include "AsyncSystem.h"
+#include "PartitionStreamer.h"
+#include "CheckpointRing.h"
+#include "BulkOps.h"
+#include "SpatialIndex.h"
+#include "EventChannel.h"
+#include "CommandBuffer.h"
 
 
 namespace ECS
@@ -14,25 +28,96 @@ namespace ECS
 	{
 	public:
 
-		World()
+		// The chunks and the entity bookkeeping of the world's storage are allocated from the given memory resource,
+		// e.g. an arena of the world's own, which must outlive the world.
+		World(std::pmr::memory_resource* resource_ptr = std::pmr::get_default_resource()) : World(resource_ptr, nullptr) {}
+
+		// The chunks are placed on NUMA nodes by the resource, and the parallel iterations run each on its node.
+		World(NumaChunkResource* resource_ptr) : World(resource_ptr, resource_ptr) {}
+
+		World(std::pmr::memory_resource* resource_ptr, const NumaChunkResource* numa_resource_ptr) :
+			entity_mgr(resource_ptr, numa_resource_ptr),
+#ifdef ECS_ENABLE_COROUTINES
+			coroutine_scheduler(&job_system),
+#endif
+			partition_streamer(&entity_mgr, &job_system), default_group("Default", 0)
 		{
 			entity_mgr.Init();
+			groups[0].push_back(&default_group);
 		}
 
 		void Update(double delta_time)
 		{
-			for (const auto& pair : systems) {
-				for (System* system_ptr : pair.second) {
-					system_ptr->Update(delta_time);
+#ifdef ECS_ENABLE_PROFILING
+			double frame_start = profiler.Now();
+#endif
+			partition_streamer.Sync();
+			this->PlaybackCommands();
+			entity_mgr.FlipBuffers(step_flipped_c_ids);
+			events.EndFrame();
+#ifdef ECS_ENABLE_COROUTINES
+			coroutine_scheduler.BeginFrame(delta_time);
+#endif
+			for (const auto& pair : groups) {
+				for (SystemGroup* group_ptr : pair.second) {
+					this->UpdateGroup(*group_ptr, delta_time);
 				}
 			}
+#ifdef ECS_ENABLE_COROUTINES
+			coroutine_scheduler.EndFrame();
+#endif
+#ifdef ECS_ENABLE_PROFILING
+			for (const auto& [system_ptr, stats] : frame_stats_by_system) {
+				profiler.RecordSystem(system_ptr, system_ptr->GetName(), stats);
+			}
+			frame_stats_by_system.clear();
+			profiler.RecordFrame(frame_start, profiler.Now() - frame_start);
+#endif
 		}
 
+		// Add a system updated once per Update, in the default group.
 		void AddSystem(System* system_ptr, int priority = 0)
 		{
-			systems[priority].push_back(system_ptr);
+			this->AddSystem(system_ptr, &default_group, priority);
+		}
+
+		void AddSystem(System* system_ptr, SystemGroup* group_ptr, int priority = 0)
+		{
+			group_ptr->systems[priority].push_back(system_ptr);
 			system_ptr->Init();
 			system_ptr->world_ptr = this;
+#ifdef ECS_ENABLE_COROUTINES
+			if (AsyncSystem* async_system_ptr = dynamic_cast<AsyncSystem*>(system_ptr)) {
+				async_system_ptr->scheduler_ptr = &coroutine_scheduler;
+			}
+#endif
+		}
+
+		// Create a group of systems ticking at tick_rate Hz (0 for once per Update). Groups are updated in order
+		// of priority, highest first; the default group has priority 0.
+		SystemGroup* AddSystemGroup(const std::string& name, double tick_rate, int priority = 0)
+		{
+			owned_groups.emplace_back(new SystemGroup(name, tick_rate));
+			groups[priority].push_back(owned_groups.back().get());
+			return owned_groups.back().get();
+		}
+
+		// Flip the buffers of the double-buffered component T before each step of the group, in the chunks the step
+		// processes, instead of at every Update; for T written by a group with a tick rate or time slices, which
+		// doesn't run one step over all chunks per frame. A type is flipped by one group.
+		template <typename T>
+		void FlipBuffersPerStep(SystemGroup* group_ptr)
+		{
+			static_assert(IsDoubleBufferedComponent<T>, "T is not a double-buffered component");
+			ComponentTypeID c_id = entity_mgr.GetComponentTypeID<T>();
+			assert(step_flipped_c_ids.count(c_id) == 0);
+			step_flipped_c_ids.insert(c_id);
+			flipped_c_ids_by_group[group_ptr].insert(c_id);
+		}
+
+		SystemGroup& GetDefaultSystemGroup()
+		{
+			return this->default_group;
 		}
 
 		EntityManager& GetEntityManager()
@@ -40,6 +125,69 @@ namespace ECS
 			return this->entity_mgr;
 		}
 
+#ifdef ECS_ENABLE_PROFILING
+		Profiler& GetProfiler()
+		{
+			return this->profiler;
+		}
+#endif
+
+		// Set the world resource T, constructed with given arguments and replacing the old one.
+		template <typename T, typename... Args>
+		T* SetResource(const Args&... args)
+		{
+			return resources.Set<T, Args...>(args...);
+		}
+
+		// The world resource T in O(1), or nullptr if it is not set.
+		template <typename T>
+		T* GetResource() const
+		{
+			return resources.Get<T>();
+		}
+
+		template <typename T>
+		void RemoveResource()
+		{
+			resources.Remove<T>();
+		}
+
+		// The channel of events E, created with the given frame count on first use, see EventChannel. Its frames
+		// end at the start of every Update.
+		template <typename E>
+		EventChannel<E>& GetEvents(size_t frame_count = 2)
+		{
+			return events.Get<E>(frame_count);
+		}
+
+		// A command buffer recording changes to this world's entities, see EntityCommandBuffer.
+		EntityCommandBuffer CreateCommandBuffer()
+		{
+			return EntityCommandBuffer(&entity_mgr);
+		}
+
+		// Queue a filled command buffer, played back after the Update of the running system, or at the start of the
+		// next Update if submitted outside of systems. Buffers are played back in the order submitted; safe to call
+		// from several threads at once, e.g. by the jobs of a ParallelFor.
+		void SubmitCommands(EntityCommandBuffer&& buffer)
+		{
+			std::lock_guard<std::mutex> lock(command_mutex);
+			submitted_commands.push_back(std::move(buffer));
+		}
+
+		// Play back the submitted command buffers now, e.g. before querying the entities they create.
+		void PlaybackCommands()
+		{
+			std::vector<EntityCommandBuffer> buffers;
+			{
+				std::lock_guard<std::mutex> lock(command_mutex);
+				buffers.swap(submitted_commands);
+			}
+			for (auto& buffer : buffers) {
+				buffer.Playback();
+			}
+		}
+
 		// In g++, must use type traits to extract the type and must be qualified by typename. No need in MSVC.
 		template<typename... Args>
 		void ForEach(typename std::common_type<std::function<void(const Entity*, Args*...)>>::type func)
@@ -47,10 +195,147 @@ namespace ECS
 			entity_mgr.ForEach<decltype(func), Args...>(func);
 		}
 
+		// Iterate chunk by chunk, see EntityManager::ForEachChunk.
+		template<typename... Args>
+		void ForEachChunk(std::function<void(const ChunkView&)> func)
+		{
+			entity_mgr.ForEachChunk<Args...>(func);
+		}
+
+		// Iterate the chunks in parallel on the world's job system, see EntityManager::ForEachChunkParallel.
+		template<typename... Args>
+		void ForEachChunkParallel(std::function<void(const ChunkView&)> func)
+		{
+			entity_mgr.ForEachChunkParallel<Args...>(func, job_system);
+		}
+
+		// Iterate the chunks of children parents first, see EntityManager::ForEachChunkByDepth; the chunks
+		// of a depth are processed in parallel by the world's job system unless parallel is false.
+		template<typename... Args>
+		void ForEachChunkByDepth(std::function<void(const ChunkView&)> func, bool parallel = true)
+		{
+			entity_mgr.ForEachChunkByDepth<Args...>(func, parallel ? &job_system : nullptr);
+		}
+
+		// Order the entities having T and Args by a T value, see EntityManager::SortBy.
+		template<typename T, typename... Args>
+		size_t SortBy(std::function<bool(const T&, const T&)> compare)
+		{
+			return entity_mgr.SortBy<T, Args...>(compare);
+		}
+
+		// Move the entities having all of Args to another world, handing whole chunks over where the archetypes line up;
+		// returns the new entity of each moved one, see EntityManager::MoveEntities.
+		template<typename... Args>
+		std::unordered_map<Entity, Entity> MoveEntities(World& dst_world)
+		{
+			return entity_mgr.MoveEntities<Args...>(dst_world.entity_mgr);
+		}
+
+		JobSystem& GetJobSystem()
+		{
+			return this->job_system;
+		}
+
+		// Unloads and loads partitions in the background; the loaded ones are attached at the start of Update.
+		PartitionStreamer& GetPartitionStreamer()
+		{
+			return this->partition_streamer;
+		}
+
+#ifdef ECS_ENABLE_COROUTINES
+		// Resumes the coroutines of the async systems, e.g. to set their time budget per frame.
+		CoroutineScheduler& GetCoroutineScheduler()
+		{
+			return this->coroutine_scheduler;
+		}
+#endif
+
 	private:
+		// Run the steps the group's accumulator is due; a time-sliced group processes one slice of the chunks
+		// per step, each with the delta time of a whole tick, or of the frames since the slice was last processed.
+		void UpdateGroup(SystemGroup& group, double delta_time)
+		{
+			size_t step_count = group.Accumulate(delta_time);
+			double step_delta_time = group.GetStepDeltaTime();
+
+			auto flipped_iter = flipped_c_ids_by_group.find(&group);
+			for (size_t i = 0; i < step_count; i++) {
+				size_t slice_index = 0;
+				if (group.GetSliceCount() > 1) {
+					slice_index = group.NextSlice();
+					entity_mgr.SetIterationSlice(slice_index, group.GetSliceCount());
+				}
+				if (flipped_iter != flipped_c_ids_by_group.end()) {
+					entity_mgr.FlipSliceBuffers(flipped_iter->second, slice_index, group.GetSliceCount());
+				}
+				for (const auto& pair : group.systems) {
+					for (System* system_ptr : pair.second) {
+						this->UpdateSystem(system_ptr, step_delta_time);
+					}
+				}
+			}
+			entity_mgr.SetIterationSlice(0, 1);
+		}
+
+		void UpdateSystem(System* system_ptr, double delta_time)
+		{
+#ifdef ECS_ENABLE_PROFILING
+			entity_mgr.TakeProfileCounters();  // drop the work done outside of systems
+			double start = profiler.Now();
+
+			system_ptr->Update(delta_time);
+			this->PlaybackCommands();
+
+			SystemFrameStats stats;
+			stats.wall_time_us = profiler.Now() - start;
+			ProfileCounters counters = entity_mgr.TakeProfileCounters();
+			stats.entities_visited = counters.entities_visited;
+			stats.chunks_visited = counters.chunks_visited;
+			stats.structural_changes = counters.structural_changes;
+			profiler.TraceSystemStep(system_ptr->GetName(), start, stats);
+
+			SystemFrameStats& frame_stats = frame_stats_by_system[system_ptr];
+			frame_stats.wall_time_us += stats.wall_time_us;
+			frame_stats.entities_visited += stats.entities_visited;
+			frame_stats.chunks_visited += stats.chunks_visited;
+			frame_stats.structural_changes += stats.structural_changes;
+#else
+			system_ptr->Update(delta_time);
+			this->PlaybackCommands();
+#endif
+		}
+
 		EntityManager entity_mgr;
 
-		// Systems sorted by priority, highest first
-		std::map<int, std::list<System*>, std::greater<int>> systems;
+		ResourceStorage resources;
+
+		EventChannels events;
+
+		// The command buffers submitted and not played back yet
+		std::vector<EntityCommandBuffer> submitted_commands;
+		std::mutex command_mutex;
+
+		// Declared before the job system, so that the jobs finishing while it stops can still report to them
+#ifdef ECS_ENABLE_COROUTINES
+		CoroutineScheduler coroutine_scheduler;
+#endif
+		PartitionStreamer partition_streamer;
+
+		JobSystem job_system;
+
+		// System groups sorted by priority, highest first
+		SystemGroup default_group;
+		std::list<std::unique_ptr<SystemGroup>> owned_groups;
+		std::map<int, std::list<SystemGroup*>, std::greater<int>> groups;
+
+		// The double-buffered types flipped at the steps of a group rather than at every Update
+		ComponentTypeIDSet step_flipped_c_ids;
+		std::unordered_map<const SystemGroup*, ComponentTypeIDSet> flipped_c_ids_by_group;
+
+#ifdef ECS_ENABLE_PROFILING
+		Profiler profiler;
+		std::unordered_map<const System*, SystemFrameStats> frame_stats_by_system;  // Of the current Update
+#endif
 	};
 }
@@ -1,11 +1,22 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
 using std::cout;
 using std::endl;
 
 #include "ComponentTypeManager.h"
 #include "ArchetypeManager.h"
 #include "ComponentStorageManager.h"
+#include "MappedStorage.h"
+#include "Profiler.h"
+#include "Hierarchy.h"
+#include "Partition.h"
+#include "DeltaSnapshot.h"
+#include "Checkpoint.h"
+#include "JobSystem.h"
 
 
 namespace ECS
@@ -16,7 +27,10 @@ namespace ECS
 	{
 	public:
 
-		EntityManager() {}
+		// The chunks and the entity bookkeeping of the component storage are allocated from the given memory resource.
+		// A NumaChunkResource is passed as the NUMA resource too, for the chunks to record their nodes.
+		EntityManager(std::pmr::memory_resource* resource_ptr = std::pmr::get_default_resource(), const NumaChunkResource* numa_resource_ptr = nullptr)
+			: storage_mgr(resource_ptr, numa_resource_ptr) {}
 
 		// Avoid unintentional copy
 		EntityManager(const EntityManager&) = delete;
@@ -33,13 +47,8 @@ namespace ECS
 		template <typename... Args>
 		Entity CreateEntity()
 		{
-			Entity new_entity = Entity(entity_id_counter++);
-			entities.insert(new_entity);
-
-			ComponentTypeIDSet c_id_set = ComponentTypeIDSet{ component_type_mgr.GetOrCreateComponentTypeID<Args>()... };
-			ArchetypeID a_id = archetype_mgr.GetOrCreateArchetype(c_id_set);
-
-			storage_mgr.AddEntity<Args...>(new_entity, a_id);
+			Entity new_entity = this->ReserveEntity();
+			this->CreateReservedEntity<Args...>(new_entity);
 
 			return new_entity;
 		}
@@ -47,12 +56,40 @@ namespace ECS
 		// Create an entity with no component type
 		Entity CreateEntity()
 		{
-			Entity new_entity = Entity(entity_id_counter++);
+			Entity new_entity = this->ReserveEntity();
 			null_entities.insert(new_entity);
 
 			return new_entity;
 		}
 
+		// Take the next entity ID without creating the entity, e.g. for a job to refer to an entity it creates
+		// through a command buffer. Safe to call from several threads at once, also while the manager is in use
+		// by the others; IDs reserved and never created are simply not used.
+		Entity ReserveEntity()
+		{
+			return Entity(entity_id_counter.fetch_add(1, std::memory_order_relaxed));
+		}
+
+		// Create an entity reserved by ReserveEntity, like CreateEntity.
+		template <typename... Args>
+		void CreateReservedEntity(const Entity& new_entity)
+		{
+			// Sparse set components are not part of the archetype
+			ComponentTypeIDSet c_id_set;
+			(this->InsertChunkComponentTypeID<Args>(c_id_set), ...);
+
+			if (c_id_set.empty()) {
+				null_entities.insert(new_entity);
+			}
+			else {
+				entities.insert(new_entity);
+				ArchetypeID a_id = archetype_mgr.GetOrCreateArchetype(c_id_set);
+				storage_mgr.AddEntity<Args...>(new_entity, a_id);
+			}
+			(this->DefaultConstructSparseComponent<Args>(new_entity), ...);
+			ECS_PROFILE_COUNT(structural_changes, 1);
+		}
+
 		// Add a new component (or replace the old one) to an entity.
 		template <typename T, typename... Args>
 		void AddEntityComponent(const Entity& entity, const Args&... args)
@@ -61,13 +98,30 @@ namespace ECS
 			// T is component type
 			ComponentTypeID add_c_id = component_type_mgr.GetOrCreateComponentTypeID<T>();
 
+			if constexpr (IsSparseComponent<T>) {
+				// No migration: the entity's archetype doesn't change
+				storage_mgr.GetOrCreateSparseSet<T>(add_c_id).Emplace(entity, args...);
+				return;
+			}
+
+			if (this->IsEntityReadOnly(entity)) {
+				return;
+			}
+
+			bool is_new_component = true;
 			if (null_entities.count(entity) != 0) {
 				// the entity has no component yet
 				ArchetypeID a_id = archetype_mgr.GetOrCreateArchetype(ComponentTypeIDSet{ add_c_id });
-				storage_mgr.AddEntity<T>(entity, a_id);
-
 				null_entities.erase(entity);
 				entities.insert(entity);
+				ECS_PROFILE_COUNT(structural_changes, 1);
+
+				if constexpr (IsSharedComponent<T>) {
+					// Placed directly into a chunk sharing the value
+					storage_mgr.AddEntityComponent<T, Args...>(entity, a_id, args...);
+					return;
+				}
+				storage_mgr.AddEntity<T>(entity, a_id);
 			}
 			else {
 				if (!storage_mgr.HasComponentType(entity, add_c_id)) {
@@ -76,18 +130,36 @@ namespace ECS
 					ComponentTypeIDSet c_id_set = archetype_mgr.GetArchtype(old_a_id).GetComponentTypeIDs();
 					c_id_set.insert(add_c_id);
 					ArchetypeID new_a_id = archetype_mgr.GetOrCreateArchetype(c_id_set);
+					ECS_PROFILE_COUNT(structural_changes, 1);
 
+					if constexpr (IsSharedComponent<T>) {
+						storage_mgr.AddEntityComponent<T, Args...>(entity, new_a_id, args...);
+						return;
+					}
 					storage_mgr.MigrateEntity(entity, new_a_id);
 				}
+				else {
+					is_new_component = false;
+				}
 			}
 			// the entity already has this component, then just emplace it with new value. 
 			storage_mgr.SetEntityComponent<T, Args...>(entity, args...);
+
+			if constexpr (IsDoubleBufferedComponent<T>) {
+				if (is_new_component) {
+					// A new component has the same value in the last frame
+					storage_mgr.SetPreviousEntityComponent<T, Args...>(entity, args...);
+				}
+			}
 		}
 
-		// Set a new component value fpr an entity.
+		// Set a new component value fpr an entity. For a shared component, the entity moves to a chunk sharing the new value.
 		template <typename T, typename... Args>
 		void SetEntityComponent(const Entity& entity, const Args&... args)
 		{
+			if (!IsSparseComponent<T> && this->IsEntityReadOnly(entity)) {
+				return;
+			}
 			storage_mgr.SetEntityComponent<T, Args...>(entity, args...);
 		}
 
@@ -98,11 +170,55 @@ namespace ECS
 			return storage_mgr.GetEntityComponent<T>(entity);
 		}
 
+		// The previous frame's value of a double-buffered component T; GetEntityComponent gives the next frame's.
+		template <typename T>
+		const T* GetPreviousEntityComponent(const Entity& entity)
+		{
+			return storage_mgr.GetPreviousEntityComponent<T>(entity);
+		}
+
+		// Swap the previous and next buffers of all double-buffered components; called by World::Update before
+		// the systems, so that the values written in the last frame become the previous ones. No data is copied,
+		// so systems must write the next value of every entity each frame. The skipped types are flipped by the
+		// steps of their system group instead, see FlipSliceBuffers.
+		void FlipBuffers(const ComponentTypeIDSet& skipped_c_ids = ComponentTypeIDSet())
+		{
+			storage_mgr.FlipBuffers(skipped_c_ids);
+		}
+
+		// Swap the buffers of the given double-buffered types in the chunks of an iteration slice, see
+		// SetIterationSlice; called by World::Update before each step of a group flipping them.
+		void FlipSliceBuffers(const ComponentTypeIDSet& c_id_set, size_t slice_index, size_t slice_count)
+		{
+			storage_mgr.FlipBuffers(c_id_set, slice_index, slice_count);
+		}
+
+		// Restrict ForEach and ForEachChunk to the chunks whose index modulo slice_count is slice_index (to the
+		// entities at such positions, for a query driven by a sparse set); set by World::Update for the steps
+		// of a time-sliced system group, and reset to (0, 1) after.
+		void SetIterationSlice(size_t slice_index, size_t slice_count)
+		{
+			this->slice_index = slice_index;
+			this->slice_count = slice_count;
+		}
+
+		// Whether an entity's chunk components are pages of a file mapped read-only by MapStorage. Such an entity
+		// can't be changed: the functions adding, setting or removing its chunk components, or destroying it, leave
+		// it as it is, and the components given by GetEntityComponent must only be read.
+		bool IsEntityReadOnly(const Entity& entity) const
+		{
+			return mapped_file && storage_mgr.IsEntityReadOnly(entity);
+		}
+
 		// Whether an entity has component T.
 		template <typename T>
 		bool HasComponent(const Entity& entity)
 		{
 			ComponentTypeID c_id = component_type_mgr.GetOrCreateComponentTypeID<T>();
+			if constexpr (IsSparseComponent<T>) {
+				SparseSet<T>* sparse_set_ptr = storage_mgr.GetSparseSet<T>(c_id);
+				return sparse_set_ptr != nullptr && sparse_set_ptr->Has(entity);
+			}
 			return storage_mgr.HasComponentType(entity, c_id);
 		}
 
@@ -110,17 +226,7 @@ namespace ECS
 		template <typename T, typename V, typename... Args>
 		bool HasComponent(const Entity& entity)
 		{
-			ComponentTypeIDSet c_id_set = ComponentTypeIDSet{ component_type_mgr.GetOrCreateComponentTypeID<T>(),
-				component_type_mgr.GetOrCreateComponentTypeID<V>(),
-				component_type_mgr.GetOrCreateComponentTypeID<Args>()... };
-
-			for (auto const& c_id : c_id_set) {
-				if (!storage_mgr.HasComponentType(entity, c_id)) {
-					return false;
-				}
-			}
-
-			return true;
+			return this->HasComponent<T>(entity) && this->HasComponent<V>(entity) && (this->HasComponent<Args>(entity) && ...);
 		}
 
 		// Remove the component T from an entity.
@@ -129,31 +235,319 @@ namespace ECS
 		{
 			ComponentTypeID remove_c_id = component_type_mgr.GetOrCreateComponentTypeID<T>();
 
-			if (null_entities.count(entity) != 0 || !storage_mgr.HasComponentType(entity, remove_c_id)) {
-				// Nothing to remove;
+			if constexpr (IsSparseComponent<T>) {
+				SparseSet<T>* sparse_set_ptr = storage_mgr.GetSparseSet<T>(remove_c_id);
+				if (sparse_set_ptr != nullptr) {
+					sparse_set_ptr->Remove(entity);
+				}
 				return;
 			}
 
-			// the entity doesn't have this component yet
-			ArchetypeID old_a_id = storage_mgr.GetEntityArchetypeID(entity);
-			ComponentTypeIDSet c_id_set = archetype_mgr.GetArchtype(old_a_id).GetComponentTypeIDs();
-			c_id_set.erase(remove_c_id);
+			this->RemoveChunkComponentTypeID(entity, remove_c_id);
+		}
 
-			if (c_id_set.size() == 0) {
-				this->RemoveEntityAllComponents(entity);
+		// Destroy an entity: remove all its components, and clean up the relation pairs targeting it by the
+		// policies of their relations, which may destroy the related entities as well.
+		void DestroyEntity(const Entity& entity)
+		{
+			if (this->IsEntityReadOnly(entity)) {
+				return;
 			}
-			else {
-				ArchetypeID new_a_id = archetype_mgr.GetOrCreateArchetype(c_id_set);
-				storage_mgr.MigrateEntity(entity, new_a_id);
+			this->RemoveEntityAllComponents(entity);
+			null_entities.erase(entity);
+
+			for (const auto& pair_c_id : component_type_mgr.GetPairTypeIDsOfTarget(entity)) {
+				RelationCleanup cleanup = component_type_mgr.GetComponentType(pair_c_id).cleanup;
+
+				std::vector<Entity> sources;
+				for (const auto& a_id : archetype_mgr.GetArchetypesWith(pair_c_id)) {
+					std::vector<Entity> a_entities = storage_mgr.GetEntities(a_id);
+					sources.insert(sources.end(), a_entities.begin(), a_entities.end());
+				}
+				for (const auto& source : sources) {
+					if (cleanup == RelationCleanup::DestroySource) {
+						this->DestroyEntity(source);
+					}
+					else {
+						this->RemoveChunkComponentTypeID(source, pair_c_id);
+					}
+				}
 			}
+			component_type_mgr.ForgetTarget(entity);
 		}
 
-		// Remove all components from an entity
+		// Remove all components from an entity; it leaves its hierarchy, and its children become roots.
 		void RemoveEntityAllComponents(const Entity& entity)
 		{
-			storage_mgr.RemoveEntity(entity);
-			null_entities.insert(entity);
-			entities.erase(entity);
+			if (this->IsEntityReadOnly(entity)) {
+				return;
+			}
+			this->RemoveParent(entity);
+			auto children_iter = children_by_parent.find(entity);
+			if (children_iter != children_by_parent.end()) {
+				std::vector<Entity> children = children_iter->second;
+				for (const auto& child : children) {
+					this->RemoveParent(child);
+				}
+			}
+
+			if (entities.count(entity) != 0) {
+				this->RemoveEntityArchetype(entity);
+			}
+			storage_mgr.RemoveSparseComponents(entity);
+		}
+
+		// Snapshot an entity's archetype and component values (except sparse set ones) as a prefab to instantiate.
+		// Returns nullptr if the entity has no chunk component.
+		std::unique_ptr<Prefab> CreatePrefab(const Entity& entity)
+		{
+			if (entities.count(entity) == 0) {
+				return nullptr;
+			}
+			return storage_mgr.CreatePrefab(entity);
+		}
+
+		// Create count entities with copies of the prefab's values, filling chunk slots in batches instead of
+		// constructing the entities one by one.
+		std::vector<Entity> Instantiate(const Prefab& prefab, size_t count = 1)
+		{
+			std::vector<Entity> new_entities;
+			new_entities.reserve(count);
+			entities.reserve(entities.size() + count);
+			for (size_t i = 0; i < count; i++) {
+				new_entities.push_back(this->ReserveEntity());
+				entities.insert(new_entities.back());
+			}
+
+			storage_mgr.AddEntities(new_entities.data(), count, prefab.GetArchetypeID(), prefab.GetSharedKey(), prefab.GetValues());
+			ECS_PROFILE_COUNT(structural_changes, count);
+
+			return new_entities;
+		}
+
+		// Create an entity with copies of all components of the given entity.
+		Entity Clone(const Entity& entity)
+		{
+			Entity new_entity = this->ReserveEntity();
+
+			if (entities.count(entity) != 0) {
+				entities.insert(new_entity);
+				storage_mgr.CloneEntity(entity, new_entity);
+			}
+			else {
+				null_entities.insert(new_entity);
+			}
+			storage_mgr.CopySparseComponents(entity, new_entity);
+			ECS_PROFILE_COUNT(structural_changes, 1);
+
+			return new_entity;
+		}
+
+		/**
+		* Relations: a pair (R, target) is a component type of its own holding an R, so that the entities
+		* related to a target, or having a relation with any target, are found by their archetypes.
+		*/
+		// Add the pair (R, target) to an entity, constructing its R with given arguments (or replacing the old one).
+		template <typename R, typename... Args>
+		void AddRelation(const Entity& entity, const Entity& target, const Args&... args)
+		{
+			if (this->IsEntityReadOnly(entity)) {
+				return;
+			}
+			ComponentTypeID pair_c_id = component_type_mgr.GetOrCreatePairTypeID<R>(target);
+			this->AddChunkComponentTypeID(entity, pair_c_id);
+			new (storage_mgr.GetEntityComponentData(entity, pair_c_id)) R(args...);
+		}
+
+		// The R of an entity's pair (R, target), or nullptr if it doesn't have the pair.
+		template <typename R>
+		R* GetRelation(const Entity& entity, const Entity& target)
+		{
+			ComponentTypeID pair_c_id;
+			if (!component_type_mgr.GetPairTypeID<R>(target, pair_c_id) || !storage_mgr.HasComponentType(entity, pair_c_id)) {
+				return nullptr;
+			}
+			return static_cast<R*>(storage_mgr.GetEntityComponentData(entity, pair_c_id));
+		}
+
+		template <typename R>
+		bool HasRelation(const Entity& entity, const Entity& target)
+		{
+			return this->GetRelation<R>(entity, target) != nullptr;
+		}
+
+		template <typename R>
+		void RemoveRelation(const Entity& entity, const Entity& target)
+		{
+			ComponentTypeID pair_c_id;
+			if (component_type_mgr.GetPairTypeID<R>(target, pair_c_id)) {
+				this->RemoveChunkComponentTypeID(entity, pair_c_id);
+			}
+		}
+
+		// The targets of an entity's pairs of relation R
+		template <typename R>
+		std::vector<Entity> GetRelationTargets(const Entity& entity)
+		{
+			std::vector<Entity> targets;
+			if (entities.count(entity) == 0) {
+				return targets;
+			}
+			ComponentTypeID relation_id = component_type_mgr.GetOrCreateComponentTypeID<R>();
+			for (const auto& c_id : archetype_mgr.GetArchtype(storage_mgr.GetEntityArchetypeID(entity)).GetComponentTypeIDs()) {
+				const ComponentType& c_type = component_type_mgr.GetComponentType(c_id);
+				if (c_type.is_pair && c_type.relation_id == relation_id) {
+					targets.push_back(Entity(c_type.target_id));
+				}
+			}
+			return targets;
+		}
+
+		// Call func(entity, r) for every entity having the pair (R, target), e.g. all entities ChildOf X.
+		template <typename R, typename F>
+		void ForEachRelated(const Entity& target, F func)
+		{
+			ComponentTypeID pair_c_id;
+			if (!component_type_mgr.GetPairTypeID<R>(target, pair_c_id)) {
+				return;
+			}
+			for (const auto& a_id : archetype_mgr.GetArchetypesWith(pair_c_id)) {
+				std::vector<Entity> a_entities = storage_mgr.GetEntities(a_id);
+				ECS_PROFILE_COUNT(entities_visited, a_entities.size());
+
+				for (const auto& entity : a_entities) {
+					func(&entity, static_cast<R*>(storage_mgr.GetEntityComponentData(entity, pair_c_id)));
+				}
+			}
+		}
+
+		// Call func(entity, target, r) for every pair of relation R with any target, e.g. all entities with any Targets.
+		template <typename R, typename F>
+		void ForEachRelation(F func)
+		{
+			ComponentTypeID relation_id = component_type_mgr.GetOrCreateComponentTypeID<R>();
+			for (const auto& a_id : archetype_mgr.GetArchetypesWithRelation(relation_id)) {
+				std::vector<Entity> a_entities = storage_mgr.GetEntities(a_id);
+				ECS_PROFILE_COUNT(entities_visited, a_entities.size());
+
+				for (const auto& c_id : archetype_mgr.GetArchtype(a_id).GetComponentTypeIDs()) {
+					const ComponentType& c_type = component_type_mgr.GetComponentType(c_id);
+					if (!c_type.is_pair || c_type.relation_id != relation_id) {
+						continue;
+					}
+					Entity target(c_type.target_id);
+					for (const auto& entity : a_entities) {
+						func(&entity, target, static_cast<R*>(storage_mgr.GetEntityComponentData(entity, c_id)));
+					}
+				}
+			}
+		}
+
+		/**
+		* Hierarchy: a child has the Parent and HierarchyDepth components, which must only be changed by
+		* SetParent and RemoveParent. A root is an entity with children but no parent.
+		*/
+		// Make an entity a child of the parent, moving its subtree along. Returns false if it would make a cycle.
+		bool SetParent(const Entity& child, const Entity& parent)
+		{
+			if (child.id == parent.id || this->IsAncestor(child, parent)) {
+				return false;
+			}
+
+			this->DetachFromParent(child);
+			this->AddEntityComponent<Parent>(child, parent);
+			children_by_parent[parent].push_back(child);
+			this->SetSubtreeDepth(child, this->GetDepth(parent) + 1);
+			return true;
+		}
+
+		// Make a child a root, with its subtree along.
+		void RemoveParent(const Entity& child)
+		{
+			if (!this->DetachFromParent(child)) {
+				return;
+			}
+			this->RemoveEntityComponent<Parent>(child);
+			this->RemoveEntityComponent<HierarchyDepth>(child);
+
+			auto children_iter = children_by_parent.find(child);
+			if (children_iter != children_by_parent.end()) {
+				for (const auto& grandchild : children_iter->second) {
+					this->SetSubtreeDepth(grandchild, 1);
+				}
+			}
+		}
+
+		// The parent of an entity, or NULL_ENTITY if it is a root or not in a hierarchy.
+		Entity GetParent(const Entity& entity)
+		{
+			if (!this->HasComponent<Parent>(entity)) {
+				return NULL_ENTITY;
+			}
+			return this->GetEntityComponent<Parent>(entity)->entity;
+		}
+
+		const std::vector<Entity>& GetChildren(const Entity& entity) const
+		{
+			static const std::vector<Entity> no_children;
+			auto iter = children_by_parent.find(entity);
+			return iter == children_by_parent.end() ? no_children : iter->second;
+		}
+
+		// The depth of an entity in its hierarchy, 0 for roots and entities not in a hierarchy.
+		size_t GetDepth(const Entity& entity)
+		{
+			if (!this->HasComponent<HierarchyDepth>(entity)) {
+				return 0;
+			}
+			return this->GetEntityComponent<HierarchyDepth>(entity)->depth;
+		}
+
+		// Call func once per non-empty chunk of the children having all of Args, level by level from depth 1, so
+		// that parents are visited before their children, e.g. to propagate transforms. With a job system, the
+		// chunks of a level are processed in parallel, so func must be safe to run concurrently on different chunks.
+		template <typename... Args, typename F>
+		void ForEachChunkByDepth(F func, JobSystem* job_system_ptr = nullptr)
+		{
+			struct DepthChunk
+			{
+				size_t depth;
+				ArchetypeStorage* a_store_ptr;
+				size_t chunk_index;
+			};
+			std::vector<DepthChunk> depth_chunks;
+
+			this->ForEachChunk<HierarchyDepth, Args...>([&](const ChunkView& chunk) -> void {
+				depth_chunks.push_back({ chunk.GetShared<HierarchyDepth>()->depth, chunk.GetArchetypeStorage(), chunk.GetChunkIndex() });
+			});
+			std::stable_sort(depth_chunks.begin(), depth_chunks.end(), [](const DepthChunk& lhs, const DepthChunk& rhs) -> bool {
+				return lhs.depth < rhs.depth;
+			});
+
+			size_t level_begin = 0;
+			while (level_begin < depth_chunks.size()) {
+				size_t level_end = level_begin;
+				while (level_end < depth_chunks.size() && depth_chunks[level_end].depth == depth_chunks[level_begin].depth) {
+					level_end++;
+				}
+
+				auto run_chunk = [&](size_t i) -> void {
+					const DepthChunk& depth_chunk = depth_chunks[level_begin + i];
+					func(ChunkView(&component_type_mgr, &storage_mgr, depth_chunk.a_store_ptr, depth_chunk.chunk_index));
+				};
+				if (job_system_ptr != nullptr) {
+					job_system_ptr->ParallelFor(level_end - level_begin, run_chunk, [&](size_t i) -> size_t {
+						const DepthChunk& depth_chunk = depth_chunks[level_begin + i];
+						return depth_chunk.a_store_ptr->GetChunkNumaNode(depth_chunk.chunk_index);
+					});
+				}
+				else {
+					for (size_t i = 0; i < level_end - level_begin; i++) {
+						run_chunk(i);
+					}
+				}
+				level_begin = level_end;
+			}
 		}
 
 		std::unordered_set<Entity>& GetEntities()
@@ -161,6 +555,640 @@ namespace ECS
 			return entities;
 		}
 
+		// Persist all entities and their component data into a file, which can be mapped back by MapStorage.
+		// Only trivially copyable component types stored in chunks can be persisted, in archetypes without
+		// interleaved or cold components.
+		bool SaveStorage(const std::string& path) const
+		{
+			if (storage_mgr.HasSparseComponents() || storage_mgr.HasSharedComponents()) {
+				return false;  // only chunk rows are persisted
+			}
+			return Internal::WriteStorageFile(path, component_type_mgr, storage_mgr, null_entities, entity_id_counter.load());
+		}
+
+		// Use a file written by SaveStorage as the storage of this (empty) manager. Chunks are pages of the mapped file
+		// and faulted in on first touch, instead of being read and deserialized; only the entity indices are built here.
+		bool MapStorage(const std::string& path, MapMode mode = MapMode::CopyOnWrite)
+		{
+			if (!entities.empty() || !null_entities.empty() || !storage_mgr.GetArchetypeStorages().empty() || mapped_file) {
+				return false;
+			}
+
+			std::unique_ptr<MappedFile> file(new MappedFile());
+			size_t id_counter = entity_id_counter.load();
+			if (!file->Open(path, mode) || !Internal::ReadStorageFile(*file, mode, component_type_mgr, archetype_mgr,
+				storage_mgr, entities, null_entities, id_counter)) {
+				return false;
+			}
+			entity_id_counter.store(id_counter);
+			mapped_file = std::move(file);
+
+			return true;
+		}
+
+		// Take the chunks of a partition's entities out of the world, e.g. to write them to a file in the background
+		// and free them; the entities leave the world until AttachPartition. Returns nullptr, changing nothing, if
+		// an entity can't be detached: having sparse set components, shared components other than Partition or
+		// components that can't be persisted (see SaveStorage). Hierarchies and relations across partitions are
+		// not maintained.
+		std::unique_ptr<PartitionData> DetachPartition(uint64_t partition_id)
+		{
+			std::unique_ptr<PartitionData> data(new PartitionData(partition_id));
+			ComponentTypeID partition_c_id = component_type_mgr.GetOrCreateComponentTypeID<Partition>();
+			SharedValueStore<Partition>* store_ptr = storage_mgr.GetSharedValueStore<Partition>(partition_c_id);
+			size_t value_index = store_ptr == nullptr ? INVALID_SHARED_VALUE_INDEX : store_ptr->Find(Partition(partition_id));
+			if (value_index == INVALID_SHARED_VALUE_INDEX) {
+				return data;
+			}
+
+			auto is_partition_chunk = [&](const ArchetypeStorage* a_store_ptr, size_t chunk_index) -> bool {
+				const SharedKey& shared_key = a_store_ptr->GetChunkSharedKey(chunk_index);
+				return !shared_key.empty() && shared_key[a_store_ptr->GetSharedTypeIndex(partition_c_id)] == value_index;
+			};
+
+			// Check all chunks of the partition before detaching any
+			std::vector<ArchetypeID> a_ids;
+			for (const auto& a_id : archetype_mgr.GetArchetypesWith(partition_c_id)) {
+				auto iter = storage_mgr.GetArchetypeStorages().find(a_id);
+				if (iter == storage_mgr.GetArchetypeStorages().end()) {
+					continue;
+				}
+				const ArchetypeStorage* a_store_ptr = iter->second;
+				bool has_partition_chunk = false;
+				for (size_t i = 0; i < a_store_ptr->GetChunkCount(); i++) {
+					if (!is_partition_chunk(a_store_ptr, i)) {
+						continue;
+					}
+					has_partition_chunk = true;
+					if (a_store_ptr->GetChunkEntityCount(i) == 0) {
+						continue;
+					}
+					if (a_store_ptr->GetSharedTypes().size() != 1 || !a_store_ptr->HasDefaultLayout()) {
+						return nullptr;
+					}
+					for (const auto& c_id : a_store_ptr->GetComponentTypes()) {
+						if (!component_type_mgr.GetComponentType(c_id).trivially_copyable || component_type_mgr.GetComponentType(c_id).is_pair) {
+							return nullptr;
+						}
+					}
+					const Entity* chunk_entities = a_store_ptr->GetChunkEntities(i);
+					for (size_t j = 0; j < a_store_ptr->GetChunkEntityCount(i); j++) {
+						if (storage_mgr.HasSparseComponents(chunk_entities[j])) {
+							return nullptr;
+						}
+					}
+				}
+				// The chunks of an archetype with cold rows can't be detached, so its empty ones are left in place
+				if (has_partition_chunk && a_store_ptr->HasDefaultLayout()) {
+					a_ids.push_back(a_id);
+				}
+			}
+
+			for (const auto& a_id : a_ids) {
+				ArchetypeStorage* a_store_ptr = storage_mgr.GetArchetypeStorages().at(a_id);
+				PartitionData::ArchetypeChunks archetype;
+				archetype.chunk_entity_capacity = a_store_ptr->GetChunkEntityCapacity();
+				for (size_t row_index = 0; row_index < a_store_ptr->GetComponentTypes().size(); row_index++) {
+					const ComponentType& c_type = component_type_mgr.GetComponentType(a_store_ptr->GetComponentTypes()[row_index]);
+					archetype.rows.push_back({ c_type.name, c_type.size, a_store_ptr->GetRowOffsets()[row_index],
+						a_store_ptr->GetRowPreviousOffsets()[row_index] });
+				}
+
+				// From the last chunk, since a detached chunk is replaced by the last one
+				for (size_t i = a_store_ptr->GetChunkCount(); i-- > 0;) {
+					if (!is_partition_chunk(a_store_ptr, i)) {
+						continue;
+					}
+					std::vector<Entity> chunk_entities;
+					std::unique_ptr<Chunk> chunk_ptr(storage_mgr.DetachChunk(a_id, i, chunk_entities));
+					if (chunk_entities.empty()) {
+						continue;  // an empty chunk is just freed
+					}
+					for (const auto& entity : chunk_entities) {
+						entities.erase(entity);
+					}
+					ECS_PROFILE_COUNT(structural_changes, chunk_entities.size());
+					archetype.chunks.push_back(std::move(chunk_ptr));
+					archetype.chunk_entities.push_back(std::move(chunk_entities));
+				}
+				if (!archetype.chunks.empty()) {
+					data->GetArchetypes().push_back(std::move(archetype));
+				}
+			}
+			return data;
+		}
+
+		// Put the chunks of a partition back into the world, as detached by DetachPartition or read from the file it
+		// was written to. The chunks are taken over from the data and only the entity indices are built, so that
+		// little work is left to the thread calling it; chunks of another memory resource, e.g. read from a file,
+		// are copied into the world's resource and placed on its NUMA nodes, see ArchetypeStorage::AttachChunk. Returns false, changing nothing, if an archetype's layout
+		// differs from the world's or an entity is in the world already.
+		bool AttachPartition(PartitionData& data)
+		{
+			ComponentTypeID partition_c_id = component_type_mgr.GetOrCreateComponentTypeID<Partition>();
+
+			// Resolve the archetypes and check everything before attaching any chunk
+			std::vector<ArchetypeID> a_ids;
+			std::vector<std::vector<size_t>> flipped_rows;  // Double-buffered rows with their buffers swapped in the data
+			for (const auto& archetype : data.GetArchetypes()) {
+				ComponentTypeIDSet c_id_set{ partition_c_id };
+				for (const auto& row : archetype.rows) {
+					ComponentTypeID c_id;
+					if (!component_type_mgr.GetOrCreateComponentTypeID(row.name, row.size, c_id)) {
+						return false;
+					}
+					c_id_set.insert(c_id);
+				}
+				ArchetypeID a_id = archetype_mgr.GetOrCreateArchetype(c_id_set);
+				const ArchetypeStorage* a_store_ptr = storage_mgr.GetOrAddArchetypeStorage(a_id);
+				if (a_store_ptr->GetChunkEntityCapacity() != archetype.chunk_entity_capacity || !a_store_ptr->HasDefaultLayout()
+					|| a_store_ptr->GetComponentTypes().size() != archetype.rows.size() || a_store_ptr->GetSharedTypes().size() != 1) {
+					return false;
+				}
+
+				std::vector<size_t> archetype_flipped_rows;
+				for (size_t row_index = 0; row_index < archetype.rows.size(); row_index++) {
+					const PartitionData::Row& row = archetype.rows[row_index];
+					size_t offset = a_store_ptr->GetRowOffsets()[row_index];
+					size_t previous_offset = a_store_ptr->GetRowPreviousOffsets()[row_index];
+					if (component_type_mgr.GetComponentType(a_store_ptr->GetComponentTypes()[row_index]).name != row.name) {
+						return false;
+					}
+					if (offset == row.previous_offset && previous_offset == row.offset && offset != previous_offset) {
+						archetype_flipped_rows.push_back(row_index);
+					}
+					else if (offset != row.offset || previous_offset != row.previous_offset) {
+						return false;
+					}
+				}
+
+				for (const auto& chunk_entities : archetype.chunk_entities) {
+					for (const auto& entity : chunk_entities) {
+						if (entities.count(entity) != 0 || null_entities.count(entity) != 0) {
+							return false;
+						}
+					}
+				}
+				a_ids.push_back(a_id);
+				flipped_rows.push_back(std::move(archetype_flipped_rows));
+			}
+
+			if (data.GetEntityCount() == 0) {
+				return true;
+			}
+			SharedKey shared_key{ storage_mgr.GetOrCreateSharedValueStore<Partition>(partition_c_id).FindOrAdd(Partition(data.GetPartitionID())) };
+
+			for (size_t a = 0; a < a_ids.size(); a++) {
+				PartitionData::ArchetypeChunks& archetype = data.GetArchetypes()[a];
+				for (size_t i = 0; i < archetype.chunks.size(); i++) {
+					char* chunk_data = static_cast<char*>(archetype.chunks[i]->chunk_ptr);
+					for (const auto& row_index : flipped_rows[a]) {
+						const PartitionData::Row& row = archetype.rows[row_index];
+						std::swap_ranges(chunk_data + row.offset, chunk_data + row.offset + row.size * archetype.chunk_entity_capacity,
+							chunk_data + row.previous_offset);
+					}
+
+					const std::vector<Entity>& chunk_entities = archetype.chunk_entities[i];
+					storage_mgr.AttachChunk(a_ids[a], archetype.chunks[i].release(), chunk_entities.data(), chunk_entities.size(), shared_key);
+					for (const auto& entity : chunk_entities) {
+						entities.insert(entity);
+						entity_id_counter.store(std::max(entity_id_counter.load(), entity.id + 1));
+					}
+					ECS_PROFILE_COUNT(structural_changes, chunk_entities.size());
+				}
+			}
+			data.GetArchetypes().clear();
+			return true;
+		}
+
+		// Move the entities having all of Args to another manager, e.g. from a staging world to the live one, giving them
+		// new entities there; returns the new entity of each moved one. Where the archetype's chunk layout is the same
+		// in both, whole chunks are handed over without copying, only the entity indices being built; the entities of
+		// partially filled chunks are copied one by one, filling the destination's chunks. The component types are
+		// matched by stable name. Chunks are handed over only between managers of the same memory resource; from
+		// another resource, e.g. an arena released with the staging world, a full chunk is copied as a whole into
+		// one of the destination's. Entities with shared, relation or sparse
+		// set components, with children, that are the target of relations or in read-only chunks, are not moved; entity
+		// handles stored in components are not remapped.
+		template <typename... Args>
+		std::unordered_map<Entity, Entity> MoveEntities(EntityManager& dst)
+		{
+			static_assert(!(IsSparseComponent<Args> || ...), "sparse set components are not stored in chunks");
+			assert(&dst != this);
+
+			ComponentTypeIDSet c_id_set;
+			(this->InsertChunkComponentTypeID<Args>(c_id_set), ...);
+			bool has_sparse_components = storage_mgr.HasSparseComponents();
+			auto is_movable = [&](const Entity& entity) -> bool {
+				return children_by_parent.count(entity) == 0 && component_type_mgr.GetPairTypeIDsOfTarget(entity).empty() && !this->IsEntityReadOnly(entity)
+					&& !(has_sparse_components && storage_mgr.HasSparseComponents(entity));
+			};
+
+			std::unordered_map<Entity, Entity> moved_entities;
+			for (const auto& a_id : archetype_mgr.GetArchetypeContains(c_id_set)) {
+				auto iter = storage_mgr.GetArchetypeStorages().find(a_id);
+				if (iter == storage_mgr.GetArchetypeStorages().end() || iter->second->GetEntityCount() == 0) {
+					continue;
+				}
+				ArchetypeStorage* a_store_ptr = iter->second;
+				if (!a_store_ptr->GetSharedTypes().empty()) {
+					continue;
+				}
+
+				// The same archetype in the destination, by the names of the component types. All of them are checked
+				// before registering any, so that a rejected archetype adds no types to the destination.
+				bool has_dst_types = true;
+				for (const auto& c_id : a_store_ptr->GetComponentTypes()) {
+					const ComponentType& c_type = component_type_mgr.GetComponentType(c_id);
+					ComponentTypeID dst_c_id;
+					if (c_type.is_pair || (dst.component_type_mgr.FindComponentTypeID(c_type.name, dst_c_id)
+						&& (dst.component_type_mgr.GetComponentType(dst_c_id).size != c_type.size || dst.component_type_mgr.GetComponentType(dst_c_id).storage != c_type.storage))) {
+						has_dst_types = false;
+						break;
+					}
+				}
+				if (!has_dst_types) {
+					continue;
+				}
+				ComponentTypeIDSet dst_c_id_set;
+				for (const auto& c_id : a_store_ptr->GetComponentTypes()) {
+					ComponentTypeID dst_c_id;
+					dst.component_type_mgr.GetOrCreateComponentTypeID(component_type_mgr.GetComponentType(c_id), dst_c_id);
+					dst_c_id_set.insert(dst_c_id);
+				}
+				ArchetypeID dst_a_id = dst.archetype_mgr.GetOrCreateArchetype(dst_c_id_set);
+				ArchetypeStorage* dst_a_store_ptr = dst.storage_mgr.GetOrAddArchetypeStorage(dst_a_id);
+
+				// The rows are ordered by name in both, but double-buffered rows may have their buffers swapped
+				bool same_layout = !mapped_file && a_store_ptr->HasDefaultLayout() && dst_a_store_ptr->HasDefaultLayout()
+					&& a_store_ptr->GetChunkEntityCapacity() == dst_a_store_ptr->GetChunkEntityCapacity();
+				std::vector<size_t> flipped_rows;
+				for (size_t row_index = 0; same_layout && row_index < a_store_ptr->GetComponentTypes().size(); row_index++) {
+					size_t offset = a_store_ptr->GetRowOffsets()[row_index];
+					size_t previous_offset = a_store_ptr->GetRowPreviousOffsets()[row_index];
+					size_t dst_offset = dst_a_store_ptr->GetRowOffsets()[row_index];
+					size_t dst_previous_offset = dst_a_store_ptr->GetRowPreviousOffsets()[row_index];
+					if (dst_offset == previous_offset && dst_previous_offset == offset && offset != previous_offset) {
+						flipped_rows.push_back(row_index);
+					}
+					else if (dst_offset != offset || dst_previous_offset != previous_offset) {
+						same_layout = false;
+					}
+				}
+
+				// Full chunks of movable entities are handed over, the other entities are copied
+				std::vector<size_t> whole_chunks;
+				std::vector<Entity> copied_entities;
+				for (size_t i = 0; i < a_store_ptr->GetChunkCount(); i++) {
+					const Entity* chunk_entities = a_store_ptr->GetChunkEntities(i);
+					size_t entity_count = a_store_ptr->GetChunkEntityCount(i);
+					bool whole_chunk = same_layout && entity_count == a_store_ptr->GetChunkEntityCapacity();
+					for (size_t j = 0; j < entity_count && whole_chunk; j++) {
+						whole_chunk = is_movable(chunk_entities[j]);
+					}
+					if (whole_chunk) {
+						whole_chunks.push_back(i);
+						continue;
+					}
+					for (size_t j = 0; j < entity_count; j++) {
+						if (is_movable(chunk_entities[j])) {
+							copied_entities.push_back(chunk_entities[j]);
+						}
+					}
+				}
+
+				// From the last chunk, since a detached chunk is replaced by the last one
+				for (size_t k = whole_chunks.size(); k-- > 0;) {
+					std::vector<Entity> chunk_entities;
+					std::unique_ptr<Chunk> chunk_ptr(storage_mgr.DetachChunk(a_id, whole_chunks[k], chunk_entities));
+					char* chunk_data = static_cast<char*>(chunk_ptr->chunk_ptr);
+					for (const auto& row_index : flipped_rows) {
+						size_t row_bytes = a_store_ptr->GetRowSizeofs()[row_index] * a_store_ptr->GetChunkEntityCapacity();
+						std::swap_ranges(chunk_data + a_store_ptr->GetRowOffsets()[row_index], chunk_data + a_store_ptr->GetRowOffsets()[row_index] + row_bytes,
+							chunk_data + a_store_ptr->GetRowPreviousOffsets()[row_index]);
+					}
+
+					std::vector<Entity> new_entities;
+					new_entities.reserve(chunk_entities.size());
+					for (const auto& entity : chunk_entities) {
+						new_entities.push_back(dst.ReserveEntity());
+						moved_entities.insert({ entity, new_entities.back() });
+						entities.erase(entity);
+					}
+					dst.storage_mgr.AttachChunk(dst_a_id, chunk_ptr.release(), new_entities.data(), new_entities.size(), SharedKey());
+					dst.entities.insert(new_entities.begin(), new_entities.end());
+					ECS_PROFILE_COUNT(structural_changes, chunk_entities.size());
+				}
+
+				for (const auto& entity : copied_entities) {
+					Entity new_entity = dst.ReserveEntity();
+					dst.storage_mgr.AddEntities(&new_entity, 1, dst_a_id, SharedKey(), a_store_ptr->GetEntityRowAddresses(entity));
+					dst.entities.insert(new_entity);
+					moved_entities.insert({ entity, new_entity });
+					storage_mgr.RemoveEntity(entity);
+					entities.erase(entity);
+					ECS_PROFILE_COUNT(structural_changes, 1);
+				}
+			}
+			return moved_entities;
+		}
+
+		// Capture the state of the world as the base of later deltas, see EncodeDelta. Capturing into a snapshot of
+		// this world again only copies the chunks changed since it was captured.
+		void CaptureSnapshot(WorldSnapshot& snapshot)
+		{
+			uint64_t base_version = snapshot.version;
+			snapshot.version = storage_mgr.NextChangeVersion();
+			snapshot.entities = entities;
+			snapshot.null_entities = null_entities;
+
+			for (const auto& [a_id, a_store_ptr] : storage_mgr.GetArchetypeStorages()) {
+				WorldSnapshot::ArchetypeChunks& archetype = snapshot.archetypes[a_id];
+				archetype.row_offsets = a_store_ptr->GetRowOffsets();
+				archetype.chunks.resize(a_store_ptr->GetChunkCount());
+				archetype.chunk_entities.resize(a_store_ptr->GetChunkCount());
+
+				for (size_t i = 0; i < a_store_ptr->GetChunkCount(); i++) {
+					if (base_version != 0 && !archetype.chunks[i].empty() && a_store_ptr->GetChunkVersion(i) <= base_version) {
+						continue;  // unchanged since the last capture
+					}
+					const char* chunk_data = static_cast<const char*>(a_store_ptr->GetChunk(i)->chunk_ptr);
+					archetype.chunks[i].assign(chunk_data, chunk_data + ArchetypeStorage::GetChunkSize());
+					const Entity* chunk_entities = a_store_ptr->GetChunkEntities(i);
+					archetype.chunk_entities[i].assign(chunk_entities, chunk_entities + a_store_ptr->GetChunkEntityCount(i));
+				}
+
+				archetype.entity_indices.clear();
+				for (size_t i = 0; i < archetype.chunk_entities.size(); i++) {
+					for (size_t j = 0; j < archetype.chunk_entities[i].size(); j++) {
+						archetype.entity_indices.insert({ archetype.chunk_entities[i][j], EntityIndex(i, j) });
+					}
+				}
+			}
+		}
+
+		// Encode the changes of the world since a snapshot of it into a compact delta, to be applied by ApplyDelta to
+		// a world in the snapshot's state, e.g. a replica or the world rolled back. Only the rows of the chunks changed
+		// since the snapshot are encoded, XORed with their base values and run-length encoded. Previous buffers of
+		// double-buffered components are not encoded. Returns false if the world can't be encoded: having sparse set
+		// components, shared components, components that can't be persisted (see SaveStorage), or entities in
+		// archetypes with interleaved or cold components.
+		bool EncodeDelta(const WorldSnapshot& base, std::vector<char>& delta) const
+		{
+			if (!this->HasOnlyByteCopyableData()) {
+				return false;
+			}
+			for (const auto& [a_id, a_store_ptr] : storage_mgr.GetArchetypeStorages()) {
+				if (a_store_ptr->GetEntityCount() != 0 && !a_store_ptr->HasDefaultLayout()) {
+					return false;
+				}
+			}
+			delta.clear();
+
+			std::vector<Entity> destroyed_entities;
+			for (const auto& base_entities : { &base.entities, &base.null_entities }) {
+				for (const auto& entity : *base_entities) {
+					if (entities.count(entity) == 0 && null_entities.count(entity) == 0) {
+						destroyed_entities.push_back(entity);
+					}
+				}
+			}
+			Internal::AppendVarint(delta, destroyed_entities.size());
+			for (const auto& entity : destroyed_entities) {
+				Internal::AppendVarint(delta, entity.id);
+			}
+
+			std::vector<Entity> new_null_entities;
+			for (const auto& entity : null_entities) {
+				if (base.null_entities.count(entity) == 0) {
+					new_null_entities.push_back(entity);
+				}
+			}
+			Internal::AppendVarint(delta, new_null_entities.size());
+			for (const auto& entity : new_null_entities) {
+				Internal::AppendVarint(delta, entity.id);
+			}
+
+			std::vector<char> archetype_records;
+			size_t archetype_count = 0;
+			std::vector<char> row_base;
+			for (const auto& [a_id, a_store_ptr] : storage_mgr.GetArchetypeStorages()) {
+				auto base_iter = base.archetypes.find(a_id);
+				const WorldSnapshot::ArchetypeChunks* base_archetype = base_iter == base.archetypes.end() ? nullptr : &base_iter->second;
+				const std::vector<ComponentTypeID>& component_types = a_store_ptr->GetComponentTypes();
+
+				std::vector<char> chunk_records;
+				size_t chunk_count = 0;
+				for (size_t i = 0; i < a_store_ptr->GetChunkCount(); i++) {
+					size_t entity_count = a_store_ptr->GetChunkEntityCount(i);
+					if (entity_count == 0 || (base.version != 0 && a_store_ptr->GetChunkVersion(i) <= base.version)) {
+						continue;
+					}
+					chunk_count++;
+					const Entity* chunk_entities = a_store_ptr->GetChunkEntities(i);
+					Internal::AppendVarint(chunk_records, entity_count);
+					for (size_t j = 0; j < entity_count; j++) {
+						Internal::AppendVarint(chunk_records, chunk_entities[j].id);
+					}
+
+					std::vector<size_t> changed_rows;
+					for (size_t row_index = 0; row_index < component_types.size(); row_index++) {
+						if (base.version == 0 || a_store_ptr->GetRowVersion(i, row_index) > base.version) {
+							changed_rows.push_back(row_index);
+						}
+					}
+					Internal::AppendVarint(chunk_records, changed_rows.size());
+
+					const char* chunk_data = static_cast<const char*>(a_store_ptr->GetChunk(i)->chunk_ptr);
+					for (const auto& row_index : changed_rows) {
+						size_t row_size = a_store_ptr->GetRowSizeofs()[row_index];
+						row_base.assign(row_size * entity_count, 0);
+						for (size_t j = 0; base_archetype != nullptr && j < entity_count; j++) {
+							auto index_iter = base_archetype->entity_indices.find(chunk_entities[j]);
+							if (index_iter != base_archetype->entity_indices.end()) {
+								const EntityIndex& base_e_index = index_iter->second;
+								const char* base_value = base_archetype->chunks[base_e_index.chunk_index].data()
+									+ base_archetype->row_offsets[row_index] + base_e_index.col_index * row_size;
+								std::copy(base_value, base_value + row_size, row_base.begin() + j * row_size);
+							}
+						}
+						Internal::AppendVarint(chunk_records, row_index);
+						Internal::AppendXorRuns(chunk_records, chunk_data + a_store_ptr->GetRowOffsets()[row_index], row_base.data(), row_base.size());
+					}
+				}
+				if (chunk_count == 0) {
+					continue;
+				}
+
+				archetype_count++;
+				Internal::AppendVarint(archetype_records, component_types.size());
+				for (const auto& c_id : component_types) {
+					const ComponentType& c_type = component_type_mgr.GetComponentType(c_id);
+					Internal::AppendVarint(archetype_records, c_type.size);
+					Internal::AppendVarint(archetype_records, c_type.name.size());
+					archetype_records.insert(archetype_records.end(), c_type.name.begin(), c_type.name.end());
+				}
+				Internal::AppendVarint(archetype_records, chunk_count);
+				archetype_records.insert(archetype_records.end(), chunk_records.begin(), chunk_records.end());
+			}
+			Internal::AppendVarint(delta, archetype_count);
+			delta.insert(delta.end(), archetype_records.begin(), archetype_records.end());
+			return true;
+		}
+
+		// Patch the world with a delta encoded by EncodeDelta against a snapshot of a world in the same state as this:
+		// destroy and create entities, move entities between archetypes and XOR their changed rows. Returns false,
+		// changing nothing, if the delta is corrupted, an archetype's component types differ from this world's, or
+		// the world has read-only chunks.
+		bool ApplyDelta(const std::vector<char>& delta)
+		{
+			Internal::ParsedDelta parsed;
+			if ((mapped_file && storage_mgr.HasReadOnlyChunks()) || !Internal::ParseDelta(delta, parsed)) {
+				return false;
+			}
+
+			// Resolve the archetypes and check everything before changing any entity
+			std::vector<ArchetypeID> a_ids;
+			std::vector<std::vector<ComponentTypeID>> row_c_ids;
+			std::unordered_set<Entity> chunk_entities;
+			for (const auto& archetype : parsed.archetypes) {
+				ComponentTypeIDSet c_id_set;
+				std::vector<ComponentTypeID> archetype_c_ids;
+				for (const auto& [name, size] : archetype.rows) {
+					ComponentTypeID c_id;
+					if (!component_type_mgr.GetOrCreateComponentTypeID(name, size, c_id)) {
+						return false;
+					}
+					const ComponentType& c_type = component_type_mgr.GetComponentType(c_id);
+					if (!c_type.trivially_copyable || c_type.is_pair || c_type.storage != StoragePolicy::Chunk) {
+						return false;
+					}
+					c_id_set.insert(c_id);
+					archetype_c_ids.push_back(c_id);
+				}
+				if (c_id_set.size() != archetype_c_ids.size()) {
+					return false;
+				}
+				for (const auto& chunk : archetype.chunks) {
+					for (const auto& entity : chunk.entities) {
+						if (!chunk_entities.insert(entity).second) {
+							return false;
+						}
+					}
+				}
+				a_ids.push_back(archetype_mgr.GetOrCreateArchetype(c_id_set));
+				row_c_ids.push_back(std::move(archetype_c_ids));
+			}
+
+			for (const auto& entity : parsed.destroyed_entities) {
+				if (entities.count(entity) != 0 || null_entities.count(entity) != 0) {
+					this->DestroyEntity(entity);
+				}
+			}
+			for (const auto& entity : parsed.null_entities) {
+				if (entities.count(entity) != 0) {
+					this->RemoveEntityAllComponents(entity);
+				}
+				null_entities.insert(entity);
+				entity_id_counter.store(std::max(entity_id_counter.load(), entity.id + 1));
+			}
+
+			for (size_t a = 0; a < a_ids.size(); a++) {
+				for (const auto& chunk : parsed.archetypes[a].chunks) {
+					for (const auto& entity : chunk.entities) {
+						// An entity new to the archetype has zeros as the base of its rows, as in the encoder
+						if (entities.count(entity) == 0 || storage_mgr.GetEntityArchetypeID(entity) != a_ids[a]) {
+							if (entities.count(entity) == 0) {
+								null_entities.erase(entity);
+								entities.insert(entity);
+								storage_mgr.AddEntity<>(entity, a_ids[a]);
+								entity_id_counter.store(std::max(entity_id_counter.load(), entity.id + 1));
+							}
+							else {
+								storage_mgr.MigrateEntity(entity, a_ids[a]);
+							}
+							for (const auto& c_id : row_c_ids[a]) {
+								std::memset(storage_mgr.GetEntityComponentData(entity, c_id), 0, component_type_mgr.GetComponentType(c_id).size);
+							}
+							ECS_PROFILE_COUNT(structural_changes, 1);
+						}
+					}
+					for (const auto& [row_index, runs] : chunk.changed_rows) {
+						ComponentTypeID c_id = row_c_ids[a][row_index];
+						Internal::ApplyXorRuns(runs, component_type_mgr.GetComponentType(c_id).size, chunk.entities.size(),
+							[&](size_t i) -> void* { return storage_mgr.GetEntityComponentData(chunk.entities[i], c_id); });
+					}
+				}
+			}
+			return true;
+		}
+
+		// Save the state of the world into a checkpoint, to roll back to by RestoreCheckpoint. Only the chunks changed
+		// since a previous checkpoint of the world (e.g. the last one saved or restored) are copied; the others, and
+		// the entity bookkeeping if no entity was added or removed since, are shared with it. Returns false if the
+		// world can't be checkpointed: having data outside of chunks or not byte-copyable (see EncodeDelta), or
+		// mapped storage.
+		bool SaveCheckpoint(WorldCheckpoint& checkpoint, const WorldCheckpoint* previous_ptr = nullptr)
+		{
+			if (mapped_file || !this->HasOnlyByteCopyableData()) {
+				return false;
+			}
+			bool structure_changed = previous_ptr == nullptr || !previous_ptr->entities_ptr
+				|| storage_mgr.HasStructureChangedSince(previous_ptr->storage.version);
+			storage_mgr.CaptureCheckpoint(checkpoint.storage, previous_ptr == nullptr ? nullptr : &previous_ptr->storage);
+
+			if (structure_changed) {
+				checkpoint.entities_ptr.reset(new std::unordered_set<Entity>(entities));
+			}
+			else {
+				checkpoint.entities_ptr = previous_ptr->entities_ptr;
+			}
+			checkpoint.null_entities = null_entities;
+			checkpoint.entity_id_counter = entity_id_counter.load();
+			checkpoint.taken = false;
+			return true;
+		}
+
+		// Put the world back to its state at a checkpoint saved by SaveCheckpoint, copying back only the chunks changed
+		// since. The entities created since are gone and their IDs are given out again, so that a resimulation
+		// creates the same entities. Returns false, changing nothing, if the world can't be checkpointed any more.
+		bool RestoreCheckpoint(const WorldCheckpoint& checkpoint)
+		{
+			if (!checkpoint.entities_ptr || checkpoint.taken || mapped_file || !this->HasOnlyByteCopyableData()) {
+				return false;
+			}
+			if (storage_mgr.RestoreCheckpoint(checkpoint.storage)) {
+				entities = *checkpoint.entities_ptr;
+			}
+			null_entities = checkpoint.null_entities;
+			entity_id_counter.store(checkpoint.entity_id_counter);
+			return true;
+		}
+
+		// Same as above, for a checkpoint no longer needed, e.g. of a speculative frame: the chunk copies held by it
+		// alone are swapped into the world rather than copied back. The checkpoint can't be restored any more, but
+		// the next one can still be saved upon it, as the chunks swapped count as changed since.
+		bool RestoreCheckpoint(WorldCheckpoint&& checkpoint)
+		{
+			if (!checkpoint.entities_ptr || checkpoint.taken || mapped_file || !this->HasOnlyByteCopyableData()) {
+				return false;
+			}
+			if (storage_mgr.RestoreCheckpoint(std::move(checkpoint.storage))) {
+				entities = *checkpoint.entities_ptr;
+			}
+			null_entities = checkpoint.null_entities;
+			entity_id_counter.store(checkpoint.entity_id_counter);
+			checkpoint.taken = true;
+			return true;
+		}
+
+		// Memory accounting of the storage and the entity bookkeeping, cheap enough to be sampled every frame.
+		void GetStorageStats(StorageStats& stats) const
+		{
+			storage_mgr.GetStorageStats(stats);
+			stats.entity_bookkeeping_bytes += Internal::HashContainerBytes(entities) + Internal::HashContainerBytes(null_entities);
+		}
+
 		// For debug
 		void PrintEntitiesInfo() const
 		{
@@ -190,22 +1218,362 @@ namespace ECS
 		void ForEach(F func)
 		{
 			// ҪǱʱ entity ɾ⡣
-			ComponentTypeIDSet c_id_set = { component_type_mgr.GetOrCreateComponentTypeID<Args>()... };
+			ComponentTypeIDSet c_id_set;
+			(this->InsertChunkComponentTypeID<Args>(c_id_set), ...);
+
+			if constexpr ((IsSparseComponent<Args> || ...)) {
+				this->ForEachJoinSparse<F, Args...>(func, c_id_set);
+			}
+			else {
+				for (const auto& a_id : archetype_mgr.GetArchetypeContains(c_id_set)) {
+					std::vector<Entity> entities = storage_mgr.GetEntities(a_id, slice_index, slice_count);
+					ECS_PROFILE_COUNT(entities_visited, entities.size());
+					ECS_PROFILE_COUNT(chunks_visited, storage_mgr.GetArchetypeStorages().at(a_id)->GetUsedChunkCount());
+
+					for (const auto& entity : entities) {
+						func(&entity, this->GetQueryComponent<Args>(entity)...);
+					}
+				}
+			}
+		}
+
+		// Call func once per non-empty chunk of the archetypes having all of Args, with a view of the chunk's
+		// component arrays and shared values, e.g. to batch the entities sharing a mesh into one draw call.
+		template <typename... Args, typename F>
+		void ForEachChunk(F func)
+		{
+			static_assert(!(IsSparseComponent<Args> || ...), "sparse set components are not stored in chunks");
+
+			ComponentTypeIDSet c_id_set;
+			(this->InsertChunkComponentTypeID<Args>(c_id_set), ...);
 
 			for (const auto& a_id : archetype_mgr.GetArchetypeContains(c_id_set)) {
-				std::vector<Entity> entities = storage_mgr.GetEntities(a_id);
-				for (const auto& entity : entities) {
-					func(&entity, this->GetEntityComponent<Args>(entity)...);
+				ArchetypeStorage* a_store_ptr = storage_mgr.GetArchetypeStorages().at(a_id);
+
+				for (size_t i = slice_index; i < a_store_ptr->GetChunkCount(); i += slice_count) {
+					if (a_store_ptr->GetChunkEntityCount(i) == 0) {
+						continue;
+					}
+					ECS_PROFILE_COUNT(entities_visited, a_store_ptr->GetChunkEntityCount(i));
+					ECS_PROFILE_COUNT(chunks_visited, 1);
+					func(ChunkView(&component_type_mgr, &storage_mgr, a_store_ptr, i));
 				}
 			}
 		}
 
+		// Same as ForEachChunk, with the chunks processed in parallel by a job system, each preferably by a worker on
+		// the NUMA node of the chunk's memory, see NumaChunkResource. func must be safe to run concurrently on
+		// different chunks.
+		template <typename... Args, typename F>
+		void ForEachChunkParallel(F func, JobSystem& job_system)
+		{
+			std::vector<std::pair<ArchetypeStorage*, size_t>> chunk_refs;
+			this->ForEachChunk<Args...>([&](const ChunkView& chunk) -> void {
+				chunk_refs.push_back({ chunk.GetArchetypeStorage(), chunk.GetChunkIndex() });
+			});
+
+			job_system.ParallelFor(chunk_refs.size(), [&](size_t i) -> void {
+				func(ChunkView(&component_type_mgr, &storage_mgr, chunk_refs[i].first, chunk_refs[i].second));
+			}, [&](size_t i) -> size_t {
+				return chunk_refs[i].first->GetChunkNumaNode(chunk_refs[i].second);
+			});
+		}
+
+		// Reorder the entities of the archetypes having T and all of Args so that ForEach and ForEachChunk visit them
+		// in the order of compare(const T&, const T&), e.g. by depth or material to batch draw calls. The order holds
+		// within each archetype, and among the chunks sharing the same shared values. Sorting again data already
+		// nearly sorted, e.g. sorted last frame, costs a comparison per entity. Returns the number of entities moved.
+		template <typename T, typename... Args, typename Compare>
+		size_t SortBy(Compare compare)
+		{
+			static_assert(!IsSparseComponent<T> && !(IsSparseComponent<Args> || ...), "sparse set components are not stored in chunks");
+
+			ComponentTypeIDSet c_id_set;
+			this->InsertChunkComponentTypeID<T>(c_id_set);
+			(this->InsertChunkComponentTypeID<Args>(c_id_set), ...);
+			ComponentTypeID c_id = component_type_mgr.GetComponentTypeID<T>();
+
+			size_t moved_count = 0;
+			for (const auto& a_id : archetype_mgr.GetArchetypeContains(c_id_set)) {
+				moved_count += storage_mgr.GetArchetypeStorages().at(a_id)->SortBy(c_id, [&](const void* lhs, const void* rhs) -> bool {
+					return compare(*static_cast<const T*>(lhs), *static_cast<const T*>(rhs));
+				});
+			}
+			return moved_count;
+		}
+
+		// Call func(a_id, a_store_ptr) for every archetype storage having all of Args, with its empty chunks as well,
+		// e.g. to follow the changes of the chunks by their versions.
+		template <typename... Args, typename F>
+		void ForEachArchetypeStorage(F func)
+		{
+			ComponentTypeIDSet c_id_set;
+			(this->InsertChunkComponentTypeID<Args>(c_id_set), ...);
+
+			for (const auto& a_id : archetype_mgr.GetArchetypeContains(c_id_set)) {
+				func(a_id, storage_mgr.GetArchetypeStorages().at(a_id));
+			}
+		}
+
+		// Take a change version: the chunks changed after this call have greater versions, see
+		// ArchetypeStorage::GetChunkVersion.
+		uint64_t NextChangeVersion()
+		{
+			return storage_mgr.NextChangeVersion();
+		}
+
+		template <typename T>
+		ComponentTypeID GetComponentTypeID()
+		{
+			return component_type_mgr.GetOrCreateComponentTypeID<T>();
+		}
+
+#ifdef ECS_ENABLE_PROFILING
+		// Take the work counted since the last call.
+		ProfileCounters TakeProfileCounters()
+		{
+			ProfileCounters counters = profile_counters;
+			profile_counters = ProfileCounters();
+			return counters;
+		}
+#endif
+
 	private:
+		// Whether all component data is in chunks and can be copied as bytes, i.e. there are no sparse set
+		// components, shared components or relation pairs, and all chunk components can be persisted.
+		bool HasOnlyByteCopyableData() const
+		{
+			if (storage_mgr.HasSparseComponents() || storage_mgr.HasSharedComponents()) {
+				return false;
+			}
+			for (const auto& [a_id, a_store_ptr] : storage_mgr.GetArchetypeStorages()) {
+				for (const auto& c_id : a_store_ptr->GetComponentTypes()) {
+					const ComponentType& c_type = component_type_mgr.GetComponentType(c_id);
+					if (a_store_ptr->GetEntityCount() != 0 && (!c_type.trivially_copyable || c_type.is_pair)) {
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+
+		// The component handed to a ForEach function for the query term T: a read-only term (const T) of a
+		// double-buffered component reads the previous frame's value, any other term the current one. The row of
+		// a read-only term isn't marked as changed.
+		template <typename T>
+		T* GetQueryComponent(const Entity& entity)
+		{
+			if constexpr (std::is_const_v<T> && IsDoubleBufferedComponent<T>) {
+				return storage_mgr.GetPreviousEntityComponent<std::remove_const_t<T>>(entity);
+			}
+			else if constexpr (std::is_const_v<T> && !IsSparseComponent<T> && !IsSharedComponent<T>) {
+				return storage_mgr.ReadEntityComponent<std::remove_const_t<T>>(entity);
+			}
+			else {
+				return this->GetEntityComponent<std::remove_const_t<T>>(entity);
+			}
+		}
+
+		template <typename T>
+		void InsertChunkComponentTypeID(ComponentTypeIDSet& c_id_set)
+		{
+			ComponentTypeID c_id = component_type_mgr.GetOrCreateComponentTypeID<std::remove_const_t<T>>();
+			if constexpr (!IsSparseComponent<T>) {
+				c_id_set.insert(c_id);
+			}
+		}
+
+		template <typename T>
+		void DefaultConstructSparseComponent(const Entity& entity)
+		{
+			if constexpr (IsSparseComponent<T>) {
+				storage_mgr.GetOrCreateSparseSet<T>(component_type_mgr.GetComponentTypeID<T>()).Emplace(entity);
+			}
+		}
+
+		// Keep the smallest sparse set of the query terms in driver_ptr; an absent set has no entity at all.
+		template <typename T>
+		void FindSparseDriver(const SparseSetBase*& driver_ptr, bool& has_empty_set)
+		{
+			if constexpr (IsSparseComponent<T>) {
+				const SparseSetBase* sparse_set_ptr = storage_mgr.GetSparseSet<std::remove_const_t<T>>(component_type_mgr.GetComponentTypeID<T>());
+				if (sparse_set_ptr == nullptr || sparse_set_ptr->Size() == 0) {
+					has_empty_set = true;
+				}
+				else if (driver_ptr == nullptr || sparse_set_ptr->Size() < driver_ptr->Size()) {
+					driver_ptr = sparse_set_ptr;
+				}
+			}
+		}
+
+		// ForEach over a query with sparse set terms: walk whichever is smaller, the smallest sparse set
+		// (probing the archetypes of its entities) or the matching archetypes (probing the sparse sets).
+		template <typename F, typename... Args>
+		void ForEachJoinSparse(F func, const ComponentTypeIDSet& c_id_set)
+		{
+			const SparseSetBase* driver_ptr = nullptr;
+			bool has_empty_set = false;
+			(this->FindSparseDriver<Args>(driver_ptr, has_empty_set), ...);
+			if (has_empty_set) {
+				return;
+			}
+
+			ArchetypeIDSet a_id_set;
+			size_t archetype_entity_count = 0;
+			if (!c_id_set.empty()) {
+				a_id_set = archetype_mgr.GetArchetypeContains(c_id_set);
+				for (const auto& a_id : a_id_set) {
+					archetype_entity_count += storage_mgr.GetArchetypeStorages().at(a_id)->GetEntityCount();
+				}
+			}
+
+			if (c_id_set.empty() || driver_ptr->Size() <= archetype_entity_count) {
+				std::vector<Entity> entities = driver_ptr->GetEntities();
+				ECS_PROFILE_COUNT(entities_visited, entities.size());
+
+				for (size_t i = slice_index; i < entities.size(); i += slice_count) {
+					const Entity& entity = entities[i];
+					if ((this->HasComponent<std::remove_const_t<Args>>(entity) && ...)) {
+						func(&entity, this->GetQueryComponent<Args>(entity)...);
+					}
+				}
+			}
+			else {
+				for (const auto& a_id : a_id_set) {
+					std::vector<Entity> entities = storage_mgr.GetEntities(a_id, slice_index, slice_count);
+					ECS_PROFILE_COUNT(entities_visited, entities.size());
+					ECS_PROFILE_COUNT(chunks_visited, storage_mgr.GetArchetypeStorages().at(a_id)->GetUsedChunkCount());
+
+					for (const auto& entity : entities) {
+						if ((this->HasSparseComponent<std::remove_const_t<Args>>(entity) && ...)) {
+							func(&entity, this->GetQueryComponent<Args>(entity)...);
+						}
+					}
+				}
+			}
+		}
+
+		// Whether the entity has T, if T is a sparse set component; true for chunk components.
+		template <typename T>
+		bool HasSparseComponent(const Entity& entity)
+		{
+			if constexpr (IsSparseComponent<T>) {
+				return this->HasComponent<T>(entity);
+			}
+			return true;
+		}
+
+		// Add a chunk component type to an entity, migrating it to the archetype with the type; the data is left
+		// unconstructed if the entity didn't have the type.
+		void AddChunkComponentTypeID(const Entity& entity, const ComponentTypeID& add_c_id)
+		{
+			if (null_entities.count(entity) != 0) {
+				ArchetypeID a_id = archetype_mgr.GetOrCreateArchetype(ComponentTypeIDSet{ add_c_id });
+				storage_mgr.AddEntity<>(entity, a_id);
+
+				null_entities.erase(entity);
+				entities.insert(entity);
+				ECS_PROFILE_COUNT(structural_changes, 1);
+			}
+			else if (!storage_mgr.HasComponentType(entity, add_c_id)) {
+				ComponentTypeIDSet c_id_set = archetype_mgr.GetArchtype(storage_mgr.GetEntityArchetypeID(entity)).GetComponentTypeIDs();
+				c_id_set.insert(add_c_id);
+
+				storage_mgr.MigrateEntity(entity, archetype_mgr.GetOrCreateArchetype(c_id_set));
+				ECS_PROFILE_COUNT(structural_changes, 1);
+			}
+		}
+
+		void RemoveChunkComponentTypeID(const Entity& entity, const ComponentTypeID& remove_c_id)
+		{
+			if (null_entities.count(entity) != 0 || !storage_mgr.HasComponentType(entity, remove_c_id) || this->IsEntityReadOnly(entity)) {
+				// Nothing to remove, or the entity can't be changed
+				return;
+			}
+
+			ArchetypeID old_a_id = storage_mgr.GetEntityArchetypeID(entity);
+			ComponentTypeIDSet c_id_set = archetype_mgr.GetArchtype(old_a_id).GetComponentTypeIDs();
+			c_id_set.erase(remove_c_id);
+
+			if (c_id_set.size() == 0) {
+				this->RemoveEntityArchetype(entity);
+			}
+			else {
+				ArchetypeID new_a_id = archetype_mgr.GetOrCreateArchetype(c_id_set);
+				storage_mgr.MigrateEntity(entity, new_a_id);
+				ECS_PROFILE_COUNT(structural_changes, 1);
+			}
+		}
+
+		// Whether the ancestor is a parent, a grandparent... of the entity
+		bool IsAncestor(const Entity& ancestor, const Entity& entity)
+		{
+			for (Entity cur = this->GetParent(entity); cur.id != NULL_ENTITY.id; cur = this->GetParent(cur)) {
+				if (cur.id == ancestor.id) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Remove a child from the children of its parent; returns false if it has no parent.
+		bool DetachFromParent(const Entity& child)
+		{
+			Entity parent = this->GetParent(child);
+			if (parent.id == NULL_ENTITY.id) {
+				return false;
+			}
+
+			std::vector<Entity>& siblings = children_by_parent.at(parent);
+			siblings.erase(std::find_if(siblings.begin(), siblings.end(), [&](const Entity& sibling) -> bool {
+				return sibling.id == child.id;
+			}));
+			if (siblings.empty()) {
+				children_by_parent.erase(parent);
+			}
+			return true;
+		}
+
+		void SetSubtreeDepth(const Entity& entity, size_t depth)
+		{
+			this->AddEntityComponent<HierarchyDepth>(entity, depth);
+
+			auto children_iter = children_by_parent.find(entity);
+			if (children_iter != children_by_parent.end()) {
+				for (const auto& child : children_iter->second) {
+					this->SetSubtreeDepth(child, depth + 1);
+				}
+			}
+		}
+
+		// Remove the entity's chunk components, keeping its sparse set components.
+		void RemoveEntityArchetype(const Entity& entity)
+		{
+			storage_mgr.RemoveEntity(entity);
+			null_entities.insert(entity);
+			entities.erase(entity);
+			ECS_PROFILE_COUNT(structural_changes, 1);
+		}
+
 		// Store entities by a hash map since we may create and delete entities frequently.
 		std::unordered_set<Entity> entities;
-		size_t entity_id_counter = 1;  // Grows from 1; 0 is the invalid entity's ID.
+		std::atomic<size_t> entity_id_counter{ 1 };  // Grows from 1; 0 is the invalid entity's ID.
 		std::unordered_set<Entity> null_entities;
 
+		// The children of each entity having any
+		std::unordered_map<Entity, std::vector<Entity>> children_by_parent;
+
+		// The slice of the chunks iterated, see SetIterationSlice
+		size_t slice_index = 0;
+		size_t slice_count = 1;
+
+		// The file mapped by MapStorage, which must outlive the chunks in storage_mgr
+		std::unique_ptr<MappedFile> mapped_file;
+
+#ifdef ECS_ENABLE_PROFILING
+		ProfileCounters profile_counters;
+#endif
+
 		// manage component types
 		ComponentTypeManager component_type_mgr;
 
@@ -0,0 +1,372 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "Resource.h"
+
+
+namespace ECS
+{
+	namespace Internal
+	{
+		// The events of one frame in pages of doubling capacity, appended by any number of threads at once: an
+		// event takes the next index with an atomic increment, and the page holding the index is allocated by the
+		// first thread needing it. The pages are kept when the arena is cleared, so that the arena of a frame
+		// reused for a later one doesn't allocate.
+		template <typename E>
+		class EventArena
+		{
+		public:
+			EventArena()
+			{
+				for (auto& page : pages) {
+					page.store(nullptr, std::memory_order_relaxed);
+				}
+			}
+
+			// Avoid unintentional copy
+			EventArena(const EventArena&) = delete;
+			EventArena operator=(const EventArena&) = delete;
+
+			~EventArena()
+			{
+				this->Clear();
+				for (size_t k = 0; k < max_page_count; k++) {
+					::operator delete(pages[k].load(std::memory_order_relaxed), std::align_val_t(alignof(E)));
+				}
+			}
+
+			// Safe to call from several threads at once
+			void Push(const E& event)
+			{
+				size_t index = count.fetch_add(1, std::memory_order_relaxed);
+				size_t page_index = GetPageIndex(index);
+				new (this->GetPage(page_index) + (index - GetPageStart(page_index))) E(event);
+			}
+
+			// Push consecutive events with a single atomic increment
+			void Push(const E* events, size_t event_count)
+			{
+				size_t begin = count.fetch_add(event_count, std::memory_order_relaxed);
+				size_t end = begin + event_count;
+				while (begin < end) {
+					size_t page_index = GetPageIndex(begin);
+					size_t page_start = GetPageStart(page_index);
+					size_t page_end = std::min(end, page_start + (first_page_capacity << page_index));
+					E* page = this->GetPage(page_index);
+					for (size_t i = begin; i < page_end; i++) {
+						new (page + (i - page_start)) E(*events++);
+					}
+					begin = page_end;
+				}
+			}
+
+			size_t GetCount() const
+			{
+				return count.load(std::memory_order_acquire);
+			}
+
+			// Call func(const E&) for the events from begin to end, a page at a time; only the events pushed before
+			// the last synchronization with their threads, e.g. the end of a ParallelFor, are complete.
+			template <typename F>
+			void ForEach(size_t begin, size_t end, F func) const
+			{
+				while (begin < end) {
+					size_t page_index = GetPageIndex(begin);
+					size_t page_start = GetPageStart(page_index);
+					size_t page_end = std::min(end, page_start + (first_page_capacity << page_index));
+					const E* page = pages[page_index].load(std::memory_order_acquire);
+					for (size_t i = begin; i < page_end; i++) {
+						func(page[i - page_start]);
+					}
+					begin = page_end;
+				}
+			}
+
+			void Clear()
+			{
+				if constexpr (!std::is_trivially_destructible_v<E>) {
+					this->ForEach(0, count.load(std::memory_order_relaxed), [](const E& event) -> void {
+						event.~E();
+					});
+				}
+				count.store(0, std::memory_order_relaxed);
+			}
+
+		private:
+			// Page k holds first_page_capacity << k events
+			static const size_t first_page_capacity = 64;
+			static const size_t max_page_count = 48;
+
+			// The floor of log2(index / first_page_capacity + 1)
+			static size_t GetPageIndex(size_t index)
+			{
+				uint64_t v = index / first_page_capacity + 1;
+#ifdef _MSC_VER
+				unsigned long highest_bit;
+				_BitScanReverse64(&highest_bit, v);
+				return highest_bit;
+#else
+				return 63 - __builtin_clzll(v);
+#endif
+			}
+
+			static size_t GetPageStart(size_t page_index)
+			{
+				return first_page_capacity * ((size_t(1) << page_index) - 1);
+			}
+
+			E* GetPage(size_t page_index)
+			{
+				E* page = pages[page_index].load(std::memory_order_acquire);
+				if (page != nullptr) {
+					return page;
+				}
+				size_t page_bytes = sizeof(E) * (first_page_capacity << page_index);
+				E* new_page = static_cast<E*>(::operator new(page_bytes, std::align_val_t(alignof(E))));
+				if (pages[page_index].compare_exchange_strong(page, new_page, std::memory_order_acq_rel)) {
+					return new_page;
+				}
+				::operator delete(new_page, std::align_val_t(alignof(E)));  // another thread was first
+				return page;
+			}
+
+			std::atomic<E*> pages[max_page_count];
+			std::atomic<size_t> count{ 0 };
+		};
+	}
+
+	class EventChannelBase
+	{
+	public:
+		virtual ~EventChannelBase() = default;
+
+		// Start a new frame, dropping the events of the old ones, see EventChannel::EndFrame.
+		virtual void EndFrame() = 0;
+	};
+
+	template <typename E>
+	class EventChannel;
+
+	namespace Internal
+	{
+		// The position of a reader in a channel, shared by the two so that either may be destroyed first
+		struct EventCursor
+		{
+			uint64_t next_sequence = 0;
+			uint64_t missed_count = 0;
+		};
+	}
+
+	// A system's position in an event channel: Read visits the events sent since the last Read once each. A
+	// reader not reading for longer than the channel keeps events misses the dropped ones, see GetMissedCount.
+	template <typename E>
+	class EventReader
+	{
+	public:
+		EventReader() : channel_ptr(nullptr) {}
+
+		EventReader(EventReader&&) = default;
+		EventReader& operator=(EventReader&&) = default;
+
+		// Avoid unintentional copy
+		EventReader(const EventReader&) = delete;
+		EventReader operator=(const EventReader&) = delete;
+
+		// Call func(const E&) for every event sent since the last call, in order. Returns the number of events.
+		template <typename F>
+		size_t Read(F func)
+		{
+			return channel_ptr == nullptr ? 0 : channel_ptr->Read(*cursor_ptr, func);
+		}
+
+		// The number of events dropped before this reader read them
+		uint64_t GetMissedCount() const
+		{
+			return cursor_ptr ? cursor_ptr->missed_count : 0;
+		}
+
+		bool IsValid() const { return channel_ptr != nullptr; }
+
+	private:
+		friend class EventChannel<E>;
+
+		EventReader(EventChannel<E>* channel_ptr, std::shared_ptr<Internal::EventCursor> cursor_ptr)
+			: channel_ptr(channel_ptr), cursor_ptr(std::move(cursor_ptr)) {}
+
+		EventChannel<E>* channel_ptr;
+		std::shared_ptr<Internal::EventCursor> cursor_ptr;
+	};
+
+	// A queue of events of type E sent by systems to others, e.g. collisions or damage, instead of transient
+	// components that would migrate entities between archetypes. Each frame's events are kept in an arena of
+	// their own; Send may be called from several threads at once, e.g. from the jobs of a ParallelFor, and the
+	// events are read after the senders are done. The events of a frame are dropped at the end of a frame once
+	// every reader has read them, or when they are older than the channel's frame count.
+	template <typename E>
+	class EventChannel : public EventChannelBase
+	{
+	public:
+		// Events are kept for frame_count frames at most, the one they are sent in included.
+		EventChannel(size_t frame_count = 2) : frame_count(std::max(frame_count, size_t(1)))
+		{
+			frames.emplace_back(this->NewArena(), 0);
+		}
+
+		// Avoid unintentional copy
+		EventChannel(const EventChannel&) = delete;
+		EventChannel operator=(const EventChannel&) = delete;
+
+		// Safe to call from several threads at once, but not with the other functions.
+		void Send(const E& event)
+		{
+			frames.back().arena_ptr->Push(event);
+		}
+
+		// Send consecutive events at the cost of one, e.g. the events of a chunk gathered by a job.
+		void Send(const E* events, size_t event_count)
+		{
+			frames.back().arena_ptr->Push(events, event_count);
+		}
+
+		// A reader starting at the events sent from now on, e.g. a member of the reading system. A reader may be
+		// destroyed after the channel, but not read from.
+		EventReader<E> CreateReader()
+		{
+			std::shared_ptr<Internal::EventCursor> cursor_ptr(new Internal::EventCursor());
+			cursor_ptr->next_sequence = this->GetEndSequence();
+			cursor_ptrs.push_back(cursor_ptr);
+			return EventReader<E>(this, cursor_ptr);
+		}
+
+		// Start a new frame, dropping the events of the oldest frames read by all readers or kept for frame_count
+		// frames. World::Update calls it once per frame.
+		virtual void EndFrame() override
+		{
+			uint64_t end_sequence = this->GetEndSequence();
+			std::unique_ptr<Internal::EventArena<E>> arena_ptr;
+			if (!free_arena_ptrs.empty()) {
+				arena_ptr = std::move(free_arena_ptrs.back());
+				free_arena_ptrs.pop_back();
+			}
+			frames.emplace_back(arena_ptr ? std::move(arena_ptr) : this->NewArena(), end_sequence);
+
+			// The cursors only held here are of destroyed readers
+			cursor_ptrs.erase(std::remove_if(cursor_ptrs.begin(), cursor_ptrs.end(), [](const std::shared_ptr<Internal::EventCursor>& cursor_ptr) {
+				return cursor_ptr.use_count() == 1;
+			}), cursor_ptrs.end());
+			uint64_t min_cursor = end_sequence;
+			for (const auto& cursor_ptr : cursor_ptrs) {
+				min_cursor = std::min(min_cursor, cursor_ptr->next_sequence);
+			}
+			while (frames.size() > 1 && (frames.size() > frame_count || frames[1].first_sequence <= min_cursor)) {
+				frames.front().arena_ptr->Clear();
+				free_arena_ptrs.push_back(std::move(frames.front().arena_ptr));
+				frames.pop_front();
+			}
+		}
+
+		// The number of events kept, in all frames
+		size_t GetEventCount() const
+		{
+			return static_cast<size_t>(this->GetEndSequence() - frames.front().first_sequence);
+		}
+
+		size_t GetFrameCount() const { return frame_count; }
+
+	private:
+		friend class EventReader<E>;
+
+		struct Frame
+		{
+			Frame(std::unique_ptr<Internal::EventArena<E>> arena_ptr, uint64_t first_sequence)
+				: arena_ptr(std::move(arena_ptr)), first_sequence(first_sequence) {}
+
+			std::unique_ptr<Internal::EventArena<E>> arena_ptr;
+			uint64_t first_sequence;  // The sequence number of the frame's first event, counting from the first frame
+		};
+
+		std::unique_ptr<Internal::EventArena<E>> NewArena()
+		{
+			return std::unique_ptr<Internal::EventArena<E>>(new Internal::EventArena<E>());
+		}
+
+		uint64_t GetEndSequence() const
+		{
+			return frames.back().first_sequence + frames.back().arena_ptr->GetCount();
+		}
+
+		template <typename F>
+		size_t Read(Internal::EventCursor& reader, F func)
+		{
+			if (reader.next_sequence < frames.front().first_sequence) {
+				reader.missed_count += frames.front().first_sequence - reader.next_sequence;
+				reader.next_sequence = frames.front().first_sequence;
+			}
+			size_t read_count = 0;
+			for (const auto& frame : frames) {
+				size_t event_count = frame.arena_ptr->GetCount();
+				size_t begin = static_cast<size_t>(std::min(std::max(reader.next_sequence, frame.first_sequence) - frame.first_sequence, uint64_t(event_count)));
+				frame.arena_ptr->ForEach(begin, event_count, func);
+				read_count += event_count - begin;
+				reader.next_sequence = std::max(reader.next_sequence, frame.first_sequence + event_count);
+			}
+			return read_count;
+		}
+
+		size_t frame_count;
+
+		// The frames kept, oldest first; the last one receives the events sent
+		std::deque<Frame> frames;
+		std::vector<std::unique_ptr<Internal::EventArena<E>>> free_arena_ptrs;
+		std::vector<std::shared_ptr<Internal::EventCursor>> cursor_ptrs;
+	};
+
+	// The event channels of a world by event type, created on first use.
+	class EventChannels
+	{
+	public:
+
+		EventChannels() {}
+
+		// Avoid unintentional copy
+		EventChannels(const EventChannels&) = delete;
+		EventChannels operator=(const EventChannels&) = delete;
+
+		// The channel of events E, created with the given frame count if it doesn't exist. Channels are created
+		// from one thread, e.g. in the systems' Init, before events are sent from several.
+		template <typename E>
+		EventChannel<E>& Get(size_t frame_count = 2)
+		{
+			size_t index = Internal::GetResourceTypeIndex<EventChannel<E>>();
+			if (index >= channels.size()) {
+				channels.resize(index + 1);
+			}
+			if (!channels[index]) {
+				channels[index].reset(new EventChannel<E>(frame_count));
+			}
+			return *static_cast<EventChannel<E>*>(channels[index].get());
+		}
+
+		void EndFrame()
+		{
+			for (const auto& channel_ptr : channels) {
+				if (channel_ptr) {
+					channel_ptr->EndFrame();
+				}
+			}
+		}
+
+	private:
+		std::vector<std::unique_ptr<EventChannelBase>> channels;
+	};
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "Entity.h"
+#include "ComponentTypeManager.h"
+
+
+namespace ECS
+{
+	// The parent of a child entity, maintained by EntityManager::SetParent and RemoveParent.
+	struct Parent
+	{
+		Parent() {}
+		Parent(const Entity& entity) : entity(entity) {}
+
+		Entity entity;
+	};
+
+	// The depth of a child entity in its hierarchy, 1 for the children of a root. It is a shared component,
+	// so that the entities of a depth are grouped into the same chunks and can be walked level by level.
+	struct HierarchyDepth
+	{
+		HierarchyDepth() : depth(0) {}
+		HierarchyDepth(size_t depth) : depth(depth) {}
+
+		size_t depth;
+	};
+
+	inline bool operator==(const HierarchyDepth& lhs, const HierarchyDepth& rhs)
+	{
+		return lhs.depth == rhs.depth;
+	}
+
+	template <>
+	struct ComponentTraits<HierarchyDepth> : DefaultComponentTraits
+	{
+		static constexpr StoragePolicy storage = StoragePolicy::Shared;
+	};
+}
@@ -0,0 +1,225 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Numa.h"
+
+
+namespace ECS
+{
+	// A pool of worker threads running ParallelFor loops and background tasks. Workers are started on first use,
+	// so that a world which never runs parallel work costs no threads. On a NUMA host, the workers are spread
+	// over the nodes, each running on the CPUs of its node.
+	class JobSystem
+	{
+	public:
+
+		JobSystem() : JobSystem(std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 0) {}
+
+		JobSystem(size_t worker_count) : JobSystem(worker_count, Internal::GetNumaNodeCount()) {}
+
+		// Spread the workers over node_count NUMA nodes, e.g. fewer than the host has.
+		JobSystem(size_t worker_count, size_t node_count) : worker_count(worker_count), node_count(std::max(node_count, size_t(1))) {}
+
+		// Avoid unintentional copy
+		JobSystem(const JobSystem&) = delete;
+		JobSystem operator=(const JobSystem&) = delete;
+
+		~JobSystem()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			job_cv.notify_all();
+			for (auto& worker : workers) {
+				worker.join();
+			}
+		}
+
+		// Call func(i) for every i in [0, count), spread over the workers and the calling thread, and return when
+		// all calls are done. Must be called from one thread at a time, and not from within func.
+		void ParallelFor(size_t count, const std::function<void(size_t)>& func)
+		{
+			if (worker_count == 0 || count <= 1) {
+				for (size_t i = 0; i < count; i++) {
+					func(i);
+				}
+				return;
+			}
+
+			this->RunParallel(std::shared_ptr<Job>(new Job(func, count)));
+		}
+
+		// Same as above, with the calls for index i preferably run by the threads of NUMA node node_of(i), e.g. the
+		// node of the chunk i processes; a thread done with the indices of its node takes those of the others.
+		void ParallelFor(size_t count, const std::function<void(size_t)>& func, const std::function<size_t(size_t)>& node_of)
+		{
+			if (worker_count == 0 || count <= 1 || node_count == 1) {
+				this->ParallelFor(count, func);
+				return;
+			}
+
+			std::shared_ptr<Job> job_ptr(new Job(func, count));
+			job_ptr->node_indices.resize(node_count);
+			job_ptr->node_next_indices = std::vector<std::atomic<size_t>>(node_count);
+			for (size_t i = 0; i < count; i++) {
+				job_ptr->node_indices[node_of(i) % node_count].push_back(i);
+			}
+			this->RunParallel(job_ptr);
+		}
+
+		// Run a task on a worker in the background and return at once, or run it inline if there is no worker.
+		// Tasks start in submission order, after the ParallelFor loop in progress; the job system is destroyed once
+		// all of them are done, so that e.g. the partitions being unloaded are written.
+		void Submit(std::function<void()> task)
+		{
+			if (worker_count == 0) {
+				task();
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				this->StartWorkers();
+				tasks.push_back(std::move(task));
+			}
+			job_cv.notify_one();
+		}
+
+		size_t GetWorkerCount() const
+		{
+			return worker_count;
+		}
+
+		size_t GetNumaNodeCount() const
+		{
+			return node_count;
+		}
+
+	private:
+		struct Job
+		{
+			Job(const std::function<void(size_t)>& func, size_t count) : func(func), count(count) {}
+
+			const std::function<void(size_t)>& func;
+			size_t count;
+			std::atomic<size_t> next_index{ 0 };
+			std::atomic<size_t> done_count{ 0 };
+
+			// The indices of each node, and the position of the next one to run, for a job placed on NUMA nodes
+			std::vector<std::vector<size_t>> node_indices;
+			std::vector<std::atomic<size_t>> node_next_indices;
+		};
+
+		// Run a job on the workers and the calling thread, and return when it's done
+		void RunParallel(const std::shared_ptr<Job>& job_ptr)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				this->StartWorkers();
+				current_job_ptr = job_ptr;
+				job_generation++;
+			}
+			job_cv.notify_all();
+
+			this->RunJob(*job_ptr, Internal::GetCurrentNumaNode());
+
+			std::unique_lock<std::mutex> lock(mutex);
+			done_cv.wait(lock, [&]() { return job_ptr->done_count.load() == job_ptr->count; });
+			current_job_ptr.reset();
+		}
+
+		void RunJob(Job& job, size_t node)
+		{
+			if (job.node_indices.empty()) {
+				size_t index;
+				while ((index = job.next_index++) < job.count) {
+					this->RunIndex(job, index);
+				}
+				return;
+			}
+
+			// The indices of the thread's node first, then those left on the other nodes
+			for (size_t k = 0; k < job.node_indices.size(); k++) {
+				size_t queue = (node + k) % job.node_indices.size();
+				size_t position;
+				while ((position = job.node_next_indices[queue]++) < job.node_indices[queue].size()) {
+					this->RunIndex(job, job.node_indices[queue][position]);
+				}
+			}
+		}
+
+		void RunIndex(Job& job, size_t index)
+		{
+			job.func(index);
+			if (++job.done_count == job.count) {
+				std::lock_guard<std::mutex> lock(mutex);
+				done_cv.notify_all();
+			}
+		}
+
+		// Must be called with the mutex locked
+		void StartWorkers()
+		{
+			if (workers.empty()) {
+				for (size_t i = 0; i < worker_count; i++) {
+					workers.emplace_back([this, i]() { this->WorkerLoop(i % node_count); });
+				}
+			}
+		}
+
+		void WorkerLoop(size_t node)
+		{
+			Internal::RunOnNumaNode(node);
+			size_t seen_generation = 0;
+			while (true) {
+				std::shared_ptr<Job> job_ptr;
+				std::function<void()> task;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					job_cv.wait(lock, [&]() { return stopping || job_generation != seen_generation || !tasks.empty(); });
+					if (stopping && tasks.empty()) {
+						return;
+					}
+					if (job_generation != seen_generation) {
+						seen_generation = job_generation;
+						job_ptr = current_job_ptr;
+					}
+					else {
+						task = std::move(tasks.front());
+						tasks.pop_front();
+					}
+				}
+				if (job_ptr) {
+					this->RunJob(*job_ptr, node);
+				}
+				else if (task) {
+					task();
+				}
+			}
+		}
+
+		size_t worker_count;
+		size_t node_count;
+		std::vector<std::thread> workers;
+
+		std::mutex mutex;
+		std::condition_variable job_cv;
+		std::condition_variable done_cv;
+
+		// A job is shared with the workers, so that a worker late for a finished job finds no index left in it
+		std::shared_ptr<Job> current_job_ptr;
+		size_t job_generation = 0;
+		bool stopping = false;
+
+		std::deque<std::function<void()>> tasks;
+	};
+}
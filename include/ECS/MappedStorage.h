@@ -0,0 +1,454 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ComponentStorageManager.h"
+
+
+namespace ECS
+{
+	// How a persisted storage file is mapped into memory.
+	enum class MapMode
+	{
+		ReadOnly,     // Chunks are read-only pages of the file; entities stored in them must not be changed.
+		CopyOnWrite   // Chunks are private pages of the file; writes are never flushed back to the file.
+	};
+
+	// A whole file mapped into memory, whose pages are faulted in lazily by the OS.
+	class MappedFile
+	{
+	public:
+
+		MappedFile() {}
+
+		// Avoid unintentional copy
+		MappedFile(const MappedFile&) = delete;
+		MappedFile operator=(const MappedFile&) = delete;
+
+		~MappedFile()
+		{
+			this->Close();
+		}
+
+		bool Open(const std::string& path, MapMode mode)
+		{
+			this->Close();
+
+#ifdef _WIN32
+			file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file_handle == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+			LARGE_INTEGER file_size;
+			if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0) {
+				this->Close();
+				return false;
+			}
+			mapping_handle = CreateFileMappingA(file_handle, nullptr,
+				mode == MapMode::ReadOnly ? PAGE_READONLY : PAGE_WRITECOPY, 0, 0, nullptr);
+			if (mapping_handle == nullptr) {
+				this->Close();
+				return false;
+			}
+			void* view = MapViewOfFile(mapping_handle, mode == MapMode::ReadOnly ? FILE_MAP_READ : FILE_MAP_COPY, 0, 0, 0);
+			if (view == nullptr) {
+				this->Close();
+				return false;
+			}
+			data = static_cast<char*>(view);
+			size = static_cast<size_t>(file_size.QuadPart);
+#else
+			int fd = open(path.c_str(), O_RDONLY);
+			if (fd < 0) {
+				return false;
+			}
+			struct stat file_stat;
+			if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+				close(fd);
+				return false;
+			}
+			int protection = mode == MapMode::ReadOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+			void* view = mmap(nullptr, static_cast<size_t>(file_stat.st_size), protection, MAP_PRIVATE, fd, 0);
+			close(fd);  // the mapping keeps its own reference to the file
+			if (view == MAP_FAILED) {
+				return false;
+			}
+			data = static_cast<char*>(view);
+			size = static_cast<size_t>(file_stat.st_size);
+#endif
+			return true;
+		}
+
+		void Close()
+		{
+#ifdef _WIN32
+			if (data != nullptr) {
+				UnmapViewOfFile(data);
+			}
+			if (mapping_handle != nullptr) {
+				CloseHandle(mapping_handle);
+				mapping_handle = nullptr;
+			}
+			if (file_handle != INVALID_HANDLE_VALUE) {
+				CloseHandle(file_handle);
+				file_handle = INVALID_HANDLE_VALUE;
+			}
+#else
+			if (data != nullptr) {
+				munmap(data, size);
+			}
+#endif
+			data = nullptr;
+			size = 0;
+		}
+
+		char* GetData() const { return data; }
+		size_t GetSize() const { return size; }
+
+	private:
+		char* data = nullptr;
+		size_t size = 0;
+
+#ifdef _WIN32
+		HANDLE file_handle = INVALID_HANDLE_VALUE;
+		HANDLE mapping_handle = nullptr;
+#endif
+	};
+
+	namespace Internal
+	{
+		// On-disk layout of persisted storage, in native byte order:
+		//   StorageFileHeader
+		//   component types: { u64 size, u64 name_length, char name[name_length] } x type_count
+		//   null entities:   { u64 id } x null_entity_count
+		//   archetypes:      { u64 row_count, u64 chunk_entity_capacity, u64 chunk_count,
+		//                      { u64 type_index, u64 row_offset } x row_count,
+		//                      { u64 entity_count, { u64 id } x entity_count } x chunk_count } x archetype_count
+		//   zero padding up to data_offset
+		//   chunk data:      { char data[chunk_size] } x all chunks, in the order of the archetypes above
+		struct StorageFileHeader
+		{
+			char magic[4];
+			uint32_t version;
+			uint64_t chunk_size;
+			uint64_t entity_id_counter;
+			uint64_t type_count;
+			uint64_t null_entity_count;
+			uint64_t archetype_count;
+			uint64_t data_offset;
+		};
+
+		const char storage_file_magic[4] = { 'S', 'E', 'C', 'S' };
+		const uint32_t storage_file_version = 1;
+
+		// Chunk data starts at a multiple of it, so that every chunk is page aligned once mapped
+		// (64K is also the allocation granularity of Windows).
+		const uint64_t storage_file_alignment = 65536;
+
+		// Sequential reads of the metadata section, with bounds checking.
+		class StorageFileReader
+		{
+		public:
+			StorageFileReader(const char* data, size_t size) : data(data), size(size) {}
+
+			bool Read(void* dest, size_t count)
+			{
+				if (count > size - cursor) {
+					return false;
+				}
+				std::memcpy(dest, data + cursor, count);
+				cursor += count;
+				return true;
+			}
+
+			bool Read(uint64_t& value)
+			{
+				return this->Read(&value, sizeof(value));
+			}
+
+		private:
+			const char* data;
+			size_t size;
+			size_t cursor = 0;
+		};
+
+		inline void AppendU64(std::vector<char>& buffer, uint64_t value)
+		{
+			const char* bytes = reinterpret_cast<const char*>(&value);
+			buffer.insert(buffer.end(), bytes, bytes + sizeof(value));
+		}
+
+		// Write all archetype storages with at least one entity, and the entities without component.
+		inline bool WriteStorageFile(const std::string& path, const ComponentTypeManager& c_mgr,
+			const ComponentStorageManager& storage_mgr, const std::unordered_set<Entity>& null_entities, size_t entity_id_counter)
+		{
+			std::vector<const ArchetypeStorage*> a_storages;
+			const size_t chunk_size = ArchetypeStorage::GetChunkSize();
+			for (const auto& pair : storage_mgr.GetArchetypeStorages()) {
+				const ArchetypeStorage* a_store_ptr = pair.second;
+				if (a_store_ptr->GetEntityCount() == 0) {
+					continue;
+				}
+				if (!a_store_ptr->HasDefaultLayout()) {
+					return false;  // the layout of its chunks can't be described by row offsets
+				}
+				for (const auto& c_id : a_store_ptr->GetComponentTypes()) {
+					if (!c_mgr.GetComponentType(c_id).trivially_copyable) {
+						return false;  // its data can't survive a byte copy
+					}
+					if (c_mgr.GetComponentType(c_id).is_pair || c_mgr.GetComponentType(c_id).storage != StoragePolicy::Chunk) {
+						return false;  // it would be read back as a plain component
+					}
+				}
+				a_storages.push_back(a_store_ptr);
+			}
+
+			// Metadata section, following the header
+			std::vector<char> metadata;
+			for (size_t c_id = 0; c_id < c_mgr.GetComponentTypeCount(); c_id++) {
+				const ComponentType& c_type = c_mgr.GetComponentType(c_id);
+				AppendU64(metadata, c_type.size);
+				AppendU64(metadata, c_type.name.size());
+				metadata.insert(metadata.end(), c_type.name.begin(), c_type.name.end());
+			}
+			for (const auto& entity : null_entities) {
+				AppendU64(metadata, entity.id);
+			}
+
+			for (const ArchetypeStorage* a_store_ptr : a_storages) {
+				size_t used_chunk_count = a_store_ptr->GetUsedChunkCount();
+
+				const std::vector<ComponentTypeID>& component_types = a_store_ptr->GetComponentTypes();
+				AppendU64(metadata, component_types.size());
+				AppendU64(metadata, a_store_ptr->GetChunkEntityCapacity());
+				AppendU64(metadata, used_chunk_count);
+				for (size_t row_index = 0; row_index < component_types.size(); row_index++) {
+					AppendU64(metadata, component_types[row_index]);  // component type ID is the index of the type table
+					AppendU64(metadata, a_store_ptr->GetRowOffsets()[row_index]);
+				}
+				for (size_t i = 0; i < a_store_ptr->GetChunkCount(); i++) {
+					size_t entity_count = a_store_ptr->GetChunkEntityCount(i);
+					if (entity_count == 0) {
+						continue;
+					}
+					AppendU64(metadata, entity_count);
+					const Entity* entities = a_store_ptr->GetChunkEntities(i);
+					for (size_t j = 0; j < entity_count; j++) {
+						AppendU64(metadata, entities[j].id);
+					}
+				}
+			}
+
+			StorageFileHeader header;
+			std::memcpy(header.magic, storage_file_magic, sizeof(header.magic));
+			header.version = storage_file_version;
+			header.chunk_size = chunk_size;
+			header.entity_id_counter = entity_id_counter;
+			header.type_count = c_mgr.GetComponentTypeCount();
+			header.null_entity_count = null_entities.size();
+			header.archetype_count = a_storages.size();
+
+			uint64_t metadata_end = sizeof(header) + metadata.size();
+			header.data_offset = (metadata_end + storage_file_alignment - 1) / storage_file_alignment * storage_file_alignment;
+
+			std::ofstream out(path, std::ios::binary | std::ios::trunc);
+			if (!out) {
+				return false;
+			}
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(metadata.data(), metadata.size());
+			std::vector<char> padding(header.data_offset - metadata_end, 0);
+			out.write(padding.data(), padding.size());
+
+			for (const ArchetypeStorage* a_store_ptr : a_storages) {
+				for (size_t i = 0; i < a_store_ptr->GetChunkCount(); i++) {
+					if (a_store_ptr->GetChunkEntityCount(i) != 0) {
+						out.write(static_cast<const char*>(a_store_ptr->GetChunk(i)->chunk_ptr), chunk_size);
+					}
+				}
+			}
+
+			return static_cast<bool>(out);
+		}
+
+		// Build the storage of an empty world from a mapped file. All metadata is validated before anything is changed.
+		inline bool ReadStorageFile(const MappedFile& file, MapMode mode, ComponentTypeManager& c_mgr, ArchetypeManager& a_mgr,
+			ComponentStorageManager& storage_mgr, std::unordered_set<Entity>& entities, std::unordered_set<Entity>& null_entities,
+			size_t& entity_id_counter)
+		{
+			struct ArchetypeRecord
+			{
+				std::vector<std::pair<uint64_t, uint64_t>> rows;  // (type index, row offset)
+				uint64_t chunk_entity_capacity = 0;
+				std::vector<std::vector<Entity>> chunk_entities;
+			};
+
+			StorageFileReader reader(file.GetData(), file.GetSize());
+
+			StorageFileHeader header;
+			if (!reader.Read(&header, sizeof(header)) || std::memcmp(header.magic, storage_file_magic, sizeof(header.magic)) != 0
+				|| header.version != storage_file_version || header.chunk_size != ArchetypeStorage::GetChunkSize()
+				|| header.data_offset % storage_file_alignment != 0 || header.data_offset > file.GetSize() || header.archetype_count > file.GetSize()) {
+				return false;
+			}
+
+			std::vector<std::pair<std::string, uint64_t>> type_records;  // (name, size)
+			for (uint64_t i = 0; i < header.type_count; i++) {
+				uint64_t size, name_length;
+				if (!reader.Read(size) || !reader.Read(name_length) || name_length > file.GetSize()) {
+					return false;
+				}
+				std::string name(name_length, '\0');
+				if (!reader.Read(&name[0], name_length)) {
+					return false;
+				}
+				type_records.emplace_back(name, size);
+			}
+
+			// The entities have distinct IDs, none of them 0, the invalid entity's ID, and all below the counter, so
+			// that the manager doesn't create them again
+			std::unordered_set<uint64_t> entity_ids;
+			auto read_entity = [&](Entity& entity) -> bool {
+				uint64_t id;
+				if (!reader.Read(id) || id == 0 || id >= header.entity_id_counter || !entity_ids.insert(id).second) {
+					return false;
+				}
+				entity = Entity(id);
+				return true;
+			};
+
+			std::vector<Entity> null_entity_records;
+			for (uint64_t i = 0; i < header.null_entity_count; i++) {
+				Entity entity;
+				if (!read_entity(entity)) {
+					return false;
+				}
+				null_entity_records.push_back(entity);
+			}
+
+			// The rows are within the chunk without overlapping, bounded without overflow, and an archetype, i.e. a
+			// set of types, has one record
+			std::vector<ArchetypeRecord> archetype_records(header.archetype_count);
+			std::set<std::set<uint64_t>> archetype_type_sets;
+			uint64_t total_chunk_count = 0;
+			for (auto& record : archetype_records) {
+				uint64_t row_count, chunk_count;
+				if (!reader.Read(row_count) || !reader.Read(record.chunk_entity_capacity) || !reader.Read(chunk_count)
+					|| record.chunk_entity_capacity == 0 || record.chunk_entity_capacity > header.chunk_size
+					|| chunk_count > file.GetSize() / header.chunk_size - total_chunk_count) {
+					return false;
+				}
+				std::set<uint64_t> type_indices;
+				std::vector<std::pair<uint64_t, uint64_t>> row_extents;  // (begin, end)
+				for (uint64_t r = 0; r < row_count; r++) {
+					uint64_t type_index, row_offset;
+					if (!reader.Read(type_index) || !reader.Read(row_offset) || type_index >= header.type_count
+						|| !type_indices.insert(type_index).second || row_offset > header.chunk_size) {
+						return false;
+					}
+					uint64_t row_size = type_records[type_index].second;
+					if (row_size != 0 && record.chunk_entity_capacity > (header.chunk_size - row_offset) / row_size) {
+						return false;
+					}
+					record.rows.emplace_back(type_index, row_offset);
+					row_extents.emplace_back(row_offset, row_offset + record.chunk_entity_capacity * row_size);
+				}
+				std::sort(row_extents.begin(), row_extents.end());
+				for (size_t r = 1; r < row_extents.size(); r++) {
+					if (row_extents[r].first < row_extents[r - 1].second) {
+						return false;
+					}
+				}
+				if (!archetype_type_sets.insert(type_indices).second) {
+					return false;
+				}
+
+				for (uint64_t i = 0; i < chunk_count; i++) {
+					uint64_t entity_count;
+					if (!reader.Read(entity_count) || entity_count > record.chunk_entity_capacity) {
+						return false;
+					}
+					std::vector<Entity> chunk_entities(entity_count);
+					for (auto& entity : chunk_entities) {
+						if (!read_entity(entity)) {
+							return false;
+						}
+					}
+					record.chunk_entities.push_back(std::move(chunk_entities));
+				}
+				total_chunk_count += chunk_count;
+			}
+
+			if (total_chunk_count > (file.GetSize() - header.data_offset) / header.chunk_size) {
+				return false;
+			}
+
+			// Check the known component types before registering the others, so that a failed read registers none
+			std::unordered_map<std::string, uint64_t> size_by_name;
+			for (const auto& type_record : type_records) {
+				if (!size_by_name.insert({ type_record.first, type_record.second }).second) {
+					return false;  // a name appears twice
+				}
+				ComponentTypeID c_id;
+				if (c_mgr.FindComponentTypeID(type_record.first, c_id) && (c_mgr.GetComponentType(c_id).size != type_record.second
+					|| !c_mgr.GetComponentType(c_id).trivially_copyable || c_mgr.GetComponentType(c_id).is_pair
+					|| c_mgr.GetComponentType(c_id).storage != StoragePolicy::Chunk)) {
+					return false;
+				}
+			}
+
+			// Everything is valid, resolve component types by their stable names and build the storage
+			std::vector<ComponentTypeID> c_id_by_type_index;
+			for (const auto& type_record : type_records) {
+				ComponentTypeID c_id;
+				c_mgr.GetOrCreateComponentTypeID(type_record.first, type_record.second, c_id);
+				c_id_by_type_index.push_back(c_id);
+			}
+
+			char* chunk_address = file.GetData() + header.data_offset;
+			for (const auto& record : archetype_records) {
+				ComponentTypeIDSet c_id_set;
+				std::unordered_map<ComponentTypeID, size_t> row_offset_by_id;
+				for (const auto& row : record.rows) {
+					c_id_set.insert(c_id_by_type_index[row.first]);
+					row_offset_by_id.insert({ c_id_by_type_index[row.first], row.second });
+				}
+				ArchetypeID a_id = a_mgr.GetOrCreateArchetype(c_id_set);
+
+				ArchetypeStorage* a_store_ptr = new ArchetypeStorage(&c_mgr, &a_mgr, a_id, row_offset_by_id, record.chunk_entity_capacity,
+					storage_mgr.GetMemoryResource());
+				for (const auto& chunk_entities : record.chunk_entities) {
+					Chunk* chunk_ptr = new Chunk(header.chunk_size, chunk_address, mode == MapMode::ReadOnly);
+					a_store_ptr->AttachChunk(chunk_ptr, chunk_entities.data(), chunk_entities.size());
+					entities.insert(chunk_entities.begin(), chunk_entities.end());
+					chunk_address += header.chunk_size;
+				}
+				storage_mgr.AttachArchetypeStorage(a_id, a_store_ptr);
+			}
+
+			null_entities.insert(null_entity_records.begin(), null_entity_records.end());
+			entity_id_counter = header.entity_id_counter;
+
+			return true;
+		}
+	}
+}
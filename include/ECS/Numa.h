@@ -0,0 +1,205 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <memory_resource>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// NUMA placement is compiled in only with ECS_ENABLE_NUMA defined, which needs libnuma (Linux); otherwise there is a
+// single node, and the memory is placed by the OS on first touch.
+#ifdef ECS_ENABLE_NUMA
+#include <numa.h>
+#include <numaif.h>
+#include <sched.h>
+#endif
+
+
+namespace ECS
+{
+	namespace Internal
+	{
+		// The number of NUMA nodes of the host, 1 if NUMA is not available
+		inline size_t GetNumaNodeCount()
+		{
+#ifdef ECS_ENABLE_NUMA
+			static const size_t node_count = numa_available() < 0 ? 1 : static_cast<size_t>(numa_max_node() + 1);
+			return node_count;
+#else
+			return 1;
+#endif
+		}
+
+		// The node of the CPU the calling thread runs on
+		inline size_t GetCurrentNumaNode()
+		{
+#ifdef ECS_ENABLE_NUMA
+			if (GetNumaNodeCount() > 1) {
+				int cpu = sched_getcpu();
+				int node = cpu < 0 ? -1 : numa_node_of_cpu(cpu);
+				return node < 0 ? 0 : static_cast<size_t>(node);
+			}
+#endif
+			return 0;
+		}
+
+		// Restrict the calling thread to the CPUs of a node.
+		inline void RunOnNumaNode(size_t node)
+		{
+#ifdef ECS_ENABLE_NUMA
+			if (GetNumaNodeCount() > 1 && node < GetNumaNodeCount()) {
+				numa_run_on_node(static_cast<int>(node));
+			}
+#else
+			(void)node;
+#endif
+		}
+
+		// Prefer a node for the pages of a page-aligned range, moving those already touched. Returns false if the
+		// pages are left to be placed on first touch.
+		inline bool BindToNumaNode(void* ptr, size_t bytes, size_t node)
+		{
+#ifdef ECS_ENABLE_NUMA
+			if (GetNumaNodeCount() > 1) {
+				const size_t bits = 8 * sizeof(unsigned long);
+				std::vector<unsigned long> node_mask(node / bits + 1, 0);
+				node_mask[node / bits] |= 1UL << (node % bits);
+				return mbind(ptr, bytes, MPOL_PREFERRED, node_mask.data(), node_mask.size() * bits + 1, MPOL_MF_MOVE) == 0;
+			}
+#else
+			(void)ptr;
+			(void)bytes;
+			(void)node;
+#endif
+			return false;
+		}
+	}
+
+	// A memory resource placing chunks on NUMA nodes, either all on one node, e.g. for a world per node, or
+	// interleaved chunk by chunk over the nodes, so that a parallel iteration reads from all nodes at once with
+	// each worker reading the chunks of its node, see JobSystem::ParallelFor. Blocks of a page or more are carved
+	// from slabs bound to their node; smaller ones, i.e. the entity bookkeeping, come from the upstream resource
+	// and are placed on first touch. Pass it to the World constructor.
+	class NumaChunkResource : public std::pmr::memory_resource
+	{
+	public:
+		static constexpr size_t interleaved = static_cast<size_t>(-1);
+
+		NumaChunkResource(size_t node = interleaved, std::pmr::memory_resource* upstream_ptr = std::pmr::get_default_resource())
+			: node(node), upstream_ptr(upstream_ptr), node_blocks(Internal::GetNumaNodeCount()) {}
+
+		// Avoid unintentional copy
+		NumaChunkResource(const NumaChunkResource&) = delete;
+		NumaChunkResource operator=(const NumaChunkResource&) = delete;
+
+		~NumaChunkResource()
+		{
+			for (const auto& pair : slabs) {
+				upstream_ptr->deallocate(const_cast<char*>(pair.first), pair.second.bytes, page_size);
+			}
+		}
+
+		// The node a block allocated here is placed on; 0 for the blocks from the upstream resource.
+		size_t GetNode(const void* ptr) const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return this->FindNode(static_cast<const char*>(ptr));
+		}
+
+		size_t GetNodeCount() const
+		{
+			return node_blocks.size();
+		}
+
+	private:
+		struct Slab
+		{
+			size_t bytes;
+			size_t node;
+		};
+
+		// The free blocks of a node by size, and the rest of its current slab
+		struct NodeBlocks
+		{
+			std::unordered_map<size_t, std::vector<void*>> free_blocks;
+			char* slab_next = nullptr;
+			size_t slab_remaining = 0;
+		};
+
+		static constexpr size_t page_size = 4096;
+		static constexpr size_t slab_size = size_t(2) << 20;
+
+		static size_t RoundToPages(size_t bytes)
+		{
+			return (bytes + page_size - 1) / page_size * page_size;
+		}
+
+		virtual void* do_allocate(size_t bytes, size_t alignment) override
+		{
+			if (bytes < page_size || alignment > page_size) {
+				return upstream_ptr->allocate(bytes, alignment);
+			}
+			size_t block_size = RoundToPages(bytes);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			size_t block_node = (node == interleaved ? next_node++ : node) % node_blocks.size();
+			NodeBlocks& blocks = node_blocks[block_node];
+			std::vector<void*>& free_blocks = blocks.free_blocks[block_size];
+			if (!free_blocks.empty()) {
+				void* block_ptr = free_blocks.back();
+				free_blocks.pop_back();
+				return block_ptr;
+			}
+
+			if (blocks.slab_remaining < block_size) {
+				size_t slab_bytes = std::max(slab_size, block_size);
+				char* slab_ptr = static_cast<char*>(upstream_ptr->allocate(slab_bytes, page_size));
+				Internal::BindToNumaNode(slab_ptr, slab_bytes, block_node);
+				slabs.insert({ slab_ptr, Slab{ slab_bytes, block_node } });
+				blocks.slab_next = slab_ptr;
+				blocks.slab_remaining = slab_bytes;
+			}
+			void* block_ptr = blocks.slab_next;
+			blocks.slab_next += block_size;
+			blocks.slab_remaining -= block_size;
+			return block_ptr;
+		}
+
+		virtual void do_deallocate(void* ptr, size_t bytes, size_t alignment) override
+		{
+			if (bytes < page_size || alignment > page_size) {
+				upstream_ptr->deallocate(ptr, bytes, alignment);
+				return;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			node_blocks[this->FindNode(static_cast<const char*>(ptr))].free_blocks[RoundToPages(bytes)].push_back(ptr);
+		}
+
+		virtual bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+		{
+			return this == &other;
+		}
+
+		// Must be called with the mutex locked
+		size_t FindNode(const char* ptr) const
+		{
+			auto iter = slabs.upper_bound(ptr);
+			if (iter == slabs.begin()) {
+				return 0;
+			}
+			--iter;
+			return ptr < iter->first + iter->second.bytes ? iter->second.node : 0;
+		}
+
+		size_t node;
+		std::pmr::memory_resource* upstream_ptr;
+
+		mutable std::mutex mutex;
+		std::vector<NodeBlocks> node_blocks;
+		size_t next_node = 0;
+
+		// The slabs by address, to find the node of a block
+		std::map<const char*, Slab> slabs;
+	};
+}
@@ -0,0 +1,213 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Entity.h"
+#include "Chunk.h"
+#include "ComponentTypeManager.h"
+#include "MappedStorage.h"
+
+
+namespace ECS
+{
+	// The world partition (e.g. a region of an open world) of an entity. It is a shared component, so that
+	// the entities of a partition are grouped into chunks of their own, which can be unloaded and loaded back
+	// as a whole, see EntityManager::DetachPartition and AttachPartition.
+	struct Partition
+	{
+		Partition() : id(0) {}
+		Partition(uint64_t id) : id(id) {}
+
+		uint64_t id;
+	};
+
+	inline bool operator==(const Partition& lhs, const Partition& rhs)
+	{
+		return lhs.id == rhs.id;
+	}
+
+	template <>
+	struct ComponentTraits<Partition> : DefaultComponentTraits
+	{
+		static constexpr StoragePolicy storage = StoragePolicy::Shared;
+	};
+
+	// The chunks of a partition, detached from the world, with what is needed to put them back: the layout
+	// of their archetypes by stable type names, and their entities. Writing and reading don't touch the world,
+	// so that they can run on a background thread.
+	class PartitionData
+	{
+	public:
+		struct Row
+		{
+			std::string name;
+			uint64_t size;
+			uint64_t offset;
+			uint64_t previous_offset;  // The same as offset, but for double-buffered rows
+		};
+
+		struct ArchetypeChunks
+		{
+			std::vector<Row> rows;
+			uint64_t chunk_entity_capacity = 0;
+			std::vector<std::vector<Entity>> chunk_entities;
+			std::vector<std::unique_ptr<Chunk>> chunks;
+		};
+
+		PartitionData(uint64_t partition_id) : partition_id(partition_id) {}
+
+		// Avoid unintentional copy
+		PartitionData(const PartitionData&) = delete;
+		PartitionData operator=(const PartitionData&) = delete;
+
+		uint64_t GetPartitionID() const { return partition_id; }
+
+		std::vector<ArchetypeChunks>& GetArchetypes() { return archetypes; }
+
+		size_t GetEntityCount() const
+		{
+			size_t entity_count = 0;
+			for (const auto& archetype : archetypes) {
+				for (const auto& chunk_entities : archetype.chunk_entities) {
+					entity_count += chunk_entities.size();
+				}
+			}
+			return entity_count;
+		}
+
+		// Layout of a partition file, in native byte order:
+		//   { char magic[4], u32 version, u64 chunk_size, u64 partition_id, u64 archetype_count }
+		//   archetypes: { u64 row_count, u64 chunk_entity_capacity, u64 chunk_count,
+		//                 { u64 size, u64 offset, u64 previous_offset, u64 name_length, char name[name_length] } x row_count,
+		//                 { u64 entity_count, { u64 id } x entity_count } x chunk_count } x archetype_count
+		//   chunk data:  { char data[chunk_size] } x all chunks, in the order of the archetypes above
+		bool Write(const std::string& path) const
+		{
+			std::vector<char> metadata;
+			metadata.insert(metadata.end(), partition_file_magic, partition_file_magic + sizeof(partition_file_magic));
+			const char* version_bytes = reinterpret_cast<const char*>(&partition_file_version);
+			metadata.insert(metadata.end(), version_bytes, version_bytes + sizeof(partition_file_version));
+			Internal::AppendU64(metadata, ArchetypeStorage::GetChunkSize());
+			Internal::AppendU64(metadata, partition_id);
+			Internal::AppendU64(metadata, archetypes.size());
+
+			for (const auto& archetype : archetypes) {
+				Internal::AppendU64(metadata, archetype.rows.size());
+				Internal::AppendU64(metadata, archetype.chunk_entity_capacity);
+				Internal::AppendU64(metadata, archetype.chunks.size());
+				for (const auto& row : archetype.rows) {
+					Internal::AppendU64(metadata, row.size);
+					Internal::AppendU64(metadata, row.offset);
+					Internal::AppendU64(metadata, row.previous_offset);
+					Internal::AppendU64(metadata, row.name.size());
+					metadata.insert(metadata.end(), row.name.begin(), row.name.end());
+				}
+				for (const auto& chunk_entities : archetype.chunk_entities) {
+					Internal::AppendU64(metadata, chunk_entities.size());
+					for (const auto& entity : chunk_entities) {
+						Internal::AppendU64(metadata, entity.id);
+					}
+				}
+			}
+
+			std::ofstream out(path, std::ios::binary | std::ios::trunc);
+			if (!out) {
+				return false;
+			}
+			out.write(metadata.data(), metadata.size());
+			for (const auto& archetype : archetypes) {
+				for (const auto& chunk_ptr : archetype.chunks) {
+					out.write(static_cast<const char*>(chunk_ptr->chunk_ptr), ArchetypeStorage::GetChunkSize());
+				}
+			}
+			return static_cast<bool>(out);
+		}
+
+		// Read a file written by Write into new chunks, replacing the content of this. The chunks are allocated from
+		// the default heap, since the world's memory resource may not be safe to use from this thread; AttachPartition
+		// copies them into the world's resource if it is another one.
+		bool Read(const std::string& path)
+		{
+			std::ifstream in(path, std::ios::binary);
+			if (!in) {
+				return false;
+			}
+			auto read_u64 = [&](uint64_t& value) -> bool {
+				return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+			};
+
+			char magic[4];
+			uint32_t version;
+			uint64_t chunk_size, file_partition_id, archetype_count;
+			if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, partition_file_magic, sizeof(magic)) != 0
+				|| !in.read(reinterpret_cast<char*>(&version), sizeof(version)) || version != partition_file_version
+				|| !read_u64(chunk_size) || chunk_size != ArchetypeStorage::GetChunkSize()
+				|| !read_u64(file_partition_id) || file_partition_id != partition_id || !read_u64(archetype_count)) {
+				return false;
+			}
+
+			std::vector<ArchetypeChunks> read_archetypes;
+			for (uint64_t a = 0; a < archetype_count && in; a++) {
+				ArchetypeChunks archetype;
+				uint64_t row_count, chunk_count;
+				if (!read_u64(row_count) || !read_u64(archetype.chunk_entity_capacity) || !read_u64(chunk_count)
+					|| archetype.chunk_entity_capacity > ArchetypeStorage::GetChunkSize()) {
+					return false;
+				}
+				for (uint64_t r = 0; r < row_count; r++) {
+					Row row;
+					uint64_t name_length;
+					if (!read_u64(row.size) || !read_u64(row.offset) || !read_u64(row.previous_offset)
+						|| !read_u64(name_length) || name_length > max_name_length) {
+						return false;
+					}
+					row.name.resize(name_length);
+					if (!in.read(&row.name[0], name_length)) {
+						return false;
+					}
+					archetype.rows.push_back(std::move(row));
+				}
+				for (uint64_t i = 0; i < chunk_count; i++) {
+					uint64_t entity_count;
+					if (!read_u64(entity_count) || entity_count > archetype.chunk_entity_capacity) {
+						return false;
+					}
+					std::vector<Entity> chunk_entities(entity_count);
+					for (auto& entity : chunk_entities) {
+						uint64_t id;
+						if (!read_u64(id)) {
+							return false;
+						}
+						entity = Entity(id);
+					}
+					archetype.chunk_entities.push_back(std::move(chunk_entities));
+				}
+				read_archetypes.push_back(std::move(archetype));
+			}
+
+			for (auto& archetype : read_archetypes) {
+				for (size_t i = 0; i < archetype.chunk_entities.size(); i++) {
+					archetype.chunks.emplace_back(new Chunk(ArchetypeStorage::GetChunkSize()));
+					if (!in.read(static_cast<char*>(archetype.chunks.back()->chunk_ptr), ArchetypeStorage::GetChunkSize())) {
+						return false;
+					}
+				}
+			}
+
+			archetypes = std::move(read_archetypes);
+			return true;
+		}
+
+	private:
+		static constexpr char partition_file_magic[4] = { 'S', 'E', 'C', 'P' };
+		static constexpr uint32_t partition_file_version = 1;
+		static constexpr uint64_t max_name_length = 4096;
+
+		uint64_t partition_id;
+		std::vector<ArchetypeChunks> archetypes;
+	};
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "EntityManager.h"
+#include "JobSystem.h"
+#include "Partition.h"
+
+
+namespace ECS
+{
+	enum class PartitionState
+	{
+		Resident,   // In the world
+		Unloading,  // Detached from the world, being written
+		Unloaded,   // Written and freed
+		Loading     // Being read, or read and waiting for the next sync point
+	};
+
+	// Unloads and loads the partitions of a world in the background, so that memory scales with the active
+	// area rather than the world size. Files are written and read on the job system; the world is only touched
+	// to detach the chunks of a partition, and to attach the chunks read at a sync point, see World::Update.
+	class PartitionStreamer
+	{
+	public:
+
+		PartitionStreamer(EntityManager* entity_mgr_ptr, JobSystem* job_system_ptr)
+			: entity_mgr_ptr(entity_mgr_ptr), job_system_ptr(job_system_ptr) {}
+
+		// Avoid unintentional copy
+		PartitionStreamer(const PartitionStreamer&) = delete;
+		PartitionStreamer operator=(const PartitionStreamer&) = delete;
+
+		// Detach a resident partition from the world now, and write it to the file in the background, freeing its
+		// chunks once written. If writing fails, the partition is attached back at the next sync point.
+		// Returns false if the partition is not resident or can't be detached, see EntityManager::DetachPartition.
+		bool Unload(uint64_t partition_id, const std::string& path)
+		{
+			if (this->GetState(partition_id) != PartitionState::Resident) {
+				return false;
+			}
+			std::shared_ptr<PartitionData> data_ptr(entity_mgr_ptr->DetachPartition(partition_id));
+			if (!data_ptr) {
+				return false;
+			}
+			this->SetState(partition_id, PartitionState::Unloading);
+
+			job_system_ptr->Submit([this, data_ptr, path]() -> void {
+				if (data_ptr->Write(path)) {
+					this->SetState(data_ptr->GetPartitionID(), PartitionState::Unloaded);
+					return;  // the chunks are freed with the data
+				}
+				std::lock_guard<std::mutex> lock(mutex);
+				ready_data_ptrs.push_back(data_ptr);
+			});
+			return true;
+		}
+
+		// Read an unloaded partition from its file in the background, to be attached at the next sync point after.
+		// If reading or attaching fails, the partition is left unloaded.
+		bool Load(uint64_t partition_id, const std::string& path)
+		{
+			if (this->GetState(partition_id) != PartitionState::Unloaded) {
+				return false;
+			}
+			this->SetState(partition_id, PartitionState::Loading);
+
+			job_system_ptr->Submit([this, partition_id, path]() -> void {
+				std::shared_ptr<PartitionData> data_ptr(new PartitionData(partition_id));
+				if (!data_ptr->Read(path)) {
+					this->SetState(partition_id, PartitionState::Unloaded);
+					return;
+				}
+				std::lock_guard<std::mutex> lock(mutex);
+				ready_data_ptrs.push_back(data_ptr);
+			});
+			return true;
+		}
+
+		// Attach the partitions read (or failed to be written) since the last call; must be called when no
+		// system iterates the world.
+		void Sync()
+		{
+			std::vector<std::shared_ptr<PartitionData>> data_ptrs;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				data_ptrs.swap(ready_data_ptrs);
+			}
+			for (const auto& data_ptr : data_ptrs) {
+				bool attached = entity_mgr_ptr->AttachPartition(*data_ptr);
+				this->SetState(data_ptr->GetPartitionID(), attached ? PartitionState::Resident : PartitionState::Unloaded);
+			}
+		}
+
+		// Partitions never unloaded are resident
+		PartitionState GetState(uint64_t partition_id)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto iter = states.find(partition_id);
+			return iter == states.end() ? PartitionState::Resident : iter->second;
+		}
+
+	private:
+		void SetState(uint64_t partition_id, PartitionState state)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			states[partition_id] = state;
+		}
+
+		EntityManager* entity_mgr_ptr;
+		JobSystem* job_system_ptr;
+
+		std::mutex mutex;
+		std::unordered_map<uint64_t, PartitionState> states;
+
+		// The partitions to be attached at the next sync point
+		std::vector<std::shared_ptr<PartitionData>> ready_data_ptrs;
+	};
+}
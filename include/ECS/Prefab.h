@@ -0,0 +1,94 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "ComponentTypeManager.h"
+#include "ArchetypeStorage.h"
+#include "SharedComponent.h"
+
+
+namespace ECS
+{
+	// A snapshot of an entity's archetype and component values, created by EntityManager::CreatePrefab,
+	// from which entities are instantiated in bulk. Sparse set components are not part of a prefab.
+	// A prefab holds references to shared values, so it must not outlive its entity manager.
+	class Prefab
+	{
+	public:
+
+		// Avoid unintentional copy
+		Prefab(const Prefab&) = delete;
+		Prefab operator=(const Prefab&) = delete;
+
+		Prefab(const ComponentTypeManager* c_mgr_ptr, SharedValueStores* shared_stores_ptr,
+			const ArchetypeID& a_id, ArchetypeStorage* a_store_ptr, const Entity& entity)
+			: archetype_id(a_id), shared_stores_ptr(shared_stores_ptr), shared_types(a_store_ptr->GetSharedTypes()),
+			shared_key(a_store_ptr->GetEntitySharedKey(entity))
+		{
+			// Keep the shared values alive, even if no chunk uses them anymore
+			for (size_t i = 0; i < shared_types.size(); i++) {
+				(*shared_stores_ptr)[shared_types[i]]->AddRef(shared_key[i]);
+			}
+
+			// Each value at an offset aligned for any type
+			const std::vector<ComponentTypeID>& component_types = a_store_ptr->GetComponentTypes();
+			size_t data_size = 0;
+			for (const auto& c_id : component_types) {
+				value_offsets.push_back(data_size);
+				data_size += (c_mgr_ptr->GetComponentType(c_id).size + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+			}
+			data.reset(new std::max_align_t[data_size / sizeof(std::max_align_t) + 1]);
+
+			std::vector<const void*> row_addresses = a_store_ptr->GetEntityRowAddresses(entity);
+			for (size_t i = 0; i < component_types.size(); i++) {
+				const ComponentType& c_type = c_mgr_ptr->GetComponentType(component_types[i]);
+				void* value_ptr = this->GetValueAddress(i);
+				if (c_type.copy_construct != nullptr) {
+					c_type.copy_construct(value_ptr, row_addresses[i]);
+				}
+				else {
+					std::memcpy(value_ptr, row_addresses[i], c_type.size);
+				}
+				value_destroys.push_back(c_type.destroy);
+				values.push_back(value_ptr);
+			}
+		}
+
+		~Prefab()
+		{
+			for (size_t i = 0; i < values.size(); i++) {
+				if (value_destroys[i] != nullptr) {
+					value_destroys[i](this->GetValueAddress(i));
+				}
+			}
+			for (size_t i = 0; i < shared_types.size(); i++) {
+				(*shared_stores_ptr)[shared_types[i]]->Release(shared_key[i]);
+			}
+		}
+
+		const ArchetypeID& GetArchetypeID() const { return archetype_id; }
+		const SharedKey& GetSharedKey() const { return shared_key; }
+
+		// The value of each chunk component, in the row order of the archetype storage
+		const std::vector<const void*>& GetValues() const { return values; }
+
+	private:
+		void* GetValueAddress(size_t value_index)
+		{
+			return reinterpret_cast<char*>(data.get()) + value_offsets[value_index];
+		}
+
+		ArchetypeID archetype_id;
+
+		SharedValueStores* shared_stores_ptr;
+		std::vector<ComponentTypeID> shared_types;
+		SharedKey shared_key;
+
+		std::unique_ptr<std::max_align_t[]> data;
+		std::vector<size_t> value_offsets;
+		std::vector<DestroyFunc> value_destroys;
+		std::vector<const void*> values;
+	};
+}
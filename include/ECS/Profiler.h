@@ -0,0 +1,209 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// Profiling is compiled in only with ECS_ENABLE_PROFILING defined; otherwise the counters below cost nothing.
+#ifdef ECS_ENABLE_PROFILING
+#define ECS_PROFILE_COUNT(counter, n) (this->profile_counters.counter += (n))
+#else
+#define ECS_PROFILE_COUNT(counter, n) ((void)0)
+#endif
+
+
+namespace ECS
+{
+	// Work counted by the entity manager, accumulated until read and reset by the profiler.
+	struct ProfileCounters
+	{
+		size_t entities_visited = 0;
+		size_t chunks_visited = 0;
+		size_t structural_changes = 0;  // Entity creations, component additions and removals
+	};
+
+	// What a system did in one frame, added up over its steps in the frame
+	struct SystemFrameStats
+	{
+		double wall_time_us = 0.0;
+		size_t entities_visited = 0;
+		size_t chunks_visited = 0;
+		size_t structural_changes = 0;
+	};
+
+	// The stats of a system over a rolling window of the latest frames
+	class SystemProfile
+	{
+	public:
+
+		SystemProfile(const std::string& name, size_t window_size) : name(name), window_size(std::max<size_t>(window_size, 1)) {}
+
+		void AddFrame(const SystemFrameStats& stats)
+		{
+			if (frames.size() < window_size) {
+				frames.push_back(stats);
+			}
+			else {
+				frames[next_frame_index] = stats;
+			}
+			next_frame_index = (next_frame_index + 1) % window_size;
+			frame_count++;
+		}
+
+		// The p-th percentile (0 to 100) of wall time within the window, in microseconds.
+		double GetWallTimePercentile(double p) const
+		{
+			if (frames.empty()) {
+				return 0.0;
+			}
+			std::vector<double> wall_times;
+			wall_times.reserve(frames.size());
+			for (const auto& stats : frames) {
+				wall_times.push_back(stats.wall_time_us);
+			}
+			size_t rank = static_cast<size_t>(std::clamp(p, 0.0, 100.0) / 100.0 * (wall_times.size() - 1) + 0.5);
+			std::nth_element(wall_times.begin(), wall_times.begin() + rank, wall_times.end());
+			return wall_times[rank];
+		}
+
+		// The stats of the last frame recorded, all zero if there is none
+		const SystemFrameStats& GetLastFrame() const
+		{
+			static const SystemFrameStats no_frame;
+			if (frames.empty()) {
+				return no_frame;
+			}
+			return frames[(next_frame_index + window_size - 1) % window_size];
+		}
+
+		const std::string& GetName() const { return name; }
+		size_t GetFrameCount() const { return frame_count; }
+
+	private:
+		std::string name;
+
+		// A ring buffer of the latest frames
+		std::vector<SystemFrameStats> frames;
+		size_t window_size;
+		size_t next_frame_index = 0;
+
+		size_t frame_count = 0;  // All frames ever recorded
+	};
+
+	// Collect per-system stats of World::Update, and optionally export them as Chrome trace events
+	// (viewable in chrome://tracing or Perfetto).
+	class Profiler
+	{
+	public:
+
+		Profiler(size_t window_size = 256) : window_size(window_size), start_time(Clock::now()) {}
+
+		// Avoid unintentional copy
+		Profiler(const Profiler&) = delete;
+		Profiler operator=(const Profiler&) = delete;
+
+		~Profiler()
+		{
+			this->StopTrace();
+		}
+
+		// Microseconds since the profiler was created, the time base of all records.
+		double Now() const
+		{
+			return std::chrono::duration<double, std::micro>(Clock::now() - start_time).count();
+		}
+
+		// Add a frame of a system to its profile, once per frame with the stats of all its steps in the frame.
+		void RecordSystem(const void* system_ptr, const std::string& name, const SystemFrameStats& stats)
+		{
+			auto iter = profiles.find(system_ptr);
+			if (iter == profiles.end()) {
+				iter = profiles.emplace(system_ptr, SystemProfile(name, window_size)).first;
+			}
+			iter->second.AddFrame(stats);
+		}
+
+		// Write a trace event of one step of a system, if tracing.
+		void TraceSystemStep(const std::string& name, double start_us, const SystemFrameStats& stats)
+		{
+			if (trace_file.is_open()) {
+				this->WriteTraceEventHeader(name, "system", start_us, stats.wall_time_us);
+				trace_file << ",\"args\":{\"entities\":" << stats.entities_visited << ",\"chunks\":" << stats.chunks_visited
+					<< ",\"structural_changes\":" << stats.structural_changes << "}}";
+			}
+		}
+
+		void RecordFrame(double start_us, double wall_time_us)
+		{
+			frame_count++;
+			if (trace_file.is_open()) {
+				this->WriteTraceEventHeader("Frame " + std::to_string(frame_count), "frame", start_us, wall_time_us);
+				trace_file << "}";
+			}
+		}
+
+		// The profile of a system, or nullptr if it has never been updated.
+		const SystemProfile* GetSystemProfile(const void* system_ptr) const
+		{
+			auto iter = profiles.find(system_ptr);
+			return iter == profiles.end() ? nullptr : &iter->second;
+		}
+
+		// Start writing trace events of all following frames to a JSON file, until StopTrace.
+		bool StartTrace(const std::string& path)
+		{
+			this->StopTrace();
+
+			trace_file.open(path, std::ios::trunc);
+			if (!trace_file) {
+				return false;
+			}
+			trace_file << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+			trace_event_count = 0;
+			return true;
+		}
+
+		void StopTrace()
+		{
+			if (trace_file.is_open()) {
+				trace_file << "]}" << std::endl;
+				trace_file.close();
+			}
+		}
+
+		size_t GetFrameCount() const { return frame_count; }
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		// Write a complete ("X") event up to its args, leaving the object open.
+		void WriteTraceEventHeader(const std::string& name, const char* category, double start_us, double duration_us)
+		{
+			if (trace_event_count++ != 0) {
+				trace_file << ",";
+			}
+			std::string escaped_name;
+			for (char c : name) {
+				if (c == '"' || c == '\\') {
+					escaped_name.push_back('\\');
+				}
+				escaped_name.push_back(c);
+			}
+			trace_file << "\n{\"name\":\"" << escaped_name << "\",\"cat\":\"" << category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+				<< ",\"ts\":" << start_us << ",\"dur\":" << duration_us;
+		}
+
+		size_t window_size;
+		Clock::time_point start_time;
+		size_t frame_count = 0;
+
+		std::unordered_map<const void*, SystemProfile> profiles;
+
+		std::ofstream trace_file;
+		size_t trace_event_count = 0;
+	};
+}
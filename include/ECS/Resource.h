@@ -0,0 +1,143 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+
+namespace ECS
+{
+	namespace Internal
+	{
+		inline size_t NextResourceTypeIndex()
+		{
+			static std::atomic<size_t> resource_type_counter{ 0 };
+			return resource_type_counter++;
+		}
+
+		// A dense index per resource type, assigned on first use and shared by all worlds.
+		template <typename T>
+		size_t GetResourceTypeIndex()
+		{
+			static const size_t index = NextResourceTypeIndex();
+			return index;
+		}
+	}
+
+	// The resources a system reads and writes, declared up front so that a scheduler can tell which
+	// systems may run in parallel.
+	class ResourceAccess
+	{
+	public:
+
+		template <typename T>
+		void AddRead()
+		{
+			Insert(reads, Internal::GetResourceTypeIndex<T>());
+		}
+
+		template <typename T>
+		void AddWrite()
+		{
+			Insert(writes, Internal::GetResourceTypeIndex<T>());
+		}
+
+		// Whether running concurrently with the other could race: one writes what the other reads or writes.
+		bool ConflictsWith(const ResourceAccess& other) const
+		{
+			return Intersects(writes, other.writes) || Intersects(writes, other.reads) || Intersects(reads, other.writes);
+		}
+
+		const std::vector<size_t>& GetReads() const { return reads; }
+		const std::vector<size_t>& GetWrites() const { return writes; }
+
+	private:
+		// Both lists are kept sorted
+		static void Insert(std::vector<size_t>& indices, size_t index)
+		{
+			auto iter = std::lower_bound(indices.begin(), indices.end(), index);
+			if (iter == indices.end() || *iter != index) {
+				indices.insert(iter, index);
+			}
+		}
+
+		static bool Intersects(const std::vector<size_t>& lhs, const std::vector<size_t>& rhs)
+		{
+			auto lhs_iter = lhs.begin();
+			auto rhs_iter = rhs.begin();
+			while (lhs_iter != lhs.end() && rhs_iter != rhs.end()) {
+				if (*lhs_iter == *rhs_iter) {
+					return true;
+				}
+				*lhs_iter < *rhs_iter ? ++lhs_iter : ++rhs_iter;
+			}
+			return false;
+		}
+
+		std::vector<size_t> reads;
+		std::vector<size_t> writes;
+	};
+
+	// World-global singletons (clock, config, RNG...) stored outside of archetypes, in an array indexed by
+	// resource type, so that an access costs one bounds check and one indirection.
+	class ResourceStorage
+	{
+	public:
+
+		ResourceStorage() {}
+
+		// Avoid unintentional copy
+		ResourceStorage(const ResourceStorage&) = delete;
+		ResourceStorage operator=(const ResourceStorage&) = delete;
+
+		// Construct the resource T with given arguments, replacing the old one if it exists.
+		template <typename T, typename... Args>
+		T* Set(const Args&... args)
+		{
+			size_t index = Internal::GetResourceTypeIndex<T>();
+			if (index >= resources.size()) {
+				resources.resize(index + 1);
+			}
+			ResourceHolder<T>* holder_ptr = new ResourceHolder<T>(args...);
+			resources[index].reset(holder_ptr);
+			return &holder_ptr->value;
+		}
+
+		// The resource T, or nullptr if it is not set.
+		template <typename T>
+		T* Get() const
+		{
+			size_t index = Internal::GetResourceTypeIndex<T>();
+			if (index >= resources.size() || !resources[index]) {
+				return nullptr;
+			}
+			return &static_cast<ResourceHolder<T>*>(resources[index].get())->value;
+		}
+
+		template <typename T>
+		void Remove()
+		{
+			size_t index = Internal::GetResourceTypeIndex<T>();
+			if (index < resources.size()) {
+				resources[index].reset();
+			}
+		}
+
+	private:
+		struct ResourceHolderBase
+		{
+			virtual ~ResourceHolderBase() = default;
+		};
+
+		template <typename T>
+		struct ResourceHolder : ResourceHolderBase
+		{
+			template <typename... Args>
+			ResourceHolder(const Args&... args) : value(args...) {}
+
+			T value;
+		};
+
+		std::vector<std::unique_ptr<ResourceHolderBase>> resources;
+	};
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+
+namespace ECS
+{
+	// The shared value of each shared component type in a chunk, as value indices into the types' stores,
+	// ordered as the shared types of the chunk's archetype.
+	typedef std::vector<size_t> SharedKey;
+
+	constexpr size_t INVALID_SHARED_VALUE_INDEX = static_cast<size_t>(-1);
+
+	// Whether std::hash is specialized for T, e.g. to index the distinct values of a shared component type
+	template <typename T, typename = void>
+	constexpr bool IsHashable = false;
+
+	template <typename T>
+	constexpr bool IsHashable<T, std::void_t<decltype(std::hash<T>()(std::declval<const T&>()))>> = true;
+
+	// The type-erased part of a shared value store, for reference counting by the chunks.
+	class SharedValueStoreBase
+	{
+	public:
+		virtual ~SharedValueStoreBase() = default;
+
+		void AddRef(size_t value_index)
+		{
+			ref_counts[value_index]++;
+		}
+
+		// Release a reference from a chunk, and drop the value once no chunk uses it.
+		void Release(size_t value_index)
+		{
+			assert(ref_counts[value_index] != 0);
+			if (--ref_counts[value_index] == 0) {
+				this->DropValue(value_index);
+				free_indices.push_back(value_index);
+			}
+		}
+
+		// The number of distinct values in use
+		size_t GetValueCount() const
+		{
+			return ref_counts.size() - free_indices.size();
+		}
+
+	protected:
+		virtual void DropValue(size_t value_index) = 0;
+
+		// The number of chunks referring to each value
+		std::vector<size_t> ref_counts;
+		std::vector<size_t> free_indices;
+	};
+
+	// The distinct values of a shared component type T, deduplicated by operator== of T. The values are indexed
+	// by std::hash<T>, which must agree with operator==, if it is specialized; otherwise they are searched linearly.
+	template <typename T>
+	class SharedValueStore : public SharedValueStoreBase
+	{
+	public:
+
+		// The index of a value equal to the given one, or INVALID_SHARED_VALUE_INDEX if there is none.
+		size_t Find(const T& value) const
+		{
+			if constexpr (IsHashable<T>) {
+				auto range = value_indices_by_hash.equal_range(std::hash<T>()(value));
+				for (auto iter = range.first; iter != range.second; ++iter) {
+					if (*values[iter->second] == value) {
+						return iter->second;
+					}
+				}
+			}
+			else {
+				for (size_t i = 0; i < values.size(); i++) {
+					if (values[i] && *values[i] == value) {
+						return i;
+					}
+				}
+			}
+			return INVALID_SHARED_VALUE_INDEX;
+		}
+
+		// The index of a value equal to the given one, which is added if there is none.
+		size_t FindOrAdd(const T& value)
+		{
+			size_t value_index = this->Find(value);
+			if (value_index != INVALID_SHARED_VALUE_INDEX) {
+				return value_index;
+			}
+
+			if (!free_indices.empty()) {
+				value_index = free_indices.back();
+				free_indices.pop_back();
+				values[value_index].emplace(value);
+			}
+			else {
+				value_index = values.size();
+				values.emplace_back(value);
+				ref_counts.push_back(0);
+			}
+			if constexpr (IsHashable<T>) {
+				value_indices_by_hash.emplace(std::hash<T>()(value), value_index);
+			}
+			return value_index;
+		}
+
+		T* Get(size_t value_index)
+		{
+			return &*values[value_index];
+		}
+
+	protected:
+		virtual void DropValue(size_t value_index) override
+		{
+			if constexpr (IsHashable<T>) {
+				auto range = value_indices_by_hash.equal_range(std::hash<T>()(*values[value_index]));
+				for (auto iter = range.first; iter != range.second; ++iter) {
+					if (iter->second == value_index) {
+						value_indices_by_hash.erase(iter);
+						break;
+					}
+				}
+			}
+			values[value_index].reset();
+		}
+
+	private:
+		std::vector<std::optional<T>> values;
+		std::unordered_multimap<size_t, size_t> value_indices_by_hash;  // Only used if T is hashable
+	};
+
+	// The stores of all shared component types, indexed by component type ID
+	typedef std::vector<std::unique_ptr<SharedValueStoreBase>> SharedValueStores;
+}
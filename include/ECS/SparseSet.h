@@ -0,0 +1,140 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <vector>
+
+#include "Entity.h"
+
+
+namespace ECS
+{
+	// The type-erased part of a sparse set, for operations that don't need the component type.
+	class SparseSetBase
+	{
+	public:
+		virtual ~SparseSetBase() = default;
+
+		virtual void Remove(const Entity& entity) = 0;
+
+		// Give the destination entity a copy of the source entity's component, if the source has one.
+		virtual void Copy(const Entity& src_entity, const Entity& dest_entity) = 0;
+
+		bool Has(const Entity& entity) const
+		{
+			return this->GetDenseIndex(entity) != invalid_index;
+		}
+
+		size_t Size() const
+		{
+			return dense_entities.size();
+		}
+
+		// All entities having the component, densely packed
+		const std::vector<Entity>& GetEntities() const
+		{
+			return dense_entities;
+		}
+
+	protected:
+		static constexpr size_t invalid_index = static_cast<size_t>(-1);
+
+		// Entity IDs only grow, so the sparse index is paged to only hold pages that have been touched.
+		static constexpr size_t page_size = 4096;
+
+		size_t GetDenseIndex(const Entity& entity) const
+		{
+			size_t page_index = entity.id / page_size;
+			if (page_index >= sparse_pages.size() || !sparse_pages[page_index]) {
+				return invalid_index;
+			}
+			return sparse_pages[page_index][entity.id % page_size];
+		}
+
+		void SetDenseIndex(const Entity& entity, size_t dense_index)
+		{
+			size_t page_index = entity.id / page_size;
+			if (page_index >= sparse_pages.size()) {
+				sparse_pages.resize(page_index + 1);
+			}
+			if (!sparse_pages[page_index]) {
+				sparse_pages[page_index].reset(new size_t[page_size]);
+				std::fill(sparse_pages[page_index].get(), sparse_pages[page_index].get() + page_size, invalid_index);
+			}
+			sparse_pages[page_index][entity.id % page_size] = dense_index;
+		}
+
+		// The dense array of entities, parallel to the values of the derived set
+		std::vector<Entity> dense_entities;
+
+		// The sparse index: entity ID -> position in the dense arrays
+		std::vector<std::unique_ptr<size_t[]>> sparse_pages;
+	};
+
+	// Components of type T stored outside of archetypes: adding and removing them is O(1) and never
+	// migrates the entity's other components, at the cost of an indirection when joined with chunk components.
+	template <typename T>
+	class SparseSet : public SparseSetBase
+	{
+	public:
+
+		// Construct the entity's component with given arguments, replacing the old one if it exists.
+		template <typename... Args>
+		T* Emplace(const Entity& entity, const Args&... args)
+		{
+			size_t dense_index = this->GetDenseIndex(entity);
+			if (dense_index != invalid_index) {
+				dense_values[dense_index] = T(args...);
+				return &dense_values[dense_index];
+			}
+
+			this->SetDenseIndex(entity, dense_entities.size());
+			dense_entities.push_back(entity);
+			dense_values.emplace_back(args...);
+			return &dense_values.back();
+		}
+
+		T* Get(const Entity& entity)
+		{
+			size_t dense_index = this->GetDenseIndex(entity);
+			return dense_index == invalid_index ? nullptr : &dense_values[dense_index];
+		}
+
+		// Remove the entity's component, filling the hole with the last entry to keep the arrays dense.
+		virtual void Remove(const Entity& entity) override
+		{
+			size_t dense_index = this->GetDenseIndex(entity);
+			if (dense_index == invalid_index) {
+				return;
+			}
+
+			size_t last_index = dense_entities.size() - 1;
+			if (dense_index != last_index) {
+				dense_entities[dense_index] = dense_entities[last_index];
+				dense_values[dense_index] = std::move(dense_values[last_index]);
+				this->SetDenseIndex(dense_entities[dense_index], dense_index);
+			}
+			dense_entities.pop_back();
+			dense_values.pop_back();
+			this->SetDenseIndex(entity, invalid_index);
+		}
+
+		virtual void Copy(const Entity& src_entity, const Entity& dest_entity) override
+		{
+			T* value_ptr = this->Get(src_entity);
+			if (value_ptr != nullptr) {
+				T value = *value_ptr;  // Emplace may reallocate the values
+				this->Emplace(dest_entity, value);
+			}
+		}
+
+		// All values, parallel to GetEntities()
+		std::vector<T>& GetValues()
+		{
+			return dense_values;
+		}
+
+	private:
+		std::vector<T> dense_values;
+	};
+}
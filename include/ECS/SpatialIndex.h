@@ -0,0 +1,353 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "Entity.h"
+#include "EntityManager.h"
+
+
+namespace ECS
+{
+	// A uniform grid of the entities having a position component T, for range and nearest neighbour queries that
+	// visit the cells around the queried region instead of every entity, e.g. areas of interest or a collision
+	// broad phase. T has float members x and y, and z in 3D. Update brings the grid up to date by reading only the
+	// chunks changed since the last update, i.e. whose entities were added or removed, or whose T may have been
+	// written; queries see the positions as of the last update.
+	template <typename T, size_t Dims = 3>
+	class SpatialIndex
+	{
+		static_assert(Dims == 2 || Dims == 3, "the grid is 2D or 3D");
+
+	public:
+		typedef std::array<float, Dims> Point;
+
+		SpatialIndex(EntityManager* entity_mgr_ptr, float cell_size)
+			: entity_mgr_ptr(entity_mgr_ptr), cell_size(cell_size), inv_cell_size(1.0f / cell_size) {}
+
+		// Avoid unintentional copy
+		SpatialIndex(const SpatialIndex&) = delete;
+		SpatialIndex operator=(const SpatialIndex&) = delete;
+
+		// Returns the number of entities read.
+		size_t Update()
+		{
+			uint64_t since = version;
+			version = entity_mgr_ptr->NextChangeVersion();
+			update_count++;
+
+			// The entities last seen in a changed or dropped chunk, which are gone unless seen again in this update
+			std::vector<Entity> candidates;
+			size_t read_count = 0;
+			std::unordered_map<ArchetypeID, std::vector<std::vector<Entity>>> visited_chunk_entities;
+			entity_mgr_ptr->ForEachArchetypeStorage<T>([&](const ArchetypeID& a_id, ArchetypeStorage* a_store_ptr) -> void {
+				std::vector<std::vector<Entity>>& seen_chunks = visited_chunk_entities[a_id];
+				seen_chunks.swap(chunk_entities[a_id]);
+				for (size_t i = a_store_ptr->GetChunkCount(); i < seen_chunks.size(); i++) {
+					candidates.insert(candidates.end(), seen_chunks[i].begin(), seen_chunks[i].end());
+				}
+				seen_chunks.resize(a_store_ptr->GetChunkCount());
+
+				size_t row_index = a_store_ptr->GetRowIndex(entity_mgr_ptr->GetComponentTypeID<T>());
+				for (size_t i = 0; i < a_store_ptr->GetChunkCount(); i++) {
+					if (since != 0 && a_store_ptr->GetRowVersion(i, row_index) <= since) {
+						continue;
+					}
+					candidates.insert(candidates.end(), seen_chunks[i].begin(), seen_chunks[i].end());
+					const Entity* entities = a_store_ptr->GetChunkEntities(i);
+					size_t entity_count = a_store_ptr->GetChunkEntityCount(i);
+					seen_chunks[i].assign(entities, entities + entity_count);
+					read_count += entity_count;
+					for (size_t j = 0; j < entity_count; j++) {
+						const T* value_ptr = static_cast<const T*>(a_store_ptr->ReadEntryComponent(EntityIndex(i, j), row_index));
+						this->Place(entities[j], GetPoint(*value_ptr));
+					}
+				}
+			});
+			for (auto& [a_id, seen_chunks] : chunk_entities) {
+				for (const auto& entities : seen_chunks) {
+					candidates.insert(candidates.end(), entities.begin(), entities.end());  // the archetype is gone
+				}
+			}
+			chunk_entities.swap(visited_chunk_entities);
+
+			for (const auto& entity : candidates) {
+				auto iter = records.find(entity);
+				if (iter != records.end() && iter->second.update_count != update_count) {
+					this->Remove(iter);
+				}
+			}
+			return read_count;
+		}
+
+		// Set result to the entities within the box from min_point to max_point, bounds included.
+		size_t QueryAABB(const Point& min_point, const Point& max_point, std::vector<Entity>& result) const
+		{
+			result.clear();
+			this->ForEachCellIn(this->GetCellCoords(min_point), this->GetCellCoords(max_point), [&](const Cell& cell) -> void {
+				for (const auto& entry : cell) {
+					bool inside = true;
+					for (size_t d = 0; d < Dims; d++) {
+						inside = inside && entry.point[d] >= min_point[d] && entry.point[d] <= max_point[d];
+					}
+					if (inside) {
+						result.push_back(entry.entity);
+					}
+				}
+			});
+			return result.size();
+		}
+
+		// Set result to the entities within radius of center.
+		size_t QueryRadius(const Point& center, float radius, std::vector<Entity>& result) const
+		{
+			result.clear();
+			float radius_sq = radius * radius;
+			this->ForEachCellIn(this->GetCellCoords(Offset(center, -radius)), this->GetCellCoords(Offset(center, radius)), [&](const Cell& cell) -> void {
+				for (const auto& entry : cell) {
+					if (DistanceSquared(entry.point, center) <= radius_sq) {
+						result.push_back(entry.entity);
+					}
+				}
+			});
+			return result.size();
+		}
+
+		// Find the entity nearest to point within max_distance, visiting the cells ring by ring from the point's one.
+		// Returns false if there is none.
+		bool QueryNearest(const Point& point, float max_distance, Entity& nearest) const
+		{
+			if (!(max_distance >= 0.0f)) {
+				return false;  // negative or NaN
+			}
+			float best_sq = max_distance * max_distance;
+			bool found = false;
+			auto visit = [&](const Cell& cell) -> void {
+				for (const auto& entry : cell) {
+					float distance_sq = DistanceSquared(entry.point, point);
+					if (distance_sq <= best_sq) {
+						best_sq = distance_sq;
+						nearest = entry.entity;
+						found = true;
+					}
+				}
+			};
+
+			// The points of the cells of ring r are farther than (r - 1) * cell_size from the point. The rings are
+			// bounded before casting, since a box of more rings than cells holds more cells than the grid anyway.
+			CellCoords center = this->GetCellCoords(point);
+			double ring_bound = std::ceil(static_cast<double>(max_distance) * inv_cell_size) + 1.0;
+			if (!(ring_bound <= static_cast<double>(cells.size())) || RingBoxCellCount(static_cast<int64_t>(ring_bound)) > cells.size()) {
+				for (const auto& pair : cells) {
+					visit(pair.second);
+				}
+				return found;
+			}
+			int64_t max_ring = static_cast<int64_t>(ring_bound);
+			for (int64_t r = 0; r <= max_ring && !(found && (r - 1) * cell_size > std::sqrt(best_sq)); r++) {
+				CellCoords low = center, high = center;
+				for (size_t d = 0; d < Dims; d++) {
+					low[d] -= r;
+					high[d] += r;
+				}
+				this->ForEachCoordsIn(low, high, [&](const CellCoords& coords) -> void {
+					int64_t ring = 0;
+					for (size_t d = 0; d < Dims; d++) {
+						ring = std::max(ring, std::abs(coords[d] - center[d]));
+					}
+					if (ring == r) {
+						auto iter = cells.find(GetCellKey(coords));
+						if (iter != cells.end()) {
+							visit(iter->second);
+						}
+					}
+				});
+			}
+			return found;
+		}
+
+		size_t GetEntityCount() const { return records.size(); }
+		size_t GetCellCount() const { return cells.size(); }
+		float GetCellSize() const { return cell_size; }
+
+	private:
+		typedef std::array<int64_t, Dims> CellCoords;
+
+		// Far enough from the limits of int64_t for the box and ring arithmetic
+		static constexpr double max_cell_coord = double(int64_t(1) << 60);
+
+		struct CellEntry
+		{
+			Entity entity;
+			Point point;
+		};
+
+		// The entities of a cell, with their positions
+		typedef std::vector<CellEntry> Cell;
+
+		struct Record
+		{
+			uint64_t cell_key = 0;
+			size_t slot = 0;  // The index in the cell
+			uint64_t update_count = 0;  // The last update that saw the entity
+		};
+
+		static Point GetPoint(const T& value)
+		{
+			if constexpr (Dims == 2) {
+				return { value.x, value.y };
+			}
+			else {
+				return { value.x, value.y, value.z };
+			}
+		}
+
+		static Point Offset(const Point& point, float offset)
+		{
+			Point result = point;
+			for (auto& value : result) {
+				value += offset;
+			}
+			return result;
+		}
+
+		static float DistanceSquared(const Point& lhs, const Point& rhs)
+		{
+			float distance_sq = 0.0f;
+			for (size_t d = 0; d < Dims; d++) {
+				distance_sq += (lhs[d] - rhs[d]) * (lhs[d] - rhs[d]);
+			}
+			return distance_sq;
+		}
+
+		// The coordinates are clamped, so that infinite or huge points have cells, and NaN ones are put in cell 0.
+		CellCoords GetCellCoords(const Point& point) const
+		{
+			CellCoords coords;
+			for (size_t d = 0; d < Dims; d++) {
+				double coord = std::floor(static_cast<double>(point[d]) * inv_cell_size);
+				coords[d] = coord != coord ? 0 : static_cast<int64_t>(std::min(std::max(coord, -max_cell_coord), max_cell_coord));
+			}
+			return coords;
+		}
+
+		// The coordinates packed into 64 bits, wrapping around: cells far apart may share a key, which only
+		// costs their entities being tested against queries of the other one.
+		static uint64_t GetCellKey(const CellCoords& coords)
+		{
+			const unsigned bits = 64 / Dims;
+			const uint64_t mask = (uint64_t(1) << bits) - 1;
+			uint64_t key = 0;
+			for (size_t d = 0; d < Dims; d++) {
+				key |= (static_cast<uint64_t>(coords[d]) & mask) << (d * bits);
+			}
+			return key;
+		}
+
+		static size_t RingBoxCellCount(int64_t ring)
+		{
+			double count = std::pow(2.0 * ring + 1.0, static_cast<double>(Dims));
+			return count >= double(std::numeric_limits<size_t>::max()) ? std::numeric_limits<size_t>::max() : static_cast<size_t>(count);
+		}
+
+		template <typename F>
+		static void ForEachCoordsIn(const CellCoords& low, const CellCoords& high, F func)
+		{
+			CellCoords coords = low;
+			while (true) {
+				func(coords);
+				size_t d = 0;
+				while (d < Dims && coords[d] == high[d]) {
+					coords[d] = low[d];
+					d++;
+				}
+				if (d == Dims) {
+					return;
+				}
+				coords[d]++;
+			}
+		}
+
+		// Call func for every non-empty cell in the box of cells from low to high, or for every cell if there are
+		// fewer cells than in the box.
+		template <typename F>
+		void ForEachCellIn(const CellCoords& low, const CellCoords& high, F func) const
+		{
+			double box_cell_count = 1.0;
+			for (size_t d = 0; d < Dims; d++) {
+				if (high[d] < low[d]) {
+					return;
+				}
+				box_cell_count *= double(high[d] - low[d]) + 1.0;
+			}
+			if (box_cell_count > double(cells.size())) {
+				for (const auto& pair : cells) {
+					func(pair.second);
+				}
+				return;
+			}
+			ForEachCoordsIn(low, high, [&](const CellCoords& coords) -> void {
+				auto iter = cells.find(GetCellKey(coords));
+				if (iter != cells.end()) {
+					func(iter->second);
+				}
+			});
+		}
+
+		// Put an entity at a point, moving it to another cell if needed
+		void Place(const Entity& entity, const Point& point)
+		{
+			uint64_t cell_key = GetCellKey(this->GetCellCoords(point));
+			auto [iter, inserted] = records.try_emplace(entity);
+			Record& record = iter->second;
+			record.update_count = update_count;
+			if (!inserted && record.cell_key == cell_key) {
+				cells.at(cell_key)[record.slot].point = point;
+				return;
+			}
+			if (!inserted) {
+				this->RemoveFromCell(record);
+			}
+			Cell& cell = cells[cell_key];
+			record.cell_key = cell_key;
+			record.slot = cell.size();
+			cell.push_back({ entity, point });
+		}
+
+		void Remove(typename std::unordered_map<Entity, Record>::iterator iter)
+		{
+			this->RemoveFromCell(iter->second);
+			records.erase(iter);
+		}
+
+		// Remove an entity from its cell by moving the cell's last entity into its slot, and drop the cell if empty
+		void RemoveFromCell(const Record& record)
+		{
+			auto cell_iter = cells.find(record.cell_key);
+			Cell& cell = cell_iter->second;
+			if (record.slot != cell.size() - 1) {
+				cell[record.slot] = cell.back();
+				records.at(cell[record.slot].entity).slot = record.slot;
+			}
+			cell.pop_back();
+			if (cell.empty()) {
+				cells.erase(cell_iter);
+			}
+		}
+
+		EntityManager* entity_mgr_ptr;
+		float cell_size;
+		float inv_cell_size;
+
+		std::unordered_map<uint64_t, Cell> cells;
+		std::unordered_map<Entity, Record> records;
+		// The entities of the chunks as of the last update, to find the entities gone from them
+		std::unordered_map<ArchetypeID, std::vector<std::vector<Entity>>> chunk_entities;
+		uint64_t version = 0;
+		uint64_t update_count = 0;
+	};
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <array>
+#include <vector>
+
+#include "Archetype.h"
+
+
+namespace ECS
+{
+	namespace Internal
+	{
+		// Estimate the heap memory of a node-based hash container: the bucket array plus one node per element,
+		// each holding the value, the link to the next node and the cached hash.
+		template <typename C>
+		size_t HashContainerBytes(const C& container)
+		{
+			return container.bucket_count() * sizeof(void*)
+				+ container.size() * (sizeof(typename C::value_type) + sizeof(void*) + sizeof(size_t));
+		}
+	}
+
+	// Memory and fragmentation statistics of one archetype's storage
+	struct ArchetypeStorageStats
+	{
+		ArchetypeID archetype_id = 0;
+
+		size_t entity_count = 0;
+		size_t chunk_count = 0;
+		size_t chunk_entity_capacity = 0;
+
+		// Chunks counted by how full they are: empty, up to 1/4, 1/2, 3/4, and up to full.
+		std::array<size_t, 5> occupancy_histogram{};
+
+		size_t bytes_used = 0;      // Component data of the stored entities
+		size_t bytes_reserved = 0;  // All chunk memory, used or not
+		size_t wasted_tail_bytes_per_chunk = 0;  // The chunk tail that is too small for one more entity
+
+		size_t index_bytes = 0;  // The entity arrays and the entity-to-index map
+	};
+
+	// Memory statistics of a whole world, gathered in O(archetypes + chunks).
+	struct StorageStats
+	{
+		std::vector<ArchetypeStorageStats> archetypes;
+
+		// Totals of all archetypes
+		size_t entity_count = 0;
+		size_t chunk_count = 0;
+		size_t bytes_used = 0;
+		size_t bytes_reserved = 0;
+		size_t wasted_tail_bytes = 0;
+		size_t index_bytes = 0;
+
+		// Bookkeeping outside of the archetype storages: the entity sets and the entity-to-archetype map
+		size_t entity_bookkeeping_bytes = 0;
+
+		size_t GetTotalBytes() const
+		{
+			return bytes_reserved + index_bytes + entity_bookkeeping_bytes;
+		}
+	};
+}
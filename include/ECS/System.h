@@ -1,4 +1,8 @@
 #pragma once
+#include <string>
+#include <typeinfo>
+
+#include "Resource.h"
 
 
 namespace ECS
@@ -15,8 +19,37 @@ namespace ECS
 		virtual void Init() = 0;
 		virtual void Update(double delta_time) = 0;
 
+		// The name shown in profiles and traces
+		virtual std::string GetName() const
+		{
+			return typeid(*this).name();
+		}
+
 		virtual ~System() = default;  // since it's a class with virtual function
 
+		// The world resources this system reads and writes, as declared in Init.
+		const ResourceAccess& GetResourceAccess() const
+		{
+			return resource_access;
+		}
+
 		World* world_ptr = nullptr;
+
+	protected:
+		// Declare the access to world resources, typically in Init.
+		template <typename T>
+		void ReadsResource()
+		{
+			resource_access.AddRead<T>();
+		}
+
+		template <typename T>
+		void WritesResource()
+		{
+			resource_access.AddWrite<T>();
+		}
+
+	private:
+		ResourceAccess resource_access;
 	};
 }
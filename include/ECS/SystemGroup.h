@@ -0,0 +1,121 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "System.h"
+
+
+namespace ECS
+{
+	// Systems updated together at a tick rate of their own. A group with a tick rate runs a fixed-step loop driven
+	// by an accumulator of the frame times, and can be time-sliced: each tick is then spread over several steps,
+	// each processing a slice of the matching chunks.
+	class SystemGroup
+	{
+	public:
+
+		// A tick rate of 0 runs the group once per World::Update, with the frame's delta time.
+		SystemGroup(const std::string& name, double tick_rate) : name(name), tick_interval(tick_rate > 0 ? 1.0 / tick_rate : 0) {}
+
+		// Avoid unintentional copy
+		SystemGroup(const SystemGroup&) = delete;
+		SystemGroup operator=(const SystemGroup&) = delete;
+
+		// The most ticks run in one update to catch up after a long frame; time beyond is dropped, so that
+		// a slow frame doesn't cause even slower ones.
+		void SetMaxCatchUpTicks(size_t max_catch_up_ticks)
+		{
+			this->max_catch_up_ticks = std::max(max_catch_up_ticks, size_t(1));
+		}
+
+		// Spread each tick over slice_count steps evenly in time, the k-th step processing the chunks whose
+		// index modulo slice_count is k, to flatten the frame time of a low-frequency group.
+		void SetTimeSlices(size_t slice_count)
+		{
+			this->slice_count = std::max(slice_count, size_t(1));
+			this->accumulator = 0;
+			this->next_slice_index = 0;
+			this->frame_times.assign(this->slice_count, 0.0);
+			this->frame_time_index = 0;
+		}
+
+		// Add the time of a frame and return the number of steps to run; one step per frame without a tick rate.
+		size_t Accumulate(double delta_time)
+		{
+			if (tick_interval <= 0) {
+				frame_times[frame_time_index] = delta_time;
+				frame_time_index = (frame_time_index + 1) % frame_times.size();
+				return 1;
+			}
+
+			double step_interval = tick_interval / slice_count;
+			accumulator += delta_time;
+			size_t step_count = static_cast<size_t>(accumulator / step_interval);
+
+			size_t max_step_count = max_catch_up_ticks * slice_count;
+			if (step_count > max_step_count) {
+				step_count = max_step_count;
+				accumulator = std::fmod(accumulator, step_interval);
+			}
+			else {
+				accumulator -= step_count * step_interval;
+			}
+			return step_count;
+		}
+
+		// The slice of the next step, advancing to the one after
+		size_t NextSlice()
+		{
+			size_t slice_index = next_slice_index;
+			next_slice_index = (next_slice_index + 1) % slice_count;
+			return slice_index;
+		}
+
+		// The delta time passed to the systems at each step: a tick, or without a tick rate the time of the last
+		// slice_count frames, since the slice processed was last processed slice_count frames ago.
+		double GetStepDeltaTime() const
+		{
+			if (tick_interval > 0) {
+				return tick_interval;
+			}
+			double step_delta_time = 0;
+			for (const auto& frame_time : frame_times) {
+				step_delta_time += frame_time;
+			}
+			return step_delta_time;
+		}
+
+		// How far the time is into the next step (0 to 1), e.g. to interpolate rendering between fixed steps.
+		double GetInterpolationAlpha() const
+		{
+			return tick_interval > 0 ? accumulator / (tick_interval / slice_count) : 0.0;
+		}
+
+		const std::string& GetName() const { return name; }
+		bool HasTickRate() const { return tick_interval > 0; }
+		double GetTickInterval() const { return tick_interval; }
+		size_t GetSliceCount() const { return slice_count; }
+
+		// Systems sorted by priority, highest first
+		std::map<int, std::list<System*>, std::greater<int>> systems;
+
+	private:
+		std::string name;
+
+		double tick_interval;
+		double accumulator = 0;
+		size_t max_catch_up_ticks = 4;
+
+		size_t slice_count = 1;
+		size_t next_slice_index = 0;
+
+		// The times of the last slice_count frames, for a group without a tick rate
+		std::vector<double> frame_times = std::vector<double>(1, 0.0);
+		size_t frame_time_index = 0;
+	};
+}
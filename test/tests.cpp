@@ -243,4 +243,2061 @@ TEST(System, AllCases)
 	EXPECT_EQ(30, s2->i_copy);
 	EXPECT_EQ(50, s3->i_copy);
 	EXPECT_EQ(70, s1->i_copy);
-}
\ No newline at end of file
+}
+
+struct NameComponent
+{
+	std::string name;
+};
+
+// A type persisted under the name of IntComponent, with another size
+struct ClashComponent
+{
+	double a, b;
+};
+
+template <>
+struct ECS::ComponentName<ClashComponent>
+{
+	static std::string Get() { return std::type_index(typeid(IntComponent)).name(); }
+};
+
+// A type under the name of IntComponent, of its size but in a sparse set
+struct SparseClashComponent
+{
+	int num;
+};
+
+template <>
+struct ECS::ComponentName<SparseClashComponent>
+{
+	static std::string Get() { return std::type_index(typeid(IntComponent)).name(); }
+};
+
+template <>
+struct ECS::ComponentTraits<SparseClashComponent> : ECS::DefaultComponentTraits
+{
+	static constexpr ECS::StoragePolicy storage = ECS::StoragePolicy::SparseSet;
+};
+
+TEST(EntityManager, MappedStorage)
+{
+	const std::string path = "mapped_storage_test.bin";
+
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+
+	std::vector<ECS::Entity> entities;
+	for (int i = 0; i < 1000; i++) {
+		entities.push_back(entity_mgr.CreateEntity<PositionComponent, IntComponent>());
+		entity_mgr.SetEntityComponent<IntComponent>(entities.back(), i);
+	}
+	ECS::Entity mix_entity = entity_mgr.CreateEntity<MixComponent>();
+	ECS::Entity null_entity = entity_mgr.CreateEntity();
+	entity_mgr.CreateEntity<IntComponent>();
+	ASSERT_TRUE(entity_mgr.SaveStorage(path));
+
+	{
+		// Copy-on-write: the mapped world can be changed freely
+		ECS::World mapped_world;
+		ECS::EntityManager& mapped_mgr = mapped_world.GetEntityManager();
+		ASSERT_TRUE(mapped_mgr.MapStorage(path, ECS::MapMode::CopyOnWrite));
+		EXPECT_FALSE(mapped_mgr.MapStorage(path));
+
+		EXPECT_EQ(entity_mgr.GetEntities().size(), mapped_mgr.GetEntities().size());
+		for (int i = 0; i < 1000; i++) {
+			EXPECT_EQ(i, mapped_mgr.GetEntityComponent<IntComponent>(entities[i])->num);
+		}
+		EXPECT_EQ(666, mapped_mgr.GetEntityComponent<MixComponent>(mix_entity)->s);
+
+		mapped_mgr.GetEntityComponent<IntComponent>(entities[0])->num = -1;
+		mapped_mgr.RemoveEntityComponent<PositionComponent>(entities[1]);
+		mapped_mgr.AddEntityComponent<IntComponent>(null_entity, 7);
+		ECS::Entity new_entity = mapped_mgr.CreateEntity<PositionComponent, IntComponent>();
+		EXPECT_GT(new_entity.id, mix_entity.id);
+
+		size_t count = 0;
+		mapped_world.ForEach<PositionComponent, IntComponent>(
+			[&](const ECS::Entity*, PositionComponent*, IntComponent*) -> void {
+			count++;
+		});
+		EXPECT_EQ(1000u, count);
+		EXPECT_EQ(1, entity_mgr.GetEntityComponent<IntComponent>(entities[1])->num);
+	}
+
+	{
+		// Read-only: the data is the file's, untouched by the copy-on-write world above
+		ECS::World mapped_world;
+		ECS::EntityManager& mapped_mgr = mapped_world.GetEntityManager();
+		ASSERT_TRUE(mapped_mgr.MapStorage(path, ECS::MapMode::ReadOnly));
+		EXPECT_EQ(0, mapped_mgr.GetEntityComponent<IntComponent>(entities[0])->num);
+		EXPECT_TRUE(mapped_mgr.HasComponent<PositionComponent>(entities[1]));
+
+		// The entities of the file can't be changed
+		EXPECT_TRUE(mapped_mgr.IsEntityReadOnly(entities[0]));
+		mapped_mgr.SetEntityComponent<IntComponent>(entities[0], 9);
+		mapped_mgr.AddEntityComponent<PositionComponent>(entities[0]);
+		mapped_mgr.RemoveEntityComponent<PositionComponent>(entities[1]);
+		mapped_mgr.DestroyEntity(entities[2]);
+		EXPECT_EQ(0, mapped_mgr.GetEntityComponent<IntComponent>(entities[0])->num);
+		EXPECT_TRUE(mapped_mgr.HasComponent<PositionComponent>(entities[1]));
+		EXPECT_TRUE(mapped_mgr.HasComponent<IntComponent>(entities[2]));
+		EXPECT_EQ(entity_mgr.GetEntities().size(), mapped_mgr.GetEntities().size());
+
+		// New entities go to new chunks
+		ECS::Entity new_entity = mapped_mgr.CreateEntity<PositionComponent, IntComponent>();
+		mapped_mgr.SetEntityComponent<IntComponent>(new_entity, 5);
+		EXPECT_EQ(5, mapped_mgr.GetEntityComponent<IntComponent>(new_entity)->num);
+		EXPECT_FALSE(mapped_mgr.IsEntityReadOnly(new_entity));
+	}
+
+	{
+		// A type known with another size fails the read
+		ECS::World mapped_world;
+		ECS::EntityManager& mapped_mgr = mapped_world.GetEntityManager();
+		EXPECT_FALSE(mapped_mgr.HasComponent<ClashComponent>(ECS::NULL_ENTITY));
+		EXPECT_FALSE(mapped_mgr.MapStorage(path, ECS::MapMode::ReadOnly));
+		EXPECT_TRUE(mapped_mgr.GetEntities().empty());
+	}
+
+	{
+		// Inconsistent metadata fails the read, changing nothing: find the records of the archetypes of IntComponent
+		// with and without PositionComponent, and of MixComponent, and change one field at a time
+		std::ifstream in(path, std::ios::binary);
+		const std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		in.close();
+		auto read_u64 = [&](size_t offset) -> uint64_t {
+			uint64_t value;
+			std::memcpy(&value, &bytes[offset], sizeof(value));
+			return value;
+		};
+		ECS::Internal::StorageFileHeader header;
+		std::memcpy(&header, bytes.data(), sizeof(header));
+		size_t offset = sizeof(header);
+		uint64_t int_type_index = 0;
+		for (uint64_t i = 0; i < header.type_count; i++) {
+			if (std::string(&bytes[offset + 16], read_u64(offset + 8)) == ECS::ComponentName<IntComponent>::Get()) {
+				int_type_index = i;
+			}
+			offset += 16 + read_u64(offset + 8);
+		}
+		offset += 8 * header.null_entity_count;
+		size_t pair_record = 0, int_record = 0, mix_record = 0;
+		for (uint64_t a = 0; a < header.archetype_count; a++) {
+			uint64_t row_count = read_u64(offset);
+			if (row_count == 2) {
+				pair_record = offset;
+			}
+			else if (read_u64(offset + 24) == int_type_index) {
+				int_record = offset;
+			}
+			else {
+				mix_record = offset;
+			}
+			offset += 24 + 16 * row_count;
+			for (uint64_t i = 0; i < read_u64(offset - 8 - 16 * row_count); i++) {
+				offset += 8 + 8 * read_u64(offset);
+			}
+		}
+		ASSERT_NE(0u, pair_record * int_record * mix_record);
+
+		const std::string patched_path = "mapped_storage_patched.bin";
+		auto map_patched = [&](size_t offset, uint64_t value) -> bool {
+			std::vector<char> patched = bytes;
+			std::memcpy(&patched[offset], &value, sizeof(value));
+			std::ofstream(patched_path, std::ios::binary).write(patched.data(), patched.size());
+			ECS::World patched_world;
+			bool mapped = patched_world.GetEntityManager().MapStorage(patched_path, ECS::MapMode::ReadOnly);
+			EXPECT_EQ(mapped, !patched_world.GetEntityManager().GetEntities().empty());
+			return mapped;
+		};
+		size_t first_entity = pair_record + 24 + 2 * 16 + 8;  // after the rows and the entity count of the first chunk
+		EXPECT_TRUE(map_patched(first_entity, read_u64(first_entity)));
+		EXPECT_FALSE(map_patched(pair_record + 8, uint64_t(1) << 62));  // the rows would wrap around
+		EXPECT_FALSE(map_patched(pair_record + 24 + 16 + 8, read_u64(pair_record + 24 + 8)));  // the rows overlap
+		EXPECT_FALSE(map_patched(mix_record + 24, int_type_index));  // two records of the same archetype
+		EXPECT_FALSE(map_patched(first_entity, read_u64(first_entity + 8)));  // an entity twice
+		EXPECT_FALSE(map_patched(first_entity, 0));
+		EXPECT_FALSE(map_patched(first_entity, header.entity_id_counter));
+		std::remove(patched_path.c_str());
+	}
+
+	{
+		// A C++ type is bound to the type registered under its name, by the file or by another C++ type, only if
+		// it is of the same size and storage policy, and the type isn't bound yet
+		::testing::FLAGS_gtest_death_test_style = "threadsafe";
+		EXPECT_DEATH(entity_mgr.GetComponentTypeID<ClashComponent>(), "doesn't match");
+		ECS::World mapped_world;
+		ECS::EntityManager& mapped_mgr = mapped_world.GetEntityManager();
+		ASSERT_TRUE(mapped_mgr.MapStorage(path, ECS::MapMode::ReadOnly));
+		EXPECT_DEATH(mapped_mgr.GetComponentTypeID<SparseClashComponent>(), "doesn't match");
+		EXPECT_EQ(0, mapped_mgr.GetEntityComponent<IntComponent>(entities[0])->num);
+	}
+	std::remove(path.c_str());
+
+	// Component data that can't be byte copied is not persisted
+	entity_mgr.CreateEntity<NameComponent>();
+	EXPECT_FALSE(entity_mgr.SaveStorage(path));
+	std::remove(path.c_str());
+}
+
+#ifdef ECS_ENABLE_PROFILING
+TEST(System, Profiling)
+{
+	const std::string path = "profiling_test.json";
+
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+	for (int i = 0; i < 100; i++) {
+		entity_mgr.CreateEntity<IntComponent>();
+	}
+
+	CopyIntSystem* system = new CopyIntSystem();
+	world.AddSystem(system);
+
+	ASSERT_TRUE(world.GetProfiler().StartTrace(path));
+	for (int i = 0; i < 10; i++) {
+		world.Update(1);
+	}
+	world.GetProfiler().StopTrace();
+
+	const ECS::SystemProfile* profile = world.GetProfiler().GetSystemProfile(system);
+	ASSERT_NE(nullptr, profile);
+	EXPECT_EQ(10u, profile->GetFrameCount());
+	EXPECT_EQ(100u, profile->GetLastFrame().entities_visited);
+	EXPECT_EQ(1u, profile->GetLastFrame().chunks_visited);
+	EXPECT_EQ(0u, profile->GetLastFrame().structural_changes);
+	EXPECT_LE(profile->GetWallTimePercentile(50), profile->GetWallTimePercentile(99));
+
+	std::ifstream trace(path);
+	std::string content((std::istreambuf_iterator<char>(trace)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(0u, content.find("{\"displayTimeUnit\""));
+	EXPECT_NE(std::string::npos, content.find("\"cat\":\"system\""));
+	EXPECT_NE(std::string::npos, content.find("\"entities\":100"));
+	trace.close();
+	std::remove(path.c_str());
+
+	// The steps of a system within an Update are added up into one frame
+	CopyIntSystem* stepped_system = new CopyIntSystem();
+	world.AddSystem(stepped_system, world.AddSystemGroup("Fixed", 4));
+	world.Update(1);
+	profile = world.GetProfiler().GetSystemProfile(stepped_system);
+	ASSERT_NE(nullptr, profile);
+	EXPECT_EQ(1u, profile->GetFrameCount());
+	EXPECT_EQ(400u, profile->GetLastFrame().entities_visited);
+	EXPECT_EQ(4u, profile->GetLastFrame().chunks_visited);
+
+	// A profile without a window keeps the last frame, and has no last frame until one is recorded
+	ECS::Profiler unwindowed(0);
+	unwindowed.RecordSystem(system, "Copy", ECS::SystemFrameStats());
+	const ECS::SystemProfile* unwindowed_profile = unwindowed.GetSystemProfile(system);
+	EXPECT_EQ(0u, unwindowed_profile->GetLastFrame().entities_visited);
+	ECS::SystemFrameStats stats;
+	stats.entities_visited = 7;
+	unwindowed.RecordSystem(system, "Copy", stats);
+	EXPECT_EQ(2u, unwindowed_profile->GetFrameCount());
+	EXPECT_EQ(7u, unwindowed_profile->GetLastFrame().entities_visited);
+	ECS::SystemProfile empty_profile("Empty", 0);
+	EXPECT_EQ(0u, empty_profile.GetLastFrame().entities_visited);
+	EXPECT_EQ(0.0, empty_profile.GetWallTimePercentile(50));
+}
+#endif
+
+TEST(EntityManager, StorageStats)
+{
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+
+	// IntComponent alone: 4096 entities per 16K chunk
+	for (int i = 0; i < 5000; i++) {
+		entity_mgr.CreateEntity<IntComponent>();
+	}
+	entity_mgr.CreateEntity<PositionComponent, IntComponent>();
+	entity_mgr.CreateEntity();
+
+	ECS::StorageStats stats;
+	entity_mgr.GetStorageStats(stats);
+
+	ASSERT_EQ(2u, stats.archetypes.size());
+	EXPECT_EQ(5001u, stats.entity_count);
+	EXPECT_EQ(3u, stats.chunk_count);
+	EXPECT_EQ(3u * 16384, stats.bytes_reserved);
+	EXPECT_EQ(5000u * sizeof(IntComponent) + sizeof(PositionComponent) + sizeof(IntComponent), stats.bytes_used);
+	EXPECT_GT(stats.index_bytes, 5001u * sizeof(ECS::Entity));
+	EXPECT_GT(stats.entity_bookkeeping_bytes, 0u);
+
+	for (const auto& a_stats : stats.archetypes) {
+		if (a_stats.entity_count == 5000) {
+			EXPECT_EQ(4096u, a_stats.chunk_entity_capacity);
+			EXPECT_EQ(0u, a_stats.wasted_tail_bytes_per_chunk);
+			EXPECT_EQ(1u, a_stats.occupancy_histogram[1]);  // 904 of 4096
+			EXPECT_EQ(1u, a_stats.occupancy_histogram[4]);
+		}
+		else {
+			// The int row starts on the next 64 byte boundary after the position row
+			EXPECT_EQ(1360u, a_stats.chunk_entity_capacity);
+			EXPECT_EQ(16384u - 1360 * 12, a_stats.wasted_tail_bytes_per_chunk);
+			EXPECT_EQ(1u, a_stats.occupancy_histogram[1]);
+		}
+	}
+}
+
+struct SelectedComponent
+{
+	SelectedComponent() : order(0) {}
+	SelectedComponent(int order) : order(order) {}
+
+	int order;
+};
+
+template <>
+struct ECS::ComponentTraits<SelectedComponent> : ECS::DefaultComponentTraits
+{
+	static constexpr ECS::StoragePolicy storage = ECS::StoragePolicy::SparseSet;
+};
+
+TEST(EntityManager, SparseSetComponents)
+{
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+
+	std::vector<ECS::Entity> entities;
+	for (int i = 0; i < 100; i++) {
+		entities.push_back(entity_mgr.CreateEntity<PositionComponent, IntComponent>());
+		entity_mgr.SetEntityComponent<IntComponent>(entities.back(), i);
+	}
+	ECS::Entity sparse_only = entity_mgr.CreateEntity<SelectedComponent>();
+	ECS::Entity mixed = entity_mgr.CreateEntity<IntComponent, SelectedComponent>();
+	EXPECT_EQ(0, entity_mgr.GetEntityComponent<SelectedComponent>(sparse_only)->order);
+	EXPECT_TRUE(entity_mgr.HasComponent<SelectedComponent>(mixed));
+
+	// Toggling a sparse component keeps the entity in its chunk
+	IntComponent* i_ptr = entity_mgr.GetEntityComponent<IntComponent>(entities[5]);
+	entity_mgr.AddEntityComponent<SelectedComponent>(entities[5], 5);
+	entity_mgr.AddEntityComponent<SelectedComponent>(entities[7], 7);
+	EXPECT_EQ(i_ptr, entity_mgr.GetEntityComponent<IntComponent>(entities[5]));
+	EXPECT_EQ(5, entity_mgr.GetEntityComponent<SelectedComponent>(entities[5])->order);
+	EXPECT_TRUE((entity_mgr.HasComponent<IntComponent, SelectedComponent>(entities[7])));
+	EXPECT_FALSE(entity_mgr.HasComponent<SelectedComponent>(entities[6]));
+	EXPECT_EQ(nullptr, entity_mgr.GetEntityComponent<SelectedComponent>(entities[6]));
+
+	// Joins: driven by the sparse set (3 entities) and by the archetypes (1 entity)
+	int sum = 0;
+	world.ForEach<IntComponent, SelectedComponent>(
+		[&](const ECS::Entity*, IntComponent* i_ptr, SelectedComponent* s_ptr) -> void {
+		sum += i_ptr->num + s_ptr->order;
+	});
+	EXPECT_EQ(5 + 5 + 7 + 7 + 99, sum);
+
+	ECS::Entity only_position = entity_mgr.CreateEntity<PositionComponent>();
+	entity_mgr.AddEntityComponent<SelectedComponent>(only_position, 1);
+	size_t count = 0;
+	world.ForEach<PositionComponent, SelectedComponent>(
+		[&](const ECS::Entity*, PositionComponent*, SelectedComponent*) -> void {
+		count++;
+	});
+	EXPECT_EQ(3u, count);
+
+	count = 0;
+	world.ForEach<SelectedComponent>([&](const ECS::Entity*, SelectedComponent*) -> void {
+		count++;
+	});
+	EXPECT_EQ(5u, count);
+
+	// Removal
+	entity_mgr.RemoveEntityComponent<SelectedComponent>(entities[5]);
+	EXPECT_FALSE(entity_mgr.HasComponent<SelectedComponent>(entities[5]));
+	EXPECT_EQ(7, entity_mgr.GetEntityComponent<SelectedComponent>(entities[7])->order);
+
+	entity_mgr.RemoveEntityComponent<IntComponent>(mixed);
+	EXPECT_TRUE(entity_mgr.HasComponent<SelectedComponent>(mixed));
+	entity_mgr.RemoveEntityAllComponents(mixed);
+	entity_mgr.RemoveEntityAllComponents(sparse_only);
+	EXPECT_FALSE(entity_mgr.HasComponent<SelectedComponent>(mixed));
+	EXPECT_FALSE(entity_mgr.HasComponent<SelectedComponent>(sparse_only));
+}
+
+struct MeshComponent
+{
+	MeshComponent() : mesh_id(0) {}
+	MeshComponent(int mesh_id) : mesh_id(mesh_id) {}
+
+	int mesh_id;
+	char material[252] = {};
+};
+
+inline bool operator==(const MeshComponent& lhs, const MeshComponent& rhs)
+{
+	return lhs.mesh_id == rhs.mesh_id;
+}
+
+template <>
+struct std::hash<MeshComponent>
+{
+	size_t operator()(const MeshComponent& mesh) const { return static_cast<size_t>(mesh.mesh_id) % 16; }
+};
+
+template <>
+struct ECS::ComponentTraits<MeshComponent> : ECS::DefaultComponentTraits
+{
+	static constexpr ECS::StoragePolicy storage = ECS::StoragePolicy::Shared;
+};
+
+TEST(EntityManager, SharedComponents)
+{
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+
+	std::vector<ECS::Entity> entities;
+	for (int i = 0; i < 10; i++) {
+		ECS::Entity entity = entity_mgr.CreateEntity<PositionComponent>();
+		entity_mgr.AddEntityComponent<MeshComponent>(entity, i % 2);
+		entities.push_back(entity);
+	}
+	ECS::Entity defaulted = entity_mgr.CreateEntity<PositionComponent, MeshComponent>();
+	EXPECT_EQ(0, entity_mgr.GetEntityComponent<MeshComponent>(defaulted)->mesh_id);
+	EXPECT_TRUE(entity_mgr.HasComponent<MeshComponent>(entities[3]));
+	EXPECT_EQ(1, entity_mgr.GetEntityComponent<MeshComponent>(entities[3])->mesh_id);
+
+	// One chunk per value, exposing the value once
+	size_t chunk_count = 0;
+	size_t entity_count = 0;
+	world.ForEachChunk<PositionComponent, MeshComponent>([&](const ECS::ChunkView& chunk) -> void {
+		const MeshComponent* mesh = chunk.GetShared<MeshComponent>();
+		PositionComponent* positions = chunk.GetComponents<PositionComponent>();
+		for (size_t i = 0; i < chunk.GetEntityCount(); i++) {
+			EXPECT_EQ(mesh->mesh_id, entity_mgr.GetEntityComponent<MeshComponent>(chunk.GetEntities()[i])->mesh_id);
+			EXPECT_EQ(entity_mgr.GetEntityComponent<PositionComponent>(chunk.GetEntities()[i]), positions + i);
+		}
+		chunk_count++;
+		entity_count += chunk.GetEntityCount();
+	});
+	EXPECT_EQ(2u, chunk_count);
+	EXPECT_EQ(11u, entity_count);
+
+	// Changing the value moves the entity, keeping its other components
+	entity_mgr.GetEntityComponent<PositionComponent>(entities[3])->x = 3;
+	entity_mgr.SetEntityComponent<MeshComponent>(entities[3], 7);
+	EXPECT_EQ(7, entity_mgr.GetEntityComponent<MeshComponent>(entities[3])->mesh_id);
+	EXPECT_EQ(1, entity_mgr.GetEntityComponent<MeshComponent>(entities[1])->mesh_id);
+	EXPECT_FLOAT_EQ(3, entity_mgr.GetEntityComponent<PositionComponent>(entities[3])->x);
+
+	// Adding and removing other components keeps the shared value
+	entity_mgr.AddEntityComponent<IntComponent>(entities[3], 5);
+	EXPECT_EQ(7, entity_mgr.GetEntityComponent<MeshComponent>(entities[3])->mesh_id);
+	entity_mgr.RemoveEntityComponent<IntComponent>(entities[3]);
+	EXPECT_EQ(7, entity_mgr.GetEntityComponent<MeshComponent>(entities[3])->mesh_id);
+
+	entity_mgr.RemoveEntityComponent<MeshComponent>(entities[3]);
+	EXPECT_FALSE(entity_mgr.HasComponent<MeshComponent>(entities[3]));
+	EXPECT_FLOAT_EQ(3, entity_mgr.GetEntityComponent<PositionComponent>(entities[3])->x);
+
+	size_t sum = 0;
+	world.ForEach<MeshComponent>([&](const ECS::Entity*, MeshComponent* mesh) -> void {
+		sum += mesh->mesh_id;
+	});
+	EXPECT_EQ(4u, sum);
+
+	// The values are found through their hash, colliding ones told apart by operator==, and dropped from the index
+	static_assert(ECS::IsHashable<MeshComponent> && !ECS::IsHashable<PositionComponent>, "");
+	ECS::SharedValueStore<MeshComponent> store;
+	for (int i = 0; i < 100; i++) {
+		EXPECT_EQ(size_t(i), store.FindOrAdd(i));
+		store.AddRef(i);
+	}
+	for (int i = 0; i < 100; i++) {
+		EXPECT_EQ(size_t(i), store.Find(i));
+	}
+	EXPECT_EQ(ECS::INVALID_SHARED_VALUE_INDEX, store.Find(100));
+	store.Release(20);
+	EXPECT_EQ(ECS::INVALID_SHARED_VALUE_INDEX, store.Find(20));
+	EXPECT_EQ(size_t(4), store.Find(4));
+	EXPECT_EQ(size_t(20), store.FindOrAdd(116));
+	EXPECT_EQ(size_t(20), store.Find(116));
+	EXPECT_EQ(100u, store.GetValueCount());
+}
+
+TEST(EntityManager, PrefabInstantiateAndClone)
+{
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+
+	ECS::Entity enemy = entity_mgr.CreateEntity<PositionComponent, IntComponent>();
+	entity_mgr.SetEntityComponent<PositionComponent>(enemy, 1.0f, 2.0f);
+	entity_mgr.AddEntityComponent<NameComponent>(enemy);
+	entity_mgr.GetEntityComponent<NameComponent>(enemy)->name = "a name too long for small string optimization";
+	entity_mgr.AddEntityComponent<MeshComponent>(enemy, 3);
+	entity_mgr.AddEntityComponent<SelectedComponent>(enemy, 4);
+
+	std::unique_ptr<ECS::Prefab> prefab = entity_mgr.CreatePrefab(enemy);
+	ASSERT_NE(nullptr, prefab);
+	EXPECT_EQ(nullptr, entity_mgr.CreatePrefab(entity_mgr.CreateEntity()));
+
+	// The prefab is a snapshot
+	entity_mgr.GetEntityComponent<IntComponent>(enemy)->num = 5;
+	entity_mgr.RemoveEntityAllComponents(enemy);
+
+	std::vector<ECS::Entity> spawned = entity_mgr.Instantiate(*prefab, 5000);
+	ASSERT_EQ(5000u, spawned.size());
+	for (const auto& entity : spawned) {
+		EXPECT_FLOAT_EQ(2.0f, entity_mgr.GetEntityComponent<PositionComponent>(entity)->y);
+		EXPECT_EQ(99, entity_mgr.GetEntityComponent<IntComponent>(entity)->num);
+		EXPECT_EQ(3, entity_mgr.GetEntityComponent<MeshComponent>(entity)->mesh_id);
+		EXPECT_FALSE(entity_mgr.HasComponent<SelectedComponent>(entity));
+	}
+	EXPECT_EQ("a name too long for small string optimization", entity_mgr.GetEntityComponent<NameComponent>(spawned[4321])->name);
+
+	size_t count = 0;
+	world.ForEach<PositionComponent, NameComponent>([&](const ECS::Entity*, PositionComponent*, NameComponent*) -> void {
+		count++;
+	});
+	EXPECT_EQ(5000u, count);
+
+	// Clone copies sparse set components too
+	entity_mgr.AddEntityComponent<SelectedComponent>(spawned[7], 8);
+	entity_mgr.GetEntityComponent<NameComponent>(spawned[7])->name = "seven";
+	ECS::Entity clone = entity_mgr.Clone(spawned[7]);
+	EXPECT_EQ("seven", entity_mgr.GetEntityComponent<NameComponent>(clone)->name);
+	EXPECT_EQ(8, entity_mgr.GetEntityComponent<SelectedComponent>(clone)->order);
+	EXPECT_EQ(3, entity_mgr.GetEntityComponent<MeshComponent>(clone)->mesh_id);
+	entity_mgr.GetEntityComponent<NameComponent>(clone)->name = "clone";
+	EXPECT_EQ("seven", entity_mgr.GetEntityComponent<NameComponent>(spawned[7])->name);
+}
+
+struct TransformComponent
+{
+	TransformComponent() : local(0), world(0) {}
+	TransformComponent(float local) : local(local), world(0) {}
+
+	float local;
+	float world;
+};
+
+TEST(EntityManager, Hierarchy)
+{
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+
+	// Two roots with chains of children, built in shuffled order
+	std::vector<ECS::Entity> roots;
+	std::vector<ECS::Entity> leaves;
+	for (int r = 0; r < 2; r++) {
+		roots.push_back(entity_mgr.CreateEntity<TransformComponent>());
+		entity_mgr.GetEntityComponent<TransformComponent>(roots.back())->local = float(r * 100);
+	}
+	for (int i = 0; i < 200; i++) {
+		ECS::Entity parent = entity_mgr.CreateEntity<TransformComponent>();
+		ECS::Entity child = entity_mgr.CreateEntity<TransformComponent>();
+		entity_mgr.SetEntityComponent<TransformComponent>(parent, 1.0f);
+		entity_mgr.SetEntityComponent<TransformComponent>(child, 2.0f);
+		ASSERT_TRUE(entity_mgr.SetParent(child, parent));
+		ASSERT_TRUE(entity_mgr.SetParent(parent, roots[i % 2]));
+		leaves.push_back(child);
+	}
+	EXPECT_EQ(2u, entity_mgr.GetDepth(leaves[0]));
+	EXPECT_EQ(0u, entity_mgr.GetDepth(roots[0]));
+	EXPECT_EQ(100u, entity_mgr.GetChildren(roots[1]).size());
+	EXPECT_FALSE(entity_mgr.SetParent(roots[0], leaves[0]));  // a cycle
+
+	for (bool parallel : { false, true }) {
+		world.ForEach<TransformComponent>([&](const ECS::Entity* entity, TransformComponent* transform) -> void {
+			transform->world = entity_mgr.HasComponent<ECS::Parent>(*entity) ? -1.0f : transform->local;
+		});
+		world.ForEachChunkByDepth<TransformComponent, ECS::Parent>([&](const ECS::ChunkView& chunk) -> void {
+			TransformComponent* transforms = chunk.GetComponents<TransformComponent>();
+			ECS::Parent* parents = chunk.GetComponents<ECS::Parent>();
+			for (size_t i = 0; i < chunk.GetEntityCount(); i++) {
+				float parent_world = entity_mgr.GetEntityComponent<TransformComponent>(parents[i].entity)->world;
+				transforms[i].world = parent_world < 0 ? -1.0f : parent_world + transforms[i].local;
+			}
+		}, parallel);
+
+		for (size_t i = 0; i < leaves.size(); i++) {
+			EXPECT_FLOAT_EQ(float(i % 2 * 100 + 3), entity_mgr.GetEntityComponent<TransformComponent>(leaves[i])->world);
+		}
+	}
+
+	// Reparenting and removal move subtrees
+	ECS::Entity middle = entity_mgr.GetParent(leaves[0]);
+	entity_mgr.SetParent(middle, leaves[1]);
+	EXPECT_EQ(3u, entity_mgr.GetDepth(middle));
+	EXPECT_EQ(4u, entity_mgr.GetDepth(leaves[0]));
+	EXPECT_EQ(99u, entity_mgr.GetChildren(roots[0]).size());
+
+	entity_mgr.RemoveEntityAllComponents(leaves[1]);
+	EXPECT_EQ(0u, entity_mgr.GetDepth(middle));
+	EXPECT_EQ(1u, entity_mgr.GetDepth(leaves[0]));
+	EXPECT_EQ(ECS::NULL_ENTITY.id, entity_mgr.GetParent(middle).id);
+	EXPECT_EQ(99u, entity_mgr.GetChildren(roots[0]).size());
+}
+
+struct TargetsRelation
+{
+	TargetsRelation() : priority(0) {}
+	TargetsRelation(int priority) : priority(priority) {}
+
+	int priority;
+};
+
+struct OwnedByRelation {};
+
+template <>
+struct ECS::RelationTraits<OwnedByRelation> : ECS::DefaultRelationTraits
+{
+	static constexpr ECS::RelationCleanup on_target_destroyed = ECS::RelationCleanup::DestroySource;
+};
+
+TEST(EntityManager, Relations)
+{
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+
+	ECS::Entity ship = entity_mgr.CreateEntity<PositionComponent>();
+	ECS::Entity station = entity_mgr.CreateEntity<PositionComponent>();
+	std::vector<ECS::Entity> turrets;
+	for (int i = 0; i < 4; i++) {
+		turrets.push_back(entity_mgr.CreateEntity<IntComponent>());
+		entity_mgr.AddRelation<OwnedByRelation>(turrets.back(), ship);
+		entity_mgr.AddRelation<TargetsRelation>(turrets.back(), i < 2 ? station : ship, i);
+	}
+	ECS::Entity drone = entity_mgr.CreateEntity();
+	entity_mgr.AddRelation<TargetsRelation>(drone, station, 9);
+
+	EXPECT_TRUE(entity_mgr.HasRelation<TargetsRelation>(turrets[1], station));
+	EXPECT_FALSE(entity_mgr.HasRelation<TargetsRelation>(turrets[1], ship));
+	EXPECT_EQ(9, entity_mgr.GetRelation<TargetsRelation>(drone, station)->priority);
+	EXPECT_EQ(99, entity_mgr.GetEntityComponent<IntComponent>(turrets[3])->num);
+	ASSERT_EQ(1u, entity_mgr.GetRelationTargets<TargetsRelation>(turrets[3]).size());
+	EXPECT_EQ(ship.id, entity_mgr.GetRelationTargets<TargetsRelation>(turrets[3])[0].id);
+
+	// Query by target, and by relation with any target
+	int priority_sum = 0;
+	entity_mgr.ForEachRelated<TargetsRelation>(station, [&](const ECS::Entity*, TargetsRelation* targets) -> void {
+		priority_sum += targets->priority;
+	});
+	EXPECT_EQ(0 + 1 + 9, priority_sum);
+
+	size_t pair_count = 0;
+	entity_mgr.ForEachRelation<TargetsRelation>([&](const ECS::Entity* entity, const ECS::Entity& target, TargetsRelation*) -> void {
+		EXPECT_TRUE(entity_mgr.HasRelation<TargetsRelation>(*entity, target));
+		pair_count++;
+	});
+	EXPECT_EQ(5u, pair_count);
+
+	entity_mgr.RemoveRelation<TargetsRelation>(drone, station);
+	EXPECT_FALSE(entity_mgr.HasRelation<TargetsRelation>(drone, station));
+
+	// Destroying the station removes the pairs targeting it; destroying the ship destroys what it owns
+	entity_mgr.DestroyEntity(station);
+	EXPECT_FALSE(entity_mgr.HasRelation<TargetsRelation>(turrets[0], station));
+	EXPECT_EQ(99, entity_mgr.GetEntityComponent<IntComponent>(turrets[0])->num);
+
+	entity_mgr.DestroyEntity(ship);
+	size_t int_count = 0;
+	world.ForEach<IntComponent>([&](const ECS::Entity*, IntComponent*) -> void {
+		int_count++;
+	});
+	EXPECT_EQ(0u, int_count);
+	EXPECT_EQ(0u, entity_mgr.GetEntities().size());
+
+	// Short-lived targets reuse the pair types, archetypes and storages of destroyed ones
+	ECS::Entity turret = entity_mgr.CreateEntity<IntComponent>();
+	ECS::StorageStats stats;
+	for (int i = 0; i < 100; i++) {
+		ECS::Entity missile = entity_mgr.CreateEntity<PositionComponent>();
+		entity_mgr.AddRelation<TargetsRelation>(turret, missile, i);
+		EXPECT_EQ(i, entity_mgr.GetRelation<TargetsRelation>(turret, missile)->priority);
+		ASSERT_EQ(1u, entity_mgr.GetRelationTargets<TargetsRelation>(turret).size());
+		EXPECT_EQ(missile.id, entity_mgr.GetRelationTargets<TargetsRelation>(turret)[0].id);
+		entity_mgr.DestroyEntity(missile);
+		EXPECT_FALSE(entity_mgr.HasRelation<TargetsRelation>(turret, missile));
+		if (i == 0) {
+			entity_mgr.GetStorageStats(stats);
+		}
+	}
+	ECS::StorageStats last_stats;
+	entity_mgr.GetStorageStats(last_stats);
+	EXPECT_EQ(stats.archetypes.size(), last_stats.archetypes.size());
+}
+
+struct CounterComponent
+{
+	CounterComponent() : count(0) {}
+	CounterComponent(int count) : count(count) {}
+
+	int count;
+};
+
+template <>
+struct ECS::ComponentTraits<CounterComponent> : ECS::DefaultComponentTraits
+{
+	static constexpr ECS::StoragePolicy storage = ECS::StoragePolicy::DoubleBuffered;
+};
+
+class StepCounterSystem : public ECS::System
+{
+public:
+	virtual void Init() override {}
+	virtual void Update(double) override
+	{
+		world_ptr->ForEach<const CounterComponent, CounterComponent>(
+			[&](const ECS::Entity*, const CounterComponent* previous, CounterComponent* next) -> void {
+			next->count = previous->count + 1;
+		});
+	}
+};
+
+class ReadCounterSystem : public ECS::System
+{
+public:
+	virtual void Init() override {}
+	virtual void Update(double) override
+	{
+		sum = 0;
+		world_ptr->ForEach<const CounterComponent>([&](const ECS::Entity*, const CounterComponent* previous) -> void {
+			sum += previous->count;
+		});
+	}
+
+	int sum = 0;
+};
+
+TEST(World, DoubleBufferedComponents)
+{
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+
+	ECS::Entity created = entity_mgr.CreateEntity<CounterComponent, IntComponent>();
+	ECS::Entity added = entity_mgr.CreateEntity<IntComponent>();
+	entity_mgr.AddEntityComponent<CounterComponent>(added, 10);
+	EXPECT_EQ(10, entity_mgr.GetPreviousEntityComponent<CounterComponent>(added)->count);
+
+	StepCounterSystem* step = new StepCounterSystem();
+	ReadCounterSystem* read = new ReadCounterSystem();
+	world.AddSystem(step, 1);
+	world.AddSystem(read, 0);
+
+	// The reader runs after the writer but sees the last frame's values
+	world.Update(1);
+	EXPECT_EQ(0 + 10, read->sum);
+	EXPECT_EQ(1, entity_mgr.GetEntityComponent<CounterComponent>(created)->count);
+	world.Update(1);
+	EXPECT_EQ(1 + 11, read->sum);
+	EXPECT_EQ(12, entity_mgr.GetEntityComponent<CounterComponent>(added)->count);
+	EXPECT_EQ(11, entity_mgr.GetPreviousEntityComponent<CounterComponent>(added)->count);
+
+	// Both buffers move with the entity
+	entity_mgr.RemoveEntityComponent<IntComponent>(added);
+	EXPECT_EQ(12, entity_mgr.GetEntityComponent<CounterComponent>(added)->count);
+	EXPECT_EQ(11, entity_mgr.GetPreviousEntityComponent<CounterComponent>(added)->count);
+
+	world.ForEachChunk<CounterComponent>([&](const ECS::ChunkView& chunk) -> void {
+		const CounterComponent* previous = chunk.GetComponents<const CounterComponent>();
+		CounterComponent* next = chunk.GetComponents<CounterComponent>();
+		for (size_t i = 0; i < chunk.GetEntityCount(); i++) {
+			EXPECT_EQ(previous[i].count + 1, next[i].count);
+		}
+	});
+}
+
+struct ClockResource
+{
+	ClockResource(double time) : time(time) {}
+	double time;
+};
+
+struct ConfigResource
+{
+	int max_count = 8;
+};
+
+class TickClockSystem : public ECS::System
+{
+public:
+	virtual void Init() override
+	{
+		this->WritesResource<ClockResource>();
+		this->ReadsResource<ConfigResource>();
+	}
+	virtual void Update(double delta_time) override
+	{
+		world_ptr->GetResource<ClockResource>()->time += delta_time;
+	}
+};
+
+class ReadClockSystem : public ECS::System
+{
+public:
+	virtual void Init() override
+	{
+		this->ReadsResource<ClockResource>();
+	}
+	virtual void Update(double) override
+	{
+		last_time = world_ptr->GetResource<ClockResource>()->time;
+	}
+
+	double last_time = 0;
+};
+
+TEST(World, Resources)
+{
+	ECS::World world;
+	EXPECT_EQ(nullptr, world.GetResource<ClockResource>());
+
+	world.SetResource<ClockResource>(1.0);
+	world.SetResource<ConfigResource>();
+	EXPECT_EQ(8, world.GetResource<ConfigResource>()->max_count);
+
+	TickClockSystem* tick = new TickClockSystem();
+	ReadClockSystem* read = new ReadClockSystem();
+	world.AddSystem(tick, 1);
+	world.AddSystem(read, 0);
+	world.Update(0.5);
+	EXPECT_EQ(1.5, world.GetResource<ClockResource>()->time);
+	EXPECT_EQ(1.5, read->last_time);
+
+	// Replacing and removing
+	world.SetResource<ClockResource>(10.0);
+	EXPECT_EQ(10.0, world.GetResource<ClockResource>()->time);
+	world.RemoveResource<ConfigResource>();
+	EXPECT_EQ(nullptr, world.GetResource<ConfigResource>());
+
+	// Declared access
+	EXPECT_TRUE(tick->GetResourceAccess().ConflictsWith(read->GetResourceAccess()));
+	EXPECT_FALSE(read->GetResourceAccess().ConflictsWith(read->GetResourceAccess()));
+	ECS::ResourceAccess config_reader;
+	config_reader.AddRead<ConfigResource>();
+	EXPECT_FALSE(tick->GetResourceAccess().ConflictsWith(config_reader));
+}
+
+class VisitIntSystem : public ECS::System
+{
+public:
+	virtual void Init() override {}
+	virtual void Update(double delta_time) override
+	{
+		update_count++;
+		total_time += delta_time;
+		world_ptr->ForEach<IntComponent>([&](const ECS::Entity*, IntComponent* i) -> void {
+			i->num++;
+			entity_visits++;
+		});
+	}
+
+	size_t update_count = 0;
+	double total_time = 0;
+	size_t entity_visits = 0;
+};
+
+TEST(World, SystemGroups)
+{
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+
+	const size_t entity_count = 20000;
+	std::vector<ECS::Entity> entities;
+	for (size_t i = 0; i < entity_count; i++) {
+		entities.push_back(entity_mgr.CreateEntity<IntComponent>());
+	}
+	ECS::StorageStats stats;
+	entity_mgr.GetStorageStats(stats);
+	ASSERT_GT(stats.chunk_count, 4u);
+
+	// Once per update
+	VisitIntSystem* every_frame = new VisitIntSystem();
+	world.AddSystem(every_frame);
+
+	// Fixed steps at 4 Hz
+	ECS::SystemGroup* fixed = world.AddSystemGroup("Fixed", 4, 1);
+	VisitIntSystem* fixed_step = new VisitIntSystem();
+	world.AddSystem(fixed_step, fixed);
+
+	world.Update(0.125);
+	EXPECT_EQ(1u, every_frame->update_count);
+	EXPECT_EQ(0u, fixed_step->update_count);
+	EXPECT_EQ(0.5, fixed->GetInterpolationAlpha());
+	world.Update(0.625);
+	EXPECT_EQ(3u, fixed_step->update_count);
+	EXPECT_EQ(0.75, fixed_step->total_time);
+
+	// A long frame catches up at most the cap, dropping the rest
+	fixed->SetMaxCatchUpTicks(2);
+	world.Update(10);
+	EXPECT_EQ(5u, fixed_step->update_count);
+	EXPECT_EQ(0.0, fixed->GetInterpolationAlpha());
+
+	// Time-sliced: a tick spread over 4 steps visits every entity once
+	ECS::SystemGroup* sliced = world.AddSystemGroup("Sliced", 1, -1);
+	sliced->SetTimeSlices(4);
+	VisitIntSystem* sliced_step = new VisitIntSystem();
+	world.AddSystem(sliced_step, sliced);
+
+	world.Update(0.25);
+	EXPECT_EQ(1u, sliced_step->update_count);
+	EXPECT_GT(sliced_step->entity_visits, 0u);
+	EXPECT_LT(sliced_step->entity_visits, entity_count);
+	world.Update(0.75);
+	EXPECT_EQ(4u, sliced_step->update_count);
+	EXPECT_EQ(entity_count, sliced_step->entity_visits);
+
+	// Other groups still see all entities
+	EXPECT_EQ(every_frame->update_count * entity_count, every_frame->entity_visits);
+	int expected = static_cast<int>(99 + every_frame->update_count + fixed_step->update_count + 1);
+	for (const auto& entity : entities) {
+		ASSERT_EQ(expected, entity_mgr.GetEntityComponent<IntComponent>(entity)->num);
+	}
+
+	// Sliced without a tick rate: each slice is given the time of the frames since it was last processed
+	ECS::SystemGroup* per_frame = world.AddSystemGroup("PerFrame", 0, -2);
+	per_frame->SetTimeSlices(2);
+	VisitIntSystem* per_frame_step = new VisitIntSystem();
+	world.AddSystem(per_frame_step, per_frame);
+
+	world.Update(0.25);
+	EXPECT_EQ(0.25, per_frame_step->total_time);
+	world.Update(0.5);
+	EXPECT_EQ(1.0, per_frame_step->total_time);
+	world.Update(0.25);
+	EXPECT_EQ(1.75, per_frame_step->total_time);
+}
+
+TEST(World, DoubleBufferedSystemGroups)
+{
+	// A group at 64 Hz runs two steps in a frame of 1/32 s, and none in a frame of 1/128 s; each step reads the
+	// values of the one before
+	ECS::World fixed_world;
+	ECS::SystemGroup* fixed = fixed_world.AddSystemGroup("Fixed", 64);
+	fixed_world.AddSystem(new StepCounterSystem(), fixed);
+	fixed_world.FlipBuffersPerStep<CounterComponent>(fixed);
+	ECS::Entity counter_entity = fixed_world.GetEntityManager().CreateEntity<CounterComponent>();
+	for (int i = 0; i < 30; i++) {
+		fixed_world.Update(1.0 / 32);
+	}
+	EXPECT_EQ(60, fixed_world.GetEntityManager().GetEntityComponent<CounterComponent>(counter_entity)->count);
+	for (int i = 0; i < 4; i++) {
+		fixed_world.Update(1.0 / 128);
+	}
+	EXPECT_EQ(62, fixed_world.GetEntityManager().GetEntityComponent<CounterComponent>(counter_entity)->count);
+	EXPECT_EQ(61, fixed_world.GetEntityManager().GetPreviousEntityComponent<CounterComponent>(counter_entity)->count);
+
+	// A group sliced in two flips only the chunks of its slice, which keep their values while the other slice runs
+	ECS::World sliced_world;
+	ECS::EntityManager& entity_mgr = sliced_world.GetEntityManager();
+	ECS::SystemGroup* sliced = sliced_world.AddSystemGroup("Sliced", 0);
+	sliced->SetTimeSlices(2);
+	sliced_world.AddSystem(new StepCounterSystem(), sliced);
+	sliced_world.FlipBuffersPerStep<CounterComponent>(sliced);
+	std::vector<ECS::Entity> entities;
+	for (int i = 0; i < 5000; i++) {
+		entities.push_back(entity_mgr.CreateEntity<CounterComponent>());
+	}
+	ECS::StorageStats stats;
+	entity_mgr.GetStorageStats(stats);
+	ASSERT_GT(stats.chunk_count, 2u);
+	for (int i = 0; i < 10; i++) {
+		sliced_world.Update(1.0 / 60);
+	}
+	for (const auto& entity : entities) {
+		ASSERT_EQ(5, entity_mgr.GetEntityComponent<CounterComponent>(entity)->count);
+		ASSERT_EQ(4, entity_mgr.GetPreviousEntityComponent<CounterComponent>(entity)->count);
+	}
+}
+
+TEST(World, StreamingPartitions)
+{
+	const std::string path = "partition_test.bin";
+
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+	ECS::PartitionStreamer& streamer = world.GetPartitionStreamer();
+
+	std::vector<ECS::Entity> near_entities, far_entities;
+	for (int i = 0; i < 2000; i++) {
+		std::vector<ECS::Entity>& partition_entities = i % 2 == 0 ? near_entities : far_entities;
+		partition_entities.push_back(entity_mgr.CreateEntity<PositionComponent, IntComponent>());
+		entity_mgr.SetEntityComponent<IntComponent>(partition_entities.back(), i);
+		entity_mgr.AddEntityComponent<ECS::Partition>(partition_entities.back(), i % 2 == 0 ? 1 : 2);
+	}
+	ECS::Entity counter_entity = entity_mgr.CreateEntity<CounterComponent>();
+	entity_mgr.SetEntityComponent<CounterComponent>(counter_entity, 5);
+	entity_mgr.AddEntityComponent<ECS::Partition>(counter_entity, 2);
+	ECS::Entity free_entity = entity_mgr.CreateEntity<IntComponent>();
+
+	auto count_entities = [&]() -> size_t {
+		size_t count = 0;
+		world.ForEach<IntComponent>([&](const ECS::Entity*, IntComponent*) -> void {
+			count++;
+		});
+		return count;
+	};
+	auto wait_for = [&](uint64_t partition_id, ECS::PartitionState state) -> void {
+		for (size_t frame = 0; frame < 1000 && streamer.GetState(partition_id) != state; frame++) {
+			world.Update(0.01);
+		}
+		ASSERT_EQ(state, streamer.GetState(partition_id));
+	};
+
+	// Unloading frees the far partition's chunks, leaving the rest
+	ECS::StorageStats stats;
+	entity_mgr.GetStorageStats(stats);
+	size_t resident_chunk_count = stats.chunk_count;
+	ASSERT_TRUE(streamer.Unload(2, path));
+	EXPECT_FALSE(streamer.Unload(2, path));
+	wait_for(2, ECS::PartitionState::Unloaded);
+
+	EXPECT_EQ(1001u, count_entities());
+	EXPECT_FALSE(entity_mgr.HasComponent<IntComponent>(far_entities[0]));
+	EXPECT_EQ(0, entity_mgr.GetEntityComponent<IntComponent>(near_entities[0])->num);
+	entity_mgr.GetStorageStats(stats);
+	EXPECT_LT(stats.chunk_count, resident_chunk_count);
+
+	// The world goes on while the partition is away
+	for (size_t i = 0; i < 3; i++) {
+		world.Update(0.01);
+	}
+	entity_mgr.DestroyEntity(near_entities[1]);
+	ECS::Entity new_entity = entity_mgr.CreateEntity<IntComponent>();
+
+	// Loading splices the chunks back at a sync point, with their data
+	ASSERT_TRUE(streamer.Load(2, path));
+	wait_for(2, ECS::PartitionState::Resident);
+	EXPECT_EQ(2001u, count_entities());
+	for (size_t i = 0; i < far_entities.size(); i++) {
+		ASSERT_EQ(static_cast<int>(2 * i + 1), entity_mgr.GetEntityComponent<IntComponent>(far_entities[i])->num);
+		ASSERT_EQ(2u, entity_mgr.GetEntityComponent<ECS::Partition>(far_entities[i])->id);
+	}
+	EXPECT_EQ(5, entity_mgr.GetPreviousEntityComponent<CounterComponent>(counter_entity)->count);
+	EXPECT_TRUE(entity_mgr.HasComponent<IntComponent>(free_entity));
+	EXPECT_TRUE(entity_mgr.HasComponent<IntComponent>(new_entity));
+
+	// Loaded entities are ordinary ones
+	entity_mgr.RemoveEntityComponent<PositionComponent>(far_entities[0]);
+	EXPECT_EQ(1, entity_mgr.GetEntityComponent<IntComponent>(far_entities[0])->num);
+	entity_mgr.DestroyEntity(far_entities[1]);
+	EXPECT_EQ(2000u, count_entities());
+
+	// Partitions with data outside of chunks stay resident
+	entity_mgr.AddEntityComponent<SelectedComponent>(near_entities[0]);
+	EXPECT_FALSE(streamer.Unload(1, path));
+	EXPECT_EQ(ECS::PartitionState::Resident, streamer.GetState(1));
+	EXPECT_FALSE(streamer.Load(1, path));
+	std::remove(path.c_str());
+
+	// A partition still queued to be written when the job system is destroyed, as with its world, is written
+	for (int i = 0; i < 100; i++) {
+		ECS::Entity entity = entity_mgr.CreateEntity<IntComponent>();
+		entity_mgr.AddEntityComponent<ECS::Partition>(entity, 4);
+	}
+	std::unique_ptr<ECS::JobSystem> job_system_ptr(new ECS::JobSystem(2, 1));
+	ECS::PartitionStreamer job_streamer(&entity_mgr, job_system_ptr.get());
+	for (size_t i = 0; i < job_system_ptr->GetWorkerCount(); i++) {
+		job_system_ptr->Submit([]() -> void { std::this_thread::sleep_for(std::chrono::milliseconds(20)); });
+	}
+	ASSERT_TRUE(job_streamer.Unload(4, path));
+	job_system_ptr.reset();
+	EXPECT_EQ(ECS::PartitionState::Unloaded, job_streamer.GetState(4));
+	ECS::PartitionData data(4);
+	EXPECT_TRUE(data.Read(path));
+	EXPECT_EQ(100u, data.GetEntityCount());
+	std::remove(path.c_str());
+}
+
+TEST(World, DeltaSnapshots)
+{
+	ECS::World server, client;
+	ECS::EntityManager& server_mgr = server.GetEntityManager();
+	ECS::EntityManager& client_mgr = client.GetEntityManager();
+
+	std::vector<ECS::Entity> entities;
+	for (int i = 0; i < 5000; i++) {
+		entities.push_back(i % 5 == 0 ? server_mgr.CreateEntity<IntComponent>() : server_mgr.CreateEntity<PositionComponent, IntComponent>());
+		server_mgr.SetEntityComponent<IntComponent>(entities.back(), i);
+	}
+	ECS::Entity empty_entity = server_mgr.CreateEntity();
+
+	auto expect_same = [&]() -> void {
+		std::unordered_map<size_t, std::pair<int, float>> server_values, client_values;
+		server.ForEach<IntComponent>([&](const ECS::Entity* entity, IntComponent* i) -> void {
+			server_values[entity->id] = { i->num, server_mgr.HasComponent<PositionComponent>(*entity) ? server_mgr.GetEntityComponent<PositionComponent>(*entity)->x : -1.0f };
+		});
+		client.ForEach<IntComponent>([&](const ECS::Entity* entity, IntComponent* i) -> void {
+			client_values[entity->id] = { i->num, client_mgr.HasComponent<PositionComponent>(*entity) ? client_mgr.GetEntityComponent<PositionComponent>(*entity)->x : -1.0f };
+		});
+		ASSERT_EQ(server_values, client_values);
+	};
+
+	// A delta against an empty snapshot is the full state
+	ECS::WorldSnapshot base;
+	std::vector<char> delta;
+	ASSERT_TRUE(server_mgr.EncodeDelta(base, delta));
+	size_t full_delta_size = delta.size();
+	ASSERT_TRUE(client_mgr.ApplyDelta(delta));
+	expect_same();
+	EXPECT_FALSE(client_mgr.HasComponent<IntComponent>(empty_entity));
+
+	for (int frame = 0; frame < 4; frame++) {
+		server_mgr.CaptureSnapshot(base);
+
+		// Value changes of a few entities only encode their chunk's changed rows
+		for (size_t i = 0; i < 10; i++) {
+			server_mgr.SetEntityComponent<IntComponent>(entities[i * 7 + frame], -frame);
+		}
+		ASSERT_TRUE(server_mgr.EncodeDelta(base, delta));
+		EXPECT_LT(delta.size() * 4, full_delta_size);
+		ASSERT_TRUE(client_mgr.ApplyDelta(delta));
+		expect_same();
+		server_mgr.CaptureSnapshot(base);
+
+		// Structural changes
+		server_mgr.RemoveEntityComponent<PositionComponent>(entities[frame * 3 + 1]);
+		server_mgr.AddEntityComponent<PositionComponent>(entities[frame * 5], 1.5f * frame, 2.0f);
+		server_mgr.DestroyEntity(entities[4000 + frame]);
+		ECS::Entity new_entity = server_mgr.CreateEntity<PositionComponent, IntComponent>();
+		server_mgr.SetEntityComponent<IntComponent>(new_entity, 10000 + frame);
+		ASSERT_TRUE(server_mgr.EncodeDelta(base, delta));
+		ASSERT_TRUE(client_mgr.ApplyDelta(delta));
+		expect_same();
+		EXPECT_FALSE(client_mgr.HasComponent<IntComponent>(entities[4000 + frame]));
+	}
+
+	// Nothing changed since the snapshot, nothing to encode
+	server_mgr.CaptureSnapshot(base);
+	ASSERT_TRUE(server_mgr.EncodeDelta(base, delta));
+	EXPECT_EQ(3u, delta.size());
+
+	// Nor by reading
+	int num_sum = 0;
+	server.ForEach<const IntComponent>([&](const ECS::Entity*, const IntComponent* i) -> void {
+		num_sum += i->num;
+	});
+	server.ForEachChunk<const IntComponent>([&](const ECS::ChunkView& chunk) -> void {
+		num_sum += chunk.GetColumn<const IntComponent>()[0].num;
+	});
+	EXPECT_NE(0, num_sum);
+	ASSERT_TRUE(server_mgr.EncodeDelta(base, delta));
+	EXPECT_EQ(3u, delta.size());
+
+	// A corrupted delta changes nothing
+	server_mgr.DestroyEntity(entities[4999]);
+	server_mgr.SetEntityComponent<IntComponent>(entities[0], 7);
+	ASSERT_TRUE(server_mgr.EncodeDelta(base, delta));
+	delta.pop_back();
+	EXPECT_FALSE(client_mgr.ApplyDelta(delta));
+	EXPECT_TRUE(client_mgr.HasComponent<IntComponent>(entities[4999]));
+
+	// Data outside of chunks can't be encoded
+	server_mgr.AddEntityComponent<SelectedComponent>(entities[0]);
+	EXPECT_FALSE(server_mgr.EncodeDelta(base, delta));
+}
+
+TEST(World, Checkpoints)
+{
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+
+	std::vector<ECS::Entity> entities;
+	for (int i = 0; i < 100000; i++) {
+		entities.push_back(entity_mgr.CreateEntity<PositionComponent, IntComponent>());
+		entity_mgr.SetEntityComponent<IntComponent>(entities.back(), i);
+	}
+
+	// A frame changes a few entities, and creates and destroys some
+	auto simulate = [&](int frame) -> void {
+		for (size_t i = 0; i < 100; i++) {
+			entity_mgr.SetEntityComponent<IntComponent>(entities[(frame * 997 + i * 31) % 100000], frame);
+		}
+		if (frame % 3 == 0) {
+			entity_mgr.DestroyEntity(entities[frame]);
+		}
+		entities.push_back(entity_mgr.CreateEntity<IntComponent>());
+		entity_mgr.SetEntityComponent<IntComponent>(entities.back(), 1000000 + frame);
+	};
+	auto state = [&]() -> std::vector<std::pair<size_t, int>> {
+		std::vector<std::pair<size_t, int>> values;
+		for (const auto& entity : entities) {
+			if (entity_mgr.HasComponent<IntComponent>(entity)) {
+				values.emplace_back(entity.id, entity_mgr.GetEntityComponent<IntComponent>(entity)->num);
+			}
+		}
+		return values;
+	};
+
+	ECS::CheckpointRing checkpoints(&entity_mgr, 8);
+	std::vector<std::vector<std::pair<size_t, int>>> states;
+	std::vector<ECS::Entity> created_entities;
+	for (int frame = 0; frame < 12; frame++) {
+		simulate(frame);
+		created_entities.push_back(entities.back());
+		ASSERT_TRUE(checkpoints.Save(frame));
+		states.push_back(state());
+	}
+	EXPECT_FALSE(checkpoints.Save(11));
+	EXPECT_EQ(8u, checkpoints.GetCount());
+	EXPECT_FALSE(checkpoints.Contains(3));
+	EXPECT_FALSE(checkpoints.Restore(3));
+
+	// Roll back and simulate again, creating the same entities
+	ASSERT_TRUE(checkpoints.Restore(6));
+	EXPECT_EQ(3u, checkpoints.GetCount());  // frames 4 to 6
+	entities.resize(100000 + 7);
+	EXPECT_EQ(states[6], state());
+	EXPECT_FALSE(entity_mgr.HasComponent<IntComponent>(created_entities[7]));
+	for (int frame = 7; frame < 12; frame++) {
+		simulate(frame);
+		EXPECT_EQ(created_entities[frame].id, entities.back().id);
+		ASSERT_TRUE(checkpoints.Save(frame));
+		EXPECT_EQ(states[frame], state());
+	}
+
+	// Rolling back over a destroyed entity brings it back
+	ASSERT_TRUE(checkpoints.Restore(8));
+	entities.resize(100000 + 9);
+	EXPECT_EQ(states[8], state());
+	EXPECT_TRUE(entity_mgr.HasComponent<IntComponent>(entities[9]));
+	EXPECT_EQ(9, entity_mgr.GetEntityComponent<IntComponent>(entities[9])->num % 1000);
+
+	// Only the chunks changed since the previous checkpoint are copied
+	ECS::WorldCheckpoint first, second;
+	ASSERT_TRUE(entity_mgr.SaveCheckpoint(first));
+	entity_mgr.SetEntityComponent<IntComponent>(entities[50000], -1);
+	ASSERT_TRUE(entity_mgr.SaveCheckpoint(second, &first));
+	size_t chunk_count = 0, shared_chunk_count = 0;
+	for (const auto& [a_id, a_checkpoint] : second.storage.archetypes) {
+		for (size_t i = 0; i < a_checkpoint.chunks.size(); i++) {
+			chunk_count++;
+			shared_chunk_count += a_checkpoint.chunks[i] == first.storage.archetypes.at(a_id).chunks[i];
+		}
+	}
+	EXPECT_GT(chunk_count, 10u);
+	EXPECT_EQ(chunk_count - 1, shared_chunk_count);
+	EXPECT_EQ(first.entities_ptr, second.entities_ptr);
+	ASSERT_TRUE(entity_mgr.RestoreCheckpoint(first));
+	EXPECT_EQ(50000, entity_mgr.GetEntityComponent<IntComponent>(entities[50000])->num);
+
+	// A checkpoint no longer needed has the copies only it holds swapped in, and can then only be saved upon
+	std::vector<std::pair<size_t, int>> saved_state = state();
+	ECS::WorldCheckpoint speculative;
+	ASSERT_TRUE(entity_mgr.SaveCheckpoint(speculative));
+	std::vector<const void*> copy_ptrs;
+	for (const auto& [a_id, a_checkpoint] : speculative.storage.archetypes) {
+		for (const auto& copy_ptr : a_checkpoint.chunks) {
+			copy_ptrs.push_back(copy_ptr->chunk_ptr);
+		}
+	}
+	for (const auto& entity : entities) {
+		if (entity_mgr.HasComponent<IntComponent>(entity)) {
+			entity_mgr.SetEntityComponent<IntComponent>(entity, -1);
+		}
+	}
+	ASSERT_TRUE(entity_mgr.RestoreCheckpoint(std::move(speculative)));
+	EXPECT_EQ(saved_state, state());
+	size_t swapped_count = 0, copy_index = 0;
+	for (const auto& [a_id, a_checkpoint] : speculative.storage.archetypes) {
+		for (const auto& copy_ptr : a_checkpoint.chunks) {
+			swapped_count += copy_ptr->chunk_ptr != copy_ptrs[copy_index++];
+		}
+	}
+	EXPECT_GT(swapped_count, 10u);
+	EXPECT_EQ(copy_ptrs.size(), swapped_count);
+	EXPECT_FALSE(entity_mgr.RestoreCheckpoint(speculative));
+	ASSERT_TRUE(entity_mgr.SaveCheckpoint(second, &speculative));
+	entity_mgr.SetEntityComponent<IntComponent>(entities[50000], -2);
+	ASSERT_TRUE(entity_mgr.RestoreCheckpoint(second));
+	EXPECT_EQ(saved_state, state());
+
+	// The copies shared with another checkpoint are copied back, leaving it intact
+	ASSERT_TRUE(entity_mgr.SaveCheckpoint(speculative));
+	ASSERT_TRUE(entity_mgr.SaveCheckpoint(second, &speculative));
+	entity_mgr.SetEntityComponent<IntComponent>(entities[50000], -2);
+	ASSERT_TRUE(entity_mgr.RestoreCheckpoint(std::move(speculative)));
+	EXPECT_EQ(saved_state, state());
+	entity_mgr.SetEntityComponent<IntComponent>(entities[50000], -3);
+	ASSERT_TRUE(entity_mgr.RestoreCheckpoint(second));
+	EXPECT_EQ(saved_state, state());
+
+	// Data outside of chunks can't be checkpointed
+	entity_mgr.AddEntityComponent<SelectedComponent>(entities[0]);
+	EXPECT_FALSE(checkpoints.Save(20));
+	EXPECT_FALSE(entity_mgr.RestoreCheckpoint(first));
+}
+
+struct VelocityComponent
+{
+	VelocityComponent() : x(1.0f), y(-2.0f) {}
+
+	float x;
+	float y;
+};
+
+TEST(World, ColumnsAndBulkOps)
+{
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+	for (int i = 0; i < 3001; i++) {
+		ECS::Entity entity = entity_mgr.CreateEntity<PositionComponent, VelocityComponent, MixComponent, IntComponent>();
+		entity_mgr.SetEntityComponent<PositionComponent>(entity, 0.5f * i, -0.25f * i);
+	}
+
+	// Every row of every chunk starts on a cache line
+	size_t chunk_count = 0;
+	world.ForEachChunk<PositionComponent, VelocityComponent, MixComponent, IntComponent>([&](const ECS::ChunkView& chunk) -> void {
+		chunk_count++;
+		EXPECT_TRUE(chunk.GetColumn<PositionComponent>().IsAligned());
+		EXPECT_TRUE(chunk.GetColumn<VelocityComponent>().IsAligned());
+		EXPECT_TRUE(chunk.GetColumn<MixComponent>().IsAligned());
+		EXPECT_TRUE(chunk.GetColumn<IntComponent>().IsAligned());
+		ECS::ColumnView<PositionComponent> positions = chunk.GetColumn<PositionComponent>();
+		EXPECT_EQ(chunk.GetEntityCount(), positions.size());
+		EXPECT_EQ(positions.size(), positions.GetBodySize(8) + positions.GetTailSize(8));
+		EXPECT_EQ(0u, positions.GetBodySize(8) % 8);
+		EXPECT_EQ(2 * positions.size(), positions.AsScalars<float>().size());
+	});
+	EXPECT_GT(chunk_count, 1u);
+
+	// Every level gives the same results as the scalar code, including the tails of odd-sized columns
+	std::vector<float> expected, values;
+	for (ECS::SimdLevel level : { ECS::SimdLevel::Scalar, ECS::SimdLevel::SSE2, ECS::SimdLevel::AVX2 }) {
+		ECS::BulkOps::SetSimdLevel(level);
+		EXPECT_LE(ECS::BulkOps::GetSimdLevel(), level);
+
+		std::vector<float> results;
+		for (size_t count : { 0, 1, 7, 8, 9, 31, 1001 }) {
+			values.resize(count);
+			std::vector<float> steps(count);
+			for (size_t i = 0; i < count; i++) {
+				values[i] = 0.37f * i - 40.0f;
+				steps[i] = i % 3 == 0 ? -1.5f : 0.75f;
+			}
+			ECS::ColumnView<float> column(values.data(), count);
+			ECS::BulkOps::Axpy(column, ECS::ColumnView<const float>(steps.data(), count), 0.016f);
+			results.push_back(ECS::BulkOps::Min(column));
+			results.push_back(ECS::BulkOps::Max(column));
+			ECS::BulkOps::Clamp(column, -10.0f, 10.0f);
+			results.insert(results.end(), values.begin(), values.end());
+			EXPECT_EQ(count == 0 ? std::numeric_limits<float>::infinity() : -10.0f, ECS::BulkOps::Min(column));
+			ECS::BulkOps::Fill(column, 2.5f);
+			EXPECT_EQ(static_cast<long>(count), std::count(values.begin(), values.end(), 2.5f));
+		}
+		if (level == ECS::SimdLevel::Scalar) {
+			expected = results;
+		}
+		EXPECT_EQ(expected, results);
+	}
+
+	// Integrate the positions of every chunk
+	world.ForEachChunk<PositionComponent, VelocityComponent>([&](const ECS::ChunkView& chunk) -> void {
+		ECS::BulkOps::Integrate(chunk.GetColumn<PositionComponent>(), chunk.GetColumn<const VelocityComponent>(), 0.5f);
+	});
+	int i = 0;
+	world.ForEach<PositionComponent>([&](const ECS::Entity*, PositionComponent* position) -> void {
+		EXPECT_FLOAT_EQ(0.5f * i + 0.5f, position->x);
+		EXPECT_FLOAT_EQ(-0.25f * i - 1.0f, position->y);
+		i++;
+	});
+	EXPECT_EQ(3001, i);
+	ECS::BulkOps::SetSimdLevel(ECS::SimdLevel::AVX2);
+}
+
+struct GroupedPositionComponent
+{
+	float x = 0.0f;
+	float y = 0.0f;
+};
+
+struct GroupedVelocityComponent
+{
+	float x = 1.0f;
+	float y = 2.0f;
+};
+
+struct ColdComponent
+{
+	char name[120] = {};
+};
+
+template <>
+struct ECS::ComponentTraits<GroupedPositionComponent> : ECS::DefaultComponentTraits
+{
+	static constexpr size_t interleave_group = 1;
+};
+
+template <>
+struct ECS::ComponentTraits<GroupedVelocityComponent> : ECS::DefaultComponentTraits
+{
+	static constexpr size_t interleave_group = 1;
+};
+
+template <>
+struct ECS::ComponentTraits<ColdComponent> : ECS::DefaultComponentTraits
+{
+	static constexpr bool cold = true;
+};
+
+TEST(World, ChunkLayouts)
+{
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+	std::vector<ECS::Entity> entities;
+	for (int i = 0; i < 2000; i++) {
+		entities.push_back(entity_mgr.CreateEntity<GroupedPositionComponent, GroupedVelocityComponent, ColdComponent, IntComponent>());
+		entity_mgr.GetEntityComponent<GroupedPositionComponent>(entities[i])->x = static_cast<float>(i);
+		entity_mgr.GetEntityComponent<ColdComponent>(entities[i])->name[0] = static_cast<char>(i);
+	}
+
+	// The cold component doesn't take room in the chunks
+	ECS::StorageStats stats;
+	entity_mgr.GetStorageStats(stats);
+	ASSERT_EQ(1u, stats.archetypes.size());
+	EXPECT_GT(stats.archetypes[0].chunk_entity_capacity, 16384u / sizeof(ColdComponent));
+	EXPECT_GT(stats.bytes_reserved, stats.chunk_count * 16384u);
+
+	// The grouped components are interleaved in blocks of 8, which keep their values when entities are removed
+	for (int i = 0; i < 2000; i += 3) {
+		entity_mgr.RemoveEntityAllComponents(entities[i]);
+	}
+	world.ForEachChunk<GroupedPositionComponent, GroupedVelocityComponent, IntComponent>([&](const ECS::ChunkView& chunk) -> void {
+		ECS::BlockedColumnView<GroupedPositionComponent> positions = chunk.GetBlocks<GroupedPositionComponent>();
+		ECS::BlockedColumnView<const GroupedVelocityComponent> velocities = chunk.GetBlocks<const GroupedVelocityComponent>();
+		EXPECT_EQ(8u, positions.GetLanes());
+		EXPECT_EQ((chunk.GetEntityCount() + 7) / 8, positions.GetBlockCount());
+		EXPECT_EQ(1u, chunk.GetBlocks<IntComponent>().GetBlockCount());
+		for (size_t i = 0; i < positions.GetBlockCount(); i++) {
+			ECS::BulkOps::Integrate(positions.GetBlock(i), velocities.GetBlock(i), 0.5f);
+		}
+	});
+	for (int i = 0; i < 2000; i++) {
+		if (i % 3 != 0) {
+			EXPECT_FLOAT_EQ(i + 0.5f, entity_mgr.GetEntityComponent<GroupedPositionComponent>(entities[i])->x);
+			EXPECT_FLOAT_EQ(1.0f, entity_mgr.GetEntityComponent<GroupedPositionComponent>(entities[i])->y);
+			EXPECT_FLOAT_EQ(2.0f, entity_mgr.GetEntityComponent<GroupedVelocityComponent>(entities[i])->y);
+			EXPECT_EQ(static_cast<char>(i), entity_mgr.GetEntityComponent<ColdComponent>(entities[i])->name[0]);
+		}
+	}
+
+	// Checkpoints copy the cold chunks as well
+	ECS::WorldCheckpoint checkpoint;
+	ASSERT_TRUE(entity_mgr.SaveCheckpoint(checkpoint));
+	entity_mgr.GetEntityComponent<ColdComponent>(entities[1])->name[0] = 'x';
+	entity_mgr.GetEntityComponent<GroupedVelocityComponent>(entities[1])->x = 5.0f;
+	entity_mgr.CreateEntity<GroupedPositionComponent, GroupedVelocityComponent, ColdComponent, IntComponent>();
+	ASSERT_TRUE(entity_mgr.RestoreCheckpoint(checkpoint));
+	EXPECT_EQ(static_cast<char>(1), entity_mgr.GetEntityComponent<ColdComponent>(entities[1])->name[0]);
+	EXPECT_FLOAT_EQ(1.0f, entity_mgr.GetEntityComponent<GroupedVelocityComponent>(entities[1])->x);
+
+	// Persisted storage and deltas describe rows by their offsets only
+	std::vector<char> delta;
+	EXPECT_FALSE(entity_mgr.EncodeDelta(ECS::WorldSnapshot(), delta));
+	EXPECT_FALSE(entity_mgr.SaveStorage("chunk_layouts.bin"));
+
+	// A partition with cold components can't be detached; once they are gone, their empty chunks stay behind
+	ECS::Entity cold_entity = entity_mgr.CreateEntity<IntComponent, ColdComponent>();
+	entity_mgr.AddEntityComponent<ECS::Partition>(cold_entity, 1);
+	ECS::Entity warm_entity = entity_mgr.CreateEntity<IntComponent>();
+	entity_mgr.AddEntityComponent<ECS::Partition>(warm_entity, 1);
+	EXPECT_EQ(nullptr, entity_mgr.DetachPartition(1));
+	entity_mgr.DestroyEntity(cold_entity);
+	std::unique_ptr<ECS::PartitionData> data = entity_mgr.DetachPartition(1);
+	ASSERT_NE(nullptr, data);
+	EXPECT_EQ(1u, data->GetArchetypes().size());
+	EXPECT_EQ(0u, entity_mgr.GetEntities().count(warm_entity));
+
+	cold_entity = entity_mgr.CreateEntity<IntComponent, ColdComponent>();
+	entity_mgr.AddEntityComponent<ECS::Partition>(cold_entity, 1);
+	entity_mgr.GetEntityComponent<ColdComponent>(cold_entity)->name[0] = 'c';
+	EXPECT_EQ('c', entity_mgr.GetEntityComponent<ColdComponent>(cold_entity)->name[0]);
+	EXPECT_EQ(static_cast<char>(1), entity_mgr.GetEntityComponent<ColdComponent>(entities[1])->name[0]);
+}
+
+TEST(World, SortedIteration)
+{
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+	std::vector<ECS::Entity> entities;
+	for (int i = 0; i < 3000; i++) {
+		entities.push_back(entity_mgr.CreateEntity<IntComponent, PositionComponent, ColdComponent>());
+		int key = (i * 7919) % 3000;
+		entity_mgr.SetEntityComponent<IntComponent>(entities[i], key);
+		entity_mgr.SetEntityComponent<PositionComponent>(entities[i], static_cast<float>(key), 0.0f);
+		entity_mgr.GetEntityComponent<ColdComponent>(entities[i])->name[0] = static_cast<char>(key);
+	}
+	for (int i = 0; i < 3000; i += 5) {
+		entity_mgr.RemoveEntityAllComponents(entities[i]);
+	}
+	auto by_num = [](const IntComponent& lhs, const IntComponent& rhs) -> bool { return lhs.num < rhs.num; };
+
+	// Entities are visited in order and keep their components
+	size_t moved_count = world.SortBy<IntComponent, PositionComponent>(by_num);
+	EXPECT_GT(moved_count, 0u);
+	int last_num = -1;
+	size_t visited_count = 0;
+	world.ForEach<IntComponent, PositionComponent>([&](const ECS::Entity* entity, IntComponent* i, PositionComponent* pos) -> void {
+		EXPECT_LT(last_num, i->num);
+		last_num = i->num;
+		visited_count++;
+		EXPECT_EQ(i, entity_mgr.GetEntityComponent<IntComponent>(*entity));
+		EXPECT_FLOAT_EQ(static_cast<float>(i->num), pos->x);
+		EXPECT_EQ(static_cast<char>(i->num), entity_mgr.GetEntityComponent<ColdComponent>(*entity)->name[0]);
+	});
+	EXPECT_EQ(2400u, visited_count);
+
+	// Sorting sorted entities moves none, and a few changed keys move a few entities
+	EXPECT_EQ(0u, world.SortBy<IntComponent>(by_num));
+	entity_mgr.GetEntityComponent<IntComponent>(entities[1])->num = -1;
+	EXPECT_LT(world.SortBy<IntComponent>(by_num), 3000u);
+	std::vector<ECS::Entity> visited;
+	world.ForEach<IntComponent>([&](const ECS::Entity* entity, IntComponent*) -> void {
+		visited.push_back(*entity);
+	});
+	ASSERT_EQ(2400u, visited.size());
+	EXPECT_EQ(entities[1].id, visited[0].id);
+	EXPECT_EQ(-1, entity_mgr.GetEntityComponent<IntComponent>(visited[0])->num);
+}
+
+TEST(World, SpatialIndex)
+{
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+	std::vector<ECS::Entity> entities;
+	for (int i = 0; i < 2000; i++) {
+		entities.push_back(entity_mgr.CreateEntity<PositionComponent>());
+		entity_mgr.SetEntityComponent<PositionComponent>(entities[i], static_cast<float>(i * 37 % 100), static_cast<float>(i * 53 % 97));
+	}
+	ECS::SpatialIndex<PositionComponent, 2> index(&entity_mgr, 5.0f);
+
+	// The queries find the same entities as testing every position
+	auto check_queries = [&]() -> void {
+		index.Update();
+		std::vector<ECS::Entity> result;
+		for (float x : { -3.0f, 12.5f, 50.0f, 99.0f }) {
+			float y = 100.0f - x;
+			std::vector<size_t> in_radius, in_box;
+			float nearest_sq = 1e9f;
+			world.ForEach<PositionComponent>([&](const ECS::Entity* entity, PositionComponent* pos) -> void {
+				float distance_sq = (pos->x - x) * (pos->x - x) + (pos->y - y) * (pos->y - y);
+				if (distance_sq <= 64.0f) {
+					in_radius.push_back(entity->id);
+				}
+				if (pos->x >= x - 2.0f && pos->x <= x + 6.0f && pos->y >= y && pos->y <= y + 12.0f) {
+					in_box.push_back(entity->id);
+				}
+				nearest_sq = std::min(nearest_sq, distance_sq);
+			});
+			std::sort(in_radius.begin(), in_radius.end());
+			std::sort(in_box.begin(), in_box.end());
+
+			auto ids_of = [](const std::vector<ECS::Entity>& entities) -> std::vector<size_t> {
+				std::vector<size_t> ids;
+				for (const auto& entity : entities) {
+					ids.push_back(entity.id);
+				}
+				std::sort(ids.begin(), ids.end());
+				return ids;
+			};
+			index.QueryRadius({ x, y }, 8.0f, result);
+			EXPECT_EQ(in_radius, ids_of(result));
+			index.QueryAABB({ x - 2.0f, y }, { x + 6.0f, y + 12.0f }, result);
+			EXPECT_EQ(in_box, ids_of(result));
+			ECS::Entity nearest;
+			ASSERT_TRUE(index.QueryNearest({ x, y }, 1000.0f, nearest));
+			PositionComponent* nearest_pos = entity_mgr.GetEntityComponent<PositionComponent>(nearest);
+			EXPECT_FLOAT_EQ(nearest_sq, (nearest_pos->x - x) * (nearest_pos->x - x) + (nearest_pos->y - y) * (nearest_pos->y - y));
+		}
+	};
+	check_queries();
+	EXPECT_EQ(2000u, index.GetEntityCount());
+
+	// Moved, removed, migrated and new entities are picked up by the next update
+	for (int i = 0; i < 2000; i += 7) {
+		entity_mgr.GetEntityComponent<PositionComponent>(entities[i])->x += 11.0f;
+	}
+	for (int i = 1; i < 2000; i += 5) {
+		entity_mgr.RemoveEntityAllComponents(entities[i]);
+	}
+	for (int i = 2; i < 2000; i += 9) {
+		entity_mgr.AddEntityComponent<IntComponent>(entities[i], i);
+	}
+	for (int i = 3; i < 2000; i += 11) {
+		entity_mgr.RemoveEntityComponent<PositionComponent>(entities[i]);
+	}
+	for (int i = 0; i < 100; i++) {
+		ECS::Entity entity = entity_mgr.CreateEntity<PositionComponent, MixComponent>();
+		entity_mgr.SetEntityComponent<PositionComponent>(entity, 50.0f + i % 10, 50.0f - i / 10);
+	}
+	check_queries();
+	size_t position_count = 0;
+	world.ForEach<PositionComponent>([&](const ECS::Entity*, PositionComponent*) -> void { position_count++; });
+	EXPECT_EQ(position_count, index.GetEntityCount());
+
+	// Another update keeps the entities, and nothing is found beyond the given distance
+	index.Update();
+	EXPECT_EQ(position_count, index.GetEntityCount());
+	ECS::Entity nearest;
+	EXPECT_FALSE(index.QueryNearest({ 500.0f, 500.0f }, 10.0f, nearest));
+
+	// Writing the other components of the entities doesn't make the next update read them again
+	world.ForEach<IntComponent>([&](const ECS::Entity*, IntComponent* i) -> void { i->num++; });
+	EXPECT_EQ(0u, index.Update());
+	entity_mgr.GetEntityComponent<PositionComponent>(entities[2])->x += 1.0f;
+	EXPECT_GT(index.Update(), 0u);
+
+	// Infinite and NaN distances and positions are handled
+	const float infinity = std::numeric_limits<float>::infinity();
+	EXPECT_TRUE(index.QueryNearest({ 500.0f, 500.0f }, infinity, nearest));
+	EXPECT_FALSE(index.QueryNearest({ 500.0f, 500.0f }, std::nanf(""), nearest));
+	std::vector<ECS::Entity> result;
+	EXPECT_EQ(position_count, index.QueryRadius({ 0.0f, 0.0f }, 1e30f, result));
+	entity_mgr.SetEntityComponent<PositionComponent>(entities[2], infinity, -infinity);
+	index.Update();
+	EXPECT_EQ(position_count, index.QueryAABB({ -infinity, -infinity }, { infinity, infinity }, result));
+}
+
+struct DamageEvent
+{
+	size_t target;
+	int amount;
+};
+
+class SendDamageSystem : public ECS::System
+{
+public:
+	virtual void Init() override {}
+	virtual void Update(double) override
+	{
+		ECS::EventChannel<DamageEvent>& damage_events = world_ptr->GetEvents<DamageEvent>();
+		// Half of the events one by one, half in batches
+		world_ptr->GetJobSystem().ParallelFor(500, [&](size_t i) -> void {
+			damage_events.Send({ i, 1 });
+		});
+		world_ptr->GetJobSystem().ParallelFor(5, [&](size_t i) -> void {
+			std::vector<DamageEvent> batch;
+			for (size_t j = 0; j < 100; j++) {
+				batch.push_back({ 500 + i * 100 + j, 1 });
+			}
+			damage_events.Send(batch.data(), batch.size());
+		});
+	}
+};
+
+class SumDamageSystem : public ECS::System
+{
+public:
+	virtual void Init() override {}
+	virtual void Update(double) override
+	{
+		reader.Read([&](const DamageEvent& event) -> void {
+			damage_by_target[event.target] += event.amount;
+			sum += event.amount;
+		});
+	}
+
+	ECS::EventReader<DamageEvent> reader;
+	std::vector<int> damage_by_target = std::vector<int>(1000, 0);
+	int sum = 0;
+};
+
+TEST(World, EventChannels)
+{
+	ECS::World world;
+	ECS::EventChannel<DamageEvent>& damage_events = world.GetEvents<DamageEvent>();
+	ECS::EventReader<DamageEvent> lagging_reader = damage_events.CreateReader();
+	SumDamageSystem* sum_damage = new SumDamageSystem();
+	sum_damage->reader = damage_events.CreateReader();
+	world.AddSystem(new SendDamageSystem(), 1);
+	world.AddSystem(sum_damage, 0);
+
+	// The events sent from parallel jobs are read in the same frame, each once
+	for (int i = 0; i < 3; i++) {
+		world.Update(1);
+	}
+	EXPECT_EQ(3000, sum_damage->sum);
+	EXPECT_TRUE(std::all_of(sum_damage->damage_by_target.begin(), sum_damage->damage_by_target.end(), [](int damage) { return damage == 3; }));
+	EXPECT_EQ(0u, sum_damage->reader.GetMissedCount());
+
+	// A reader not reading keeps two frames of events at most, and learns how many it missed
+	EXPECT_EQ(2000u, damage_events.GetEventCount());
+	EXPECT_EQ(2000u, lagging_reader.Read([](const DamageEvent&) -> void {}));
+	EXPECT_EQ(1000u, lagging_reader.GetMissedCount());
+
+	// Once every reader has read a frame, it is dropped at the end of the frame
+	lagging_reader = ECS::EventReader<DamageEvent>();
+	world.Update(1);
+	EXPECT_EQ(1000u, damage_events.GetEventCount());
+
+	// Events needing destruction, readers destroyed after the channel, and arenas reused by later frames
+	ECS::EventReader<std::string> name_reader;
+	{
+		ECS::EventChannel<std::string> names(3);
+		name_reader = names.CreateReader();
+		std::vector<std::string> read_names;
+		for (int frame = 0; frame < 5; frame++) {
+			for (int i = 0; i < 100; i++) {
+				names.Send("a name too long for small string optimization " + std::to_string(frame * 100 + i));
+			}
+			if (frame % 2 == 1) {
+				name_reader.Read([&](const std::string& name) -> void { read_names.push_back(name); });
+			}
+			names.EndFrame();
+		}
+		EXPECT_EQ(400u, read_names.size());
+		EXPECT_EQ("a name too long for small string optimization 399", read_names.back());
+		EXPECT_EQ(100u, names.GetEventCount());
+	}
+}
+
+// Counts the bytes held from the default resource
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+	size_t held_bytes = 0;
+	size_t allocation_count = 0;
+
+private:
+	virtual void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		held_bytes += bytes;
+		allocation_count++;
+		return std::pmr::get_default_resource()->allocate(bytes, alignment);
+	}
+
+	virtual void do_deallocate(void* ptr, size_t bytes, size_t alignment) override
+	{
+		held_bytes -= bytes;
+		std::pmr::get_default_resource()->deallocate(ptr, bytes, alignment);
+	}
+
+	virtual bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+};
+
+TEST(World, MemoryResource)
+{
+	// The chunks and entity indices of a world come from its resource, and all of it is returned with the world
+	CountingResource resource;
+	{
+		ECS::World world(&resource);
+		ECS::EntityManager& entity_mgr = world.GetEntityManager();
+		std::vector<ECS::Entity> entities;
+		for (int i = 0; i < 2000; i++) {
+			entities.push_back(entity_mgr.CreateEntity<PositionComponent, IntComponent>());
+		}
+		entity_mgr.AddEntityComponent<IntComponent>(entities[7], 7);
+		EXPECT_EQ(7, entity_mgr.GetEntityComponent<IntComponent>(entities[7])->num);
+
+		ECS::StorageStats stats;
+		entity_mgr.GetStorageStats(stats);
+		EXPECT_GE(resource.held_bytes, stats.bytes_reserved);
+		for (int i = 0; i < 1000; i++) {
+			entity_mgr.DestroyEntity(entities[i]);
+		}
+
+		// Checkpoint copies live on the default heap, and restoring keeps the world's bookkeeping on its resource
+		ECS::WorldCheckpoint checkpoint;
+		ASSERT_TRUE(entity_mgr.SaveCheckpoint(checkpoint));
+		size_t held_bytes = resource.held_bytes;
+		entity_mgr.CreateEntity<PositionComponent, IntComponent>();
+		ASSERT_TRUE(entity_mgr.RestoreCheckpoint(checkpoint));
+		EXPECT_EQ(1000u, entity_mgr.GetEntities().size());
+		EXPECT_EQ(99, entity_mgr.GetEntityComponent<IntComponent>(entities[1500])->num);
+		EXPECT_GE(resource.held_bytes, held_bytes);
+
+		// A partition read from a file, into chunks of the default heap, is attached in chunks of the world's resource
+		const std::string path = "memory_resource_partition.bin";
+		for (int i = 1000; i < 2000; i++) {
+			entity_mgr.AddEntityComponent<ECS::Partition>(entities[i], 3);
+		}
+		std::unique_ptr<ECS::PartitionData> data = entity_mgr.DetachPartition(3);
+		ASSERT_NE(nullptr, data);
+		ASSERT_TRUE(data->Write(path));
+		ECS::PartitionData read_data(3);
+		ASSERT_TRUE(read_data.Read(path));
+		std::remove(path.c_str());
+		ASSERT_TRUE(entity_mgr.AttachPartition(read_data));
+		EXPECT_EQ(99, entity_mgr.GetEntityComponent<IntComponent>(entities[1500])->num);
+		size_t chunk_count = 0;
+		world.ForEachChunk<IntComponent>([&](const ECS::ChunkView& chunk) -> void {
+			EXPECT_EQ(&resource, chunk.GetArchetypeStorage()->GetChunk(chunk.GetChunkIndex())->resource_ptr);
+			chunk_count++;
+		});
+		EXPECT_LT(0u, chunk_count);
+	}
+	EXPECT_EQ(0u, resource.held_bytes);
+	EXPECT_LT(0u, resource.allocation_count);
+
+	// A world in a monotonic arena, released at once after the world
+	std::pmr::monotonic_buffer_resource arena;
+	{
+		ECS::World world(&arena);
+		for (int i = 0; i < 1000; i++) {
+			world.GetEntityManager().CreateEntity<PositionComponent>();
+		}
+		size_t count = 0;
+		world.ForEach<PositionComponent>([&](const ECS::Entity*, PositionComponent*) -> void { count++; });
+		EXPECT_EQ(1000u, count);
+	}
+	arena.release();
+}
+
+TEST(World, NumaPlacement)
+{
+	// The chunks are interleaved over the nodes of the host (a single one without NUMA), and the parallel
+	// iteration visits every chunk once
+	ECS::NumaChunkResource resource;
+	{
+		ECS::World world(&resource);
+		ECS::EntityManager& entity_mgr = world.GetEntityManager();
+		for (int i = 0; i < 5000; i++) {
+			entity_mgr.CreateEntity<PositionComponent, IntComponent>();
+		}
+		std::atomic<size_t> chunk_count{ 0 };
+		world.ForEachChunkParallel<IntComponent>([&](const ECS::ChunkView& chunk) -> void {
+			IntComponent* ints = chunk.GetComponents<IntComponent>();
+			for (size_t i = 0; i < chunk.GetEntityCount(); i++) {
+				ints[i].num++;
+			}
+			size_t numa_node = chunk.GetArchetypeStorage()->GetChunkNumaNode(chunk.GetChunkIndex());
+			EXPECT_LT(numa_node, resource.GetNodeCount());
+			EXPECT_EQ(resource.GetNode(chunk.GetArchetypeStorage()->GetChunk(chunk.GetChunkIndex())->chunk_ptr), numa_node);
+			chunk_count++;
+		});
+		EXPECT_LT(1u, chunk_count.load());
+		size_t visited_count = 0;
+		world.ForEach<IntComponent>([&](const ECS::Entity*, IntComponent* int_ptr) -> void {
+			EXPECT_EQ(100, int_ptr->num);
+			visited_count++;
+		});
+		EXPECT_EQ(5000u, visited_count);
+	}
+
+	// Indices placed on nodes are each run once, the threads of a node taking the others' once done with theirs
+	ECS::JobSystem job_system(3, 2);
+	std::vector<std::atomic<int>> run_counts(1000);
+	job_system.ParallelFor(run_counts.size(), [&](size_t i) -> void {
+		run_counts[i]++;
+	}, [](size_t i) -> size_t {
+		return i < 900 ? 0 : 1;
+	});
+	EXPECT_TRUE(std::all_of(run_counts.begin(), run_counts.end(), [](const std::atomic<int>& count) { return count.load() == 1; }));
+}
+
+TEST(World, MoveEntities)
+{
+	ECS::World staging;
+	ECS::World live;
+	ECS::EntityManager& staging_mgr = staging.GetEntityManager();
+	ECS::EntityManager& live_mgr = live.GetEntityManager();
+	ECS::Entity live_entity = live_mgr.CreateEntity<IntComponent>();
+
+	// Enough entities for full chunks and a partial one, some with names, and one that stays for its sparse component
+	std::vector<ECS::Entity> entities;
+	for (int i = 0; i < 5000; i++) {
+		entities.push_back(staging_mgr.CreateEntity<PositionComponent, IntComponent>());
+		staging_mgr.GetEntityComponent<IntComponent>(entities.back())->num = i;
+		if (i % 1000 == 0) {
+			staging_mgr.AddEntityComponent<NameComponent>(entities.back());
+			staging_mgr.GetEntityComponent<NameComponent>(entities.back())->name = "entity " + std::to_string(i) + " with a name too long for small string optimization";
+		}
+	}
+	staging_mgr.AddEntityComponent<SelectedComponent>(entities[4999]);
+	ECS::Entity unmatched = staging_mgr.CreateEntity<PositionComponent>();
+
+	// The target of a relation stays with its source
+	ECS::Entity source = staging_mgr.CreateEntity<PositionComponent>();
+	staging_mgr.AddRelation<TargetsRelation>(source, entities[4998], 3);
+	std::unordered_set<const IntComponent*> staging_rows;
+	staging.ForEachChunk<IntComponent>([&](const ECS::ChunkView& chunk) -> void {
+		staging_rows.insert(chunk.GetComponents<IntComponent>());
+	});
+
+	std::unordered_map<ECS::Entity, ECS::Entity> moved = staging.MoveEntities<IntComponent>(live);
+	EXPECT_EQ(4998u, moved.size());
+	EXPECT_TRUE(staging_mgr.HasComponent<IntComponent>(entities[4999]));
+	EXPECT_TRUE(staging_mgr.HasComponent<PositionComponent>(unmatched));
+	EXPECT_TRUE(staging_mgr.HasComponent<IntComponent>(entities[4998]));
+	EXPECT_EQ(3, staging_mgr.GetRelation<TargetsRelation>(source, entities[4998])->priority);
+	for (int i = 0; i < 4998; i++) {
+		EXPECT_FALSE(staging_mgr.HasComponent<IntComponent>(entities[i]));
+		ECS::Entity new_entity = moved.at(entities[i]);
+		EXPECT_NE(live_entity.id, new_entity.id);
+		EXPECT_EQ(i, live_mgr.GetEntityComponent<IntComponent>(new_entity)->num);
+		EXPECT_TRUE(live_mgr.HasComponent<PositionComponent>(new_entity));
+	}
+	EXPECT_EQ("entity 3000 with a name too long for small string optimization", live_mgr.GetEntityComponent<NameComponent>(moved.at(entities[3000]))->name);
+	EXPECT_EQ(99, live_mgr.GetEntityComponent<IntComponent>(live_entity)->num);
+
+	// The full chunks are the same memory in the live world
+	size_t handed_over_count = 0;
+	size_t live_count = 0;
+	live.ForEachChunk<IntComponent>([&](const ECS::ChunkView& chunk) -> void {
+		handed_over_count += staging_rows.count(chunk.GetComponents<IntComponent>());
+		live_count += chunk.GetEntityCount();
+	});
+	EXPECT_LT(1u, handed_over_count);
+	EXPECT_EQ(4999u, live_count);
+
+	// From a world of another memory resource, the chunks are copied, and the resource can go with that world
+	CountingResource resource;
+	std::unordered_map<ECS::Entity, ECS::Entity> moved_from_resource;
+	{
+		ECS::World resource_world(&resource);
+		for (int i = 0; i < 3000; i++) {
+			ECS::Entity entity = resource_world.GetEntityManager().CreateEntity<IntComponent>();
+			resource_world.GetEntityManager().GetEntityComponent<IntComponent>(entity)->num = -i;
+		}
+		moved_from_resource = resource_world.MoveEntities<IntComponent>(live);
+	}
+	EXPECT_EQ(0u, resource.held_bytes);
+	EXPECT_EQ(3000u, moved_from_resource.size());
+	int sum = 0;
+	for (const auto& pair : moved_from_resource) {
+		sum += live_mgr.GetEntityComponent<IntComponent>(pair.second)->num;
+	}
+	EXPECT_EQ(-2999 * 3000 / 2, sum);
+
+	// An entity of a type known to the live world with another size stays
+	ECS::World other;
+	ECS::Entity clashing = other.GetEntityManager().CreateEntity<VelocityComponent, ClashComponent>();
+	EXPECT_TRUE(other.MoveEntities<ClashComponent>(live).empty());
+	EXPECT_TRUE(other.GetEntityManager().HasComponent<ClashComponent>(clashing));
+}
+
+class SpawnSystem : public ECS::System
+{
+public:
+	virtual void Init() override {}
+	virtual void Update(double) override
+	{
+		// Every job reserves its entities at once, and the buffers are played back after this Update
+		spawned = std::vector<std::vector<ECS::Entity>>(4);
+		world_ptr->GetJobSystem().ParallelFor(4, [&](size_t i) -> void {
+			ECS::EntityCommandBuffer commands = world_ptr->CreateCommandBuffer();
+			for (int j = 0; j < 250; j++) {
+				ECS::Entity entity = commands.CreateEntity<PositionComponent>();
+				commands.SetComponent<PositionComponent>(entity, float(i), float(j));
+				commands.AddComponent<IntComponent>(entity, static_cast<int>(i * 250 + j));
+				spawned[i].push_back(entity);
+			}
+			world_ptr->SubmitCommands(std::move(commands));
+		});
+	}
+
+	std::vector<std::vector<ECS::Entity>> spawned;
+};
+
+TEST(World, CommandBuffers)
+{
+	ECS::World world;
+	ECS::EntityManager& entity_mgr = world.GetEntityManager();
+	ECS::Entity first = entity_mgr.CreateEntity<IntComponent>();
+	SpawnSystem* spawn = new SpawnSystem();
+	world.AddSystem(spawn);
+
+	world.Update(1);
+	std::unordered_set<size_t> ids;
+	for (size_t i = 0; i < spawn->spawned.size(); i++) {
+		for (size_t j = 0; j < spawn->spawned[i].size(); j++) {
+			ECS::Entity entity = spawn->spawned[i][j];
+			ids.insert(entity.id);
+			EXPECT_EQ(static_cast<int>(i * 250 + j), entity_mgr.GetEntityComponent<IntComponent>(entity)->num);
+			EXPECT_FLOAT_EQ(float(j), entity_mgr.GetEntityComponent<PositionComponent>(entity)->y);
+		}
+	}
+	EXPECT_EQ(1000u, ids.size());
+	EXPECT_EQ(0u, ids.count(first.id));
+	size_t count = 0;
+	world.ForEach<PositionComponent, IntComponent>([&](const ECS::Entity*, PositionComponent*, IntComponent*) -> void { count++; });
+	EXPECT_EQ(1000u, count);
+
+	// Buffers submitted outside of systems are played back at the start of the next Update, or on demand
+	ECS::EntityCommandBuffer commands = world.CreateCommandBuffer();
+	commands.DestroyEntity(first);
+	commands.RemoveComponent<IntComponent>(spawn->spawned[0][0]);
+	EXPECT_EQ(2u, commands.GetCommandCount());
+	world.SubmitCommands(std::move(commands));
+	EXPECT_TRUE(entity_mgr.HasComponent<IntComponent>(first));
+	world.PlaybackCommands();
+	EXPECT_FALSE(entity_mgr.HasComponent<IntComponent>(first));
+	EXPECT_FALSE(entity_mgr.HasComponent<IntComponent>(spawn->spawned[0][0]));
+	EXPECT_TRUE(entity_mgr.HasComponent<PositionComponent>(spawn->spawned[0][0]));
+
+	// A reserved entity is created by the manager directly as well
+	ECS::Entity reserved = entity_mgr.ReserveEntity();
+	EXPECT_FALSE(entity_mgr.HasComponent<IntComponent>(reserved));
+	entity_mgr.CreateReservedEntity<IntComponent>(reserved);
+	EXPECT_EQ(99, entity_mgr.GetEntityComponent<IntComponent>(reserved)->num);
+}
+
+#ifdef ECS_ENABLE_COROUTINES
+class BatchPathfindSystem : public ECS::AsyncSystem
+{
+public:
+	virtual void Init() override {}
+	virtual ECS::Task Run(double) override
+	{
+		steps.push_back("start");
+		double delta_time = co_await this->NextFrame();
+		steps.push_back("next frame " + std::to_string(static_cast<int>(delta_time)));
+		co_await this->SyncPoint();
+		steps.push_back("sync point");
+
+		int path_length = 0;
+		co_await this->RunJob([&]() { path_length = 42; });
+		steps.push_back("job " + std::to_string(path_length));
+	}
+
+	std::vector<std::string> steps;
+};
+
+class FrameCountingSystem : public ECS::AsyncSystem
+{
+public:
+	virtual void Init() override {}
+	virtual ECS::Task Run(double) override
+	{
+		while (true) {
+			co_await this->NextFrame();
+			resume_count++;
+		}
+	}
+
+	size_t resume_count = 0;
+};
+
+TEST(World, AsyncSystems)
+{
+	ECS::World world;
+	BatchPathfindSystem* pathfind = new BatchPathfindSystem();
+	world.AddSystem(pathfind);
+
+	world.Update(1);
+	EXPECT_EQ(std::vector<std::string>({ "start" }), pathfind->steps);
+	EXPECT_TRUE(pathfind->IsRunning());
+	world.Update(2);
+	EXPECT_EQ(std::vector<std::string>({ "start", "next frame 2", "sync point" }), pathfind->steps);
+
+	// The job may take a few frames on a worker
+	for (size_t frame = 0; frame < 1000 && pathfind->steps.size() < 4; frame++) {
+		world.Update(1);
+	}
+	ASSERT_LE(4u, pathfind->steps.size());
+	EXPECT_EQ("job 42", pathfind->steps[3]);
+
+	// With no budget, a single coroutine is resumed per frame
+	ECS::World budget_world;
+	budget_world.GetCoroutineScheduler().SetFrameBudget(0);
+	FrameCountingSystem* counting_1 = new FrameCountingSystem();
+	FrameCountingSystem* counting_2 = new FrameCountingSystem();
+	budget_world.AddSystem(counting_1);
+	budget_world.AddSystem(counting_2);
+
+	budget_world.Update(1);
+	EXPECT_EQ(2u, budget_world.GetCoroutineScheduler().GetPendingCount());
+	for (size_t i = 0; i < 4; i++) {
+		budget_world.Update(1);
+	}
+	EXPECT_EQ(2u, counting_1->resume_count);
+	EXPECT_EQ(2u, counting_2->resume_count);
+}
+#endif